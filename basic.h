@@ -21,7 +21,7 @@ typedef union basic_value {
 #define U2BASIC(_u) ({basic_value_t _u2BASIC_value = {.u = _u}; _u2BASIC_value;})
 #define D2BASIC(_d) ({basic_value_t _d2BASIC_value = {.d = _d}; _d2BASIC_value;})
 #define S2BASIC(_s) ({basic_value_t _s2BASIC_value = {.s = _s}; _s2BASIC_value;})
-#define P2BASIC(_p) ({basic_value_t _p2BASIC_value = {.p = (void*)_p}; _p2BASIC_value;})
+#define P2BASIC(_p) ({basic_value_t _p2BASIC_value = {.p = (void*)(_p)}; _p2BASIC_value;})
 
 static const basic_value_t _basic_value_null = {0};
 
@@ -0,0 +1,32 @@
+/**
+ * @author: luyuhuang
+ * @brief: reference counted buffers
+ */
+
+#include "buffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct rbuf *rbuf_create(size_t len)
+{
+    struct rbuf *buf = (struct rbuf*)malloc(sizeof(struct rbuf) + len);
+    if (!buf)
+        return NULL;
+    buf->refs = 1;
+    buf->len = len;
+    return buf;
+}
+
+struct rbuf *rbuf_from(const void *data, size_t len)
+{
+    struct rbuf *buf = rbuf_create(len);
+    if (buf)
+        memcpy(buf->data, data, len);
+    return buf;
+}
+
+void rbuf_unref(struct rbuf *buf)
+{
+    if (buf && __atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(buf);
+}
@@ -0,0 +1,30 @@
+/**
+ * @author: luyuhuang
+ * @brief: reference counted buffers
+ */
+
+#ifndef _BUFFER_H_
+#define _BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*shared by every session it is queued on, freed with the last reference*/
+struct rbuf {
+    int refs;
+    size_t len;
+    uint8_t data[];
+};
+
+/*with one reference, held by the caller*/
+struct rbuf *rbuf_create(size_t len);
+struct rbuf *rbuf_from(const void *data, size_t len);
+void rbuf_unref(struct rbuf *buf);
+
+static inline struct rbuf *rbuf_ref(struct rbuf *buf)
+{
+    __atomic_add_fetch(&buf->refs, 1, __ATOMIC_RELAXED);
+    return buf;
+}
+
+#endif //_BUFFER_H_
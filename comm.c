@@ -4,8 +4,13 @@
  */
 
 #include "comm.h"
+#include "rstats.h"
 #include <errno.h>
 #include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <sys/un.h>
 
 
 int64_t get_absolute_time(int32_t mtime)
@@ -24,61 +29,104 @@ int32_t get_interval_time(int64_t mtime)
     return mtime - now;
 }
 
-ssize_t thorough_read(int fd, uint8_t *buffer, int max_size)
+ssize_t budget_read(int fd, uint8_t *buffer, size_t max_size, int max_calls, int *more)
 {
-    ssize_t ret = 0;
-    ssize_t nread = 0;
+    size_t nread = 0;
     ssize_t size;
-    
-    do {
+    int calls = 0;
+
+    if (more)
+        *more = 0;
+    while (nread < max_size) {
+        if (max_calls > 0 && calls++ == max_calls)
+            break;
         size = read(fd, buffer + nread, max_size - nread);
+        rstats_add(RSTAT_SYS_READ, 1);
         if (size > 0) {
             nread += size;
-            if (nread > max_size) {
-                nread = 0;
-                ret = TREAD_FULL;
-            }
-        } else if (size == 0) {
-            ret = TREAD_EOF;
+        } else if (size < 0 && errno == EINTR) {
+            continue;
+        } else if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return nread > 0 ? (ssize_t)nread : TREAD_AGAIN;
+        } else {
+            /*hand out what came before the end, the next read sees it again*/
+            if (nread == 0)
+                return size == 0 ? TREAD_EOF : TREAD_ERR;
             break;
-        } else if (size < 0 && errno != EINTR) {
-            if (errno == EAGAIN) {
-                ret = nread;
-                break;
-            } else {
-                ret = TREAD_ERR;
-                break;
-            }
         }
-    } while (1);
+    }
+    if (more)
+        *more = 1;
+    return nread;
+}
 
-    return ret;
+ssize_t thorough_read(int fd, uint8_t *buffer, int max_size)
+{
+    return budget_read(fd, buffer, max_size, 0, NULL);
 }
 
 ssize_t thorough_write(int fd, uint8_t *buffer, int len)
 {
-    ssize_t ret = 0;
     ssize_t nwrite = 0;
     ssize_t size;
 
-    do {
+    while (nwrite < len) {
         size = write(fd, buffer + nwrite, len - nwrite);
-        if (size > 0) {
+        rstats_add(RSTAT_SYS_WRITE, 1);
+        if (size > 0)
             nwrite += size;
-        } else if (size == 0) {
-            ret = TWRITE_EOF;
+        else if (size < 0 && errno == EINTR)
+            continue;
+        else if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
             break;
-        } else if (size < 0 && errno != EINTR) {
-            if (errno == EAGAIN) {
-                ret = nwrite;
-                break;
-            } else {
-                ret = TWRITE_ERR;
-                break;
-            }
-        }
-    } while (nwrite < len);
-    ret = nwrite;
+        else
+            return nwrite > 0 ? nwrite : TWRITE_ERR;
+    }
+    return nwrite;
+}
+
+int parse_addr(const char *addr, struct sockaddr_storage *ss, socklen_t *len)
+{
+    memset(ss, 0, sizeof(struct sockaddr_storage));
+
+    if (strncmp(addr, "unix:", 5) == 0) {
+        struct sockaddr_un *sun = (struct sockaddr_un*)ss;
+        size_t pathlen = strlen(addr + 5);
+        if (pathlen == 0 || pathlen >= sizeof(sun->sun_path))
+            return -1;
+        sun->sun_family = AF_UNIX;
+        memcpy(sun->sun_path, addr + 5, pathlen + 1);
+        *len = offsetof(struct sockaddr_un, sun_path) + pathlen + 1;
+        return 0;
+    }
+
+    char host[INET6_ADDRSTRLEN];
+    const char *strport = strrchr(addr, ':');
+    if (!strport)
+        return -1;
+    const char *begin = addr, *end = strport;
+    if (*addr == '[') {
+        begin = addr + 1;
+        end = strport - 1;
+        if (end < begin || *end != ']')
+            return -1;
+    }
+    if (end - begin >= sizeof(host))
+        return -1;
+    memcpy(host, begin, end - begin);
+    host[end - begin] = '\0';
+    in_port_t port = htons(strtol(strport + 1, NULL, 10));
 
-    return ret;
+    if (*addr == '[') {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)ss;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = port;
+        *len = sizeof(struct sockaddr_in6);
+        return inet_pton(AF_INET6, host, (void*)&sin6->sin6_addr) == 1 ? 0 : -1;
+    }
+    struct sockaddr_in *sin = (struct sockaddr_in*)ss;
+    sin->sin_family = AF_INET;
+    sin->sin_port = port;
+    *len = sizeof(struct sockaddr_in);
+    return inet_pton(AF_INET, host, (void*)&sin->sin_addr) == 1 ? 0 : -1;
 }
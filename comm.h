@@ -20,13 +20,26 @@ int32_t get_interval_time(int64_t mtime);
 #define TREAD_EOF       0 
 #define TREAD_FULL      -1
 #define TREAD_ERR       -2      //please check errno
+#define TREAD_AGAIN     -3      //nothing to read yet
 
 #define TWRITE_EOF      0
 #define TWRITE_ERR      -2      //please check errno
 
+/*
+ * Read at most max_size bytes in at most max_calls reads (0 for no limit).
+ * Bytes read before EOF or an error are returned, the next read reports
+ * it. *more is set unless the read stopped on EAGAIN: the fd is readable
+ * again at once, with data left, the EOF or the error.
+ */
+ssize_t budget_read(int fd, uint8_t *buffer, size_t max_size, int max_calls, int *more);
+/*read until EAGAIN or until the buffer is full*/
 ssize_t thorough_read(int fd, uint8_t *buffer, int max_size);
+/*write until EAGAIN, the number of bytes written*/
 ssize_t thorough_write(int fd, uint8_t *buffer, int len);
 
+/*"ip:port", "[ipv6]:port" or "unix:/path" to a sockaddr*/
+int parse_addr(const char *addr, struct sockaddr_storage *ss, socklen_t *len);
+
 #ifdef USE_MUTEX
 
 typedef pthread_mutex_t lock_t;
@@ -0,0 +1,144 @@
+/**
+ * @author: luyuhuang
+ * @brief: Data structure: a concurrent hash map, lock-striped shards of hashmap_t
+ */
+
+#include "conc_hashmap.h"
+#include "hash.h"
+#include <stdlib.h>
+#include <assert.h>
+
+conc_hashmap_t conc_hashmap_create(hashmap_hs hs, hashmap_eq eq)
+{
+    return conc_hashmap_create_for_all(hs, eq, CONC_HASHMAP_SHARDS, CONC_HASHMAP_INIT_CAPA);
+}
+
+conc_hashmap_t
+conc_hashmap_create_for_all(hashmap_hs hs, hashmap_eq eq, size_t shard_num, size_t init_capacity)
+{
+    if (!hs || !eq || shard_num == 0)
+        return NULL;
+
+    size_t n = 1;
+    while (n < shard_num)
+        n <<= 1;
+
+    conc_hashmap_t map = (struct conc_hashmap*)calloc(1, sizeof(struct conc_hashmap));
+    map->shard_num = n;
+    map->hs = hs;
+    if (posix_memalign((void**)&map->shards, 64, n * sizeof(struct conc_hashmap_shard)) != 0) {
+        free(map);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        struct conc_hashmap_shard *shard = map->shards + i;
+        pthread_rwlock_init(&shard->lock, NULL);
+        shard->map = hashmap_create_for_all(hs, eq, init_capacity, HASHMAP_INIT_FACTOR);
+        hashmap_set_incremental(shard->map, true);
+    }
+    return map;
+}
+
+void conc_hashmap_destroy(conc_hashmap_t *pmap)
+{
+    assert(pmap != NULL);
+    assert((*pmap) != NULL);
+
+    conc_hashmap_t map = *pmap;
+    for (size_t i = 0; i < map->shard_num; ++i) {
+        hashmap_destroy(&map->shards[i].map);
+        pthread_rwlock_destroy(&map->shards[i].lock);
+    }
+    free(map->shards);
+    free(map);
+    *pmap = NULL;
+}
+
+/*the shard maps index by the top bits of a fibonacci product of the hash,
+ *so pick the shard from differently mixed bits to keep them independent*/
+static inline struct conc_hashmap_shard *_conc_hashmap_shard(conc_hashmap_t map, basic_value_t key)
+{
+    uint64_t h = hash_mix64(map->hs(key));
+    return map->shards + (h & (map->shard_num - 1));
+}
+
+int conc_hashmap_is_in(conc_hashmap_t map, basic_value_t key)
+{
+    if (!map)
+        return -1;
+
+    struct conc_hashmap_shard *shard = _conc_hashmap_shard(map, key);
+    pthread_rwlock_rdlock(&shard->lock);
+    int ret = hashmap_is_in(shard->map, key);
+    pthread_rwlock_unlock(&shard->lock);
+    return ret;
+}
+
+int conc_hashmap_add(conc_hashmap_t map, basic_value_t key, basic_value_t value)
+{
+    if (!map)
+        return -1;
+
+    struct conc_hashmap_shard *shard = _conc_hashmap_shard(map, key);
+    pthread_rwlock_wrlock(&shard->lock);
+    int ret = hashmap_add(shard->map, key, value);
+    pthread_rwlock_unlock(&shard->lock);
+    return ret;
+}
+
+basic_value_t conc_hashmap_get_value(conc_hashmap_t map, basic_value_t key)
+{
+    if (!map)
+        return BASIC_NULL;
+
+    struct conc_hashmap_shard *shard = _conc_hashmap_shard(map, key);
+    pthread_rwlock_rdlock(&shard->lock);
+    basic_value_t value = hashmap_get_value(shard->map, key);
+    pthread_rwlock_unlock(&shard->lock);
+    return value;
+}
+
+basic_value_t conc_hashmap_del(conc_hashmap_t map, basic_value_t key)
+{
+    if (!map)
+        return BASIC_NULL;
+
+    struct conc_hashmap_shard *shard = _conc_hashmap_shard(map, key);
+    pthread_rwlock_wrlock(&shard->lock);
+    basic_value_t value = hashmap_del(shard->map, key);
+    pthread_rwlock_unlock(&shard->lock);
+    return value;
+}
+
+ssize_t conc_hashmap_len(conc_hashmap_t map)
+{
+    if (!map)
+        return -1;
+
+    ssize_t len = 0;
+    for (size_t i = 0; i < map->shard_num; ++i) {
+        struct conc_hashmap_shard *shard = map->shards + i;
+        pthread_rwlock_rdlock(&shard->lock);
+        len += hashmap_len(shard->map);
+        pthread_rwlock_unlock(&shard->lock);
+    }
+    return len;
+}
+
+void conc_hashmap_foreach(conc_hashmap_t map, conc_hashmap_visit func, void *arg)
+{
+    if (!map || !func)
+        return;
+
+    for (size_t i = 0; i < map->shard_num; ++i) {
+        struct conc_hashmap_shard *shard = map->shards + i;
+        pthread_rwlock_rdlock(&shard->lock);
+        hashmap_iter_t it = hashmap_iter_create(shard->map);
+        struct hashmap_pair *p;
+        while ((p = hashmap_iter_next(it)) != NULL)
+            func(p->key, p->value, arg);
+        hashmap_iter_destroy(&it);
+        pthread_rwlock_unlock(&shard->lock);
+    }
+}
@@ -0,0 +1,57 @@
+/**
+ * @author: luyuhuang
+ * @brief: Data structure: a concurrent hash map, lock-striped shards of hashmap_t
+ */
+
+#ifndef _CONC_HASHMAP_H_
+#define _CONC_HASHMAP_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "basic.h"
+#include "hashmap.h"
+
+#define CONC_HASHMAP_SHARDS     64
+#define CONC_HASHMAP_INIT_CAPA  64      //buckets of each shard
+
+/*
+ * A key lives in one of the shards, chosen by its hash. Each shard is a
+ * hashmap_t behind its own reader/writer lock, so readers never block each
+ * other and writers only block the keys of one shard. The shard maps resize
+ * incrementally and lookups never migrate buckets, which keeps them
+ * read-only under the read lock.
+ */
+struct conc_hashmap_shard {
+    pthread_rwlock_t lock;
+    hashmap_t map;
+} __attribute__((aligned(64)));     //no false sharing between shard locks
+
+struct conc_hashmap {
+    size_t shard_num;           //power of 2
+    hashmap_hs hs;
+    struct conc_hashmap_shard *shards;
+};
+
+typedef struct conc_hashmap *conc_hashmap_t;
+typedef void (*conc_hashmap_visit)(basic_value_t key, basic_value_t value, void *arg);
+
+conc_hashmap_t conc_hashmap_create(hashmap_hs hs, hashmap_eq eq);
+conc_hashmap_t conc_hashmap_create_for_all(hashmap_hs hs, hashmap_eq eq, size_t shard_num, size_t init_capacity);
+void conc_hashmap_destroy(conc_hashmap_t *pmap);
+
+/*values returned by get_value and del are copies: whatever they point to
+ *must be kept alive by the caller, e.g. with a reference count*/
+int conc_hashmap_is_in(conc_hashmap_t map, basic_value_t key);
+int conc_hashmap_add(conc_hashmap_t map, basic_value_t key, basic_value_t value);
+basic_value_t conc_hashmap_get_value(conc_hashmap_t map, basic_value_t key);
+basic_value_t conc_hashmap_del(conc_hashmap_t map, basic_value_t key);
+/*a snapshot: shards are counted one by one*/
+ssize_t conc_hashmap_len(conc_hashmap_t map);
+
+/*call func on every pair, holding the read lock of one shard at a time.
+ *func must not modify the map*/
+void conc_hashmap_foreach(conc_hashmap_t map, conc_hashmap_visit func, void *arg);
+
+#endif //_CONC_HASHMAP_H_
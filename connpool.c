@@ -0,0 +1,444 @@
+/**
+ * @author: luyuhuang
+ * @brief: outbound connection pool
+ */
+
+#include "connpool.h"
+#include "reactor.h"
+#include "thread_pool.h"
+#include "macro_tuple.h"
+#include "hash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static int _connpool_tick(struct rtimer *timer, void *arg);
+
+/*one shot, the tick arms the next one. the armed tick holds the pool*/
+static int _connpool_schedule(struct connpool *pool)
+{
+    struct rtimer timer;
+    timer.timer_id = pool->timer_id;
+    timer.mtime = CONNPOOL_TICK;
+    timer.repeat = 0;
+    return reactor_add_timer(REACTOR_INST, &timer, _connpool_tick, pool);
+}
+
+connpool_t connpool_create()
+{
+    return connpool_create_for_all(CONNPOOL_MAX_PER_HOST, CONNPOOL_IDLE_TIMEOUT, CONNPOOL_CONNECT_TIMEOUT);
+}
+
+connpool_t connpool_create_for_all(int max_per_host, int32_t idle_timeout, int32_t connect_timeout)
+{
+    static int next_timer_id = CONNPOOL_TIMER_ID_BASE;
+
+    struct connpool *pool = (struct connpool*)calloc(1, sizeof(struct connpool));
+    if (!pool)
+        return NULL;
+
+    LOCK_INIT(&pool->lock);
+    pool->hosts = hashmap_create(hash_str_key, hash_str_equal);
+    pool->host_list = NULL;
+    pool->max_per_host = max_per_host;
+    pool->idle_timeout = idle_timeout;
+    pool->connect_timeout = connect_timeout;
+    pool->conn_cache = objcache_create(sizeof(struct connpool_conn));
+    pool->waiter_cache = objcache_create(sizeof(struct connpool_waiter));
+
+    pool->timer_id = __atomic_fetch_add(&next_timer_id, 1, __ATOMIC_RELAXED);
+    pool->pending = 1;
+    if (_connpool_schedule(pool) != REACTER_OK) {
+        pool->pending = 0;
+        connpool_destroy(&pool);
+        return NULL;
+    }
+    return pool;
+}
+
+static void _connpool_free(struct connpool *p)
+{
+    struct connpool_host *host = p->host_list;
+    while (host) {
+        struct connpool_host *next = host->next;
+        free(host->addr);
+        free(host);
+        host = next;
+    }
+
+    hashmap_destroy(&p->hosts);
+    objcache_destroy(&p->conn_cache);
+    objcache_destroy(&p->waiter_cache);
+    LOCK_DESTROY(&p->lock);
+    free(p);
+}
+
+/*drop a hold on the pool, the last one after destroy frees it*/
+static void _connpool_unpend(struct connpool *p)
+{
+    LOCK(&p->lock);
+    int last = --p->pending == 0 && p->destroyed;
+    UNLOCK(&p->lock);
+    if (last)
+        _connpool_free(p);
+}
+
+static void _connpool_deliver(struct connpool_waiter *waiter, struct connpool_conn *conn);
+
+void connpool_destroy(connpool_t *pool)
+{
+    if (!pool || !*pool)
+        return;
+
+    struct connpool *p = *pool;
+    *pool = NULL;
+
+    /*from here on connects coming back close their fds. the timer is not
+     * deleted, a tick may be on its way to a worker already: the next one
+     * sees the flag and lets go of the pool instead of arming again*/
+    LOCK(&p->lock);
+    p->destroyed = 1;
+    p->pending++;
+    UNLOCK(&p->lock);
+
+    for (struct connpool_host *host = p->host_list; host; host = host->next) {
+        LOCK(&p->lock);
+        struct connpool_conn *conn = LIST_BEGIN(&host->idle);
+        LIST_INIT(&host->idle);
+        host->idle_len = 0;
+        struct connpool_waiter *waiter = SLIST_BEGIN(&host->waiters);
+        SLIST_INIT(&host->waiters);
+        host->waiter_len = 0;
+        UNLOCK(&p->lock);
+
+        while (conn) {
+            struct connpool_conn *n = LIST_NEXT(conn);
+            close(conn->f.fd);
+            objcache_free(conn);
+            conn = n;
+        }
+        while (waiter) {
+            struct connpool_waiter *n = SLIST_NEXT(waiter);
+            _connpool_deliver(waiter, NULL);
+            waiter = n;
+        }
+    }
+    _connpool_unpend(p);
+}
+
+/*with the lock held*/
+static struct connpool_host *_connpool_host(struct connpool *pool, const char *addr)
+{
+    struct connpool_host *host = BASIC2P(hashmap_get_value(pool->hosts, S2BASIC(addr)), struct connpool_host*);
+    if (host)
+        return host;
+
+    host = (struct connpool_host*)calloc(1, sizeof(struct connpool_host));
+    if (!host)
+        return NULL;
+    if (parse_addr(addr, &host->ss, &host->len) < 0 || !(host->addr = strdup(addr))) {
+        free(host);
+        return NULL;
+    }
+    host->pool = pool;
+    LIST_INIT(&host->idle);
+    SLIST_INIT(&host->waiters);
+    hashmap_add(pool->hosts, S2BASIC(host->addr), P2BASIC(host));
+    host->next = pool->host_list;
+    pool->host_list = host;
+    return host;
+}
+
+/*an idle connection is good if nothing is pending on it: a closed or reset
+ * one reads EOF or an error, and a stray reply would corrupt the next request*/
+static int _connpool_healthy(struct connpool_conn *conn)
+{
+    char c;
+    return recv(conn->f.fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0
+        && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/*with the lock held*/
+static void _connpool_evict(struct connpool_host *host, struct connpool_conn *conn)
+{
+    host->total--;
+    host->pool->evicted++;
+    close(conn->f.fd);
+    objcache_free(conn);
+}
+
+static void _connpool_deliver_task(void *arg)
+{
+    connpool_cb callback;
+    void *cb_arg;
+    struct connpool_conn *conn;
+
+    GET_TUPLE_3(arg, callback, cb_arg, conn);
+    callback(conn, cb_arg);
+}
+
+/*the callback runs in the thread pool, never under the lock*/
+static void _connpool_deliver(struct connpool_waiter *waiter, struct connpool_conn *conn)
+{
+    LOCAL_TUPLE_3(tuple, waiter->callback, waiter->arg, conn);
+    objcache_free(waiter);
+    if (thread_pool_dispatch(THREAD_POOL_INST, TASK_PRIO_NORMAL,
+                _connpool_deliver_task, &tuple, sizeof(tuple)) != 0)
+        _connpool_deliver_task(&tuple);
+}
+
+/*with the lock held*/
+static struct connpool_waiter *_connpool_pop_waiter(struct connpool_host *host)
+{
+    struct connpool_waiter *waiter = SLIST_BEGIN(&host->waiters);
+    if (waiter) {
+        SLIST_ERASE_HEAD(&host->waiters);
+        host->waiter_len--;
+    }
+    return waiter;
+}
+
+/*hand conn to the longest waiter, or keep it warm*/
+static void _connpool_release(struct connpool_host *host, struct connpool_conn *conn)
+{
+    struct connpool *pool = host->pool;
+
+    LOCK(&pool->lock);
+    if (pool->destroyed) {
+        UNLOCK(&pool->lock);
+        close(conn->f.fd);
+        objcache_free(conn);
+        return;
+    }
+    struct connpool_waiter *waiter = _connpool_pop_waiter(host);
+    if (!waiter) {
+        conn->idle_since = conn->checked = get_absolute_time(0);
+        LIST_INSERT_AT_HEAD(&host->idle, conn);
+        host->idle_len++;
+    }
+    UNLOCK(&pool->lock);
+
+    if (waiter)
+        _connpool_deliver(waiter, conn);
+}
+
+/*with the lock held: count a connect for the host if it has room*/
+static int _connpool_reserve(struct connpool_host *host)
+{
+    struct connpool *pool = host->pool;
+    if (host->total >= pool->max_per_host)
+        return 0;
+    host->total++;
+    pool->connects++;
+    pool->pending++;
+    return 1;
+}
+
+static int _connpool_start(struct connpool_host *host);
+
+/*a connect came to nothing: the head waiter gets NULL rather than wait for
+ * a host that is likely down, and the next one gets a connect of its own.
+ * every retry costs a waiter, so a dead host does not spin*/
+static void _connpool_failed(struct connpool_host *host)
+{
+    struct connpool *pool = host->pool;
+
+    for (;;) {
+        LOCK(&pool->lock);
+        if (pool->destroyed) {
+            UNLOCK(&pool->lock);
+            _connpool_unpend(pool);
+            return;
+        }
+        host->total--;
+        pool->pending--;
+        struct connpool_waiter *waiter = _connpool_pop_waiter(host);
+        int connect = !SLIST_EMPTY(&host->waiters) && _connpool_reserve(host);
+        UNLOCK(&pool->lock);
+
+        if (waiter)
+            _connpool_deliver(waiter, NULL);
+        if (!connect || _connpool_start(host) == 0)
+            return;
+    }
+}
+
+static int _connpool_on_connect(struct rfile *file, int fd, void *arg)
+{
+    struct connpool_host *host = (struct connpool_host*)arg;
+    struct connpool *pool = host->pool;
+    if (fd < 0) {
+        close(file->fd);
+        _connpool_failed(host);
+        return 0;
+    }
+
+    if (host->ss.ss_family != AF_UNIX) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    /*the pool is freed only once this connect lets go of it, a destroy
+     * meanwhile makes the release close the connection*/
+    struct connpool_conn *conn = (struct connpool_conn*)objcache_alloc(pool->conn_cache);
+    if (!conn) {
+        close(fd);
+        _connpool_failed(host);
+        return 0;
+    }
+    conn->f.fd = fd;
+    conn->host = host;
+    _connpool_release(host, conn);
+    _connpool_unpend(pool);
+    return 0;
+}
+
+/*the slot is already reserved. -1 if the connect could not start, the
+ * caller fails the slot then*/
+static int _connpool_start(struct connpool_host *host)
+{
+    struct rfile file;
+    file.fd = socket(host->ss.ss_family, SOCK_STREAM, 0);
+    if (file.fd < 0)
+        return -1;
+    if (reactor_asyn_connect(REACTOR_INST, &file, (struct sockaddr*)&host->ss, host->len,
+                host->pool->connect_timeout, _connpool_on_connect, host) != REACTER_OK) {
+        close(file.fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void _connpool_connect(struct connpool_host *host)
+{
+    if (_connpool_start(host) < 0)
+        _connpool_failed(host);
+}
+
+int connpool_get(connpool_t pool, const char *addr, int32_t mtime,
+        connpool_cb callback, void *arg, struct connpool_conn **conn)
+{
+    struct connpool_conn *c;
+
+    LOCK(&pool->lock);
+    struct connpool_host *host = _connpool_host(pool, addr);
+    if (!host) {
+        UNLOCK(&pool->lock);
+        return -1;
+    }
+
+    while ((c = LIST_BEGIN(&host->idle))) {
+        LIST_ERASE(&host->idle, c);
+        host->idle_len--;
+        if (_connpool_healthy(c)) {
+            pool->reused++;
+            UNLOCK(&pool->lock);
+            *conn = c;
+            return CONNPOOL_READY;
+        }
+        _connpool_evict(host, c);
+    }
+
+    if (host->waiter_len >= CONNPOOL_MAX_WAITERS) {
+        UNLOCK(&pool->lock);
+        return -1;
+    }
+    struct connpool_waiter *waiter = (struct connpool_waiter*)objcache_alloc(pool->waiter_cache);
+    if (!waiter) {
+        UNLOCK(&pool->lock);
+        return -1;
+    }
+    waiter->callback = callback;
+    waiter->arg = arg;
+    waiter->deadline = mtime >= 0 ? get_absolute_time(mtime) : 0;
+    SLIST_INSERT_AT_TAIL(&host->waiters, waiter);
+    host->waiter_len++;
+
+    int connect = _connpool_reserve(host);
+    UNLOCK(&pool->lock);
+
+    if (connect)
+        _connpool_connect(host);
+    return CONNPOOL_PENDING;
+}
+
+void connpool_put(connpool_t pool, struct connpool_conn *conn)
+{
+    _connpool_release(conn->host, conn);
+}
+
+void connpool_discard(connpool_t pool, struct connpool_conn *conn)
+{
+    struct connpool_host *host = conn->host;
+    close(conn->f.fd);
+    objcache_free(conn);
+
+    /*the freed slot goes to whoever waits for it*/
+    LOCK(&pool->lock);
+    host->total--;
+    int connect = !SLIST_EMPTY(&host->waiters) && _connpool_reserve(host);
+    UNLOCK(&pool->lock);
+
+    if (connect)
+        _connpool_connect(host);
+}
+
+static int _connpool_tick(struct rtimer *timer, void *arg)
+{
+    struct connpool *pool = (struct connpool*)arg;
+    int64_t now = get_absolute_time(0);
+    SLIST(struct connpool_waiter) expired = SLIST_INITIALIZER;
+
+    /*destroyed, or the tick could not be armed (mtime holds the error)*/
+    LOCK(&pool->lock);
+    if (pool->destroyed || timer->mtime < 0) {
+        UNLOCK(&pool->lock);
+        _connpool_unpend(pool);
+        return 0;
+    }
+    for (struct connpool_host *host = pool->host_list; host; host = host->next) {
+        /*the least recently used are at the tail*/
+        struct connpool_conn *conn = LIST_EMPTY(&host->idle) ? NULL : host->idle.tail;
+        while (conn) {
+            struct connpool_conn *prev = LIST_PREV(conn);
+            int evict = now - conn->idle_since >= pool->idle_timeout;
+            if (!evict && now - conn->checked >= CONNPOOL_CHECK_INTERVAL) {
+                conn->checked = now;
+                evict = !_connpool_healthy(conn);
+            }
+            if (evict) {
+                LIST_ERASE(&host->idle, conn);
+                host->idle_len--;
+                _connpool_evict(host, conn);
+            }
+            conn = prev;
+        }
+
+        struct connpool_waiter *waiter = SLIST_BEGIN(&host->waiters);
+        SLIST_INIT(&host->waiters);
+        while (waiter) {
+            struct connpool_waiter *next = SLIST_NEXT(waiter);
+            if (waiter->deadline && now >= waiter->deadline) {
+                host->waiter_len--;
+                SLIST_INSERT_AT_TAIL(&expired, waiter);
+            } else {
+                SLIST_INSERT_AT_TAIL(&host->waiters, waiter);
+            }
+            waiter = next;
+        }
+    }
+    UNLOCK(&pool->lock);
+
+    struct connpool_waiter *waiter = SLIST_BEGIN(&expired);
+    while (waiter) {
+        struct connpool_waiter *next = SLIST_NEXT(waiter);
+        _connpool_deliver(waiter, NULL);
+        waiter = next;
+    }
+
+    if (_connpool_schedule(pool) != REACTER_OK)
+        _connpool_unpend(pool);
+    return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * @author: luyuhuang
+ * @brief: outbound connection pool
+ */
+
+#ifndef _CONNPOOL_H_
+#define _CONNPOOL_H_
+
+#include "reactor_event.h"
+#include "hashmap.h"
+#include "objcache.h"
+#include "macro_list.h"
+#include "comm.h"
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define CONNPOOL_MAX_PER_HOST 64
+#define CONNPOOL_MAX_WAITERS 1024       //per host, a get beyond fails at once
+#define CONNPOOL_IDLE_TIMEOUT 30000     //ms an idle connection is kept
+#define CONNPOOL_CONNECT_TIMEOUT 3000
+#define CONNPOOL_CHECK_INTERVAL 1000    //ms between health checks of an idle connection
+#define CONNPOOL_TICK 100               //ms, evicts idle connections, times out waiters
+#define CONNPOOL_TIMER_ID_BASE 0x50000000
+
+#define CONNPOOL_READY      0           //a warm connection is handed out at once
+#define CONNPOOL_PENDING    1           //the callback gets it later
+
+struct connpool_host;
+
+struct connpool_conn {
+    struct rfile f;
+    struct connpool_host *host;
+    int64_t idle_since;
+    int64_t checked;                //last health check
+    struct connpool_conn *__next__;
+    struct connpool_conn *__prev__;
+};
+
+/*in the thread pool. conn is NULL if the connect failed or the wait timed out*/
+typedef void (*connpool_cb)(struct connpool_conn *conn, void *arg);
+
+struct connpool_waiter {
+    connpool_cb callback;
+    void *arg;
+    int64_t deadline;               //0 to wait without limit
+    struct connpool_waiter *__next__;
+};
+
+struct connpool_host {
+    char *addr;
+    struct sockaddr_storage ss;
+    socklen_t len;
+    struct connpool *pool;
+    struct connpool_host *next;
+
+    LIST(struct connpool_conn) idle;    //the most recently used first
+    int idle_len;
+    int total;                      //idle, leased and connecting
+    SLIST(struct connpool_waiter) waiters;
+    int waiter_len;
+};
+
+struct connpool {
+    lock_t lock;
+    hashmap_t hosts;                //addr to struct connpool_host
+    struct connpool_host *host_list;
+    int max_per_host;
+    int32_t idle_timeout;
+    int32_t connect_timeout;
+    int timer_id;
+    int pending;                    //the armed tick, connects in flight and a running destroy hold the hosts
+    int destroyed;                  //the last pending one frees the pool
+    struct objcache *conn_cache;
+    struct objcache *waiter_cache;
+
+    uint64_t reused;                //gets served by a warm connection
+    uint64_t connects;
+    uint64_t evicted;               //idle or broken connections closed
+};
+
+typedef struct connpool *connpool_t;
+
+connpool_t connpool_create();
+connpool_t connpool_create_for_all(int max_per_host, int32_t idle_timeout, int32_t connect_timeout);
+/*closes the idle connections and fails the waiters with NULL. leased ones
+ * must not be put back any more. the pool is freed by the next tick, or by
+ * the last connect in flight if that comes later*/
+void connpool_destroy(connpool_t *pool);
+
+/*
+ * Get a connection to addr ("ip:port", "[ipv6]:port" or "unix:/path").
+ * A warm one is returned in *conn with CONNPOOL_READY. Otherwise, with
+ * CONNPOOL_PENDING, callback gets a new one, or one put back by another
+ * caller if the host is at max_per_host; it waits at most mtime ms (-1
+ * for no limit). -1 if addr is bad or too many are waiting.
+ */
+int connpool_get(connpool_t pool, const char *addr, int32_t mtime,
+        connpool_cb callback, void *arg, struct connpool_conn **conn);
+/*give back a connection still good for another request*/
+void connpool_put(connpool_t pool, struct connpool_conn *conn);
+/*close a broken connection*/
+void connpool_discard(connpool_t pool, struct connpool_conn *conn);
+
+#endif //_CONNPOOL_H_
@@ -0,0 +1,180 @@
+/**
+ * @author: luyuhuang
+ * @brief: Data structure: a 4-ary minimum heap of inline (key, value) entries
+ */
+
+#include "dheap.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define DHEAP_PAD       (DHEAP_ARITY - 1)
+#define DHEAP_LINE      64
+
+#define ENTRY(heap, p)  ((heap)->entries[(p) + DHEAP_PAD])
+
+static struct dheap_entry *_dheap_alloc(size_t capacity)
+{
+    void *p = NULL;
+    if (posix_memalign(&p, DHEAP_LINE, (capacity + DHEAP_PAD) * sizeof(struct dheap_entry)) != 0)
+        return NULL;
+    return (struct dheap_entry*)p;
+}
+
+dheap_t dheap_create_for_all(dheap_setidx setidx, size_t init_capacity)
+{
+    if (init_capacity == 0)
+        return NULL;
+
+    dheap_t heap = (struct dheap*)calloc(1, sizeof(struct dheap));
+    assert(heap != NULL);
+
+    heap->entries = _dheap_alloc(init_capacity);
+    assert(heap->entries != NULL);
+
+    heap->capacity = init_capacity;
+    heap->len = 0;
+    heap->setidx = setidx;
+    return heap;
+}
+
+dheap_t dheap_create(dheap_setidx setidx)
+{
+    return dheap_create_for_all(setidx, DHEAP_INIT_CAPA);
+}
+
+void dheap_destroy(dheap_t *heap)
+{
+    if (!heap || !*heap)
+        return;
+    free((*heap)->entries);
+    free(*heap);
+    *heap = NULL;
+}
+
+static inline void _dheap_set(dheap_t heap, size_t p, struct dheap_entry e)
+{
+    ENTRY(heap, p) = e;
+    if (heap->setidx)
+        heap->setidx(e.value, p);
+}
+
+static void _dheap_adjust_up(dheap_t heap, size_t hole)
+{
+    struct dheap_entry tmp = ENTRY(heap, hole);
+    while (hole > 0) {
+        size_t parent = (hole - 1) / DHEAP_ARITY;
+        if (ENTRY(heap, parent).key <= tmp.key)
+            break;
+        _dheap_set(heap, hole, ENTRY(heap, parent));
+        hole = parent;
+    }
+    _dheap_set(heap, hole, tmp);
+}
+
+static void _dheap_adjust_down(dheap_t heap, size_t hole)
+{
+    struct dheap_entry tmp = ENTRY(heap, hole);
+    for (;;) {
+        size_t first = hole * DHEAP_ARITY + 1;
+        if (first >= heap->len)
+            break;
+
+        /*the children share a cache line*/
+        size_t last = first + DHEAP_ARITY < heap->len ? first + DHEAP_ARITY : heap->len;
+        size_t child = first;
+        for (size_t c = first + 1; c < last; ++c) {
+            if (ENTRY(heap, c).key < ENTRY(heap, child).key)
+                child = c;
+        }
+        if (ENTRY(heap, child).key >= tmp.key)
+            break;
+        _dheap_set(heap, hole, ENTRY(heap, child));
+        hole = child;
+    }
+    _dheap_set(heap, hole, tmp);
+}
+
+static int _dheap_resize(dheap_t heap)
+{
+    size_t capacity = heap->capacity * 2;
+    struct dheap_entry *entries = _dheap_alloc(capacity);
+    if (!entries)
+        return -1;
+
+    memcpy(entries + DHEAP_PAD, heap->entries + DHEAP_PAD, heap->len * sizeof(struct dheap_entry));
+    free(heap->entries);
+    heap->entries = entries;
+    heap->capacity = capacity;
+    return 0;
+}
+
+int dheap_push(dheap_t heap, int64_t key, basic_value_t value)
+{
+    if (!heap)
+        return -1;
+
+    if (heap->len >= heap->capacity && _dheap_resize(heap) < 0)
+        return -1;
+
+    size_t hole = heap->len++;
+    ENTRY(heap, hole).key = key;
+    ENTRY(heap, hole).value = value;
+    _dheap_adjust_up(heap, hole);
+    return 0;
+}
+
+basic_value_t dheap_top(dheap_t heap, int64_t *key)
+{
+    if (!heap || heap->len == 0)
+        return BASIC_NULL;
+    if (key)
+        *key = ENTRY(heap, 0).key;
+    return ENTRY(heap, 0).value;
+}
+
+basic_value_t dheap_remove(dheap_t heap, size_t index)
+{
+    if (!heap || index >= heap->len)
+        return BASIC_NULL;
+
+    basic_value_t value = ENTRY(heap, index).value;
+    if (heap->setidx)
+        heap->setidx(value, DHEAP_NO_INDEX);
+    if (index != --heap->len) {
+        ENTRY(heap, index) = ENTRY(heap, heap->len);
+        if (index > 0 && ENTRY(heap, index).key < ENTRY(heap, (index - 1) / DHEAP_ARITY).key)
+            _dheap_adjust_up(heap, index);
+        else
+            _dheap_adjust_down(heap, index);
+    }
+    return value;
+}
+
+basic_value_t dheap_pop(dheap_t heap, int64_t *key)
+{
+    if (!heap || heap->len == 0)
+        return BASIC_NULL;
+    if (key)
+        *key = ENTRY(heap, 0).key;
+    return dheap_remove(heap, 0);
+}
+
+int dheap_update(dheap_t heap, size_t index, int64_t key)
+{
+    if (!heap || index >= heap->len)
+        return -1;
+
+    int64_t old = ENTRY(heap, index).key;
+    ENTRY(heap, index).key = key;
+    if (key < old)
+        _dheap_adjust_up(heap, index);
+    else
+        _dheap_adjust_down(heap, index);
+    return 0;
+}
+
+size_t dheap_len(dheap_t heap)
+{
+    return heap->len;
+}
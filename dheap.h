@@ -0,0 +1,54 @@
+/**
+ * @author: luyuhuang
+ * @brief: Data structure: a 4-ary minimum heap of inline (key, value) entries
+ */
+
+#ifndef _DHEAP_H_
+#define _DHEAP_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "basic.h"
+
+#define DHEAP_INIT_CAPA     64
+#define DHEAP_ARITY         4
+#define DHEAP_NO_INDEX      ((size_t)-1)
+
+/*16 bytes: the 4 children of a node fill one 64-byte cache line*/
+struct dheap_entry {
+    int64_t key;
+    basic_value_t value;
+};
+
+/*same as minheap_setidx: the position is the handle for remove/update*/
+typedef void (*dheap_setidx)(basic_value_t, size_t);
+
+/*
+ * Keys are compared in place, no callback and no pointer chasing. Entry p
+ * lives at entries[p + DHEAP_ARITY - 1] so that the children of p,
+ * 4p+1 ~ 4p+4, start on a cache line boundary of the aligned array.
+ */
+struct dheap {
+    struct dheap_entry *entries;
+    size_t capacity;
+    size_t len;
+
+    dheap_setidx setidx;    //NULL if not indexed
+};
+
+typedef struct dheap *dheap_t;
+
+dheap_t dheap_create_for_all(dheap_setidx setidx, size_t init_capacity);
+dheap_t dheap_create(dheap_setidx setidx);
+void dheap_destroy(dheap_t *heap);
+
+int dheap_push(dheap_t heap, int64_t key, basic_value_t value);
+/*return BASIC_NULL if empty, key may be NULL*/
+basic_value_t dheap_top(dheap_t heap, int64_t *key);
+basic_value_t dheap_pop(dheap_t heap, int64_t *key);
+basic_value_t dheap_remove(dheap_t heap, size_t index);
+int dheap_update(dheap_t heap, size_t index, int64_t key);
+size_t dheap_len(dheap_t heap);
+
+#endif //_DHEAP_H_
@@ -0,0 +1,72 @@
+/**
+ * @author: luyuhuang
+ * @brief: eventcount: a futex based condition for lock-free queues
+ */
+
+#include "eventcount.h"
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+
+static long _futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+void ec_init(struct eventcount *ec)
+{
+    ec->seq = 0;
+    ec->waiters = 0;
+}
+
+uint32_t ec_prepare_wait(struct eventcount *ec)
+{
+    __atomic_add_fetch(&ec->waiters, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ec->seq, __ATOMIC_SEQ_CST);
+}
+
+void ec_cancel_wait(struct eventcount *ec)
+{
+    __atomic_sub_fetch(&ec->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+void ec_wait(struct eventcount *ec, uint32_t key)
+{
+    while (__atomic_load_n(&ec->seq, __ATOMIC_SEQ_CST) == key) {
+        if (_futex(&ec->seq, FUTEX_WAIT_PRIVATE, key, NULL) < 0 && errno != EINTR)
+            break;
+    }
+    __atomic_sub_fetch(&ec->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/*return 0 if notified, or -1 while time out*/
+int ec_timedwait(struct eventcount *ec, uint32_t key, int32_t mtime)
+{
+    struct timespec ts;
+    ts.tv_sec = mtime / 1000;
+    ts.tv_nsec = (mtime % 1000) * 1000000L;
+
+    int ret = 0;
+    if (__atomic_load_n(&ec->seq, __ATOMIC_SEQ_CST) == key) {
+        if (_futex(&ec->seq, FUTEX_WAIT_PRIVATE, key, &ts) < 0 && errno == ETIMEDOUT)
+            ret = -1;
+    }
+    __atomic_sub_fetch(&ec->waiters, 1, __ATOMIC_SEQ_CST);
+    return ret;
+}
+
+void ec_notify(struct eventcount *ec, int n)
+{
+    if (__atomic_load_n(&ec->waiters, __ATOMIC_SEQ_CST) == 0)
+        return;
+    __atomic_add_fetch(&ec->seq, 1, __ATOMIC_SEQ_CST);
+    _futex(&ec->seq, FUTEX_WAKE_PRIVATE, n, NULL);
+}
+
+void ec_notify_all(struct eventcount *ec)
+{
+    ec_notify(ec, INT_MAX);
+}
@@ -0,0 +1,32 @@
+/**
+ * @author: luyuhuang
+ * @brief: eventcount: a futex based condition for lock-free queues
+ */
+
+#ifndef _EVENTCOUNT_H_
+#define _EVENTCOUNT_H_
+
+#include <stdint.h>
+
+/*
+ * Waiter:                          Notifier:
+ *   key = ec_prepare_wait(ec);       publish the condition;
+ *   if (condition)                   ec_notify(ec, 1);
+ *       ec_cancel_wait(ec);
+ *   else
+ *       ec_wait(ec, key);
+ */
+struct eventcount {
+    uint32_t seq;       //futex word, bumped by every notify which finds waiters
+    int32_t waiters;
+};
+
+void ec_init(struct eventcount *ec);
+uint32_t ec_prepare_wait(struct eventcount *ec);
+void ec_cancel_wait(struct eventcount *ec);
+void ec_wait(struct eventcount *ec, uint32_t key);
+int ec_timedwait(struct eventcount *ec, uint32_t key, int32_t mtime);
+void ec_notify(struct eventcount *ec, int n);
+void ec_notify_all(struct eventcount *ec);
+
+#endif //_EVENTCOUNT_H_
@@ -0,0 +1,180 @@
+/**
+ * @author: luyuhuang
+ * @brief: length-prefixed framing
+ */
+
+#include "frame.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t _fixed_size[] = {2, 4, 8};
+
+void frame_decoder_init(struct frame_decoder *d, const struct frame_format *format)
+{
+    memset(d, 0, sizeof(struct frame_decoder));
+    d->format = *format;
+}
+
+void frame_decoder_clear(struct frame_decoder *d)
+{
+    free(d->partial);
+    d->partial = NULL;
+    d->partial_capa = 0;
+    d->partial_len = 0;
+    d->header_len = 0;
+    d->frame_len = 0;
+}
+
+/*the size of the prefix at p, 0 if it needs more bytes*/
+static int _frame_header(const struct frame_format *format, const uint8_t *p, size_t len, uint64_t *frame_len)
+{
+    if (format->prefix == FRAME_VARINT) {
+        uint64_t v = 0;
+        for (size_t i = 0; i < len; ++i) {
+            if (i == FRAME_HEADER_MAX - 1 && p[i] > 1)
+                return FRAME_ERR_PREFIX;
+            v |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+            if (!(p[i] & 0x80)) {
+                *frame_len = v;
+                return i + 1;
+            }
+        }
+        return len >= FRAME_HEADER_MAX ? FRAME_ERR_PREFIX : 0;
+    }
+
+    size_t size = _fixed_size[format->prefix];
+    if (len < size)
+        return 0;
+    uint64_t v = 0;
+    if (format->big_endian) {
+        for (size_t i = 0; i < size; ++i)
+            v = v << 8 | p[i];
+    } else {
+        for (size_t i = size; i > 0; --i)
+            v = v << 8 | p[i - 1];
+    }
+    *frame_len = v;
+    return size;
+}
+
+size_t frame_header_size(const struct frame_format *format, size_t len)
+{
+    if (format->prefix != FRAME_VARINT)
+        return _fixed_size[format->prefix];
+    size_t size = 1;
+    while (len >= 0x80) {
+        len >>= 7;
+        size++;
+    }
+    return size;
+}
+
+size_t frame_header_encode(const struct frame_format *format, size_t len, uint8_t *out)
+{
+    uint64_t v = len;
+    size_t size = frame_header_size(format, len);
+
+    if (format->prefix == FRAME_VARINT) {
+        for (size_t i = 0; i < size; ++i, v >>= 7)
+            out[i] = (v & 0x7f) | (i + 1 < size ? 0x80 : 0);
+        return size;
+    }
+    if (size < 8 && v >> (size * 8))
+        return 0;
+    for (size_t i = 0; i < size; ++i, v >>= 8)
+        out[format->big_endian ? size - 1 - i : i] = v & 0xff;
+    return size;
+}
+
+/*start reassembling a frame of which n bytes are at hand*/
+static int _frame_split(struct frame_decoder *d, uint64_t frame_len, const uint8_t *p, size_t n)
+{
+    if (d->partial_capa < frame_len) {
+        uint8_t *partial = (uint8_t*)realloc(d->partial, frame_len);
+        if (!partial)
+            return FRAME_ERR_SIZE;
+        d->partial = partial;
+        d->partial_capa = frame_len;
+    }
+    memcpy(d->partial, p, n);
+    d->partial_len = n;
+    d->frame_len = frame_len;
+    return 0;
+}
+
+int frame_decode(struct frame_decoder *d, const void *buffer, size_t len, frame_cb cb, void *arg)
+{
+    const uint8_t *p = (const uint8_t*)buffer;
+    const uint8_t *end = p + len;
+    size_t max_size = d->format.max_size;
+    uint64_t frame_len;
+    int ret, hlen;
+
+    /*finish what the last chunk left*/
+    if (d->header_len > 0) {
+        size_t take = FRAME_HEADER_MAX - d->header_len;
+        if (take > len)
+            take = len;
+        memcpy(d->header + d->header_len, p, take);
+        hlen = _frame_header(&d->format, d->header, d->header_len + take, &frame_len);
+        if (hlen < 0)
+            return hlen;
+        if (hlen == 0) {
+            d->header_len += take;
+            return 0;
+        }
+        if (max_size && frame_len > max_size)
+            return FRAME_ERR_SIZE;
+        p += hlen - d->header_len;
+        d->header_len = 0;
+        if (frame_len > end - p)
+            return _frame_split(d, frame_len, p, end - p);
+        ret = cb((void*)p, frame_len, arg);
+        p += frame_len;
+        if (ret)
+            return ret;
+    } else if (d->frame_len > 0) {
+        size_t take = d->frame_len - d->partial_len;
+        if (take > len)
+            take = len;
+        memcpy(d->partial + d->partial_len, p, take);
+        d->partial_len += take;
+        p += take;
+        if (d->partial_len < d->frame_len)
+            return 0;
+
+        d->copied++;
+        ret = cb(d->partial, d->frame_len, arg);
+        d->frame_len = 0;
+        d->partial_len = 0;
+        if (d->partial_capa > FRAME_KEEP_SIZE) {
+            free(d->partial);
+            d->partial = NULL;
+            d->partial_capa = 0;
+        }
+        if (ret)
+            return ret;
+    }
+
+    /*then the frames of this chunk, in place*/
+    while (p < end) {
+        hlen = _frame_header(&d->format, p, end - p, &frame_len);
+        if (hlen < 0)
+            return hlen;
+        if (hlen == 0) {
+            memcpy(d->header, p, end - p);
+            d->header_len = end - p;
+            return 0;
+        }
+        if (max_size && frame_len > max_size)
+            return FRAME_ERR_SIZE;
+        p += hlen;
+        if (frame_len > end - p)
+            return _frame_split(d, frame_len, p, end - p);
+        ret = cb((void*)p, frame_len, arg);
+        p += frame_len;
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
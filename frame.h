@@ -0,0 +1,62 @@
+/**
+ * @author: luyuhuang
+ * @brief: length-prefixed framing
+ */
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FRAME_HEADER_MAX 10         //a 64 bit varint
+#define FRAME_KEEP_SIZE 65536       //a larger reassembly buffer is freed after its frame
+
+#define FRAME_ERR_SIZE  -1          //a frame over max_size
+#define FRAME_ERR_PREFIX -2         //a malformed varint
+
+enum frame_prefix {
+    FRAME_FIXED2 = 0,
+    FRAME_FIXED4,
+    FRAME_FIXED8,
+    FRAME_VARINT                    //LEB128, low 7 bits first, endianness does not apply
+};
+
+struct frame_format {
+    enum frame_prefix prefix;
+    int big_endian;
+    size_t max_size;                //of the body, 0 for no limit
+};
+
+/*
+ * Reassembles frames out of the chunks read from one stream. A frame that
+ * lies within one chunk is handed out in place; only a frame straddling
+ * chunks is copied, into a buffer kept for the next one.
+ */
+struct frame_decoder {
+    struct frame_format format;
+    uint8_t header[FRAME_HEADER_MAX];
+    size_t header_len;              //bytes of a split prefix
+    uint8_t *partial;               //body of a split frame
+    size_t partial_len;
+    size_t partial_capa;
+    size_t frame_len;               //of the split frame
+    uint64_t copied;                //frames that had to be reassembled
+};
+
+/*the frame lives only during the call. return non-zero to stop decoding*/
+typedef int (*frame_cb)(void *frame, size_t len, void *arg);
+
+void frame_decoder_init(struct frame_decoder *d, const struct frame_format *format);
+/*drop a split frame and free the buffers*/
+void frame_decoder_clear(struct frame_decoder *d);
+/*0, a FRAME_ERR_* code, or what a callback returned to stop. the stream
+ * cannot go on after an error*/
+int frame_decode(struct frame_decoder *d, const void *buffer, size_t len, frame_cb cb, void *arg);
+
+size_t frame_header_size(const struct frame_format *format, size_t len);
+/*write the prefix of a len byte body to out, return its size or 0 if len
+ * does not fit the prefix*/
+size_t frame_header_encode(const struct frame_format *format, size_t len, uint8_t *out);
+
+#endif //_FRAME_H_
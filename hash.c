@@ -0,0 +1,118 @@
+/**
+ * @author: luyuhuang
+ * @brief: hash functions for integer and string keys
+ */
+
+#include "hash.h"
+#include <string.h>
+
+#define WY_P0 0xa0761d6478bd642fULL
+#define WY_P1 0xe7037ed1a0b428dbULL
+#define WY_P2 0x8ebc6af09c88c6e3ULL
+#define WY_P3 0x589965cc75374cc3ULL
+
+static inline void _wy_mum(uint64_t *a, uint64_t *b)
+{
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t _wy_mix(uint64_t a, uint64_t b)
+{
+    _wy_mum(&a, &b);
+    return a ^ b;
+}
+
+/*unaligned little-endian loads, memcpy compiles to a single mov*/
+static inline uint64_t _wy_r8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t _wy_r4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/*1~3 bytes: first, middle and last*/
+static inline uint64_t _wy_r3(const uint8_t *p, size_t k)
+{
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t*)data;
+    uint64_t a, b;
+
+    seed ^= _wy_mix(seed ^ WY_P0, WY_P1);
+    if (len <= 16) {
+        if (len >= 4) {
+            /*two overlapping 4-byte reads from each end cover 4~16 bytes*/
+            size_t off = (len >> 3) << 2;
+            a = (_wy_r4(p) << 32) | _wy_r4(p + off);
+            b = (_wy_r4(p + len - 4) << 32) | _wy_r4(p + len - 4 - off);
+        } else if (len > 0) {
+            a = _wy_r3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t s1 = seed, s2 = seed;
+            do {
+                seed = _wy_mix(_wy_r8(p) ^ WY_P1, _wy_r8(p + 8) ^ seed);
+                s1 = _wy_mix(_wy_r8(p + 16) ^ WY_P2, _wy_r8(p + 24) ^ s1);
+                s2 = _wy_mix(_wy_r8(p + 32) ^ WY_P3, _wy_r8(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= s1 ^ s2;
+        }
+        while (i > 16) {
+            seed = _wy_mix(_wy_r8(p) ^ WY_P1, _wy_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        /*the last 16 bytes, may overlap the ones already consumed*/
+        a = _wy_r8(p + i - 16);
+        b = _wy_r8(p + i - 8);
+    }
+
+    a ^= WY_P1;
+    b ^= seed;
+    _wy_mum(&a, &b);
+    return _wy_mix(a ^ WY_P0 ^ len, b ^ WY_P1);
+}
+
+uint64_t hash_string(const char *s)
+{
+    return hash_bytes(s, strlen(s), 0);
+}
+
+int64_t hash_int_key(basic_value_t key)
+{
+    return hash_mix64(BASIC2U(key));
+}
+
+bool hash_int_equal(basic_value_t key1, basic_value_t key2)
+{
+    return BASIC2U(key1) == BASIC2U(key2);
+}
+
+int64_t hash_str_key(basic_value_t key)
+{
+    return hash_string(BASIC2S(key));
+}
+
+bool hash_str_equal(basic_value_t key1, basic_value_t key2)
+{
+    return BASIC2S(key1) == BASIC2S(key2) || strcmp(BASIC2S(key1), BASIC2S(key2)) == 0;
+}
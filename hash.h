@@ -0,0 +1,36 @@
+/**
+ * @author: luyuhuang
+ * @brief: hash functions for integer and string keys
+ */
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "basic.h"
+
+/*murmur3 finalizer: every input bit affects every output bit, so
+ *sequential or strided integers spread over the whole table*/
+static inline uint64_t hash_mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/*wyhash: 128-bit multiply folding, 48 bytes per round on long keys*/
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed);
+uint64_t hash_string(const char *s);
+
+/*ready-made hashmap_hs/hashmap_eq for integer and C string keys*/
+int64_t hash_int_key(basic_value_t key);
+bool hash_int_equal(basic_value_t key1, basic_value_t key2);
+int64_t hash_str_key(basic_value_t key);
+bool hash_str_equal(basic_value_t key1, basic_value_t key2);
+
+#endif //_HASH_H_
@@ -28,6 +28,12 @@ hashmap_create_for_all(hashmap_hs hs, hashmap_eq eq, size_t init_capacity, doubl
 
     hashmap_t map = (struct hashmap*)calloc(1, sizeof(struct hashmap));
 
+    /*round up to a power of two, at least 2 for _hashmap_index*/
+    size_t capacity = 2;
+    while (capacity < init_capacity)
+        capacity <<= 1;
+    init_capacity = capacity;
+
     map->len = 0;
     map->capacity = init_capacity;
     map->resize_factor = init_factor;
@@ -41,15 +47,10 @@ hashmap_create_for_all(hashmap_hs hs, hashmap_eq eq, size_t init_capacity, doubl
     return map;
 }
 
-void hashmap_destroy(hashmap_t *pmap)
+static void _hashmap_free_lists(hm_list_t *lists, size_t capacity)
 {
-    assert(pmap != NULL);
-    assert((*pmap) != NULL);
-
-    hashmap_t map = *pmap;
-
-    for (int i = 0; i < map->capacity; ++i) {
-        hm_list_t *l = map->lists + i;
+    for (size_t i = 0; i < capacity; ++i) {
+        hm_list_t *l = lists + i;
         struct hashmap_pair *pair = SLIST_BEGIN(l);
         while (pair != SLIST_END(l)) {
             struct hashmap_pair *p = pair;
@@ -57,7 +58,24 @@ void hashmap_destroy(hashmap_t *pmap)
             free(p);
         }
     }
-    free(map->lists);
+    free(lists);
+}
+
+void hashmap_destroy(hashmap_t *pmap)
+{
+    assert(pmap != NULL);
+    assert((*pmap) != NULL);
+
+    hashmap_t map = *pmap;
+
+    _hashmap_free_lists(map->lists, map->capacity);
+    if (map->old_lists)
+        _hashmap_free_lists(map->old_lists, map->old_capacity);
+    while (map->spare) {
+        struct hashmap_pair *p = map->spare;
+        map->spare = p->__next__;
+        free(p);
+    }
     free(map);
     *pmap = NULL;
     /*
@@ -76,28 +94,78 @@ void hashmap_destroy(hashmap_t *pmap)
     */
 }
 
+/*fibonacci hashing: the multiply carries every bit of the hash into the
+ *top bits, which index the power-of-two table. no division, and weak
+ *hashes (identity of strided integers) still spread*/
+static inline size_t _hashmap_index(int64_t hash, size_t capacity)
+{
+    return ((uint64_t)hash * 0x9e3779b97f4a7c15ULL) >> (64 - __builtin_ctzll(capacity));
+}
+
 static struct hashmap_pair *
-_hashmap_list_find(hashmap_t map, hm_list_t *list, basic_value_t key)
+_hashmap_list_find(hashmap_t map, hm_list_t *list, basic_value_t key, int64_t hash)
 {
     struct hashmap_pair *p;
     SLIST_FOREACH(p, list) {
-        if (map->eq(p->key, key)) {
+        if (p->hash == hash && map->eq(p->key, key)) {
             return p;
         }
     }
     return NULL;
-    /*
-    list_iter_t it = list_iter_create(list);
-    struct hashmap_pair *p, *ret = NULL;
-    while ((p = BASIC2P(list_iter_next(it), struct hashmap_pair*)) != NULL) {
-        if (map->eq(p->key, key)) {
-            ret = p;
-            break;
+}
+
+static struct hashmap_pair *_hashmap_find(hashmap_t map, basic_value_t key, int64_t hash)
+{
+    struct hashmap_pair *p = NULL;
+    if (map->old_lists)
+        p = _hashmap_list_find(map, map->old_lists + _hashmap_index(hash, map->old_capacity), key, hash);
+    if (p == NULL)
+        p = _hashmap_list_find(map, map->lists + _hashmap_index(hash, map->capacity), key, hash);
+    return p;
+}
+
+/*unlink the pair of key from list and return it, or NULL*/
+static struct hashmap_pair *
+_hashmap_list_del(hashmap_t map, hm_list_t *l, basic_value_t key, int64_t hash)
+{
+    struct hashmap_pair *p, *pp;
+    p = SLIST_BEGIN(l);
+    pp = NULL;
+
+    while (p != SLIST_END(l)) {
+        if (p->hash == hash && map->eq(p->key, key)) {
+            if (pp)
+                SLIST_ERASE_AFTER(l, pp);
+            else
+                SLIST_ERASE_HEAD(l);
+            return p;
         }
+        pp = p;
+        p = SLIST_NEXT(p);
+    }
+    return NULL;
+}
+
+/*move up to n buckets from old_lists to lists, using the cached hashes*/
+static void _hashmap_rehash_step(hashmap_t map, size_t n)
+{
+    while (n-- > 0 && map->rehash_index < map->old_capacity) {
+        hm_list_t *l = map->old_lists + map->rehash_index++;
+        struct hashmap_pair *p = SLIST_BEGIN(l);
+        while (p != SLIST_END(l)) {
+            struct hashmap_pair *next = SLIST_NEXT(p);
+            SLIST_INSERT_AT_TAIL(map->lists + _hashmap_index(p->hash, map->capacity), p);
+            p = next;
+        }
+        SLIST_INIT(l);
+    }
+
+    if (map->rehash_index >= map->old_capacity) {
+        free(map->old_lists);
+        map->old_lists = NULL;
+        map->old_capacity = 0;
+        map->rehash_index = 0;
     }
-    list_iter_destroy(&it);
-    return ret;
-    */
 }
 
 static int _hashmap_resize(hashmap_t map)
@@ -105,33 +173,35 @@ static int _hashmap_resize(hashmap_t map)
     if (!map)
         return -1;
 
-    size_t new_capacity = map->capacity * 2;
-    //list_t *new_lists = (list_t*)calloc(new_capacity, sizeof(list_t));
-    hm_list_t *new_lists = (hm_list_t*)malloc(new_capacity * sizeof(hm_list_t));
-    for (int i = 0; i < new_capacity; ++i) {
-        SLIST_INIT(new_lists + i);
-    }
+    /*a resize still in progress must finish before the next one*/
+    if (map->old_lists)
+        _hashmap_rehash_step(map, map->old_capacity);
 
-    /*
-    for (int i = 0; i < new_capacity; i++) {
-        new_lists[i] = list_create(_is_pair_equal);
-    }
-    */
-    hashmap_iter_t it = hashmap_iter_create(map);
-    struct hashmap_pair *p;
-    while ((p = hashmap_iter_next(it)) != NULL) {
-        int hash_code = map->hs(p->key);
-        hash_code %= new_capacity;
-        if (hash_code < 0)
-            hash_code += new_capacity;
-        //list_insert_at_tail(new_lists[hash_code], P2BASIC(p));
-        SLIST_INSERT_AT_TAIL(new_lists + hash_code, p);
-    }
-    hashmap_iter_destroy(&it);
+    size_t new_capacity = map->capacity * 2;
+    /*calloc leaves the zero pages to the kernel, no O(n) SLIST_INIT loop*/
+    hm_list_t *new_lists = (hm_list_t*)calloc(new_capacity, sizeof(hm_list_t));
+    if (!new_lists)
+        return -1;
 
-    free(map->lists);
+    map->old_lists = map->lists;
+    map->old_capacity = map->capacity;
+    map->rehash_index = 0;
     map->lists = new_lists;
     map->capacity = new_capacity;
+
+    if (!map->incremental)
+        _hashmap_rehash_step(map, map->old_capacity);
+    return 0;
+}
+
+int hashmap_set_incremental(hashmap_t map, bool incremental)
+{
+    if (!map)
+        return -1;
+
+    map->incremental = incremental;
+    if (!incremental && map->old_lists)
+        _hashmap_rehash_step(map, map->old_capacity);
     return 0;
 }
 
@@ -140,18 +210,24 @@ int hashmap_add(hashmap_t map, basic_value_t key, basic_value_t value)
     if (!map)
         return -1;
 
-    int hash_code = map->hs(key);
-    hash_code %= map->capacity;
-    if (hash_code < 0)
-        hash_code += map->capacity;
-    struct hashmap_pair *pair = _hashmap_list_find(map, map->lists + hash_code, key);
+    int64_t hash = map->hs(key);
+    if (map->old_lists)
+        _hashmap_rehash_step(map, HASHMAP_REHASH_STEP);
+
+    struct hashmap_pair *pair = _hashmap_find(map, key, hash);
     if (pair == NULL) {
-        pair = (struct hashmap_pair*)calloc(1, sizeof(struct hashmap_pair));
-        assert(pair != NULL);
+        if (map->spare) {
+            pair = map->spare;
+            map->spare = pair->__next__;
+            map->spare_len--;
+        } else {
+            pair = (struct hashmap_pair*)malloc(sizeof(struct hashmap_pair));
+            assert(pair != NULL);
+        }
         pair->key = key;
         pair->value = value;
-        //list_insert_at_tail(map->lists[hash_code], P2BASIC(pair));
-        SLIST_INSERT_AT_TAIL(map->lists + hash_code, pair);
+        pair->hash = hash;
+        SLIST_INSERT_AT_TAIL(map->lists + _hashmap_index(hash, map->capacity), pair);
         map->len++;
         if (map->len > map->capacity * map->resize_factor) {
             _hashmap_resize(map);
@@ -167,11 +243,7 @@ basic_value_t hashmap_get_value(hashmap_t map, basic_value_t key)
     if (!map)
         return BASIC_NULL;
 
-    int hash_code = map->hs(key);
-    hash_code %= map->capacity;
-    if (hash_code < 0)
-        hash_code += map->capacity;
-    struct hashmap_pair *pair = _hashmap_list_find(map, map->lists + hash_code, key);
+    struct hashmap_pair *pair = _hashmap_find(map, key, map->hs(key));
     if (pair == NULL)
         return BASIC_NULL;
     else
@@ -183,11 +255,7 @@ int hashmap_is_in(hashmap_t map, basic_value_t key)
     if (!map)
         return -1;
 
-    int hash_code = map->hs(key);
-    hash_code %= map->capacity;
-    if (hash_code < 0)
-        hash_code += map->capacity;
-    struct hashmap_pair *pair = _hashmap_list_find(map, map->lists + hash_code, key);
+    struct hashmap_pair *pair = _hashmap_find(map, key, map->hs(key));
     return pair != NULL;
 }
 
@@ -196,52 +264,28 @@ basic_value_t hashmap_del(hashmap_t map, basic_value_t key)
     if (!map)
         return BASIC_NULL;
 
-    int hash_code = map->hs(key);
-    hash_code %= map->capacity;
-    if (hash_code < 0)
-        hash_code += map->capacity;
-
-    hm_list_t *l = map->lists + hash_code;
-    struct hashmap_pair *p, *pp;
-    basic_value_t value = BASIC_NULL;
-    p = SLIST_BEGIN(l);
-    pp = NULL;
+    int64_t hash = map->hs(key);
+    if (map->old_lists)
+        _hashmap_rehash_step(map, HASHMAP_REHASH_STEP);
 
-    while (p != SLIST_END(l)) {
-        if (map->eq(p->key, key)) {
-            value = p->value;
-            if (pp)
-                SLIST_ERASE_AFTER(l, pp);
-            else
-                SLIST_ERASE_HEAD(l);
-            free(p);
-            map->len--;
-            break;
-        }
-        pp = p;
-        p = SLIST_NEXT(p);
-    }
-
-    return value;
+    struct hashmap_pair *p = NULL;
+    if (map->old_lists)
+        p = _hashmap_list_del(map, map->old_lists + _hashmap_index(hash, map->old_capacity), key, hash);
+    if (p == NULL)
+        p = _hashmap_list_del(map, map->lists + _hashmap_index(hash, map->capacity), key, hash);
+    if (p == NULL)
+        return BASIC_NULL;
 
-    /*
-    list_iter_t it = list_iter_create(map->lists[hash_code]);
-    struct hashmap_pair *p;
-    basic_value_t value = BASIC_NULL;
-    int i = 0;
-    while ((p = BASIC2P(list_iter_next(it), struct hashmap_pair*)) != NULL) {
-        if (map->eq(p->key, key)) {
-            value = p->value;
-            list_del(map->lists[hash_code], i);
-            free(p);
-            map->len--;
-            break;
-        }
-        i++;
+    basic_value_t value = p->value;
+    if (map->spare_len < HASHMAP_SPARE_MAX) {
+        p->__next__ = map->spare;
+        map->spare = p;
+        map->spare_len++;
+    } else {
+        free(p);
     }
-    list_iter_destroy(&it);
+    map->len--;
     return value;
-    */
 }
 
 ssize_t hashmap_len(hashmap_t map)
@@ -261,8 +305,10 @@ hashmap_iter_t hashmap_iter_create(hashmap_t map)
     iter->index = 0;
     iter->count = 0;
     iter->map = map;
+    /*pairs not migrated yet are visited first*/
+    iter->in_old = map->old_lists != NULL;
     //iter->p_node = map->lists[0]->head;
-    iter->p_node = SLIST_BEGIN(map->lists);
+    iter->p_node = SLIST_BEGIN(iter->in_old ? map->old_lists : map->lists);
     return iter;
 }
 
@@ -272,7 +318,7 @@ void hashmap_iter_destroy(hashmap_iter_t *iter)
     assert((*iter) != NULL);
 
     free(*iter);
-    iter = NULL;
+    *iter = NULL;
 }
 
 int hashmap_iter_has_next(hashmap_iter_t iter)
@@ -284,12 +330,19 @@ int hashmap_iter_has_next(hashmap_iter_t iter)
 
 struct hashmap_pair *hashmap_iter_next(hashmap_iter_t iter)
 {
-    while (iter->p_node == SLIST_END(iter->map->lists + iter->index)) {
+    hashmap_t map = iter->map;
+    while (iter->p_node == NULL) {
         ++iter->index;
-        if (iter->index >= iter->map->capacity)
-            return NULL;
+        if (iter->index >= (iter->in_old ? map->old_capacity : map->capacity)) {
+            if (!iter->in_old)
+                return NULL;
+            iter->in_old = false;
+            iter->index = 0;
+            iter->p_node = SLIST_BEGIN(map->lists);
+            continue;
+        }
         //iter->p_node = iter->map->lists[iter->index]->head;
-        iter->p_node = SLIST_BEGIN(iter->map->lists + iter->index);
+        iter->p_node = SLIST_BEGIN((iter->in_old ? map->old_lists : map->lists) + iter->index);
     }
     //struct hashmap_pair *p = BASIC2P(iter->p_node->data, struct hashmap_pair*);
     struct hashmap_pair *p = iter->p_node;
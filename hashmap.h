@@ -15,6 +15,11 @@
 
 #define HASHMAP_INIT_CAPA       1024
 #define HASHMAP_INIT_FACTOR     0.5f
+/*buckets migrated per add/del while an incremental resize is running*/
+#define HASHMAP_REHASH_STEP     16
+/*deleted pairs kept for the next adds, a map that churns at a steady
+ *size then stops allocating*/
+#define HASHMAP_SPARE_MAX       64
 
 /*return a hash code of key*/
 //typedef int (*hashmap_hs)(void*);
@@ -28,6 +33,7 @@ struct hashmap_pair {
     //void *value;
     basic_value_t key;
     basic_value_t value;
+    int64_t hash;
 
     struct hashmap_pair *__next__;
 };
@@ -35,13 +41,23 @@ struct hashmap_pair {
 typedef SLIST(struct hashmap_pair) hm_list_t;
 struct hashmap {
     size_t len;
-    size_t capacity;
+    size_t capacity;            //always a power of two
     double resize_factor;
 
     hashmap_hs hs;
     hashmap_eq eq;
 
     hm_list_t *lists;
+
+    /*incremental resize: while old_lists is not NULL, the buckets
+     *[rehash_index, old_capacity) of it still hold pairs*/
+    bool incremental;
+    hm_list_t *old_lists;
+    size_t old_capacity;
+    size_t rehash_index;
+
+    struct hashmap_pair *spare;
+    size_t spare_len;
 };
 
 struct hashmap_iter {
@@ -50,6 +66,7 @@ struct hashmap_iter {
     //struct list_node *p_node;
     struct hashmap_pair *p_node;
     size_t count;
+    bool in_old;
 };
 
 typedef struct hashmap *hashmap_t;
@@ -58,6 +75,9 @@ typedef struct hashmap_iter *hashmap_iter_t;
 hashmap_t hashmap_create(hashmap_hs hs, hashmap_eq eq);
 hashmap_t hashmap_create_for_all(hashmap_hs hs, hashmap_eq eq, size_t init_capacity, double init_factor);
 void hashmap_destroy(hashmap_t *pmap);
+/*spread resizing over the following add/del calls instead of rehashing
+ *everything at once. lookups never migrate, so they stay read-only*/
+int hashmap_set_incremental(hashmap_t map, bool incremental);
 
 int hashmap_is_in(hashmap_t map, basic_value_t key);
 int hashmap_add(hashmap_t map, basic_value_t key, basic_value_t value);
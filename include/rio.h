@@ -14,6 +14,7 @@
 #define REACTER_FULL    -1
 #define REACTER_ERR     -2      //please check errno
 #define REACTER_TIMEOUT -3
+#define REACTER_BUSY    -4      //the fd, timer id or signal is armed already
 
 #define TRUE            1
 #define FALSE           0
@@ -40,17 +41,34 @@ typedef int (*read_cb)(struct rfile*, void*, ssize_t, void*);
 typedef int (*write_cb)(struct rfile*, void*, ssize_t, void*);
 typedef int (*timer_cb)(struct rtimer*, void*);
 typedef int (*signal_cb)(struct rsignal*, void*);
+typedef void (*post_cb)(void*);
 
 
+/*
+ * Called out of the loop thread, a registration is posted to the loop and
+ * REACTER_OK only means it was posted. If it fails there, the callback is
+ * called once with REACTER_BUSY (already armed) or REACTER_ERR as its
+ * result: the fd of an accept or connect, the length of a read or write,
+ * timer->mtime or signal->sig. It is also counted in the stats
+ * (failed_registrations). In the loop thread the error is returned.
+ */
 int reactor_asyn_accept(reactor_t r, struct rfile *file, int32_t mtime, accept_cb callback, void *data);
 int reactor_asyn_connect(
     reactor_t r, struct rfile *file, struct sockaddr *addr, socklen_t len, int32_t mtime, connect_cb callback, void *data);
 int reactor_asyn_read(reactor_t r, struct rfile *file, int32_t mtime, read_cb callback, void *data);
 int reactor_asyn_write(reactor_t r, struct rfile *file, void *buffer, size_t len, int32_t mtime, write_cb callback, void *data);
+/*cancel whatever is armed on fd, its callback is not called*/
+int reactor_del_file(reactor_t r, int fd);
 int reactor_add_timer(reactor_t r, struct rtimer *timer, timer_cb callback, void *data);
 int reactor_del_timer(reactor_t r, int timer_id);
 int reactor_add_signal(reactor_t r, struct rsignal *signal, signal_cb callback, void *data);
 int reactor_del_signal(reactor_t r, int sig);
+/*run func(arg) in the loop thread, safe to call from any thread*/
+int reactor_post(reactor_t r, post_cb func, void *arg);
+/*set before the reactor runs, 0 lifts a limit*/
+void reactor_set_budgets(reactor_t r, int read_calls, size_t write_budget);
+/*a read callback returning non-zero keeps the buffer, and frees it here later*/
+void reactor_free_buffer(void *buffer);
 
 int reactor_run(reactor_t r);
 void reactor_stop(reactor_t r);
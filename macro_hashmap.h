@@ -8,103 +8,208 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 
-#define HASHMAP(type, hash, eq, free)   \
-    struct {                            \
-        size_t len;                     \
-        size_t capacity;                \
-        double factor;                  \
-        type **lists;                   \
-        __typeof__(hash) hash;          \
-        __typeof__(eq) eq;              \
-        __typeof__(free) free;          \
+/*
+ * An intrusive hash map: the node type embeds the key and the chain link
+ * as __key__ and __next__, like the nodes of SLIST, so inserting allocates
+ * nothing. HASHMAP_GENERATE expands find/insert/erase for one node type
+ * with hash and eq inlined:
+ *
+ *     struct conn { int __key__; struct conn *__next__; ... };
+ *     #define CONN_HASH(k) (k)
+ *     #define CONN_EQ(k1, k2) ((k1) == (k2))
+ *     typedef HASHMAP(struct conn) conn_map_t;
+ *     HASHMAP_GENERATE(conn_map, conn_map_t, struct conn, CONN_HASH, CONN_EQ)
+ *
+ *     conn_map_t map = HASHMAP_INITIALIZER;
+ *     conn_map_insert(&map, c);
+ *     c = conn_map_find(&map, fd);
+ *     c = conn_map_erase(&map, fd);
+ *     HASHMAP_DEL(&map, free);
+ */
+
+#define HASHMAP_MIN_CAPA 16
+#ifndef HASHMAP_REHASH_STEP
+/*buckets migrated per insert/erase while a resize is running, as hashmap.h*/
+#define HASHMAP_REHASH_STEP 16
+#endif
+
+/*
+ * Resizing is incremental as in hashmap.c: on a doubling the buckets stay
+ * in old_lists, and every insert or erase moves a few of them over, so no
+ * call pays O(n). While old_lists is not NULL, its buckets
+ * [rehash_index, old_capacity) still hold nodes.
+ */
+#define HASHMAP(type)           \
+    struct {                    \
+        size_t len;             \
+        size_t capacity;        \
+        type **lists;           \
+        size_t old_capacity;    \
+        type **old_lists;       \
+        size_t rehash_index;    \
     }
 
-#define HASHMAP_INIT(map, capacity, factor) \
-    do {                                                                    \
-        map->len = 0;                                                       \
-        map->capacity = capacity;                                           \
-        map->factor = factor;                                               \
-        map->lists = (__typeof__(map->lists))calloc(capacity, sizeof(*map->lists));   \
-    } while (0)
+#define HASHMAP_INITIALIZER {0, 0, NULL, 0, NULL, 0}
 
-#define HASHMAP_DEL(map) \
-    do {                                                        \
-        for (int i = 0; i < map->capacity; ++i) {               \
-            __typeof__(*map->lists) t, p = map->lists[i];       \
-            while (p) {                                         \
-                t = p->__next__;                                \
-                map->free(p);                                   \
-                p = t;                                          \
-            }                                                   \
-        }                                                       \
-        free(map->lists);
+/*capacity is rounded up to a power of two, lists stays NULL if out of memory*/
+#define HASHMAP_INIT(map, init_capacity)                                                            \
+    do {                                                                                            \
+        size_t _c_IN_HASHMAP_INIT = 2;                                                              \
+        while (_c_IN_HASHMAP_INIT < (init_capacity))                                                \
+            _c_IN_HASHMAP_INIT <<= 1;                                                               \
+        (map)->len = 0;                                                                             \
+        (map)->lists = (__typeof__((map)->lists))calloc(_c_IN_HASHMAP_INIT, sizeof(*(map)->lists)); \
+        (map)->capacity = (map)->lists ? _c_IN_HASHMAP_INIT : 0;                                    \
+        (map)->old_capacity = 0;                                                                    \
+        (map)->old_lists = NULL;                                                                    \
+        (map)->rehash_index = 0;                                                                    \
     } while (0)
 
-#define HASHMAP_FOREACH(pair, map) \
-        size_t _i_IN_HASHMAP_FOREACH = 0; \
-        pair = map->lists[0];\
-        while (true) {\
-            bool _end_IN_HASHMAP_FOREACH = false;\
-            while (pair == NULL) {\
-                if (_i_IN_HASHMAP_FOREACH >= map->capacity) {\
-                    _end_IN_HASHMAP_FOREACH = true; \
-                    break;\
-                }\
-                pair = map->list[++_i_IN_HASHMAP_FOREACH];\
-            }\
-            if (_end_IN_HASHMAP_FOREACH) break;                                 
-
+/*the i-th bucket of the old table then of the new one*/
+#define HASHMAP_BUCKET(map, i)                                                                \
+    ((i) < (map)->old_capacity ? (map)->old_lists[i] : (map)->lists[(i) - (map)->old_capacity])
 
-#define HASHMAP_FOREACH_END \
-            pair = pair->__next__;                          \
-        }                                                   
+/*free every node with free_func, then the buckets*/
+#define HASHMAP_DEL(map, free_func)                                                                           \
+    do {                                                                                                      \
+        size_t _i_IN_HASHMAP_DEL;                                                                             \
+        for (_i_IN_HASHMAP_DEL = 0; _i_IN_HASHMAP_DEL < (map)->old_capacity + (map)->capacity;                \
+                ++_i_IN_HASHMAP_DEL) {                                                                        \
+            __typeof__(*(map)->lists) _t_IN_HASHMAP_DEL, _p_IN_HASHMAP_DEL =                                  \
+                HASHMAP_BUCKET(map, _i_IN_HASHMAP_DEL);                                                       \
+            while (_p_IN_HASHMAP_DEL) {                                                                       \
+                _t_IN_HASHMAP_DEL = _p_IN_HASHMAP_DEL->__next__;                                              \
+                free_func(_p_IN_HASHMAP_DEL);                                                                 \
+                _p_IN_HASHMAP_DEL = _t_IN_HASHMAP_DEL;                                                        \
+            }                                                                                                 \
+        }                                                                                                     \
+        free((map)->lists);                                                                                   \
+        free((map)->old_lists);                                                                               \
+        (map)->lists = (map)->old_lists = NULL;                                                               \
+        (map)->len = (map)->capacity = (map)->old_capacity = (map)->rehash_index = 0;                         \
+    } while (0)
 
-#define _hashmap_RESIZE(map) \
-        do {
-            size_t new_capacity = map->capacity * 2;
-            __typeof__(map->lists) new_lists = 
-                (__typeof__(map->lists))calloc(new_capacity, sizeof(*map->lists));
-            __typeof__(*map->lists) itor;
-            HASHMAP_FOREACH(itor, map)
-                int hash_code = map->hash(pair->__key__);
-                hash_code %= new_capacity;
-                if (hash_code < 0) hash_code += new_capacity;
-                itor->__next__ = new_lists[hash_code];
-                new_lists[hash_code] = pair;
-            HASHMAP_FOREACH_END
-            free(map)
-        } while (0)
+#define HASHMAP_LEN(map) ((map)->len)
+#define HASHMAP_EMPTY(map) ((map)->len == 0)
 
-#define HASHMAP_INSERT(map, pair) \
-        do {
-            if (map->len > map->capacity * map->factor) {
-                _hashmap_RESIZE(map);
-            }
+/*break leaves the whole loop (the inner loop keeps _brk set). var must not
+ *be erased inside the loop*/
+#define HASHMAP_FOREACH(var, map)                                                                       \
+    for (size_t _i_IN_HASHMAP_FOREACH = 0, _brk_IN_HASHMAP_FOREACH = 0;                                 \
+            !_brk_IN_HASHMAP_FOREACH && _i_IN_HASHMAP_FOREACH < (map)->old_capacity + (map)->capacity;  \
+            ++_i_IN_HASHMAP_FOREACH)                                                                    \
+        for ((var) = HASHMAP_BUCKET(map, _i_IN_HASHMAP_FOREACH), _brk_IN_HASHMAP_FOREACH = 1;           \
+                (var) || (_brk_IN_HASHMAP_FOREACH = 0); (var) = (var)->__next__)
 
-            int hash_code = map->hash(pair->__key__);
-            hash_code %= map->capacity;
-            if (hash_code < 0) hash_code += map->capacity;
-            __typeof__(*map->lists) p = _hashmap_LIST_FIND(map, map->lists[hash_code], pair->__key__);
+/*fibonacci hashing as in hashmap.c: identity hashes of fds or ids are fine*/
+#define HASHMAP_INDEX(hash, capacity)                                                          \
+    ((size_t)(((uint64_t)(hash) * 0x9e3779b97f4a7c15ULL) >> (64 - __builtin_ctzll(capacity))))
 
-            __typeof__(*map->lists) p = map->lists[hash_code], pp = NULL;
-            bool end = false;
-            while (p) {
-                if (map->eq(p->__key__, pair->__key__)) {
-                    pair->__next__ = p->__next__;
-                    if (pp) pp->__next__ = pair;
-                    else map->lists[hash_code] = pair;
-                    map->free(p);
-                    end = true;
-                    break;
-                }
-                pp = p;
-                p = p->__next__;
-            }
-            if (end) break;
-            pair->__next__ = map->list[hash_code];
-            map->list[hash_code] = pair;
-            ++map->len;
-        } while (0)
+#define HASHMAP_GENERATE(name, maptype, type, hash, eq)                                     \
+/*move up to n buckets from old_lists to lists*/                                            \
+static inline void _##name##_rehash_step(maptype *map, size_t n)                            \
+{                                                                                           \
+    while (n-- > 0 && map->rehash_index < map->old_capacity) {                              \
+        type *p = map->old_lists[map->rehash_index], *next;                                 \
+        map->old_lists[map->rehash_index++] = NULL;                                         \
+        for (; p; p = next) {                                                               \
+            size_t index = HASHMAP_INDEX(hash(p->__key__), map->capacity);                  \
+            next = p->__next__;                                                             \
+            p->__next__ = map->lists[index];                                                \
+            map->lists[index] = p;                                                          \
+        }                                                                                   \
+    }                                                                                       \
+    if (map->rehash_index >= map->old_capacity) {                                           \
+        free(map->old_lists);                                                               \
+        map->old_lists = NULL;                                                              \
+        map->old_capacity = 0;                                                              \
+        map->rehash_index = 0;                                                              \
+    }                                                                                       \
+}                                                                                           \
+                                                                                            \
+static inline void _##name##_resize(maptype *map)                                           \
+{                                                                                           \
+    /*a resize still in progress must finish before the next one*/                          \
+    if (map->old_lists)                                                                     \
+        _##name##_rehash_step(map, map->old_capacity);                                      \
+    size_t capacity = map->capacity * 2;                                                    \
+    type **lists = (type**)calloc(capacity, sizeof(type*));                                 \
+    if (!lists)                                                                             \
+        return;                                                                             \
+    map->old_lists = map->lists;                                                            \
+    map->old_capacity = map->capacity;                                                      \
+    map->rehash_index = 0;                                                                  \
+    map->lists = lists;                                                                     \
+    map->capacity = capacity;                                                               \
+}                                                                                           \
+                                                                                            \
+/*the link pointing at the node of key, or at the end of its bucket in lists*/             \
+static inline type **_##name##_link(maptype *map, __typeof__(((type*)0)->__key__) key)      \
+{                                                                                           \
+    type **pp;                                                                              \
+    if (map->old_lists) {                                                                   \
+        pp = map->old_lists + HASHMAP_INDEX(hash(key), map->old_capacity);                  \
+        for (; *pp; pp = &(*pp)->__next__) {                                                \
+            if (eq((*pp)->__key__, key))                                                    \
+                return pp;                                                                  \
+        }                                                                                   \
+    }                                                                                       \
+    pp = map->lists + HASHMAP_INDEX(hash(key), map->capacity);                              \
+    for (; *pp; pp = &(*pp)->__next__) {                                                    \
+        if (eq((*pp)->__key__, key))                                                        \
+            return pp;                                                                      \
+    }                                                                                       \
+    return pp;                                                                              \
+}                                                                                           \
+                                                                                            \
+static inline type *name##_find(maptype *map, __typeof__(((type*)0)->__key__) key)          \
+{                                                                                           \
+    if (map->len == 0)                                                                      \
+        return NULL;                                                                        \
+    return *_##name##_link(map, key);                                                       \
+}                                                                                           \
+                                                                                            \
+/*link node in, return the node it replaced (the same key) or NULL; node                    \
+ *itself if it could not be linked, out of memory*/                                         \
+static inline type *name##_insert(maptype *map, type *node)                                 \
+{                                                                                           \
+    if (!map->lists) {                                                                      \
+        HASHMAP_INIT(map, HASHMAP_MIN_CAPA);                                                \
+        if (!map->lists)                                                                    \
+            return node;                                                                    \
+    }                                                                                       \
+    if (map->old_lists)                                                                     \
+        _##name##_rehash_step(map, HASHMAP_REHASH_STEP);                                    \
+    type **pp = _##name##_link(map, node->__key__);                                         \
+    if (*pp) {                                                                              \
+        type *old = *pp;                                                                    \
+        node->__next__ = old->__next__;                                                     \
+        *pp = node;                                                                         \
+        return old;                                                                         \
+    }                                                                                       \
+    node->__next__ = NULL;                                                                  \
+    *pp = node;                                                                             \
+    if (++map->len > map->capacity - map->capacity / 4)                                     \
+        _##name##_resize(map);                                                              \
+    return NULL;                                                                            \
+}                                                                                           \
+                                                                                            \
+/*unlink and return the node of key, or NULL*/                                              \
+static inline type *name##_erase(maptype *map, __typeof__(((type*)0)->__key__) key)         \
+{                                                                                           \
+    if (map->len == 0)                                                                      \
+        return NULL;                                                                        \
+    if (map->old_lists)                                                                     \
+        _##name##_rehash_step(map, HASHMAP_REHASH_STEP);                                    \
+    type **pp = _##name##_link(map, key);                                                   \
+    type *p = *pp;                                                                          \
+    if (p) {                                                                                \
+        *pp = p->__next__;                                                                  \
+        --map->len;                                                                         \
+    }                                                                                       \
+    return p;                                                                               \
+}
 
 #endif //_MACRO_HASHMAP_H_
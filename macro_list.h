@@ -151,4 +151,125 @@
             (slist)->tail = (node);                     \
     } while (0)
 
+/*
+ * Vyukov's intrusive MPSC queue. Any thread may push, only one thread
+ * may pop. A push is one exchange and one store, and never waits. A pop
+ * returns NULL if the queue is empty, or if a producer is in the middle
+ * of a push; the consumer should come back once that producer is done.
+ */
+#define MPSC_QUEUE(type)                                    \
+    struct {                                                \
+        type *head;     /*producers push here*/             \
+        type *tail __attribute__((aligned(64)));            \
+        type stub;                                          \
+    }
+
+#define MPSC_QUEUE_INIT(q)                                  \
+    do {                                                    \
+        (q)->stub.__next__ = NULL;                          \
+        (q)->head = (q)->tail = &(q)->stub;                 \
+    } while (0)
+
+/*only reliable in the consumer*/
+#define MPSC_QUEUE_EMPTY(q)                                 \
+    ((q)->tail == &(q)->stub &&                             \
+     __atomic_load_n(&(q)->stub.__next__, __ATOMIC_ACQUIRE) == NULL)
+
+#define MPSC_QUEUE_PUSH(q, node)                                            \
+    do {                                                                    \
+        __typeof__((q)->head) _mPSC_PUSH_node = (node);                     \
+        __atomic_store_n(&_mPSC_PUSH_node->__next__, NULL, __ATOMIC_RELAXED); \
+        __typeof__((q)->head) _mPSC_PUSH_prev =                             \
+            __atomic_exchange_n(&(q)->head, _mPSC_PUSH_node, __ATOMIC_ACQ_REL); \
+        __atomic_store_n(&_mPSC_PUSH_prev->__next__, _mPSC_PUSH_node, __ATOMIC_RELEASE); \
+    } while (0)
+
+#define MPSC_QUEUE_POP(q)                                                   \
+    ({                                                                      \
+        __typeof__((q)->head) _mPSC_POP_tail = (q)->tail;                   \
+        __typeof__((q)->head) _mPSC_POP_next =                              \
+            __atomic_load_n(&_mPSC_POP_tail->__next__, __ATOMIC_ACQUIRE);   \
+        __typeof__((q)->head) _mPSC_POP_ret = NULL;                         \
+        if (_mPSC_POP_tail == &(q)->stub && _mPSC_POP_next != NULL) {       \
+            (q)->tail = _mPSC_POP_tail = _mPSC_POP_next;                    \
+            _mPSC_POP_next =                                                \
+                __atomic_load_n(&_mPSC_POP_tail->__next__, __ATOMIC_ACQUIRE); \
+        }                                                                   \
+        if (_mPSC_POP_tail == &(q)->stub) {                                 \
+            /*empty*/                                                       \
+        } else if (_mPSC_POP_next) {                                        \
+            (q)->tail = _mPSC_POP_next;                                     \
+            _mPSC_POP_ret = _mPSC_POP_tail;                                 \
+        } else if (_mPSC_POP_tail ==                                        \
+                __atomic_load_n(&(q)->head, __ATOMIC_ACQUIRE)) {            \
+            /*the last node, put the stub behind it to take it out*/        \
+            MPSC_QUEUE_PUSH(q, &(q)->stub);                                 \
+            _mPSC_POP_next =                                                \
+                __atomic_load_n(&_mPSC_POP_tail->__next__, __ATOMIC_ACQUIRE); \
+            if (_mPSC_POP_next) {                                           \
+                (q)->tail = _mPSC_POP_next;                                 \
+                _mPSC_POP_ret = _mPSC_POP_tail;                             \
+            }                                                               \
+        }                                                                   \
+        _mPSC_POP_ret;                                                      \
+    })
+
+
+/*
+ * Bounded SPSC ring of node pointers, one producer thread and one
+ * consumer thread. size must be a power of 2. Each side keeps a cached
+ * copy of the other side's index, and reads the shared one only when
+ * the ring looks full (or empty).
+ */
+#define SPSC_RING(type, size)                                           \
+    struct {                                                            \
+        type *slots[size];                                              \
+        size_t head __attribute__((aligned(64)));   /*next to pop*/     \
+        size_t tail_cache;                                              \
+        size_t tail __attribute__((aligned(64)));   /*next to push*/    \
+        size_t head_cache;                                              \
+    }
+
+#define SPSC_RING_INIT(ring)                                    \
+    do {                                                        \
+        (ring)->head = (ring)->tail_cache = 0;                  \
+        (ring)->tail = (ring)->head_cache = 0;                  \
+    } while (0)
+
+#define SPSC_RING_CAPA(ring) (sizeof((ring)->slots) / sizeof((ring)->slots[0]))
+#define SPSC_RING_LEN(ring)                                     \
+    (__atomic_load_n(&(ring)->tail, __ATOMIC_ACQUIRE) -         \
+     __atomic_load_n(&(ring)->head, __ATOMIC_ACQUIRE))
+#define SPSC_RING_EMPTY(ring) (SPSC_RING_LEN(ring) == 0)
+
+/*producer only. 0 on success, -1 if the ring is full*/
+#define SPSC_RING_PUSH(ring, node)                                              \
+    ({                                                                          \
+        size_t _sPSC_PUSH_tail = (ring)->tail;                                  \
+        int _sPSC_PUSH_ret = 0;                                                 \
+        if (_sPSC_PUSH_tail - (ring)->head_cache == SPSC_RING_CAPA(ring))       \
+            (ring)->head_cache = __atomic_load_n(&(ring)->head, __ATOMIC_ACQUIRE); \
+        if (_sPSC_PUSH_tail - (ring)->head_cache == SPSC_RING_CAPA(ring)) {     \
+            _sPSC_PUSH_ret = -1;                                                \
+        } else {                                                                \
+            (ring)->slots[_sPSC_PUSH_tail & (SPSC_RING_CAPA(ring) - 1)] = (node); \
+            __atomic_store_n(&(ring)->tail, _sPSC_PUSH_tail + 1, __ATOMIC_RELEASE); \
+        }                                                                       \
+        _sPSC_PUSH_ret;                                                         \
+    })
+
+/*consumer only. NULL if the ring is empty*/
+#define SPSC_RING_POP(ring)                                                     \
+    ({                                                                          \
+        size_t _sPSC_POP_head = (ring)->head;                                   \
+        __typeof__((ring)->slots[0]) _sPSC_POP_ret = NULL;                      \
+        if (_sPSC_POP_head == (ring)->tail_cache)                               \
+            (ring)->tail_cache = __atomic_load_n(&(ring)->tail, __ATOMIC_ACQUIRE); \
+        if (_sPSC_POP_head != (ring)->tail_cache) {                             \
+            _sPSC_POP_ret = (ring)->slots[_sPSC_POP_head & (SPSC_RING_CAPA(ring) - 1)]; \
+            __atomic_store_n(&(ring)->head, _sPSC_POP_head + 1, __ATOMIC_RELEASE); \
+        }                                                                       \
+        _sPSC_POP_ret;                                                          \
+    })
+
 #endif //_MACRO_LIST_H_
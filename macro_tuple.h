@@ -30,7 +30,9 @@ typedef void *tuple_t;
                 ) _nEW_TUPLE_1_type;                                    \
         _nEW_TUPLE_1_type *_nEW_TUPLE_1_t =                             \
             (_nEW_TUPLE_1_type*)malloc(sizeof(_nEW_TUPLE_1_type));      \
-        _nEW_TUPLE_1_t->_1 = v1;                                        \
+        if (_nEW_TUPLE_1_t) {                                           \
+            _nEW_TUPLE_1_t->_1 = v1;                                    \
+        }                                                               \
         (void*)_nEW_TUPLE_1_t;                                          \
      })
 
@@ -42,8 +44,10 @@ typedef void *tuple_t;
                 ) _nEW_TUPLE_2_type;                                    \
         _nEW_TUPLE_2_type *_nEW_TUPLE_2_t =                             \
             (_nEW_TUPLE_2_type*)malloc(sizeof(_nEW_TUPLE_2_type));      \
-        _nEW_TUPLE_2_t->_1 = v1;                                        \
-        _nEW_TUPLE_2_t->_2 = v2;                                        \
+        if (_nEW_TUPLE_2_t) {                                           \
+            _nEW_TUPLE_2_t->_1 = v1;                                    \
+            _nEW_TUPLE_2_t->_2 = v2;                                    \
+        }                                                               \
         (void*)_nEW_TUPLE_2_t;                                          \
      })
 
@@ -57,9 +61,11 @@ typedef void *tuple_t;
                 ) _nEW_TUPLE_3_type;                                    \
         _nEW_TUPLE_3_type *_nEW_TUPLE_3_t =                             \
             (_nEW_TUPLE_3_type*)malloc(sizeof(_nEW_TUPLE_3_type));      \
-        _nEW_TUPLE_3_t->_1 = v1;                                        \
-        _nEW_TUPLE_3_t->_2 = v2;                                        \
-        _nEW_TUPLE_3_t->_3 = v3;                                        \
+        if (_nEW_TUPLE_3_t) {                                           \
+            _nEW_TUPLE_3_t->_1 = v1;                                    \
+            _nEW_TUPLE_3_t->_2 = v2;                                    \
+            _nEW_TUPLE_3_t->_3 = v3;                                    \
+        }                                                               \
         (void*)_nEW_TUPLE_3_t;                                          \
      })
 
@@ -73,10 +79,12 @@ typedef void *tuple_t;
                 ) _nEW_TUPLE_4_type;                                    \
         _nEW_TUPLE_4_type *_nEW_TUPLE_4_t =                             \
             (_nEW_TUPLE_4_type*)malloc(sizeof(_nEW_TUPLE_4_type));      \
-        _nEW_TUPLE_4_t->_1 = v1;                                        \
-        _nEW_TUPLE_4_t->_2 = v2;                                        \
-        _nEW_TUPLE_4_t->_3 = v3;                                        \
-        _nEW_TUPLE_4_t->_4 = v4;                                        \
+        if (_nEW_TUPLE_4_t) {                                           \
+            _nEW_TUPLE_4_t->_1 = v1;                                    \
+            _nEW_TUPLE_4_t->_2 = v2;                                    \
+            _nEW_TUPLE_4_t->_3 = v3;                                    \
+            _nEW_TUPLE_4_t->_4 = v4;                                    \
+        }                                                               \
         (void*)_nEW_TUPLE_4_t;                                          \
      })
 
@@ -91,11 +99,13 @@ typedef void *tuple_t;
                 ) _nEW_TUPLE_5_type;                                    \
         _nEW_TUPLE_5_type *_nEW_TUPLE_5_t =                             \
             (_nEW_TUPLE_5_type*)malloc(sizeof(_nEW_TUPLE_5_type));      \
-        _nEW_TUPLE_5_t->_1 = v1;                                        \
-        _nEW_TUPLE_5_t->_2 = v2;                                        \
-        _nEW_TUPLE_5_t->_3 = v3;                                        \
-        _nEW_TUPLE_5_t->_4 = v4;                                        \
-        _nEW_TUPLE_5_t->_5 = v5;                                        \
+        if (_nEW_TUPLE_5_t) {                                           \
+            _nEW_TUPLE_5_t->_1 = v1;                                    \
+            _nEW_TUPLE_5_t->_2 = v2;                                    \
+            _nEW_TUPLE_5_t->_3 = v3;                                    \
+            _nEW_TUPLE_5_t->_4 = v4;                                    \
+            _nEW_TUPLE_5_t->_5 = v5;                                    \
+        }                                                               \
         (void*)_nEW_TUPLE_5_t;                                          \
      })
 
@@ -111,16 +121,65 @@ typedef void *tuple_t;
                 ) _nEW_TUPLE_6_type;                                    \
         _nEW_TUPLE_6_type *_nEW_TUPLE_6_t =                             \
             (_nEW_TUPLE_6_type*)malloc(sizeof(_nEW_TUPLE_6_type));      \
-        _nEW_TUPLE_6_t->_1 = v1;                                        \
-        _nEW_TUPLE_6_t->_2 = v2;                                        \
-        _nEW_TUPLE_6_t->_3 = v3;                                        \
-        _nEW_TUPLE_6_t->_4 = v4;                                        \
-        _nEW_TUPLE_6_t->_5 = v5;                                        \
-        _nEW_TUPLE_6_t->_6 = v6;                                        \
+        if (_nEW_TUPLE_6_t) {                                           \
+            _nEW_TUPLE_6_t->_1 = v1;                                    \
+            _nEW_TUPLE_6_t->_2 = v2;                                    \
+            _nEW_TUPLE_6_t->_3 = v3;                                    \
+            _nEW_TUPLE_6_t->_4 = v4;                                    \
+            _nEW_TUPLE_6_t->_5 = v5;                                    \
+            _nEW_TUPLE_6_t->_6 = v6;                                    \
+        }                                                               \
         (void*)_nEW_TUPLE_6_t;                                          \
      })
 
 
+/*declare a tuple `t` on the stack, to be copied by value (e.g. as a
+ * thread_pool_push_payload payload) and unpacked by GET_TUPLE_N(&t, ...)*/
+#define LOCAL_TUPLE_1(t, v1)                                            \
+    TUPLE_1(                                                            \
+            __typeof__(v1)                                              \
+            ) t = {v1}
+
+#define LOCAL_TUPLE_2(t, v1, v2)                                        \
+    TUPLE_2(                                                            \
+            __typeof__(v1),                                             \
+            __typeof__(v2)                                              \
+            ) t = {v1, v2}
+
+#define LOCAL_TUPLE_3(t, v1, v2, v3)                                    \
+    TUPLE_3(                                                            \
+            __typeof__(v1),                                             \
+            __typeof__(v2),                                             \
+            __typeof__(v3)                                              \
+            ) t = {v1, v2, v3}
+
+#define LOCAL_TUPLE_4(t, v1, v2, v3, v4)                                \
+    TUPLE_4(                                                            \
+            __typeof__(v1),                                             \
+            __typeof__(v2),                                             \
+            __typeof__(v3),                                             \
+            __typeof__(v4)                                              \
+            ) t = {v1, v2, v3, v4}
+
+#define LOCAL_TUPLE_5(t, v1, v2, v3, v4, v5)                            \
+    TUPLE_5(                                                            \
+            __typeof__(v1),                                             \
+            __typeof__(v2),                                             \
+            __typeof__(v3),                                             \
+            __typeof__(v4),                                             \
+            __typeof__(v5)                                              \
+            ) t = {v1, v2, v3, v4, v5}
+
+#define LOCAL_TUPLE_6(t, v1, v2, v3, v4, v5, v6)                        \
+    TUPLE_6(                                                            \
+            __typeof__(v1),                                             \
+            __typeof__(v2),                                             \
+            __typeof__(v3),                                             \
+            __typeof__(v4),                                             \
+            __typeof__(v5),                                             \
+            __typeof__(v6)                                              \
+            ) t = {v1, v2, v3, v4, v5, v6}
+
 #define GET_TUPLE_1(t, v1)                                              \
     do {                                                                \
          typedef TUPLE_1(                                               \
@@ -33,6 +33,21 @@ minheap_t minheap_create(minheap_lt lt)
     return minheap_create_for_all(lt, MINHEAP_INIT_CAPA);
 }
 
+minheap_t minheap_create_indexed(minheap_lt lt, minheap_setidx setidx)
+{
+    minheap_t heap = minheap_create_for_all(lt, MINHEAP_INIT_CAPA);
+    if (heap)
+        heap->setidx = setidx;
+    return heap;
+}
+
+static inline void _minheap_set(minheap_t heap, size_t index, basic_value_t data)
+{
+    heap->heap_array[index] = data;
+    if (heap->setidx)
+        heap->setidx(data, index);
+}
+
 void minheap_destroy(minheap_t *heap)
 {
     if (!heap || !*heap)
@@ -56,26 +71,38 @@ static int _minheap_adjust_down(minheap_t heap, int hole)
         if (child < heap->len - 1 && heap->lt(heap->heap_array[child + 1], heap->heap_array[child]))
             child++;
         if (heap->lt(heap->heap_array[child], tmp))
-            heap->heap_array[hole] = heap->heap_array[child];
+            _minheap_set(heap, hole, heap->heap_array[child]);
         else break;
     }
-    heap->heap_array[hole] = tmp;
+    _minheap_set(heap, hole, tmp);
     return 0;
 }
 
+static void _minheap_adjust_up(minheap_t heap, size_t hole)
+{
+    basic_value_t tmp = heap->heap_array[hole];
+    size_t parent;
+    for (; hole > 0; hole = parent) {
+        parent = (hole - 1) / 2;
+        if (!heap->lt(tmp, heap->heap_array[parent]))
+            break;
+        _minheap_set(heap, hole, heap->heap_array[parent]);
+    }
+    _minheap_set(heap, hole, tmp);
+}
+
 static int _minheap_resize(minheap_t heap)
 {
     if (!heap)
         return -1;
 
-    heap->capacity *= 2;
-    basic_value_t *new_array = (basic_value_t*)calloc(heap->capacity, sizeof(basic_value_t));
+    /*only the old capacity is valid to copy from*/
+    basic_value_t *new_array = (basic_value_t*)realloc(heap->heap_array,
+            heap->capacity * 2 * sizeof(basic_value_t));
     assert(new_array != NULL);
 
-    bzero(new_array, sizeof(void*) * heap->capacity);
-    memcpy(new_array, heap->heap_array, sizeof(void*) * heap->capacity);
-    free(heap->heap_array);
     heap->heap_array = new_array;
+    heap->capacity *= 2;
     return 0;
 }
 
@@ -87,15 +114,9 @@ int minheap_add(minheap_t heap, basic_value_t data)
     if (heap->len >= heap->capacity)
         _minheap_resize(heap);
 
-    int hole = heap->len++;
-    int parent = 0;
-    for (;hole > 0; hole = parent) {
-        parent = (hole - 1) / 2;
-        if (heap->lt(heap->heap_array[parent], heap->heap_array[hole]))
-            break;
-        heap->heap_array[hole] = heap->heap_array[parent];
-    }
+    size_t hole = heap->len++;
     heap->heap_array[hole] = data;
+    _minheap_adjust_up(heap, hole);
     return 0;
 }
 
@@ -119,9 +140,38 @@ basic_value_t minheap_del(minheap_t heap, basic_value_t data)
     if (del_index == -1)
         return BASIC_NULL;
 
-    basic_value_t d = heap->heap_array[del_index];
-    heap->heap_array[del_index] = heap->heap_array[--heap->len];
-    return _minheap_adjust_down(heap, del_index) == 0 ? d : BASIC_NULL;
+    return minheap_remove(heap, del_index);
+}
+
+basic_value_t minheap_remove(minheap_t heap, size_t index)
+{
+    if (!heap || index >= heap->len)
+        return BASIC_NULL;
+
+    basic_value_t d = heap->heap_array[index];
+    if (heap->setidx)
+        heap->setidx(d, MINHEAP_NO_INDEX);
+    if (index != --heap->len) {
+        /*the last element may belong above or below the hole*/
+        heap->heap_array[index] = heap->heap_array[heap->len];
+        if (index > 0 && heap->lt(heap->heap_array[index], heap->heap_array[(index - 1) / 2]))
+            _minheap_adjust_up(heap, index);
+        else
+            _minheap_adjust_down(heap, index);
+    }
+    return d;
+}
+
+int minheap_update(minheap_t heap, size_t index)
+{
+    if (!heap || index >= heap->len)
+        return -1;
+
+    if (index > 0 && heap->lt(heap->heap_array[index], heap->heap_array[(index - 1) / 2]))
+        _minheap_adjust_up(heap, index);
+    else
+        _minheap_adjust_down(heap, index);
+    return 0;
 }
 
 basic_value_t minheap_top(minheap_t heap)
@@ -135,9 +185,7 @@ basic_value_t minheap_pop(minheap_t heap)
 {
     if (!heap || heap->len == 0)
         return BASIC_NULL;
-    basic_value_t top = heap->heap_array[0];
-    heap->heap_array[0] = heap->heap_array[--heap->len];
-    return _minheap_adjust_down(heap, 0) == 0 ? top : BASIC_NULL;
+    return minheap_remove(heap, 0);
 }
 
 size_t minheap_len(minheap_t heap)
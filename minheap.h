@@ -11,12 +11,16 @@
 #include "basic.h"
 
 #define MINHEAP_INIT_CAPA       30
+#define MINHEAP_NO_INDEX        ((size_t)-1)
 
 /*if arg1 < arg2, return 1(true) or return 0(false)*/
 //typedef int (*minheap_lt)(void *, void*);
 typedef bool (*minheap_lt)(basic_value_t, basic_value_t);
 /*if arg1 == arg2, return 1(true) or return 0(false)*/
 //typedef int (*minheap_eq)(void *, void*);
+/*tell an element its position in the heap array, MINHEAP_NO_INDEX once it
+ *leaves the heap. the stored position is the handle for remove/update*/
+typedef void (*minheap_setidx)(basic_value_t, size_t);
 
 struct minheap {
     //void **heap_array;
@@ -26,16 +30,22 @@ struct minheap {
 
     minheap_lt lt;
     //minheap_eq eq;
+    minheap_setidx setidx;  //NULL if not indexed
 };
 
 typedef struct minheap *minheap_t;
 
 minheap_t minheap_create_for_all(minheap_lt lt, size_t init_capacity);
 minheap_t minheap_create(minheap_lt lt);
+minheap_t minheap_create_indexed(minheap_lt lt, minheap_setidx setidx);
 void minheap_destroy(minheap_t *heap);
 
 int minheap_add(minheap_t heap, basic_value_t data);
 basic_value_t minheap_del(minheap_t heap, basic_value_t data);
+/*O(log n) by the index kept through setidx*/
+basic_value_t minheap_remove(minheap_t heap, size_t index);
+/*restore the order after the key of the element at index changed*/
+int minheap_update(minheap_t heap, size_t index);
 basic_value_t minheap_top(minheap_t heap);
 basic_value_t minheap_pop(minheap_t heap);
 size_t minheap_len(minheap_t heap);
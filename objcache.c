@@ -0,0 +1,165 @@
+/**
+ * @author: luyuhuang
+ * @brief: fixed size object cache with per-thread free lists
+ */
+
+#include "objcache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*sits right before every object*/
+struct _oc_header {
+    struct objcache_local *owner;
+} __attribute__((aligned(OBJCACHE_ALIGN)));
+
+#define OC_HEADER(obj) ((struct _oc_header*)(obj) - 1)
+#define OC_NEXT(obj) (*(void**)(obj))
+
+static void _objcache_local_exit(void *arg)
+{
+    struct objcache_local *local = (struct objcache_local*)arg;
+    struct objcache *cache = local->cache;
+
+    /*the objects stay with the local, the next new thread adopts it*/
+    LOCK(&cache->lock);
+    local->orphan = 1;
+    UNLOCK(&cache->lock);
+}
+
+struct objcache *objcache_create(size_t obj_size)
+{
+    struct objcache *cache = (struct objcache*)calloc(1, sizeof(struct objcache));
+    if (!cache)
+        return NULL;
+
+    if (obj_size < sizeof(void*))
+        obj_size = sizeof(void*);
+    obj_size = (obj_size + OBJCACHE_ALIGN - 1) & ~(size_t)(OBJCACHE_ALIGN - 1);
+    cache->obj_size = obj_size + sizeof(struct _oc_header);
+    cache->slab_objs = OBJCACHE_SLAB_SIZE / cache->obj_size;
+    if (cache->slab_objs < OBJCACHE_SLAB_MIN_OBJS)
+        cache->slab_objs = OBJCACHE_SLAB_MIN_OBJS;
+
+    if (pthread_key_create(&cache->key, _objcache_local_exit) != 0) {
+        free(cache);
+        return NULL;
+    }
+    LOCK_INIT(&cache->lock);
+    cache->locals = NULL;
+    return cache;
+}
+
+void objcache_destroy(struct objcache **cache)
+{
+    if (!cache || !*cache)
+        return;
+
+    struct objcache *c = *cache;
+    pthread_key_delete(c->key);
+
+    struct objcache_local *local = c->locals;
+    while (local) {
+        struct objcache_local *next = local->next;
+        void *slab = local->slabs;
+        while (slab) {
+            void *next_slab = OC_NEXT(slab);
+            free(slab);
+            slab = next_slab;
+        }
+        free(local);
+        local = next;
+    }
+
+    LOCK_DESTROY(&c->lock);
+    free(c);
+    *cache = NULL;
+}
+
+static struct objcache_local *_objcache_local(struct objcache *cache)
+{
+    struct objcache_local *local = (struct objcache_local*)pthread_getspecific(cache->key);
+    if (local)
+        return local;
+
+    LOCK(&cache->lock);
+    for (local = cache->locals; local; local = local->next) {
+        if (local->orphan) {
+            local->orphan = 0;
+            break;
+        }
+    }
+    if (!local) {
+        if (posix_memalign((void**)&local, 64, sizeof(struct objcache_local)) != 0) {
+            UNLOCK(&cache->lock);
+            return NULL;
+        }
+        memset(local, 0, sizeof(struct objcache_local));
+        local->cache = cache;
+        local->next = cache->locals;
+        cache->locals = local;
+    }
+    UNLOCK(&cache->lock);
+
+    pthread_setspecific(cache->key, local);
+    return local;
+}
+
+static int _objcache_grow(struct objcache *cache, struct objcache_local *local)
+{
+    /*the slab link takes the first OBJCACHE_ALIGN bytes*/
+    uint8_t *slab = (uint8_t*)malloc(OBJCACHE_ALIGN + cache->slab_objs * cache->obj_size);
+    if (!slab)
+        return -1;
+    OC_NEXT(slab) = local->slabs;
+    local->slabs = slab;
+
+    uint8_t *p = slab + OBJCACHE_ALIGN;
+    for (size_t i = 0; i < cache->slab_objs; ++i, p += cache->obj_size) {
+        struct _oc_header *header = (struct _oc_header*)p;
+        void *obj = header + 1;
+        header->owner = local;
+        OC_NEXT(obj) = local->free_list;
+        local->free_list = obj;
+    }
+    return 0;
+}
+
+void *objcache_alloc(struct objcache *cache)
+{
+    struct objcache_local *local = _objcache_local(cache);
+    if (!local)
+        return NULL;
+
+    if (!local->free_list) {
+        /*take back everything other threads have freed, in one go*/
+        if (__atomic_load_n(&local->remote_free, __ATOMIC_RELAXED))
+            local->free_list = __atomic_exchange_n(&local->remote_free, NULL, __ATOMIC_ACQUIRE);
+        if (!local->free_list && _objcache_grow(cache, local) != 0)
+            return NULL;
+    }
+
+    void *obj = local->free_list;
+    local->free_list = OC_NEXT(obj);
+    return obj;
+}
+
+void objcache_free(void *obj)
+{
+    if (!obj)
+        return;
+
+    struct objcache_local *owner = OC_HEADER(obj)->owner;
+    if (pthread_getspecific(owner->cache->key) == owner) {
+        OC_NEXT(obj) = owner->free_list;
+        owner->free_list = obj;
+        return;
+    }
+
+    /*only the owner pops, and it takes the whole list, so there is no ABA*/
+    void *head = __atomic_load_n(&owner->remote_free, __ATOMIC_RELAXED);
+    do {
+        OC_NEXT(obj) = head;
+    } while (!__atomic_compare_exchange_n(&owner->remote_free, &head, obj,
+                1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,49 @@
+/**
+ * @author: luyuhuang
+ * @brief: fixed size object cache with per-thread free lists
+ */
+
+#ifndef _OBJCACHE_H_
+#define _OBJCACHE_H_
+
+#include <stddef.h>
+#include <pthread.h>
+#include "comm.h"
+
+#define OBJCACHE_SLAB_SIZE 65536    //objects are carved from slabs of about this size
+#define OBJCACHE_SLAB_MIN_OBJS 8
+#define OBJCACHE_ALIGN 16
+
+/*
+ * Every thread allocates from a local free list of its own. An object
+ * remembers the local it was carved for. Freed by that thread, it goes
+ * back to the local list; freed by any other thread, it is pushed onto
+ * the owner's lock-free remote list, which the owner takes back in one
+ * exchange when its local list runs dry.
+ */
+struct objcache_local {
+    void *free_list;                //touched by the owner only
+    void *slabs;
+    struct objcache *cache;
+    struct objcache_local *next;
+    int orphan;                     //the owner thread has exited
+    /*on its own cache line, remote frees do not disturb the owner*/
+    void *remote_free __attribute__((aligned(64)));
+};
+
+struct objcache {
+    size_t obj_size;                //with the header, a multiple of OBJCACHE_ALIGN
+    size_t slab_objs;
+    pthread_key_t key;
+    lock_t lock;                    //guards locals
+    struct objcache_local *locals;
+};
+
+struct objcache *objcache_create(size_t obj_size);
+/*frees the objects still out too, no thread may use the cache any more*/
+void objcache_destroy(struct objcache **cache);
+void *objcache_alloc(struct objcache *cache);
+/*may be called from any thread*/
+void objcache_free(void *obj);
+
+#endif //_OBJCACHE_H_
@@ -6,12 +6,147 @@
 #include "reactor.h"
 #include "reactor_epoll.h"
 #include "comm.h"
+#include "macro_tuple.h"
+#include "thread_pool.h"
+#include "objcache.h"
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
 #include <assert.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+
+/*revents, posts and read buffers are freed by workers and users, maybe
+ * after their reactor is gone, so the caches live as long as the process.
+ * file and timer nodes stay in the loop, they are cached for a connection
+ * setup that allocates nothing once warm*/
+static pthread_once_t _g_cache_once = PTHREAD_ONCE_INIT;
+static struct objcache *_g_event_cache = NULL;
+static struct objcache *_g_post_cache = NULL;
+static struct objcache *_g_file_cache = NULL;
+static struct objcache *_g_timer_cache = NULL;
+static lock_t _g_buffer_cache_lock = LOCK_INITIALIZER;
+static struct _buffer_cache {
+    size_t size;
+    struct objcache *cache;
+    struct _buffer_cache *next;
+} *_g_buffer_caches = NULL;
+
+static void _reactor_cache_init()
+{
+    _g_event_cache = objcache_create(sizeof(struct revent));
+    _g_post_cache = objcache_create(sizeof(struct rpost));
+    _g_file_cache = objcache_create(sizeof(struct _m_file));
+    _g_timer_cache = objcache_create(sizeof(struct _h_timer));
+}
+
+/*one cache per buffer size, shared by the reactors and never destroyed,
+ * read buffers may be freed after their reactor is gone. NULL if out of memory*/
+static struct objcache *_reactor_buffer_cache(size_t size)
+{
+    struct _buffer_cache *c;
+    LOCK(&_g_buffer_cache_lock);
+    for (c = _g_buffer_caches; c; c = c->next) {
+        if (c->size == size)
+            break;
+    }
+    if (!c && (c = (struct _buffer_cache*)malloc(sizeof(struct _buffer_cache))) != NULL) {
+        c->size = size;
+        c->cache = objcache_create(size);
+        if (c->cache) {
+            c->next = _g_buffer_caches;
+            _g_buffer_caches = c;
+        } else {
+            free(c);
+            c = NULL;
+        }
+    }
+    UNLOCK(&_g_buffer_cache_lock);
+    return c ? c->cache : NULL;
+}
+
+void reactor_free_buffer(void *buffer)
+{
+    objcache_free(buffer);
+}
+
+/*the time heap holds _h_timer pointers, positions kept in heap_index*/
+#ifdef REACTOR_USE_DHEAP
+
+static inline time_heap_t _time_heap_create()
+{
+    return dheap_create(_h_timer_set_index);
+}
+
+static inline int _time_heap_add(time_heap_t heap, struct _h_timer *timer)
+{
+    return dheap_push(heap, timer->absolute_mtime, P2BASIC(timer));
+}
+
+static inline struct _h_timer *_time_heap_top(time_heap_t heap)
+{
+    return BASIC2P(dheap_top(heap, NULL), struct _h_timer*);
+}
+
+static inline struct _h_timer *_time_heap_pop(time_heap_t heap)
+{
+    return BASIC2P(dheap_pop(heap, NULL), struct _h_timer*);
+}
+
+static inline void _time_heap_remove(time_heap_t heap, struct _h_timer *timer)
+{
+    dheap_remove(heap, timer->heap_index);
+}
+
+static inline size_t _time_heap_len(time_heap_t heap)
+{
+    return dheap_len(heap);
+}
+
+static inline void _time_heap_destroy(time_heap_t *heap)
+{
+    dheap_destroy(heap);
+}
+
+#else //REACTOR_USE_DHEAP
+
+static inline time_heap_t _time_heap_create()
+{
+    return minheap_create_indexed(_h_timer_little, _h_timer_set_index);
+}
+
+static inline int _time_heap_add(time_heap_t heap, struct _h_timer *timer)
+{
+    return minheap_add(heap, P2BASIC(timer));
+}
+
+static inline struct _h_timer *_time_heap_top(time_heap_t heap)
+{
+    return BASIC2P(minheap_top(heap), struct _h_timer*);
+}
+
+static inline struct _h_timer *_time_heap_pop(time_heap_t heap)
+{
+    return BASIC2P(minheap_pop(heap), struct _h_timer*);
+}
+
+static inline void _time_heap_remove(time_heap_t heap, struct _h_timer *timer)
+{
+    minheap_remove(heap, timer->heap_index);
+}
+
+static inline size_t _time_heap_len(time_heap_t heap)
+{
+    return minheap_len(heap);
+}
+
+static inline void _time_heap_destroy(time_heap_t *heap)
+{
+    minheap_destroy(heap);
+}
+
+#endif //REACTOR_USE_DHEAP
 
 static uint64_t _reactor_get_nextid(reactor_t r) {
     return r->next_eventid++;
@@ -29,121 +164,337 @@ static void _sighandler(int sig) {
     errno = save_errno;
 }
 
-int reactor_asyn_read(reactor_t r, struct rfile *file, int32_t mtime, read_cb callback, void *data)
+/*
+ * The event tables are owned by the loop thread: the one running the loop,
+ * or while it does not run, the one that last ran it or created the
+ * reactor. Registrations coming from other threads (e.g. the callbacks
+ * running in the thread pool) are posted to the loop instead of touching
+ * the tables directly.
+ */
+static bool _reactor_in_loop(reactor_t r)
 {
-    if (hashmap_is_in(r->file_events, L2BASIC(file->fd)))
-        return -1;
+    return pthread_equal(pthread_self(), __atomic_load_n(&r->loop_thread, __ATOMIC_ACQUIRE));
+}
+
+static void _reactor_wakeup(reactor_t r)
+{
+    uint64_t one = 1;
+    int ret = write(r->postfd, &one, sizeof(one));
+    (void)ret;
+}
 
-    struct revent *event = (struct revent*)calloc(1, sizeof(struct revent));
-    event->eventid = _reactor_get_nextid(r);
+int reactor_post(reactor_t r, post_cb func, void *arg)
+{
+    struct rpost *post = (struct rpost*)objcache_alloc(_g_post_cache);
+    if (!post)
+        return REACTER_ERR;
+    post->func = func;
+    post->arg = arg;
+
+    MPSC_QUEUE_PUSH(&r->posts, post);
+    /*only the first post of a batch pays the eventfd write*/
+    if (__atomic_exchange_n(&r->post_pending, 1, __ATOMIC_SEQ_CST) == 0)
+        _reactor_wakeup(r);
+    return REACTER_OK;
+}
+
+void reactor_set_budgets(reactor_t r, int read_calls, size_t write_budget)
+{
+    r->read_calls = read_calls;
+    r->write_budget = write_budget;
+}
+
+static void _reactor_run_posts(reactor_t r)
+{
+    uint64_t count;
+    int ret = read(r->postfd, &count, sizeof(count));
+    (void)ret;
+
+    /*posts pushed after this point will write the eventfd again*/
+    __atomic_store_n(&r->post_pending, 0, __ATOMIC_SEQ_CST);
+
+    /*a NULL pop may also mean a producer is mid-push, it will wake us again*/
+    struct rpost *post;
+    while ((post = MPSC_QUEUE_POP(&r->posts)) != NULL) {
+        post->func(post->arg);
+        objcache_free(post);
+        rstats_add(RSTAT_POSTS, 1);
+    }
+}
+
+static struct revent *
+_revent_create(reactor_t r, enum revent_type type, void *callback, void *data)
+{
+    struct revent *event = (struct revent*)objcache_alloc(_g_event_cache);
+    if (!event)
+        return NULL;
+    memset(event, 0, sizeof(struct revent));
     event->r = r;
-    event->fd = file->fd;
-    event->type = REVENT_READ;
-    event->mtime = mtime;
-    event->callback = (void*)callback;
+    event->type = type;
+    event->callback = callback;
     event->data = data;
     event->delete_while_done = false;
     event->__next__ = NULL;
+    return event;
+}
 
-    hashmap_add(r->reactor_events, U2BASIC(event->eventid), P2BASIC(event));
+/*the hot marks are only touched by the loop thread*/
+static void _reactor_set_hot(reactor_t r, int fd)
+{
+    if (fd >= r->hot_len) {
+        int len = r->hot_len ? r->hot_len : 64;
+        while (len <= fd)
+            len *= 2;
+        uint8_t *hot = (uint8_t*)realloc(r->hot, len);
+        if (!hot)
+            return;
+        memset(hot + r->hot_len, 0, len - r->hot_len);
+        r->hot = hot;
+        r->hot_len = len;
+    }
+    r->hot[fd] = 1;
+}
 
-    struct _m_file *new_file = (struct _m_file*)calloc(1, sizeof(struct _m_file));
-    new_file->eventid = event->eventid;
-    new_file->fd = file->fd;
+static bool _reactor_take_hot(reactor_t r, int fd)
+{
+    if (fd >= r->hot_len || !r->hot[fd])
+        return false;
+    r->hot[fd] = 0;
+    return true;
+}
 
-    hashmap_add(r->file_events, L2BASIC(new_file->fd), P2BASIC(new_file));
+static bool _reactor_push_ready(reactor_t r, uint64_t eventid)
+{
+    if (r->ready_len == r->ready_capa) {
+        size_t capa = r->ready_capa ? r->ready_capa * 2 : 64;
+        uint64_t *ready = (uint64_t*)realloc(r->ready, capa * sizeof(uint64_t));
+        if (!ready)
+            return false;
+        r->ready = ready;
+        r->ready_capa = capa;
+    }
+    r->ready[r->ready_len++] = eventid;
+    return true;
+}
 
-    if (mtime >= 0) {
-        struct _h_timer *new_timer = (struct _h_timer*)calloc(1, sizeof(struct _h_timer));
-        new_timer->eventid = event->eventid;
-        new_timer->absolute_mtime = get_absolute_time(mtime);
-        minheap_add(r->time_heap, P2BASIC(new_timer));
+/*unlink the event armed on fd from the maps and the time heap, the
+ * caller removes it from epoll and frees it*/
+static struct revent *_reactor_unlink_file(reactor_t r, int fd)
+{
+    if (fd < r->hot_len)
+        r->hot[fd] = 0;
+    struct _m_file *file = file_map_erase(&r->file_events, fd);
+    if (!file)
+        return NULL;
+
+    struct revent *event = BASIC2P(hashmap_del(r->reactor_events, U2BASIC(file->eventid)), struct revent*);
+    if (event->timer) {
+        _time_heap_remove(r->time_heap, event->timer);
+        objcache_free(event->timer);
+        event->timer = NULL;
     }
+    objcache_free(file);
+    return event;
+}
 
-    int ret = repoll_add_read_file(r->epfd, file->fd, true);
-    if (ret == 0)
+/*put the event's deadline on the time heap, event->timer stays NULL on failure*/
+static int _reactor_arm_timer(reactor_t r, struct revent *event)
+{
+    struct _h_timer *new_timer = (struct _h_timer*)objcache_alloc(_g_timer_cache);
+    if (!new_timer)
+        return -1;
+    new_timer->eventid = event->eventid;
+    new_timer->absolute_mtime = get_absolute_time(event->mtime);
+    if (_time_heap_add(r->time_heap, new_timer) != 0) {
+        objcache_free(new_timer);
+        return -1;
+    }
+    event->timer = new_timer;
+    return 0;
+}
+
+/*the adds leave nothing behind on failure, the caller still owns the event*/
+static int _reactor_add_file_event(reactor_t r, struct revent *event)
+{
+    if (file_map_find(&r->file_events, event->fd))
+        return REACTER_BUSY;
+
+    struct _m_file *new_file = (struct _m_file*)objcache_alloc(_g_file_cache);
+    if (new_file) {
+        new_file->__key__ = event->fd;
+        if (file_map_insert(&r->file_events, new_file) == new_file) {
+            objcache_free(new_file);
+            new_file = NULL;
+        }
+    }
+    if (!new_file)
+        return REACTER_ERR;
+    event->eventid = new_file->eventid = _reactor_get_nextid(r);
+    hashmap_add(r->reactor_events, U2BASIC(event->eventid), P2BASIC(event));
+
+    if (event->mtime >= 0 && _reactor_arm_timer(r, event) != 0) {
+        _reactor_unlink_file(r, event->fd);
+        return REACTER_ERR;
+    }
+
+    /*its last read left data behind, no need to ask epoll*/
+    if (event->type == REVENT_READ && _reactor_take_hot(r, event->fd) &&
+            _reactor_push_ready(r, event->eventid))
         return REACTER_OK;
+
+    int ret;
+    if (event->type == REVENT_READ || event->type == REVENT_ACCEPT)
+        ret = repoll_add_read_file(r->epfd, event->fd, true);
     else
-        return REACTER_ERR;
-}
+        ret = repoll_add_write_file(r->epfd, event->fd, true);
 
+    if (ret == 0)
+        return REACTER_OK;
+    _reactor_unlink_file(r, event->fd);
+    return REACTER_ERR;
+}
 
-int reactor_asyn_write(reactor_t r, struct rfile *file, void *buffer, size_t len, int32_t mtime, write_cb callback, void *data)
+static int _reactor_add_timer_event(reactor_t r, struct revent *event)
 {
-    if (hashmap_is_in(r->file_events, L2BASIC(file->fd)))
-        return -1;
-
-    struct revent *event = (struct revent*)calloc(1, sizeof(struct revent));
-    event->eventid = _reactor_get_nextid(r);
-    event->r = r;
-    event->fd = file->fd;
-    event->type = REVENT_WRITE;
-    event->mtime = mtime;
-    event->buffer = buffer;
-    event->buffer_len = len;
-    event->callback = (void*)callback;
-    event->data = data;
-    event->delete_while_done = false;
-    event->__next__ = NULL;
+    if (timer_map_find(&r->timer_events, event->timer_id))
+        return REACTER_BUSY;
 
+    struct _m_timer *mtimer = (struct _m_timer*)calloc(1, sizeof(struct _m_timer));
+    if (mtimer) {
+        mtimer->__key__ = event->timer_id;
+        if (timer_map_insert(&r->timer_events, mtimer) == mtimer) {
+            free(mtimer);
+            mtimer = NULL;
+        }
+    }
+    if (!mtimer)
+        return REACTER_ERR;
+    event->eventid = mtimer->eventid = _reactor_get_nextid(r);
     hashmap_add(r->reactor_events, U2BASIC(event->eventid), P2BASIC(event));
 
-    struct _m_file *new_file = (struct _m_file*)calloc(1, sizeof(struct _m_file));
-    new_file->eventid = event->eventid;
-    new_file->fd = file->fd;
+    if (_reactor_arm_timer(r, event) == 0)
+        return REACTER_OK;
+    hashmap_del(r->reactor_events, U2BASIC(event->eventid));
+    free(timer_map_erase(&r->timer_events, event->timer_id));
+    return REACTER_ERR;
+}
 
-    hashmap_add(r->file_events, L2BASIC(new_file->fd), P2BASIC(new_file));
+static int _reactor_add_signal_event(reactor_t r, struct revent *event)
+{
+    if (signal_map_find(&r->signal_events, event->sig))
+        return REACTER_BUSY;
 
-    if (mtime >= 0) {
-        struct _h_timer *new_timer = (struct _h_timer*)calloc(1, sizeof(struct _h_timer));
-        new_timer->eventid = event->eventid;
-        new_timer->absolute_mtime = get_absolute_time(mtime);
-        minheap_add(r->time_heap, P2BASIC(new_timer));
+    struct _m_signal *new_signal = (struct _m_signal*)calloc(1, sizeof(struct _m_signal));
+    if (new_signal) {
+        new_signal->__key__ = event->sig;
+        if (signal_map_insert(&r->signal_events, new_signal) == new_signal) {
+            free(new_signal);
+            new_signal = NULL;
+        }
     }
-    
-    int ret = repoll_add_write_file(r->epfd, file->fd, true);
-    if (ret == 0)
-        return REACTER_OK;
-    else
+    if (!new_signal)
         return REACTER_ERR;
+    event->eventid = new_signal->eventid = _reactor_get_nextid(r);
+    hashmap_add(r->reactor_events, U2BASIC(event->eventid), P2BASIC(event));
+
+    struct sigaction sa;
+    bzero(&sa, sizeof(sa));
+    sa.sa_handler = _sighandler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(event->sig, &sa, NULL) == 0)
+        return REACTER_OK;
+    signal_map_erase(&r->signal_events, event->sig);
+    hashmap_del(r->reactor_events, U2BASIC(event->eventid));
+    free(new_signal);
+    return REACTER_ERR;
 }
 
-int reactor_asyn_accept(reactor_t r, struct rfile *file, int32_t mtime, accept_cb callback, void *data)
+static int _reactor_add_event(reactor_t r, struct revent *event)
 {
-    if (hashmap_is_in(r->file_events, L2BASIC(file->fd)))
-        return -1;
+    switch (event->type) {
+        case REVENT_TIMER:
+            return _reactor_add_timer_event(r, event);
+        case REVENT_SIGNAL:
+            return _reactor_add_signal_event(r, event);
+        default:
+            return _reactor_add_file_event(r, event);
+    }
+}
 
-    struct revent *event = (struct revent*)calloc(1, sizeof(struct revent));
-    event->eventid = _reactor_get_nextid(r);
-    event->r = r;
+/*the caller has long been told REACTER_OK, so a failure here goes to
+ * the callback, which then owns its data again*/
+/*call back an event the loop could not arm, it is freed once done*/
+static void _reactor_fail_event(struct revent *event, int error)
+{
+    rstats_add(RSTAT_FAILED_REGISTRATIONS, 1);
+    event->reason = REVENT_FAILED;
+    event->error = error;
+    event->delete_while_done = true;
+    revent_on_failed(event);
+}
+
+static void _reactor_add_event_in_loop(void *arg)
+{
+    struct revent *event = (struct revent*)arg;
+    int ret = _reactor_add_event(event->r, event);
+    if (ret != REACTER_OK)
+        _reactor_fail_event(event, ret);
+}
+
+/*out of the loop thread the event is registered asynchronously, so only
+ * the failure of posting is returned; one failing later in the loop
+ * calls back with REACTER_ERR or REACTER_BUSY*/
+static int _reactor_register(reactor_t r, struct revent *event)
+{
+    int ret;
+    if (_reactor_in_loop(r)) {
+        if ((ret = _reactor_add_event(r, event)) != REACTER_OK)
+            objcache_free(event);
+        return ret;
+    }
+    if (reactor_post(r, _reactor_add_event_in_loop, event) != REACTER_OK) {
+        objcache_free(event);
+        return REACTER_ERR;
+    }
+    return REACTER_OK;
+}
+
+int reactor_asyn_read(reactor_t r, struct rfile *file, int32_t mtime, read_cb callback, void *data)
+{
+    struct revent *event = _revent_create(r, REVENT_READ, (void*)callback, data);
+    if (!event)
+        return REACTER_ERR;
     event->fd = file->fd;
-    event->type = REVENT_ACCEPT;
     event->mtime = mtime;
-    event->callback = (void*)callback;
-    event->data = data;
-    event->delete_while_done = false;
-    event->__next__ = NULL;
 
-    hashmap_add(r->reactor_events, U2BASIC(event->eventid), P2BASIC(event));
+    return _reactor_register(r, event);
+}
 
-    struct _m_file *new_file = (struct _m_file*)calloc(1, sizeof(struct _m_file));
-    new_file->eventid = event->eventid;
-    new_file->fd = file->fd;
 
-    hashmap_add(r->file_events, L2BASIC(new_file->fd), P2BASIC(new_file));
+int reactor_asyn_write(reactor_t r, struct rfile *file, void *buffer, size_t len, int32_t mtime, write_cb callback, void *data)
+{
+    struct revent *event = _revent_create(r, REVENT_WRITE, (void*)callback, data);
+    if (!event)
+        return REACTER_ERR;
+    event->fd = file->fd;
+    event->mtime = mtime;
+    event->buffer = buffer;
+    event->buffer_len = len;
 
-    if (mtime >= 0) {
-        struct _h_timer *new_timer = (struct _h_timer*)calloc(1, sizeof(struct _h_timer));
-        new_timer->eventid = event->eventid;
-        new_timer->absolute_mtime = get_absolute_time(mtime);
-        minheap_add(r->time_heap, P2BASIC(new_timer));
-    }
-    
-    int ret = repoll_add_read_file(r->epfd, file->fd, true);
-    if (ret == 0)
-        return REACTER_OK;
-    else
+    return _reactor_register(r, event);
+}
+
+int reactor_asyn_accept(reactor_t r, struct rfile *file, int32_t mtime, accept_cb callback, void *data)
+{
+    struct revent *event = _revent_create(r, REVENT_ACCEPT, (void*)callback, data);
+    if (!event)
         return REACTER_ERR;
+    event->fd = file->fd;
+    event->mtime = mtime;
+
+    return _reactor_register(r, event);
 }
 
 int reactor_asyn_connect(
@@ -155,134 +506,125 @@ int reactor_asyn_connect(
         callback(file, file->fd, data);
         return REACTER_OK;
     } else if (ret < 0 && errno == EINPROGRESS) {
-        struct revent *event = (struct revent*)calloc(1, sizeof(struct revent));
-        event->eventid = _reactor_get_nextid(r);
-        event->r = r;
+        struct revent *event = _revent_create(r, REVENT_CONNECT, (void*)callback, data);
+        if (!event)
+            return REACTER_ERR;
         event->fd = file->fd;
-        event->type = REVENT_CONNECT;
         event->mtime = mtime;
-        event->callback = (void*)callback;
-        event->data = data;
-        event->delete_while_done = false;
-        event->__next__ = NULL;
-
-        hashmap_add(r->reactor_events, U2BASIC(event->eventid), P2BASIC(event));
-
-        struct _m_file *new_file = (struct _m_file*)calloc(1, sizeof(struct _m_file));
-        new_file->eventid = event->eventid;
-        new_file->fd = file->fd;
-
-        hashmap_add(r->file_events, L2BASIC(new_file->fd), P2BASIC(new_file));
-
-        if (mtime >= 0) {
-            struct _h_timer *new_timer = (struct _h_timer*)calloc(1, sizeof(struct _h_timer));
-            new_timer->eventid = event->eventid;
-            new_timer->absolute_mtime = get_absolute_time(mtime);
-            minheap_add(r->time_heap, P2BASIC(new_timer));
-        }
 
-        ret = repoll_add_write_file(r->epfd, file->fd, true);
-        if (ret == 0)
-            return REACTER_OK;
-        else
-            return REACTER_ERR;
+        return _reactor_register(r, event);
     } else {
         return REACTER_ERR;
     }
 }
 
-int reactor_add_timer(reactor_t r, struct rtimer *timer, timer_cb callback, void *data)
+/*a tuple made for a post is freed by the loop, or here if it is not posted*/
+static int _reactor_post_tuple(reactor_t r, post_cb func, void *tuple)
+{
+    if (!tuple)
+        return REACTER_ERR;
+    if (reactor_post(r, func, tuple) != REACTER_OK) {
+        DELETE_TUPLE(tuple);
+        return REACTER_ERR;
+    }
+    return REACTER_OK;
+}
+
+static void _reactor_del_file_in_loop(void *arg)
 {
-    if (hashmap_is_in(r->timer_events, L2BASIC(timer->timer_id)))
+    reactor_t r;
+    int fd;
+
+    GET_TUPLE_2(arg, r, fd);
+    DELETE_TUPLE(arg);
+    reactor_del_file(r, fd);
+}
+
+/*drop the event armed on fd without calling it back*/
+int reactor_del_file(reactor_t r, int fd)
+{
+    if (!_reactor_in_loop(r))
+        return _reactor_post_tuple(r, _reactor_del_file_in_loop, NEW_TUPLE_2(r, fd));
+
+    struct revent *event = _reactor_unlink_file(r, fd);
+    if (!event)
         return -1;
+    repoll_remove_file(r->epfd, fd);
+    objcache_free(event);
+    return REACTER_OK;
+}
 
-    struct revent *event = (struct revent*)calloc(1, sizeof(struct revent));
-    event->eventid = _reactor_get_nextid(r);
-    event->r = r;
-    event->type = REVENT_TIMER;
+int reactor_add_timer(reactor_t r, struct rtimer *timer, timer_cb callback, void *data)
+{
+    struct revent *event = _revent_create(r, REVENT_TIMER, (void*)callback, data);
+    if (!event)
+        return REACTER_ERR;
     event->timer_id = timer->timer_id;
     event->mtime = timer->mtime;
     event->repeat = timer->repeat;
-    event->callback = (void*)callback;
-    event->data = data;
-    event->delete_while_done = false;
-    event->__next__ = NULL;
 
-    hashmap_add(r->reactor_events, U2BASIC(event->eventid), P2BASIC(event));
-
-    struct _m_timer *mtimer = (struct _m_timer*)calloc(1, sizeof(struct _m_timer));
-    mtimer->eventid = event->eventid;
-    mtimer->timer_id = timer->timer_id;
-
-    hashmap_add(r->timer_events, L2BASIC(mtimer->timer_id), P2BASIC(mtimer));
+    return _reactor_register(r, event);
+}
 
-    struct _h_timer *new_timer = (struct _h_timer*)calloc(1, sizeof(struct _h_timer));
-    new_timer->eventid = event->eventid;
-    new_timer->absolute_mtime = get_absolute_time(timer->mtime);
+static void _reactor_del_timer_in_loop(void *arg)
+{
+    reactor_t r;
+    int timer_id;
 
-    return minheap_add(r->time_heap, P2BASIC(new_timer));
+    GET_TUPLE_2(arg, r, timer_id);
+    DELETE_TUPLE(arg);
+    reactor_del_timer(r, timer_id);
 }
 
 int reactor_del_timer(reactor_t r, int timer_id)
 {
-    if (!hashmap_is_in(r->timer_events, L2BASIC(timer_id)))
+    if (!_reactor_in_loop(r))
+        return _reactor_post_tuple(r, _reactor_del_timer_in_loop, NEW_TUPLE_2(r, timer_id));
+
+    struct _m_timer *timer = timer_map_erase(&r->timer_events, timer_id);
+    if (!timer)
         return -1;
 
-    struct _m_timer *timer = BASIC2P(hashmap_del(r->timer_events, L2BASIC(timer_id)), struct _m_timer*);
     struct revent *event = BASIC2P(hashmap_del(r->reactor_events, P2BASIC(timer->eventid)), struct revent*);
-    struct _h_timer htimer;
-    htimer.eventid = event->eventid;
-    struct _h_timer *ptimer = BASIC2P(minheap_del(r->time_heap, P2BASIC(&htimer)), struct _h_timer*);
-    free(ptimer);
-    free(event);
+    _time_heap_remove(r->time_heap, event->timer);
+    objcache_free(event->timer);
+    objcache_free(event);
     free(timer);
     return REACTER_OK;
 }
 
 int reactor_add_signal(reactor_t r, struct rsignal *signal, signal_cb callback, void *data)
 {
-    if (hashmap_is_in(r->signal_events, L2BASIC(signal->sig)))
-        return -1;
-
-    struct revent *event = (struct revent*)calloc(1, sizeof(struct revent));
-
-    event->eventid = _reactor_get_nextid(r);
-    event->r = r;
+    struct revent *event = _revent_create(r, REVENT_SIGNAL, (void*)callback, data);
+    if (!event)
+        return REACTER_ERR;
     event->sig = signal->sig;
-    event->type = REVENT_SIGNAL;
-    event->callback = (void*)callback;
-    event->data = data;
-
-    hashmap_add(r->reactor_events, U2BASIC(event->eventid), P2BASIC(event));
-    
-    struct _m_signal *new_signal = (struct _m_signal*)calloc(1, sizeof(struct _m_signal));
-    new_signal->eventid = event->eventid;
-    new_signal->sig = signal->sig;
 
-    hashmap_add(r->signal_events, L2BASIC(new_signal->sig), P2BASIC(new_signal));
+    return _reactor_register(r, event);
+}
 
-    struct sigaction sa;
-    bzero(&sa, sizeof(sa));
-    sa.sa_handler = _sighandler;
-    sa.sa_flags = SA_RESTART;
-    sigemptyset(&sa.sa_mask);
+static void _reactor_del_signal_in_loop(void *arg)
+{
+    reactor_t r;
+    int sig;
 
-    int ret = sigaction(signal->sig, &sa, NULL);
-    if (ret == 0)
-        return REACTER_OK;
-    else
-        return REACTER_ERR;
+    GET_TUPLE_2(arg, r, sig);
+    DELETE_TUPLE(arg);
+    reactor_del_signal(r, sig);
 }
 
 int reactor_del_signal(reactor_t r, int sig)
 {
-    if (!hashmap_is_in(r->signal_events, L2BASIC(sig)))
+    if (!_reactor_in_loop(r))
+        return _reactor_post_tuple(r, _reactor_del_signal_in_loop, NEW_TUPLE_2(r, sig));
+
+    struct _m_signal *signal = signal_map_erase(&r->signal_events, sig);
+    if (!signal)
         return -1;
 
-    struct _m_signal *signal = BASIC2P(hashmap_del(r->signal_events, L2BASIC(sig)), struct _m_signal*);
     struct revent *event = BASIC2P(hashmap_del(r->reactor_events, U2BASIC(signal->eventid)), struct revent*);
     free(signal);
-    free(event);
+    objcache_free(event);
 
     struct sigaction sa;
     bzero(&sa, sizeof(sa));
@@ -311,16 +653,18 @@ static struct revent *_deal_overtime_event(reactor_t r, struct _h_timer *timer)
     struct revent *event = BASIC2P(hashmap_del(r->reactor_events, U2BASIC(timer->eventid)), struct revent*);
     event->reason = REVENT_TIMEOUT;
     event->delete_while_done = true;
+    event->timer = NULL;    //popped, the caller frees it
     if (event->type == REVENT_ACCEPT ||
             event->type == REVENT_READ ||
             event->type == REVENT_WRITE ||
             event->type == REVENT_CONNECT) {
-        struct _m_file *file = BASIC2P(hashmap_del(r->file_events, L2BASIC(event->fd)), struct _m_file*);
+        struct _m_file *file = file_map_erase(&r->file_events, event->fd);
         repoll_remove_file(r->epfd, event->fd);
-        free(file);
+        objcache_free(file);
     } else if (event->type == REVENT_TIMER) {
-        struct _m_timer *timer = BASIC2P(hashmap_del(r->timer_events, L2BASIC(event->timer_id)), struct _m_timer*);
+        struct _m_timer *timer = timer_map_erase(&r->timer_events, event->timer_id);
         free(timer);
+        rstats_add(RSTAT_TIMERS_FIRED, 1);
     }
     return event;
 }
@@ -328,37 +672,84 @@ static struct revent *_deal_overtime_event(reactor_t r, struct _h_timer *timer)
 static struct revent *_deal_signal_event(reactor_t r, int pipefd)
 {
     int sig = _get_signal_by_read_pipefd(pipefd);
-    struct _m_signal *signal = BASIC2P(hashmap_get_value(r->signal_events, L2BASIC(sig)), struct _m_signal*);
+    struct _m_signal *signal = signal_map_find(&r->signal_events, sig);
     struct revent *event = BASIC2P(hashmap_get_value(r->reactor_events, U2BASIC(signal->eventid)), struct revent*);
     event->reason = REVENT_READY;
     return event;
 }
 
-static struct revent *_deal_file_event(reactor_t r, int fd)
+/*polled: registered in epoll, rather than on the ready list*/
+static struct revent *_deal_file_event(reactor_t r, int fd, bool polled)
 {
-    struct _m_file *file = BASIC2P(hashmap_del(r->file_events, L2BASIC(fd)), struct _m_file*);
+    struct _m_file *file = file_map_erase(&r->file_events, fd);
     struct revent *event = BASIC2P(hashmap_del(r->reactor_events, U2BASIC(file->eventid)), struct revent*);
     event->reason = REVENT_READY;
     event->delete_while_done = true;
-    if (event->mtime >= 0) {
-        struct _h_timer htimer;
-        htimer.eventid = event->eventid;
-        struct _h_timer *timer = BASIC2P(minheap_del(r->time_heap, P2BASIC(&htimer)), struct _h_timer*);
-        free(timer);
+    if (event->timer) {
+        _time_heap_remove(r->time_heap, event->timer);
+        objcache_free(event->timer);
+        event->timer = NULL;
     }
-    repoll_remove_file(r->epfd, fd);
-    free(file);
+    if (polled)
+        repoll_remove_file(r->epfd, fd);
+    objcache_free(file);
     return event;
 }
 
+/*after the fds epoll reported, so a busy fd takes its turn behind them*/
+static void _reactor_serve_ready(reactor_t r)
+{
+    for (size_t i = 0; i < r->ready_len; ++i) {
+        struct revent *event = BASIC2P(hashmap_get_value(r->reactor_events, U2BASIC(r->ready[i])), struct revent*);
+        /*deleted or timed out meanwhile*/
+        if (!event)
+            continue;
+        event = _deal_file_event(r, event->fd, false);
+        SLIST_INSERT_AT_TAIL(&r->activity_events, event);
+        rstats_add(RSTAT_READY_EVENTS, 1);
+    }
+    r->ready_len = 0;
+}
+
+/*nothing to read or accept after all, wait for epoll*/
+static void _reactor_rearm(reactor_t r, struct revent *event)
+{
+    event->reason = REVENT_TIMEOUT;
+    event->delete_while_done = false;
+    int ret = _reactor_add_file_event(r, event);
+    if (ret != REACTER_OK)
+        _reactor_fail_event(event, ret);
+}
+
+static void _reactor_resume_reads(void *arg)
+{
+    reactor_t r = (reactor_t)arg;
+    struct revent *event;
+
+    while ((event = SLIST_BEGIN(&r->paused_reads)) != SLIST_END(&r->paused_reads)) {
+        SLIST_ERASE_HEAD(&r->paused_reads);
+        SLIST_INSERT_AT_TAIL(&r->activity_events, event);
+    }
+}
+
+/*called by a worker when the pool crosses a watermark*/
+static void _reactor_on_pool_watermark(bool saturated, void *arg)
+{
+    if (!saturated)
+        reactor_post((reactor_t)arg, _reactor_resume_reads, arg);
+}
+
 int reactor_run(reactor_t r)
 {
     repoll_event_t *evs = (repoll_event_t*)calloc(r->max_events, sizeof(repoll_event_t));
     struct _h_timer *timer;
     int32_t mtime;
 
+    __atomic_store_n(&r->loop_thread, pthread_self(), __ATOMIC_RELEASE);
+    __atomic_store_n(&r->running, 1, __ATOMIC_RELEASE);
+
     do {
-        timer = BASIC2P(minheap_top(r->time_heap), struct _h_timer*);
+        timer = _time_heap_top(r->time_heap);
         if (timer) {
             mtime = get_interval_time(timer->absolute_mtime);
             mtime = mtime > 0 ? mtime : 0;
@@ -366,7 +757,16 @@ int reactor_run(reactor_t r)
         else
             mtime = -1;
 
+        if (r->ready_len > 0)
+            mtime = 0;
         int num_event = repoll_wait(r->epfd, evs, r->max_events, mtime);
+        rstats_add(RSTAT_SYS_EPOLL_WAIT, 1);
+        if (num_event >= 0) {
+            rstats_add(RSTAT_WAKEUPS, 1);
+            rstats_add(RSTAT_EVENTS, num_event);
+            if (num_event == r->max_events)
+                rstats_add(RSTAT_FULL_WAKEUPS, 1);
+        }
         if (num_event < 0) {
             if (errno == EAGAIN || errno == EINTR)
                 continue;
@@ -376,26 +776,28 @@ int reactor_run(reactor_t r)
 
         mtime = 0;
         struct revent *event;
-        while (minheap_len(r->time_heap) > 0 && mtime <= 0) {
-            timer = BASIC2P(minheap_top(r->time_heap), struct _h_timer*);
+        while (_time_heap_len(r->time_heap) > 0 && mtime <= 0) {
+            timer = _time_heap_top(r->time_heap);
             mtime = get_interval_time(timer->absolute_mtime);
             if (mtime <= 0) {
-                timer = BASIC2P(minheap_pop(r->time_heap), struct _h_timer*);
+                timer = _time_heap_pop(r->time_heap);
                 event = _deal_overtime_event(r, timer);
                 //list_insert_at_tail(r->activity_events, event);
                 SLIST_INSERT_AT_TAIL(&r->activity_events, event);
-                free(timer);
+                objcache_free(timer);
             }
         }
 
         for (int i = 0; i < num_event; i++) {
             if (evs[i].repoll_events & REPOLL_IN || evs[i].repoll_events & REPOLL_OUT) {
-                if (evs[i].repoll_fd == _pipefd[0]) {
+                if (evs[i].repoll_fd == r->postfd) {
+                    _reactor_run_posts(r);
+                } else if (evs[i].repoll_fd == _pipefd[0]) {
                     event = _deal_signal_event(r, _pipefd[0]);
                     //list_insert_at_tail(r->activity_events, event);
                     SLIST_INSERT_AT_TAIL(&r->activity_events, event);
                 } else {
-                    event = _deal_file_event(r, evs[i].repoll_fd);
+                    event = _deal_file_event(r, evs[i].repoll_fd, true);
                     //list_insert_at_tail(r->activity_events, event);
                     SLIST_INSERT_AT_TAIL(&r->activity_events, event);
                 }
@@ -403,21 +805,36 @@ int reactor_run(reactor_t r)
 
             }
         }
+        _reactor_serve_ready(r);
 
         //list_iter_t it = list_iter_create(r->activity_events);
         //while ((event = list_iter_next(it)) != NULL) {
-        event = SLIST_BEGIN(&r->activity_events);
-        while (event != SLIST_END(&r->activity_events)) {
+        while ((event = SLIST_BEGIN(&r->activity_events)) != SLIST_END(&r->activity_events)) {
+            /*unlink before dispatching, a worker may free the event at once*/
+            SLIST_ERASE_HEAD(&r->activity_events);
             switch (event->type) {
                 case REVENT_ACCEPT:
-                    revent_on_accept(event);
+                    if (revent_on_accept(event) == REVENT_AGAIN)
+                        _reactor_rearm(r, event);
                     break;
                 case REVENT_CONNECT:
                     revent_on_connect(event);
                     break;
-                case REVENT_READ:
-                    revent_on_read(event);
+                case REVENT_READ: {
+                    if (event->reason == REVENT_READY && thread_pool_saturated(THREAD_POOL_INST)) {
+                        /*leave the data in the socket buffer, so that TCP flow
+                         * control pushes back on the client until the pool drains*/
+                        SLIST_INSERT_AT_TAIL(&r->paused_reads, event);
+                        break;
+                    }
+                    int fd = event->fd;
+                    int ret = revent_on_read(event);
+                    if (ret == REVENT_MORE)
+                        _reactor_set_hot(r, fd);
+                    else if (ret == REVENT_AGAIN)
+                        _reactor_rearm(r, event);
                     break;
+                }
                 case REVENT_WRITE:
                     revent_on_write(event);
                     break;
@@ -432,23 +849,22 @@ int reactor_run(reactor_t r)
                     return -1;
                     break;
             }
-
-            //event = list_del_at_head(r->activity_events);
-            //struct revent *e = event;
-            event = SLIST_NEXT(event);
-            SLIST_ERASE_HEAD(&r->activity_events);
-            //if (!hashmap_is_in(r->reactor_events, U2BASIC(e->eventid)))
-            //    free(e);
         }
         //list_iter_destroy(&it);
-    } while (r->loop);
+        __atomic_store_n(&r->stat_files, HASHMAP_LEN(&r->file_events), __ATOMIC_RELAXED);
+        __atomic_store_n(&r->stat_timers, _time_heap_len(r->time_heap), __ATOMIC_RELAXED);
+        __atomic_store_n(&r->stat_ready, r->ready_len, __ATOMIC_RELAXED);
+    } while (__atomic_load_n(&r->loop, __ATOMIC_ACQUIRE));
+    __atomic_store_n(&r->running, 0, __ATOMIC_RELEASE);
     free(evs);
     return 0;
 }
 
 void reactor_stop(reactor_t r)
 {
-    r->loop = 0;
+    __atomic_store_n(&r->loop, 0, __ATOMIC_RELEASE);
+    if (!_reactor_in_loop(r))
+        _reactor_wakeup(r);
 }
 
 reactor_t reactor_create()
@@ -464,29 +880,72 @@ reactor_t reactor_create_for_all(
     int max_buffer_size
 )
 {
+    pthread_once(&_g_cache_once, _reactor_cache_init);
     reactor_t reactor = (struct reactor_manager*)calloc(1, sizeof(struct reactor_manager));
+    if (!reactor)
+        return NULL;
+
+    reactor->max_buffer_size = DFL_MAX_BUFFER_SIZE;
+    /*one more byte, the data read is always NUL terminated*/
+    reactor->buffer_cache = _reactor_buffer_cache(reactor->max_buffer_size + 1);
+    if (!reactor->buffer_cache) {
+        free(reactor);
+        return NULL;
+    }
+
+    /*without the watcher, reads paused while the pool is saturated would
+     * never be resumed*/
+    if (thread_pool_add_watcher(THREAD_POOL_INST, _reactor_on_pool_watermark, reactor) < 0) {
+        free(reactor);
+        return NULL;
+    }
+    /*the fds next, nothing else to undo if one fails*/
     reactor->epfd = repoll_create();
+    reactor->postfd = reactor->epfd < 0 ? -1 : eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->postfd < 0 || pipe(_pipefd) < 0) {
+        thread_pool_del_watcher(THREAD_POOL_INST, _reactor_on_pool_watermark, reactor);
+        if (reactor->postfd >= 0)
+            close(reactor->postfd);
+        if (reactor->epfd >= 0)
+            close(reactor->epfd);
+        free(reactor);
+        return NULL;
+    }
+    set_nonblocking(_pipefd[0]);
+    repoll_add_read_file(reactor->epfd, _pipefd[0], false);
 
-    reactor->time_heap = minheap_create(_h_timer_little);
-    reactor->file_events = hashmap_create(_m_int_hash, _m_int_equal);
-    reactor->signal_events = hashmap_create(_m_int_hash, _m_int_equal);
-    reactor->timer_events = hashmap_create(_m_int_hash, _m_int_equal);
+    reactor->time_heap = _time_heap_create();
+    HASHMAP_INIT(&reactor->file_events, HASHMAP_INIT_CAPA);
+    HASHMAP_INIT(&reactor->signal_events, HASHMAP_MIN_CAPA);
+    HASHMAP_INIT(&reactor->timer_events, HASHMAP_MIN_CAPA);
 
     reactor->reactor_events = hashmap_create(_m_uint64_hash, _m_uint64_equal);
+    /*keep registrations from stalling the loop when a table doubles*/
+    hashmap_set_incremental(reactor->reactor_events, true);
     //reactor->activity_events = list_create(_l_revent_equal);
     SLIST_INIT(&reactor->activity_events);
+    SLIST_INIT(&reactor->paused_reads);
+
+    MPSC_QUEUE_INIT(&reactor->posts);
+    reactor->post_pending = 0;
+    repoll_add_read_file(reactor->epfd, reactor->postfd, false);
 
     reactor->loop = 1;
+    reactor->running = 0;
+    reactor->loop_thread = pthread_self();
     reactor->next_eventid = 0;
 
     reactor->max_events = DFL_MAX_EVENTS;
-    reactor->max_buffer_size = DFL_MAX_BUFFER_SIZE;
-    
-    if (pipe(_pipefd) < 0) {
-        return NULL;
-    }
-    set_nonblocking(_pipefd[0]);
-    repoll_add_read_file(reactor->epfd, _pipefd[0], false);
+    reactor->read_calls = REACTOR_READ_CALLS;
+    reactor->write_budget = REACTOR_WRITE_BUDGET;
+    reactor->hot = NULL;
+    reactor->hot_len = 0;
+    reactor->ready = NULL;
+    reactor->ready_len = 0;
+    reactor->ready_capa = 0;
+    reactor->stat_files = 0;
+    reactor->stat_timers = 0;
+    reactor->stat_ready = 0;
 
     return reactor;
 }
@@ -496,39 +955,23 @@ void reactor_destroy(reactor_t *r)
     reactor_t reactor = *r;
 
     struct _h_timer *timer;
-    while ((timer = BASIC2P(minheap_pop(reactor->time_heap), struct _h_timer*)) != NULL) {
-        free(timer);
+    while ((timer = _time_heap_pop(reactor->time_heap)) != NULL) {
+        objcache_free(timer);
     }
-    minheap_destroy(&reactor->time_heap);
+    _time_heap_destroy(&reactor->time_heap);
+
+    HASHMAP_DEL(&reactor->file_events, objcache_free);
+    HASHMAP_DEL(&reactor->signal_events, free);
+    HASHMAP_DEL(&reactor->timer_events, free);
 
     struct hashmap_pair *pair;
-    hashmap_iter_t mit = hashmap_iter_create(reactor->file_events);
-    while ((pair = hashmap_iter_next(mit)) != NULL) {
-        free(BASIC2P(pair->value, void*));
-    }
-    hashmap_iter_destroy(&mit);
-    mit = hashmap_iter_create(reactor->signal_events);
+    hashmap_iter_t mit = hashmap_iter_create(reactor->reactor_events);
     while ((pair = hashmap_iter_next(mit)) != NULL) {
-        free(BASIC2P(pair->value, void*));
-        //free(pair->value);
-    }
-    hashmap_iter_destroy(&mit);
-    mit = hashmap_iter_create(reactor->timer_events);
-    while ((pair = hashmap_iter_next(mit)) != NULL) {
-        free(BASIC2P(pair->value, void*));
-        //free(pair->value);
-    }
-    hashmap_iter_destroy(&mit);
-    mit = hashmap_iter_create(reactor->reactor_events);
-    while ((pair = hashmap_iter_next(mit)) != NULL) {
-        free(BASIC2P(pair->value, void*));
+        objcache_free(BASIC2P(pair->value, void*));
         //free(pair->value);
     }
     hashmap_iter_destroy(&mit);
 
-    hashmap_destroy(&reactor->file_events);
-    hashmap_destroy(&reactor->signal_events);
-    hashmap_destroy(&reactor->timer_events);
     hashmap_destroy(&reactor->reactor_events);
     
     struct revent *event = SLIST_BEGIN(&reactor->activity_events);
@@ -539,23 +982,92 @@ void reactor_destroy(reactor_t *r)
     while (event != SLIST_END(&reactor->activity_events)) {
         struct revent *e = event;
         event = SLIST_NEXT(event);
-        free(e);
+        objcache_free(e);
+    }
+
+    thread_pool_del_watcher(THREAD_POOL_INST, _reactor_on_pool_watermark, reactor);
+    event = SLIST_BEGIN(&reactor->paused_reads);
+    while (event != SLIST_END(&reactor->paused_reads)) {
+        struct revent *e = event;
+        event = SLIST_NEXT(event);
+        objcache_free(e);
     }
+
+    struct rpost *post;
+    while ((post = MPSC_QUEUE_POP(&reactor->posts)) != NULL) {
+        objcache_free(post);
+    }
+    close(reactor->postfd);
+    free(reactor->hot);
+    free(reactor->ready);
     
     free(reactor);
     *r = NULL;
 }
 
+void reactor_stats_snapshot(reactor_t r, struct reactor_stats *stats)
+{
+    rstats_collect(stats->process_counters);
+    stats->files = __atomic_load_n(&r->stat_files, __ATOMIC_RELAXED);
+    stats->timers = __atomic_load_n(&r->stat_timers, __ATOMIC_RELAXED);
+    stats->ready = __atomic_load_n(&r->stat_ready, __ATOMIC_RELAXED);
+    stats->pool_queued = thread_pool_len(THREAD_POOL_INST);
+    stats->pool_wait_p50 = thread_pool_handoff_percentile(THREAD_POOL_INST, 0.5);
+    stats->pool_wait_p99 = thread_pool_handoff_percentile(THREAD_POOL_INST, 0.99);
+}
+
+int reactor_stats_format(const struct reactor_stats *stats, char *buf, size_t len)
+{
+    size_t n = 0;
+    int ret;
+
+#define _STATS_PRINT(...)                                       \
+    do {                                                        \
+        ret = snprintf(buf + (n < len ? n : len),               \
+                n < len ? len - n : 0, __VA_ARGS__);            \
+        if (ret < 0)                                            \
+            return ret;                                         \
+        n += ret;                                               \
+    } while (0)
+
+    for (int i = 0; i < RSTAT_NUM; ++i)
+        _STATS_PRINT("%s %lu\n", rstats_name(i), (unsigned long)stats->process_counters[i]);
+    uint64_t wakeups = stats->process_counters[RSTAT_WAKEUPS];
+    _STATS_PRINT("events_per_wakeup %.2f\n",
+            wakeups ? (double)stats->process_counters[RSTAT_EVENTS] / wakeups : 0.0);
+    _STATS_PRINT("files %zu\ntimers %zu\nready %zu\n", stats->files, stats->timers, stats->ready);
+    _STATS_PRINT("pool_queued %zu\npool_wait_p50_ns %ld\npool_wait_p99_ns %ld\n",
+            stats->pool_queued, (long)stats->pool_wait_p50, (long)stats->pool_wait_p99);
+#undef _STATS_PRINT
+    return (int)n;
+}
+
 static reactor_t _g_reactor_instance = NULL;
 static lock_t _g_instance_lock = LOCK_INITIALIZER;
 
 reactor_t reactor_instance()
 {
-    if (_g_reactor_instance == NULL) {
+    reactor_t r = __atomic_load_n(&_g_reactor_instance, __ATOMIC_ACQUIRE);
+    if (r == NULL) {
         LOCK(&_g_instance_lock);
-        _g_reactor_instance = reactor_create();
+        r = __atomic_load_n(&_g_reactor_instance, __ATOMIC_RELAXED);
+        if (r == NULL) {
+            r = reactor_create();
+            __atomic_store_n(&_g_reactor_instance, r, __ATOMIC_RELEASE);
+        }
         UNLOCK(&_g_instance_lock);
     }
 
-    return _g_reactor_instance;
+    return r;
+}
+
+void reactor_instance_drop()
+{
+    reactor_t r = _g_reactor_instance;
+    if (r) {
+        close(r->epfd);
+        close(r->postfd);
+    }
+    _g_reactor_instance = NULL;
+    LOCK_INIT(&_g_instance_lock);
 }
@@ -8,51 +8,144 @@
 
 #include "reactor_event.h"
 #include "minheap.h"
+#include "dheap.h"
 //#include "list.h"
 #include "macro_list.h"
 #include "hashmap.h"
+#include "macro_hashmap.h"
+#include "objcache.h"
+#include "rstats.h"
+#include <pthread.h>
 
 #define DFL_MAX_EVENTS 2048
 #define DFL_MAX_BUFFER_SIZE 4096
+#define REACTOR_READ_CALLS 4        //reads of one fd per wakeup
+#define REACTOR_WRITE_BUDGET 65536  //bytes written to one fd per wakeup
 
 #define REACTER_OK      0
 #define REACTER_EOF     0
 #define REACTER_FULL    -1
 #define REACTER_ERR     -2      //please check errno
 #define REACTER_TIMEOUT -3
+#define REACTER_BUSY    -4      //the fd, timer id or signal is armed already
 
 
+typedef void (*post_cb)(void*);
+
+struct rpost {
+    post_cb func;
+    void *arg;
+
+    struct rpost *__next__;
+};
+
+typedef MPSC_QUEUE(struct rpost) post_queue_t;
+
 typedef SLIST(struct revent) activity_list_t;
+
+#ifdef REACTOR_USE_DHEAP
+typedef dheap_t time_heap_t;        //4-ary, absolute_mtime kept inline
+#else
+typedef minheap_t time_heap_t;
+#endif
+
+typedef HASHMAP(struct _m_file) file_map_t;
+typedef HASHMAP(struct _m_signal) signal_map_t;
+typedef HASHMAP(struct _m_timer) timer_map_t;
+HASHMAP_GENERATE(file_map, file_map_t, struct _m_file, _M_INT_HASH, _M_INT_EQUAL)
+HASHMAP_GENERATE(signal_map, signal_map_t, struct _m_signal, _M_INT_HASH, _M_INT_EQUAL)
+HASHMAP_GENERATE(timer_map, timer_map_t, struct _m_timer, _M_INT_HASH, _M_INT_EQUAL)
+
 struct reactor_manager {
     int epfd;
 
-    minheap_t time_heap;
-    hashmap_t file_events;
-    hashmap_t signal_events;
-    hashmap_t timer_events;
+    time_heap_t time_heap;
+    file_map_t file_events;
+    signal_map_t signal_events;
+    timer_map_t timer_events;
 
+    /*stays a hashmap_t: revent's __next__ belongs to the activity list*/
     hashmap_t reactor_events;
     //list_t activity_events;
     activity_list_t activity_events;
+    activity_list_t paused_reads;   //ready reads held back while the pool is saturated
+
+    /*
+     * Per wakeup I/O budgets, so that a client streaming at line rate
+     * cannot hold the loop. A read that uses its budget up marks the fd hot;
+     * the next read armed on it goes to the ready list instead of epoll, and
+     * is served in the next iteration after the fds epoll reported.
+     */
+    int read_calls;             //0 for no limit but the buffer
+    size_t write_budget;        //0 for no limit
+    uint8_t *hot;               //by fd
+    int hot_len;
+    uint64_t *ready;            //eventids of the reads armed on hot fds
+    size_t ready_len;
+    size_t ready_capa;
+
+    /*gauges for reactor_stats_snapshot, stored by the loop every iteration*/
+    size_t stat_files;
+    size_t stat_timers;
+    size_t stat_ready;
+
+    /*mailbox: a lock-free MPSC queue, any thread may push, the loop pops*/
+    int postfd;                 //eventfd, written once per batch of posts
+    int post_pending;
+    post_queue_t posts;
 
     int loop;
+    int running;
+    pthread_t loop_thread;
     uint64_t next_eventid;
 
     int max_events;
     int max_buffer_size;
+    struct objcache *buffer_cache;  //read buffers of max_buffer_size + 1 bytes
 };
 
 typedef struct reactor_manager *reactor_t;
 
+/*the gauges are those of one reactor, the counters and the thread pool
+ * figures are shared by all reactors of the process*/
+struct reactor_stats {
+    uint64_t process_counters[RSTAT_NUM];   //rstats of every thread, not only this loop
+    size_t files;                   //fds with an event armed
+    size_t timers;                  //in the time heap
+    size_t ready;                   //reads on the ready list
+    size_t pool_queued;             //tasks waiting in the thread pool
+    int64_t pool_wait_p50;          //ns from push to start of a task, -1 if none ran
+    int64_t pool_wait_p99;
+};
+
+/*
+ * Off the loop thread a registration is posted, and one failing in the
+ * loop calls back once with REACTER_BUSY or REACTER_ERR as the result:
+ * the fd of an accept or connect, the length of a read or write,
+ * timer->mtime or signal->sig.
+ */
 int reactor_asyn_accept(reactor_t r, struct rfile *file, int32_t mtime, accept_cb callback, void *data);
 int reactor_asyn_connect(
     reactor_t r, struct rfile *file, struct sockaddr *addr, socklen_t len, int32_t mtime, connect_cb callback, void *data);
 int reactor_asyn_read(reactor_t r, struct rfile *file, int32_t mtime, read_cb callback, void *data);
 int reactor_asyn_write(reactor_t r, struct rfile *file, void *buffer, size_t len, int32_t mtime, write_cb callback, void *data);
+/*cancel whatever is armed on fd, its callback is not called*/
+int reactor_del_file(reactor_t r, int fd);
 int reactor_add_timer(reactor_t r, struct rtimer *timer, timer_cb callback, void *data);
 int reactor_del_timer(reactor_t r, int timer_id);
 int reactor_add_signal(reactor_t r, struct rsignal *signal, signal_cb callback, void *data);
 int reactor_del_signal(reactor_t r, int sig);
+int reactor_post(reactor_t r, post_cb func, void *arg);
+/*set before the reactor runs, 0 lifts a limit*/
+void reactor_set_budgets(reactor_t r, int read_calls, size_t write_budget);
+/*a read callback returning non-zero keeps the buffer, and frees it here later*/
+void reactor_free_buffer(void *buffer);
+
+/*the gauges of r, with the process wide counters merged over all threads.
+ * safe while the loop runs*/
+void reactor_stats_snapshot(reactor_t r, struct reactor_stats *stats);
+/*one "name value" line per figure, returns what snprintf would*/
+int reactor_stats_format(const struct reactor_stats *stats, char *buf, size_t len);
 
 int reactor_run(reactor_t r);
 void reactor_stop(reactor_t r);
@@ -64,6 +157,9 @@ reactor_t reactor_create_for_all(
 void reactor_destroy(reactor_t *r);
 
 reactor_t reactor_instance();
+/*in a child after fork: close the fds of the inherited instance, whose
+ * loop did not survive, and forget it. the next REACTOR_INST is a new one*/
+void reactor_instance_drop();
 #define REACTOR_INST (reactor_instance())
 
 #endif //_REACTER_H_
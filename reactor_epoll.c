@@ -4,6 +4,7 @@
  */
 
 #include "reactor_epoll.h"
+#include "rstats.h"
 
 int set_nonblocking(int fd)
 {
@@ -24,6 +25,7 @@ int repoll_add_read_file(int epfd, int fd, bool oneshot)
     if (oneshot)
         ev.events |= EPOLLONESHOT;
     ev.data.fd = fd;
+    rstats_add(RSTAT_SYS_EPOLL_CTL, 1);
     return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
 }
 
@@ -36,11 +38,13 @@ int repoll_add_write_file(int epfd, int fd, bool oneshot)
     if (oneshot)
         ev.events |= EPOLLONESHOT;
     ev.data.fd = fd;
+    rstats_add(RSTAT_SYS_EPOLL_CTL, 1);
     return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
 }
 
 int repoll_remove_file(int epfd, int fd)
 {
+    rstats_add(RSTAT_SYS_EPOLL_CTL, 1);
     return epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
 }
 
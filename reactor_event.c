@@ -8,23 +8,17 @@
 #include "comm.h"
 #include "thread_pool.h"
 #include "macro_tuple.h"
+#include "hash.h"
+#include "objcache.h"
+#include "rstats.h"
 #include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <assert.h>
 
-int64_t _m_int_hash(basic_value_t key)
-{
-    return BASIC2L(key);
-}
-
-bool _m_int_equal(basic_value_t key1, basic_value_t key2)
-{
-    return BASIC2L(key1) == BASIC2L(key2);
-}
-
 int64_t _m_uint64_hash(basic_value_t key)
 {
-    return BASIC2U(key);
+    return hash_mix64(BASIC2U(key));
 }
 
 bool _m_uint64_equal(basic_value_t key1, basic_value_t key2)
@@ -40,6 +34,11 @@ bool _h_timer_little(basic_value_t timer1, basic_value_t timer2)
     return t1->absolute_mtime < t2->absolute_mtime;
 }
 
+void _h_timer_set_index(basic_value_t timer, size_t index)
+{
+    BASIC2P(timer, struct _h_timer*)->heap_index = index;
+}
+
 bool _l_revent_equal(basic_value_t event1, basic_value_t event2)
 {
     struct revent *e1 = BASIC2P(event1, struct revent*);
@@ -48,6 +47,39 @@ bool _l_revent_equal(basic_value_t event1, basic_value_t event2)
     return e1->eventid == e2->eventid;
 }
 
+/*latency sensitive events are served before bulk data*/
+static enum task_priority _revent_priority(struct revent *event)
+{
+    switch (event->type) {
+        case REVENT_TIMER:
+        case REVENT_SIGNAL:
+        case REVENT_ACCEPT:
+        case REVENT_CONNECT:
+            return TASK_PRIO_HIGH;
+        case REVENT_WRITE:
+            return TASK_PRIO_NORMAL;
+        default:
+            return TASK_PRIO_LOW;
+    }
+}
+
+/*what a callback gets instead of a result: REACTER_TIMEOUT, or why the
+ * registration failed in the loop*/
+static int _revent_error(struct revent *event)
+{
+    return event->reason == REVENT_FAILED ? event->error : REACTER_TIMEOUT;
+}
+
+/*the tuple is copied into the task slot, so it may live on the caller's stack*/
+static int _revent_dispatch(struct revent *event, task_func func, void *tuple, size_t len)
+{
+    /*the loop never delivers the event again, so a full pool runs it
+     * inline instead of rejecting it. -1 only if it could not do that either*/
+    if (thread_pool_dispatch(THREAD_POOL_INST, _revent_priority(event), func, tuple, len) != 0)
+        func(tuple);
+    return 0;
+}
+
 static void _revent_on_timer_thread(void *arg) {
     struct revent *event;
     struct rtimer timer;
@@ -56,14 +88,13 @@ static void _revent_on_timer_thread(void *arg) {
 
     ((timer_cb)event->callback)(&timer, event->data);
 
-    DELETE_TUPLE(arg);
     if (event->delete_while_done)
-        free(event);
+        objcache_free(event);
 }
 
 int revent_on_timer(struct revent *event)
 {
-    assert(event->reason == REVENT_TIMEOUT);
+    assert(event->reason != REVENT_READY);
     /*
     struct rtimer *timer = (struct rtimer*)malloc(sizeof(struct rtimer));
     timer->timer_id = event->timer_id;
@@ -75,79 +106,78 @@ int revent_on_timer(struct revent *event)
     timer.mtime = event->mtime;
     timer.repeat = event->repeat;
     
-    if (event->repeat) {
+    if (event->reason == REVENT_FAILED) {
+        timer.mtime = event->error;
+        timer.repeat = 0;
+    } else if (event->repeat) {
         reactor_add_timer(event->r, &timer, event->callback, event->data);
     }
 
-    void *tuple = NEW_TUPLE_2(event, timer);
-
-#if 0
-    thread_pool_push(THREAD_POOL_INST, LAMBDA(void, (void *arg) {
-        struct revent *event;
-        struct rtimer timer;
-
-        GET_TUPLE_2(arg, event, timer);
+    LOCAL_TUPLE_2(tuple, event, timer);
 
-        ((timer_cb)event->callback)(&timer, event->data);
-
-        DELETE_TUPLE(arg);
-        if (event->delete_while_done)
-            free(event);
-    }), tuple);
-#else
-    thread_pool_push(THREAD_POOL_INST, _revent_on_timer_thread, (void*)tuple);
-#endif
+    _revent_dispatch(event, _revent_on_timer_thread, &tuple, sizeof(tuple));
 
     //((timer_cb)event->callback)(&timer, event->data);
     return 0;
 }
 
-static void _revent_on_accept_thread(void *arg) {
-    struct revent *event;
+/*one wakeup may accept several clients, so the tasks carry the callback
+ * instead of the event, which the loop frees once they are dispatched.
+ * only the first len bytes of addr are carried: an IPv4 or IPv6 peer
+ * stays in the task slot, a long unix path spills*/
+struct _accept_task {
+    accept_cb callback;
+    void *data;
     struct rfile file;
     int fd;
-    struct sockaddr addr;
     socklen_t len;
-    
-    GET_TUPLE_5(arg, event, file, fd, addr, len);
-    ((accept_cb)event->callback)(&file, fd, &addr, len, event->data);
+    struct sockaddr_storage addr;
+};
 
-    DELETE_TUPLE(arg);
-    if (event->delete_while_done)
-        free(event);
+static void _revent_on_accept_thread(void *arg) {
+    struct _accept_task *task = (struct _accept_task*)arg;
+    task->callback(&task->file, task->fd, (struct sockaddr*)&task->addr, task->len, task->data);
 }
 
-
 int revent_on_accept(struct revent *event)
 {
-    struct sockaddr addr;
-    socklen_t len;
-    int fd;
-    struct rfile file;
-    file.fd = event->fd;
+    struct _accept_task task;
+    task.callback = (accept_cb)event->callback;
+    task.data = event->data;
+    task.file.fd = event->fd;
 
-    if (event->reason == REVENT_TIMEOUT) {
-        ((accept_cb)event->callback)(&file, REACTER_TIMEOUT, NULL, 0, event->data);
+    if (event->reason != REVENT_READY) {
+        task.callback(&task.file, _revent_error(event), NULL, 0, event->data);
     } else if (event->reason == REVENT_READY){
+        int dispatched = 0;
         do {
-            fd = accept(event->fd, &addr, &len);
-            if (fd < 0) {
+            task.len = sizeof(task.addr);
+            task.fd = accept(event->fd, (struct sockaddr*)&task.addr, &task.len);
+            rstats_add(RSTAT_SYS_ACCEPT, 1);
+            if (task.fd < 0) {
+                /*another process sharing the socket took the client. no
+                 * callback runs to arm the event again, the loop does*/
+                if (errno == EAGAIN && !dispatched)
+                    return REVENT_AGAIN;
                 if (errno == EAGAIN)
                     break;
                 else if (errno == EINTR)
                     continue;
-                else {
-                    //((accept_cb)event->callback)(&file, REACTER_ERR, &addr, len, event->data);
-                    void *tuple = NEW_TUPLE_6(event, file, (int)REACTER_ERR, addr, len, event->data);
-                    thread_pool_push(THREAD_POOL_INST, _revent_on_accept_thread, tuple);
-                    break;
-                }
+                task.fd = REACTER_ERR;
+                task.len = 0;
+            } else {
+                rstats_add(RSTAT_ACCEPTS, 1);
             }
-            void *tuple = NEW_TUPLE_5(event, file, fd, addr, len);
-            thread_pool_push(THREAD_POOL_INST, _revent_on_accept_thread, tuple);
-            //((accept_cb)event->callback)(&file, fd, &addr, len, event->data);
-        } while (1);
+            if (task.len > sizeof(task.addr))
+                task.len = sizeof(task.addr);
+            _revent_dispatch(event, _revent_on_accept_thread, &task,
+                    offsetof(struct _accept_task, addr) + task.len);
+            dispatched++;
+        } while (task.fd >= 0);
     }
+
+    if (event->delete_while_done)
+        objcache_free(event);
     return 0;
 }
 
@@ -157,11 +187,10 @@ static void _revent_on_connect_thread(void *arg) {
     int fd;
 
     GET_TUPLE_3(arg, event, file, fd);
-    ((connect_cb)event->callback)(&file, REVENT_TIMEOUT, event->data);
+    ((connect_cb)event->callback)(&file, fd, event->data);
 
-    DELETE_TUPLE(arg);
     if (event->delete_while_done)
-        free(event);
+        objcache_free(event);
 }
 
 
@@ -170,13 +199,19 @@ int revent_on_connect(struct revent *event)
 
     struct rfile file;
     file.fd = event->fd;
-    if (event->reason == REVENT_TIMEOUT) {
-        void *tuple = NEW_TUPLE_3(event, file, (int)REVENT_TIMEOUT);
-        thread_pool_push(THREAD_POOL_INST, _revent_on_connect_thread, tuple);
+    if (event->reason != REVENT_READY) {
+        LOCAL_TUPLE_3(tuple, event, file, _revent_error(event));
+        _revent_dispatch(event, _revent_on_connect_thread, &tuple, sizeof(tuple));
         //((connect_cb)event->callback)(&file, REVENT_TIMEOUT, event->data);
     } else if (event->reason == REVENT_READY){
-        void *tuple = NEW_TUPLE_3(event, file, event->fd);
-        thread_pool_push(THREAD_POOL_INST, _revent_on_connect_thread, tuple);
+        /*writable is also how a failed connect shows up*/
+        int err = 0;
+        socklen_t errlen = sizeof(err);
+        int fd = event->fd;
+        if (getsockopt(event->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err != 0)
+            fd = REACTER_ERR;
+        LOCAL_TUPLE_3(tuple, event, file, fd);
+        _revent_dispatch(event, _revent_on_connect_thread, &tuple, sizeof(tuple));
         //((connect_cb)event->callback)(&file, event->fd, event->data);
     }
     return 0;
@@ -189,12 +224,11 @@ static void _revent_on_read_thread(void *arg) {
     int ret;
 
     GET_TUPLE_4(arg, event, file, buffer, ret);
-    if (((read_cb)event->callback)(&file, buffer, ret, event->data) == 0);
-        free(buffer);
+    if (((read_cb)event->callback)(&file, buffer, ret, event->data) == 0)
+        reactor_free_buffer(buffer);
 
-    DELETE_TUPLE(arg);
     if (event->delete_while_done)
-        free(event);
+        objcache_free(event);
 }
 
 int revent_on_read(struct revent *event)
@@ -203,22 +237,38 @@ int revent_on_read(struct revent *event)
     struct rfile file;
     file.fd = event->fd;
 
-    if (event->reason == REVENT_TIMEOUT) {
-        void *tuple = NEW_TUPLE_4(event, file, (void*)NULL, (int)REACTER_TIMEOUT);
-        thread_pool_push(THREAD_POOL_INST, _revent_on_read_thread, tuple);
+    if (event->reason != REVENT_READY) {
+        LOCAL_TUPLE_4(tuple, event, file, (void*)NULL, _revent_error(event));
+        _revent_dispatch(event, _revent_on_read_thread, &tuple, sizeof(tuple));
         //((read_cb)event->callback)(&file, NULL, REACTER_TIMEOUT, event->data);
     } else if (event->reason == REVENT_READY) {
-        uint8_t *buffer = (uint8_t*)calloc(event->r->max_buffer_size, sizeof(uint8_t));
-        ssize_t ret = thorough_read(event->fd, buffer, event->r->max_buffer_size);
-
-        void *tuple = NEW_TUPLE_4(event, file, (void*)buffer, ret);
-        thread_pool_push(THREAD_POOL_INST, _revent_on_read_thread, tuple);
+        int more;
+        uint8_t *buffer = (uint8_t*)objcache_alloc(event->r->buffer_cache);
+        if (!buffer) {
+            LOCAL_TUPLE_4(tuple, event, file, (void*)NULL, REACTER_ERR);
+            _revent_dispatch(event, _revent_on_read_thread, &tuple, sizeof(tuple));
+            return REVENT_DONE;
+        }
+        ssize_t ret = budget_read(event->fd, buffer, event->r->max_buffer_size,
+                event->r->read_calls, &more);
+        /*a stale hint, an empty read is not the end of the stream*/
+        if (ret == TREAD_AGAIN) {
+            objcache_free(buffer);
+            return REVENT_AGAIN;
+        }
+        buffer[ret > 0 ? ret : 0] = 0;
+        if (ret > 0)
+            rstats_add(RSTAT_BYTES_IN, ret);
+
+        LOCAL_TUPLE_4(tuple, event, file, (void*)buffer, (int)ret);
+        _revent_dispatch(event, _revent_on_read_thread, &tuple, sizeof(tuple));
         /*
         if (((read_cb)event->callback)(&file, (void*)buffer, ret, event->data) == 0);
             free(buffer);
         */
+        return more ? REVENT_MORE : REVENT_DONE;
     }
-    return 0;
+    return REVENT_DONE;
 }
 
 static void _revent_on_write_thread(void *arg) {
@@ -229,9 +279,8 @@ static void _revent_on_write_thread(void *arg) {
     GET_TUPLE_3(arg, event, file, ret);
     ((write_cb)event->callback)(&file, event->buffer, ret, event->data);
 
-    DELETE_TUPLE(arg);
     if (event->delete_while_done)
-        free(event);
+        objcache_free(event);
 }
 
 int revent_on_write(struct revent *event)
@@ -240,15 +289,20 @@ int revent_on_write(struct revent *event)
     struct rfile file;
     file.fd = event->fd;
 
-    if (event->reason == REVENT_TIMEOUT) {
-        void *tuple = NEW_TUPLE_3(event, file, (int)REACTER_TIMEOUT);
-        thread_pool_push(THREAD_POOL_INST, _revent_on_write_thread, tuple);
+    if (event->reason != REVENT_READY) {
+        LOCAL_TUPLE_3(tuple, event, file, _revent_error(event));
+        _revent_dispatch(event, _revent_on_write_thread, &tuple, sizeof(tuple));
         //((write_cb)event->callback)(&file, event->buffer, REACTER_TIMEOUT, event->data);
     } else if (event->reason == REVENT_READY) {
-        ssize_t ret = thorough_write(event->fd, (uint8_t*)event->buffer, event->buffer_len);
-
-        void *tuple = NEW_TUPLE_3(event, file, ret);
-        thread_pool_push(THREAD_POOL_INST, _revent_on_write_thread, tuple);
+        size_t len = event->buffer_len;
+        if (event->r->write_budget && len > event->r->write_budget)
+            len = event->r->write_budget;
+        ssize_t ret = thorough_write(event->fd, (uint8_t*)event->buffer, len);
+        if (ret > 0)
+            rstats_add(RSTAT_BYTES_OUT, ret);
+
+        LOCAL_TUPLE_3(tuple, event, file, (int)ret);
+        _revent_dispatch(event, _revent_on_write_thread, &tuple, sizeof(tuple));
         //((write_cb)event->callback)(&file, event->buffer, ret, event->data);
     }
     return 0;
@@ -262,20 +316,36 @@ static void _revent_on_signal_thread(void *arg) {
     GET_TUPLE_2(arg, event, signal);
     ((signal_cb)event->callback)(&signal, event->data);
 
-    DELETE_TUPLE(arg);
     if (event->delete_while_done)
-        free(event);
+        objcache_free(event);
 }
 
 int revent_on_signal(struct revent *event)
 {
 
-    assert(event->reason == REVENT_READY);
     struct rsignal signal;
-    signal.sig = event->sig;
+    signal.sig = event->reason == REVENT_FAILED ? event->error : event->sig;
 
-    void *tuple = NEW_TUPLE_2(event, signal);
-    thread_pool_push(THREAD_POOL_INST, _revent_on_signal_thread, tuple);
+    LOCAL_TUPLE_2(tuple, event, signal);
+    _revent_dispatch(event, _revent_on_signal_thread, &tuple, sizeof(tuple));
     //((signal_cb)event->callback)(&signal, event->data);
     return 0;
 }
+
+int revent_on_failed(struct revent *event)
+{
+    switch (event->type) {
+        case REVENT_ACCEPT:
+            return revent_on_accept(event);
+        case REVENT_CONNECT:
+            return revent_on_connect(event);
+        case REVENT_READ:
+            return revent_on_read(event);
+        case REVENT_WRITE:
+            return revent_on_write(event);
+        case REVENT_TIMER:
+            return revent_on_timer(event);
+        default:
+            return revent_on_signal(event);
+    }
+}
@@ -37,23 +37,27 @@ typedef int (*timer_cb)(struct rtimer*, void*);
 typedef int (*signal_cb)(struct rsignal*, void*);
 
 
+/*nodes of the reactor's intrusive maps (macro_hashmap.h)*/
 struct _m_file {
     uint64_t eventid;
-    int fd;
+    int __key__;    //fd
+    struct _m_file *__next__;
 };
 
 struct _m_signal {
     uint64_t eventid;
-    int sig;
+    int __key__;    //sig
+    struct _m_signal *__next__;
 };
 
 struct _m_timer {
     uint64_t eventid;
-    int timer_id;
+    int __key__;    //timer_id
+    struct _m_timer *__next__;
 };
 
-int64_t _m_int_hash(basic_value_t key);
-bool _m_int_equal(basic_value_t key1, basic_value_t key2);
+#define _M_INT_HASH(key) (key)
+#define _M_INT_EQUAL(key1, key2) ((key1) == (key2))
 
 enum revent_type {
     REVENT_ACCEPT = 0,
@@ -66,7 +70,8 @@ enum revent_type {
 
 enum revent_reason {
     REVENT_TIMEOUT = 0,
-    REVENT_READY
+    REVENT_READY,
+    REVENT_FAILED           //a posted registration failed in the loop
 };
 
 struct revent {
@@ -83,6 +88,8 @@ struct revent {
     int timer_id;           //Only used in timer event
     int32_t mtime;          //Only used in timer and file event;
     int repeat;             //Only used in timer event
+    struct _h_timer *timer; //Only used in timer and file event, its node in the time heap
+    int error;              //REVENT_FAILED: REACTER_ERR or REACTER_BUSY
 
     bool delete_while_done;
 
@@ -99,16 +106,25 @@ bool _l_revent_equal(basic_value_t event1, basic_value_t event2);
 struct _h_timer {
     uint64_t eventid;
     int64_t absolute_mtime;
+    size_t heap_index;
 };
 
 bool _h_timer_little(basic_value_t timer1, basic_value_t timer2);
+void _h_timer_set_index(basic_value_t timer, size_t index);
 //int _h_timer_equal(void *timer1, void *timer2);
 
+/*what revent_on_read made of a ready read*/
+#define REVENT_DONE     0
+#define REVENT_MORE     1       //stopped on its budget, the fd is readable at once
+#define REVENT_AGAIN    2       //nothing to read or accept, the event was not dispatched
+
 int revent_on_timer(struct revent *event);
 int revent_on_signal(struct revent *event);
 int revent_on_accept(struct revent *event);
 int revent_on_connect(struct revent *event);
 int revent_on_read(struct revent *event);
 int revent_on_write(struct revent *event);
+/*call back a failed registration with its error as the result*/
+int revent_on_failed(struct revent *event);
 
 #endif //_REACTER_EVENT_H_
@@ -0,0 +1,107 @@
+/**
+ * @author: luyuhuang
+ * @brief: process wide counters of the reactor and the servers
+ */
+
+#include "rstats.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+__thread struct rstats_slot *_rstats_slot = NULL;
+
+static struct rstats_slot *_slots = NULL;      //only pushed to, never unlinked
+static pthread_once_t _key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _key;
+
+static const char *_names[RSTAT_NUM] = {
+    "wakeups",
+    "full_wakeups",
+    "events",
+    "ready_events",
+    "timers_fired",
+    "posts",
+    "accepts",
+    "bytes_in",
+    "bytes_out",
+    "sys_epoll_wait",
+    "sys_epoll_ctl",
+    "sys_read",
+    "sys_write",
+    "sys_accept",
+    "failed_registrations",
+};
+
+static void _rstats_release(void *slot)
+{
+    __atomic_store_n(&((struct rstats_slot*)slot)->free, 1, __ATOMIC_RELEASE);
+}
+
+static void _rstats_key_init()
+{
+    pthread_key_create(&_key, _rstats_release);
+}
+
+struct rstats_slot *rstats_slot_acquire()
+{
+    pthread_once(&_key_once, _rstats_key_init);
+
+    struct rstats_slot *slot;
+    for (slot = __atomic_load_n(&_slots, __ATOMIC_ACQUIRE); slot; slot = slot->next) {
+        int expected = 1;
+        if (__atomic_compare_exchange_n(&slot->free, &expected, 0, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (!slot) {
+        if (posix_memalign((void**)&slot, 64, sizeof(struct rstats_slot)) != 0)
+            return NULL;
+        for (int i = 0; i < RSTAT_NUM; ++i)
+            slot->counters[i] = 0;
+        slot->free = 0;
+        slot->next = __atomic_load_n(&_slots, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&_slots, &slot->next, slot, true,
+                    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    pthread_setspecific(_key, slot);
+    _rstats_slot = slot;
+    return slot;
+}
+
+void rstats_collect(uint64_t counters[RSTAT_NUM])
+{
+    for (int i = 0; i < RSTAT_NUM; ++i)
+        counters[i] = 0;
+    for (struct rstats_slot *slot = __atomic_load_n(&_slots, __ATOMIC_ACQUIRE); slot; slot = slot->next) {
+        for (int i = 0; i < RSTAT_NUM; ++i)
+            counters[i] += __atomic_load_n(slot->counters + i, __ATOMIC_RELAXED);
+    }
+}
+
+void rstats_arena_init(struct rstats_slot *slots, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        slots[i].next = i + 1 < n ? slots + i + 1 : NULL;
+        __atomic_store_n(&slots[i].free, 1, __ATOMIC_RELEASE);
+    }
+}
+
+void rstats_arena_attach(struct rstats_slot *slots)
+{
+    __atomic_store_n(&_slots, slots, __ATOMIC_RELEASE);
+    _rstats_slot = NULL;
+}
+
+void rstats_arena_sum(const struct rstats_slot *slots, int n, uint64_t counters[RSTAT_NUM])
+{
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < RSTAT_NUM; ++j)
+            counters[j] += __atomic_load_n(slots[i].counters + j, __ATOMIC_RELAXED);
+    }
+}
+
+const char *rstats_name(enum rstat stat)
+{
+    return stat < RSTAT_NUM ? _names[stat] : NULL;
+}
@@ -0,0 +1,70 @@
+/**
+ * @author: luyuhuang
+ * @brief: process wide counters of the reactor and the servers
+ */
+
+#ifndef _RSTATS_H_
+#define _RSTATS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum rstat {
+    RSTAT_WAKEUPS = 0,          //returns of epoll_wait, one per loop iteration
+    RSTAT_FULL_WAKEUPS,         //that returned max_events, the loop is behind
+    RSTAT_EVENTS,               //fds reported by epoll
+    RSTAT_READY_EVENTS,         //reads served from the ready list
+    RSTAT_TIMERS_FIRED,
+    RSTAT_POSTS,
+    RSTAT_ACCEPTS,
+    RSTAT_BYTES_IN,
+    RSTAT_BYTES_OUT,
+    RSTAT_SYS_EPOLL_WAIT,
+    RSTAT_SYS_EPOLL_CTL,
+    RSTAT_SYS_READ,
+    RSTAT_SYS_WRITE,            //write and sendmsg
+    RSTAT_SYS_ACCEPT,
+    RSTAT_FAILED_REGISTRATIONS, //posted from another thread, failed in the loop
+    RSTAT_NUM
+};
+
+/*
+ * Every thread counts into a slot of its own: an add is a plain load and
+ * store, no atomic read-modify-write and no shared cache line. A snapshot
+ * sums the slots while they are being written. The slot of an exited
+ * thread keeps its counts and goes to the next new thread.
+ */
+struct rstats_slot {
+    uint64_t counters[RSTAT_NUM];
+    int free;
+    struct rstats_slot *next;
+} __attribute__((aligned(64)));
+
+extern __thread struct rstats_slot *_rstats_slot;
+struct rstats_slot *rstats_slot_acquire();
+
+static inline void rstats_add(enum rstat stat, uint64_t n)
+{
+    struct rstats_slot *slot = _rstats_slot ? _rstats_slot : rstats_slot_acquire();
+    if (slot)
+        __atomic_store_n(slot->counters + stat,
+                __atomic_load_n(slot->counters + stat, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/*the sums over all threads, each counter only goes up*/
+void rstats_collect(uint64_t counters[RSTAT_NUM]);
+const char *rstats_name(enum rstat stat);
+
+/*
+ * Slots in memory shared between processes, e.g. mapped before a fork, so
+ * that one process sums what others count. rstats_arena_init marks all n
+ * free and keeps their counts; a new process calls rstats_arena_attach,
+ * drops the slots inherited and takes from the arena first, from the heap
+ * once it runs out.
+ */
+void rstats_arena_init(struct rstats_slot *slots, int n);
+void rstats_arena_attach(struct rstats_slot *slots);
+/*adds the sums of the arena to counters*/
+void rstats_arena_sum(const struct rstats_slot *slots, int n, uint64_t counters[RSTAT_NUM]);
+
+#endif //_RSTATS_H_
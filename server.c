@@ -5,26 +5,70 @@
 
 #include "reactor.h"
 #include "reactor_event.h"
+#include "reactor_epoll.h"
 #include "server.h"
+#include "thread_pool.h"
 #include "comm.h"
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <stddef.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <signal.h>
+#include <poll.h>
+
+static int _next_timer_id = SERVER_TIMER_ID_BASE;
 
 server_t
 server_create(const char *addr,
         newconnect_cb on_newconnect, receive_cb on_receive, connected_cb on_connected)
 {
-    struct server *newserver = (struct server*)malloc(sizeof(struct server));
+    struct server *newserver = (struct server*)calloc(1, sizeof(struct server));
+    if (!newserver)
+        return NULL;
+    newserver->session_mgr = session_manager_create();
+    if (!newserver->session_mgr) {
+        free(newserver);
+        return NULL;
+    }
 
-    newserver->addr = strdup(addr);
+    newserver->addr = addr ? strdup(addr) : NULL;
+    newserver->listeners = NULL;
+    newserver->listener_num = 0;
+    newserver->listener_capa = 0;
 
     newserver->on_newconnect = on_newconnect;
     newserver->on_receive = on_receive;
     newserver->on_connected = on_connected;
+    newserver->on_close = NULL;
+    newserver->on_timeout = NULL;
+    newserver->timer_id = 0;
+    newserver->handover.fd = -1;
+    newserver->handover_path = NULL;
+    newserver->on_handover = NULL;
+    newserver->handover_peer.fd = -1;
+    newserver->handover_sent_num = 0;
 
-    newserver->session_mgr = session_manager_create();
+    newserver->out_cache = objcache_create(sizeof(struct out_node));
+    LOCK_INIT(&newserver->flush_lock);
+
+    newserver->rate = 0;
+    newserver->burst = 0;
+    newserver->throttle_timer_id = __atomic_fetch_add(&_next_timer_id, 1, __ATOMIC_RELAXED);
+    newserver->throttle_armed = 0;
+    LOCK_INIT(&newserver->throttle_lock);
+    newserver->stats_file.fd = -1;
+    newserver->stats_path = NULL;
+    newserver->prefork = NULL;
+    newserver->worker = -1;
 
     return newserver;
 }
@@ -36,45 +80,1310 @@ server_destroy(server_t *s)
         return;
 
     struct server *server = *s;
-    //free(server->listeners);
+    if (server->timer_id)
+        reactor_del_timer(REACTOR_INST, server->timer_id);
+    if (server->throttle_armed)
+        reactor_del_timer(REACTOR_INST, server->throttle_timer_id);
+    if (server->handover.fd >= 0) {
+        reactor_del_file(REACTOR_INST, server->handover.fd);
+        close(server->handover.fd);
+    }
+    if (server->handover_peer.fd >= 0) {
+        reactor_del_file(REACTOR_INST, server->handover_peer.fd);
+        close(server->handover_peer.fd);
+    }
+    if (server->handover_path) {
+        unlink(server->handover_path);
+        free(server->handover_path);
+    }
+    if (server->stats_file.fd >= 0) {
+        reactor_del_file(REACTOR_INST, server->stats_file.fd);
+        close(server->stats_file.fd);
+        unlink(server->stats_path);
+        free(server->stats_path);
+    }
+    for (int i = 0; i < server->listener_num; ++i) {
+        struct listener *listener = server->listeners[i];
+        /*the master of a prefork server closed its SO_REUSEPORT ones*/
+        if (listener->f.fd >= 0) {
+            if (!listener->stopped)
+                reactor_del_file(REACTOR_INST, listener->f.fd);
+            close(listener->f.fd);
+        }
+        /*a handed over socket file belongs to the new process, a shared
+         * one to the master*/
+        if (!listener->stopped && server->worker < 0 && strncmp(listener->addr, "unix:", 5) == 0)
+            unlink(listener->addr + 5);
+        free(listener->addr);
+        free(listener);
+    }
+    free(server->listeners);
     free(server->addr);
     session_manager_destroy(&server->session_mgr);
+    objcache_destroy(&server->out_cache);
+    LOCK_DESTROY(&server->flush_lock);
+    free(server->dirty);
+    free(server->flushing);
+    LOCK_DESTROY(&server->throttle_lock);
+    free(server->throttled);
+    free(server->resuming);
+    if (server->prefork) {
+        munmap(server->prefork->shm, sizeof(struct prefork_worker) * server->prefork->workers);
+        free(server->prefork->addrs);
+        free(server->prefork->lens);
+        free(server->prefork->reuseport);
+        free(server->prefork);
+    }
+    free(server);
+    *s = NULL;
+}
+
+void
+server_set_close_cb(server_t s, close_cb on_close)
+{
+    s->on_close = on_close;
+}
+
+void
+server_set_framing(server_t s, const struct frame_format *format)
+{
+    s->frame_format = *format;
+    s->framing = 1;
+}
+
+int
+server_set_max_sessions(server_t s, size_t max_sessions)
+{
+    if (s->listener_num > 0 || session_manager_len(s->session_mgr) > 0)
+        return -1;
+
+    session_manager_t mgr = session_manager_create_for_all(max_sessions);
+    if (!mgr)
+        return -1;
+    session_manager_set_timeouts(mgr, s->session_mgr->idle_timeout,
+            s->session_mgr->read_timeout, s->session_mgr->write_timeout);
+    session_manager_destroy(&s->session_mgr);
+    s->session_mgr = mgr;
+    return 0;
+}
+
+void
+server_set_timeout_cb(server_t s, timeout_cb on_timeout)
+{
+    s->on_timeout = on_timeout;
+}
+
+/*runs with the wheel locked, the session is closed through its read*/
+static int
+_server_on_expire(session_t session, enum session_timeout reason, void *arg)
+{
+    struct server *s = (struct server*)arg;
+    if (s->on_timeout && s->on_timeout(session, reason) != 0)
+        return 1;
+    shutdown(session->f.fd, SHUT_RDWR);
+    return 0;
+}
+
+static int
+_on_tick(struct rtimer *timer, void *arg)
+{
+    struct server *s = (struct server*)arg;
+    session_manager_expire(s->session_mgr, get_absolute_time(0), _server_on_expire, s);
+    return 0;
+}
+
+/*one repeating timer sweeps the wheel, activity only stamps the session*/
+int
+server_set_timeouts(server_t s, int32_t idle, int32_t read, int32_t write)
+{
+    session_manager_set_timeouts(s->session_mgr, idle, read, write);
+    if (idle <= 0 && read <= 0 && write <= 0) {
+        if (s->timer_id) {
+            reactor_del_timer(REACTOR_INST, s->timer_id);
+            s->timer_id = 0;
+        }
+        return 0;
+    }
+    if (s->timer_id)
+        return 0;
+
+    struct rtimer timer;
+    timer.timer_id = __atomic_fetch_add(&_next_timer_id, 1, __ATOMIC_RELAXED);
+    timer.mtime = SESSION_WHEEL_TICK;
+    timer.repeat = 1;
+    if (reactor_add_timer(REACTOR_INST, &timer, _on_tick, s) != REACTER_OK)
+        return -1;
+    s->timer_id = timer.timer_id;
+    return 0;
+}
+
+static void _server_out_close(void *arg);
+static void _session_drop_output(struct server *s, session_t session);
+
+static void
+_server_session_close(struct server *s, session_t session)
+{
+    pthread_mutex_lock(&session->out_lock);
+    _session_drop_output(s, session);
+    session->out_closed = 1;
+    session->out_armed = 0;
+    int out_fd = session->out_fd;
+    session->out_fd = -1;
+    pthread_mutex_unlock(&session->out_lock);
+    /*the loop may have write readiness armed on it*/
+    if (out_fd >= 0)
+        reactor_post(REACTOR_INST, _server_out_close, (void*)(intptr_t)out_fd);
+
+    /*out of the wheel before the fd goes, a sweep must not shut it down*/
+    session_timeout_stop(s->session_mgr, session);
+    if (s->on_close)
+        s->on_close(session);
+    frame_decoder_clear(&session->frames);
+    close(session->f.fd);
+    session_free(s->session_mgr, session);
+}
+
+/*the read of a session is always armed until the session closes, so an
+ * outside close only shuts the socket down and lets _on_read finish it.
+ * out_closed is set under out_lock before the fd is closed, so a session
+ * closing meanwhile is never shut down through a reused fd*/
+int
+server_close_session(server_t s, session_id_t id)
+{
+    session_t session = session_get(s->session_mgr, id);
+    if (!session)
+        return -1;
+
+    int ret = -1;
+    pthread_mutex_lock(&session->out_lock);
+    if (!session->out_closed && __atomic_load_n(&session->session_id, __ATOMIC_ACQUIRE) == id)
+        ret = shutdown(session->f.fd, SHUT_RDWR);
+    pthread_mutex_unlock(&session->out_lock);
+    return ret;
+}
+
+static int
+_on_frame(void *frame, size_t len, void *arg)
+{
+    session_t session = (session_t)arg;
+    return session->server->on_receive(session, frame, len);
+}
+
+static int
+_server_receive(struct server *s, session_t session, void *buffer, size_t len)
+{
+    if (!s->on_receive)
+        return 0;
+    if (s->framing)
+        return frame_decode(&session->frames, buffer, len, _on_frame, session);
+    return s->on_receive(session, buffer, len);
+}
+
+static int _on_read(struct rfile *file, void *buffer, ssize_t len, void *arg);
+static int _on_throttle_tick(struct rtimer *timer, void *arg);
+
+void
+server_set_rate_limit(server_t s, int64_t rate, int64_t burst)
+{
+    s->rate = rate;
+    s->burst = burst;
+}
+
+static void
+_server_arm_throttle(struct server *s)
+{
+    struct rtimer timer;
+    timer.timer_id = s->throttle_timer_id;
+    timer.mtime = SERVER_THROTTLE_TICK;
+    timer.repeat = 0;
+    reactor_add_timer(REACTOR_INST, &timer, _on_throttle_tick, s);
+}
+
+/*the read stays unarmed until the bucket is out of debt*/
+static void
+_server_throttle(struct server *s, session_t session, int32_t wait)
+{
+    session->throttled_until = get_absolute_time(wait);
+
+    LOCK(&s->throttle_lock);
+    if (s->throttled_len == s->throttled_capa) {
+        size_t capa = s->throttled_capa ? s->throttled_capa * 2 : 64;
+        session_t *throttled = (session_t*)realloc(s->throttled, capa * sizeof(session_t));
+        if (!throttled) {
+            UNLOCK(&s->throttle_lock);
+            /*rather unlimited than stuck*/
+            if (reactor_asyn_read(REACTOR_INST, &session->f, -1, _on_read, session) != REACTER_OK)
+                _server_session_close(s, session);
+            return;
+        }
+        s->throttled = throttled;
+        s->throttled_capa = capa;
+    }
+    s->throttled[s->throttled_len++] = session;
+    int arm = !s->throttle_armed;
+    s->throttle_armed = 1;
+    UNLOCK(&s->throttle_lock);
+
+    if (arm)
+        _server_arm_throttle(s);
+}
+
+/*a one-shot timer armed again while sessions are throttled, so ticks
+ * never overlap and resuming needs no lock of its own*/
+static int
+_on_throttle_tick(struct rtimer *timer, void *arg)
+{
+    struct server *s = (struct server*)arg;
+    int64_t now = get_absolute_time(0);
+    size_t n = 0, kept = 0;
+
+    LOCK(&s->throttle_lock);
+    if (s->resuming_capa < s->throttled_len) {
+        session_t *resuming = (session_t*)realloc(s->resuming, s->throttled_capa * sizeof(session_t));
+        if (resuming) {
+            s->resuming = resuming;
+            s->resuming_capa = s->throttled_capa;
+        }
+    }
+    for (size_t i = 0; i < s->throttled_len; ++i) {
+        session_t session = s->throttled[i];
+        if (session->throttled_until <= now && n < s->resuming_capa)
+            s->resuming[n++] = session;
+        else
+            s->throttled[kept++] = session;
+    }
+    s->throttled_len = kept;
+    int arm = s->throttle_armed = kept > 0;
+    UNLOCK(&s->throttle_lock);
+
+    for (size_t i = 0; i < n; ++i) {
+        session_t session = s->resuming[i];
+        if (reactor_asyn_read(REACTOR_INST, &session->f, -1, _on_read, session) != REACTER_OK)
+            _server_session_close(s, session);
+    }
+    if (arm)
+        _server_arm_throttle(s);
+    return 0;
+}
+
+static int
+_on_read(struct rfile *file, void *buffer, ssize_t len, void *arg)
+{
+    session_t session = (session_t)arg;
+    struct server *s = session->server;
+
+    /*a read is armed already, it goes on*/
+    if (len == REACTER_BUSY)
+        return 0;
+    if (len > 0)
+        session_touch_read(s->session_mgr, session);
+    if (len <= 0 || _server_receive(s, session, buffer, len) != 0) {
+        _server_session_close(s, session);
+        return 0;
+    }
+    if (session->rate) {
+        int32_t wait = session_take_tokens(session, len, get_absolute_time(0));
+        if (wait > 0) {
+            _server_throttle(s, session, wait);
+            return 0;
+        }
+    }
+    if (reactor_asyn_read(REACTOR_INST, &session->f, -1, _on_read, session) != REACTER_OK)
+        _server_session_close(s, session);
+    return 0;
+}
+
+static int
+_server_session_start(struct server *s, int fd, int (*on_start)(session_t))
+{
+    session_t session = session_alloc(s->session_mgr, fd);
+    if (!session) {
+        close(fd);
+        return -1;
+    }
+    session->server = s;
+    if (s->framing)
+        frame_decoder_init(&session->frames, &s->frame_format);
+    session_timeout_start(s->session_mgr, session);
+    if (s->rate)
+        session_set_rate(session, s->rate, s->burst);
+
+    if (on_start && on_start(session) != 0) {
+        _server_session_close(s, session);
+        return -1;
+    }
+    if (reactor_asyn_read(REACTOR_INST, &session->f, -1, _on_read, session) != REACTER_OK) {
+        _server_session_close(s, session);
+        return -1;
+    }
+    return 0;
 }
 
 static int
-_on_read(struct rfile *file, void *buffer, ssize_t len, void *s)
+_on_accept(struct rfile *file, int client_fd, struct sockaddr *client_addr, socklen_t len, void *arg)
 {
+    struct listener *listener = (struct listener*)arg;
+    if (client_fd == REACTER_BUSY)
+        return 0;
 
+    /*the accept event is done after one wakeup, which may accept several
+     * clients. each of them arms it again, the reactor turns down all but
+     * the first. if a handover stopped the listener meanwhile, the re-arm
+     * may have been posted after its removal, so remove it again*/
+    if (!__atomic_load_n(&listener->stopped, __ATOMIC_SEQ_CST)) {
+        reactor_asyn_accept(REACTOR_INST, &listener->f, -1, _on_accept, listener);
+        if (__atomic_load_n(&listener->stopped, __ATOMIC_SEQ_CST))
+            reactor_del_file(REACTOR_INST, listener->f.fd);
+    }
+    if (client_fd < 0)
+        return 0;
+
+    _server_session_start(listener->server, client_fd, listener->server->on_newconnect);
+    return 0;
 }
 
 static int
-_on_accept(struct rfile *file, int client_fd, struct sockaddr *client_addr, socklen_t len, void *s)
+_on_connect(struct rfile *file, int fd, void *arg)
 {
+    struct server *s = (struct server*)arg;
 
+    if (fd < 0) {
+        close(file->fd);
+        return 0;
+    }
+    _server_session_start(s, file->fd, s->on_connected);
+    return 0;
 }
 
 int
 server_listen(server_t s)
 {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (!s->addr)
+        return -1;
+    return server_add_listener(s, s->addr, SERVER_BACKLOG, 0);
+}
+
+/*a socket file left behind by a dead process would fail the bind. it is
+ * dead if nobody accepts on it: -1 if somebody does, the path is theirs*/
+static int
+_server_unlink_stale(struct sockaddr_storage *ss, socklen_t len)
+{
+    struct stat st;
+    const char *path = ((struct sockaddr_un*)ss)->sun_path;
+    if (stat(path, &st) < 0 || !S_ISSOCK(st.st_mode))
+        return 0;
+
+    /*nonblocking, a full backlog is somebody too*/
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+    int ret = connect(fd, (struct sockaddr*)ss, len);
+    int err = errno;
+    close(fd);
+    if (ret == 0 || (err != ECONNREFUSED && err != ENOENT))
+        return -1;
+    unlink(path);
+    return 0;
+}
+
+static int
+_server_bind(struct sockaddr_storage *ss, socklen_t len, int backlog, int flags)
+{
+    int fd = socket(ss->ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    int on = 1;
+    if (ss->ss_family == AF_UNIX) {
+        if (_server_unlink_stale(ss, len) < 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (ss->ss_family == AF_INET6)
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+        if ((flags & SERVER_REUSEPORT) &&
+                setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
 
-    char *strport = strchr(s->addr, ':');
-    *strport = '\0';
-    strport += 1;
+    if (bind(fd, (struct sockaddr*)ss, len) < 0 ||
+            listen(fd, backlog > 0 ? backlog : SERVER_BACKLOG) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = PF_INET;
-    server_addr.sin_port = htons(strtol(strport, NULL, 10));
-    inet_pton(AF_INET, s->addr, (void*)&server_addr.sin_addr);
+/*takes fd over, closes it on failure*/
+static int
+_server_add_listener_fd(server_t s, int fd, const char *addr)
+{
+    if (s->listener_num == s->listener_capa) {
+        int capa = s->listener_capa ? s->listener_capa * 2 : INIT_LISTERNER_LEN;
+        struct listener **listeners =
+            (struct listener**)realloc(s->listeners, capa * sizeof(struct listener*));
+        if (!listeners) {
+            close(fd);
+            return -1;
+        }
+        s->listeners = listeners;
+        s->listener_capa = capa;
+    }
 
-    if (bind(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+    struct listener *listener = (struct listener*)calloc(1, sizeof(struct listener));
+    if (!listener) {
         close(fd);
         return -1;
     }
-    listen(fd, 1024);
+    listener->f.fd = fd;
+    listener->server = s;
+    listener->addr = strdup(addr);
+    s->listeners[s->listener_num++] = listener;
+
+    return reactor_asyn_accept(REACTOR_INST, &listener->f, -1, _on_accept, listener);
+}
 
-    //struct rfile *listener = s->listeners + s->listener_num++;
-    s->listener.fd = fd;
-    reactor_asyn_accept(REACTOR_INST, &s->listener, -1, _on_accept, s);
+int
+server_add_listener(server_t s, const char *addr, int backlog, int flags)
+{
+    struct sockaddr_storage ss;
+    socklen_t len;
+    if (parse_addr(addr, &ss, &len) < 0)
+        return -1;
+
+    int fd = _server_bind(&ss, len, backlog, flags);
+    if (fd < 0)
+        return -1;
+    return _server_add_listener_fd(s, fd, addr);
+}
+
+static void
+_set_rcvtimeo(int fd, int32_t mtime)
+{
+    struct timeval tv;
+    tv.tv_sec = mtime / 1000;
+    tv.tv_usec = mtime % 1000 * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+/*
+ * One message carries all listener fds as SCM_RIGHTS, and their addresses
+ * separated by '\n' as data. The new process answers with one byte once
+ * it accepts on them. At most SERVER_HANDOVER_MAX go, and only as many as
+ * the addresses fit: the indexes of those sent are left in sent.
+ */
+static int
+_server_send_listeners(server_t s, int fd, int *sent)
+{
+    char data[SERVER_HANDOVER_MAX * 64];
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * SERVER_HANDOVER_MAX)];
+    } control;
+    int fds[SERVER_HANDOVER_MAX];
+    int n = 0;
+    size_t len = 0;
+
+    for (int i = 0; i < s->listener_num && n < SERVER_HANDOVER_MAX; ++i) {
+        struct listener *listener = s->listeners[i];
+        size_t addrlen = strlen(listener->addr);
+        if (listener->stopped || len + addrlen + 1 > sizeof(data))
+            continue;
+        memcpy(data + len, listener->addr, addrlen);
+        data[len + addrlen] = '\n';
+        len += addrlen + 1;
+        sent[n] = i;
+        fds[n++] = listener->f.fd;
+    }
+    if (n == 0)
+        return -1;
+
+    struct iovec iov = {data, len};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n);
+
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) != len)
+        return -1;
+    return n;
+}
+
+static int _on_handover(struct rfile *file, int fd, struct sockaddr *addr, socklen_t len, void *arg);
+
+static int
+_on_handover_ack(struct rfile *file, void *buffer, ssize_t len, void *arg)
+{
+    struct server *s = (struct server*)arg;
+    if (len == REACTER_BUSY)
+        return 0;
+    int peer = s->handover_peer.fd;
+    s->handover_peer.fd = -1;
+
+    /*no ack in time: the listeners and the path stay ours, wait for the
+     * next try on the same control socket*/
+    if (len != 1 || *(char*)buffer != '1') {
+        close(peer);
+        reactor_asyn_accept(REACTOR_INST, &s->handover, -1, _on_handover, s);
+        return 0;
+    }
+
+    /*only the sockets sent stop, the others go on accepting here. they
+     * stay open until the server is destroyed, so that their fds are
+     * never reused under a re-arm*/
+    for (int i = 0; i < s->handover_sent_num; ++i) {
+        struct listener *listener = s->listeners[s->handover_sent[i]];
+        __atomic_store_n(&listener->stopped, 1, __ATOMIC_SEQ_CST);
+        reactor_del_file(REACTOR_INST, listener->f.fd);
+    }
+    s->handover_sent_num = 0;
+
+    /*the new process waits for the path to be free before it returns
+     * from server_takeover, the close of its connection tells it*/
+    unlink(s->handover_path);
+    free(s->handover_path);
+    s->handover_path = NULL;
+    close(s->handover.fd);
+    s->handover.fd = -1;
+    close(peer);
+    if (s->on_handover)
+        s->on_handover(s);
     return 0;
 }
+
+/*runs in a worker, so nothing here blocks: the ack is read by the reactor*/
+static int
+_on_handover(struct rfile *file, int fd, struct sockaddr *addr, socklen_t len, void *arg)
+{
+    struct server *s = (struct server*)arg;
+    if (fd == REACTER_BUSY)
+        return 0;
+    if (fd < 0) {
+        reactor_asyn_accept(REACTOR_INST, &s->handover, -1, _on_handover, s);
+        return 0;
+    }
+
+    /*the accept is armed again only once this handover is over*/
+    int n = _server_send_listeners(s, fd, s->handover_sent);
+    if (n >= 0) {
+        s->handover_sent_num = n;
+        s->handover_peer.fd = fd;
+        if (reactor_asyn_read(REACTOR_INST, &s->handover_peer, SERVER_HANDOVER_TIMEOUT,
+                    _on_handover_ack, s) == REACTER_OK)
+            return 0;
+        s->handover_peer.fd = -1;
+    }
+    close(fd);
+    reactor_asyn_accept(REACTOR_INST, &s->handover, -1, _on_handover, s);
+    return 0;
+}
+
+int
+server_enable_handover(server_t s, const char *path, handover_cb on_handover)
+{
+    char addr[128];
+    if (s->handover.fd >= 0 || snprintf(addr, sizeof(addr), "unix:%s", path) >= sizeof(addr))
+        return -1;
+
+    struct sockaddr_storage ss;
+    socklen_t len;
+    if (parse_addr(addr, &ss, &len) < 0)
+        return -1;
+
+    int fd = _server_bind(&ss, len, 1, 0);
+    if (fd < 0)
+        return -1;
+    s->handover.fd = fd;
+    s->handover_path = strdup(path);
+    s->on_handover = on_handover;
+    return reactor_asyn_accept(REACTOR_INST, &s->handover, -1, _on_handover, s);
+}
+
+int
+server_takeover(server_t s, const char *path)
+{
+    struct sockaddr_un sun;
+    if (strlen(path) >= sizeof(sun.sun_path))
+        return -1;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0) {
+        close(fd);
+        return errno == ENOENT || errno == ECONNREFUSED ? 0 : -1;
+    }
+    _set_rcvtimeo(fd, SERVER_HANDOVER_TIMEOUT);
+
+    char data[SERVER_HANDOVER_MAX * 64 + 1];
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * SERVER_HANDOVER_MAX)];
+    } control;
+    struct iovec iov = {data, sizeof(data) - 1};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    struct cmsghdr *cmsg = len > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        close(fd);
+        return -1;
+    }
+    int fds[SERVER_HANDOVER_MAX];
+    int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * n);
+    data[len] = '\0';
+
+    /*every fd received is ours, adopted or closed*/
+    int adopted = 0;
+    char *addr = data;
+    for (int i = 0; i < n; ++i) {
+        char *end = addr ? strchr(addr, '\n') : NULL;
+        if (!end || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+            close(fds[i]);
+            addr = NULL;
+            continue;
+        }
+        *end = '\0';
+        if (_server_add_listener_fd(s, fds[i], addr) == REACTER_OK)
+            adopted++;
+        addr = end + 1;
+    }
+
+    /*accepting now, the old process may stop. it closes the connection
+     * once it let go of the path*/
+    int ok = adopted == n && write(fd, "1", 1) == 1;
+    if (ok) {
+        char c;
+        while (read(fd, &c, 1) > 0);
+    }
+    close(fd);
+    return ok ? adopted : -1;
+}
+
+void
+server_stats_snapshot(server_t s, struct server_stats *stats)
+{
+    reactor_stats_snapshot(REACTOR_INST, &stats->reactor);
+    stats->sessions = session_manager_len(s->session_mgr);
+    stats->listeners = 0;
+    for (int i = 0; i < s->listener_num; ++i) {
+        if (!__atomic_load_n(&s->listeners[i]->stopped, __ATOMIC_RELAXED))
+            stats->listeners++;
+    }
+    LOCK(&s->throttle_lock);
+    stats->throttled = s->throttled_len;
+    UNLOCK(&s->throttle_lock);
+
+    stats->workers = 0;
+    if (s->prefork) {
+        server_prefork_stats(s, stats->reactor.process_counters);
+        for (int i = 0; i < s->prefork->workers; ++i) {
+            if (__atomic_load_n(&s->prefork->shm[i].pid, __ATOMIC_RELAXED))
+                stats->workers++;
+        }
+    }
+}
+
+int
+server_stats_format(const struct server_stats *stats, char *buf, size_t len)
+{
+    int n = snprintf(buf, len, "sessions %zu\nlisteners %zu\nthrottled %zu\nworkers %zu\n",
+            stats->sessions, stats->listeners, stats->throttled, stats->workers);
+    if (n < 0)
+        return n;
+    int m = reactor_stats_format(&stats->reactor, buf + ((size_t)n < len ? n : len),
+            (size_t)n < len ? len - n : 0);
+    return m < 0 ? m : n + m;
+}
+
+static void
+_server_dump_stats(struct server *s, int fd)
+{
+    struct server_stats stats;
+    char text[SERVER_STATS_SIZE];
+    server_stats_snapshot(s, &stats);
+    int n = server_stats_format(&stats, text, sizeof(text));
+    if (n > 0) {
+        if (n >= sizeof(text))
+            n = sizeof(text) - 1;
+        ssize_t ret = write(fd, text, n);
+        (void)ret;
+    }
+    close(fd);
+}
+
+static int
+_on_stats(struct rfile *file, int fd, struct sockaddr *addr, socklen_t len, void *arg)
+{
+    struct server *s = (struct server*)arg;
+    if (fd == REACTER_BUSY)
+        return 0;
+    reactor_asyn_accept(REACTOR_INST, &s->stats_file, -1, _on_stats, s);
+    if (fd >= 0)
+        _server_dump_stats(s, fd);
+    return 0;
+}
+
+int
+server_enable_stats(server_t s, const char *path)
+{
+    char addr[128];
+    if (s->stats_file.fd >= 0 || snprintf(addr, sizeof(addr), "unix:%s", path) >= sizeof(addr))
+        return -1;
+
+    struct sockaddr_storage ss;
+    socklen_t len;
+    if (parse_addr(addr, &ss, &len) < 0)
+        return -1;
+
+    int fd = _server_bind(&ss, len, 16, 0);
+    if (fd < 0)
+        return -1;
+    s->stats_file.fd = fd;
+    s->stats_path = strdup(path);
+    return reactor_asyn_accept(REACTOR_INST, &s->stats_file, -1, _on_stats, s);
+}
+
+/*a listener fd inherited from the master, dropped in a worker*/
+static void
+_server_drop_fd(struct rfile *file, char **path)
+{
+    if (file->fd < 0)
+        return;
+    close(file->fd);
+    file->fd = -1;
+    free(*path);
+    *path = NULL;
+}
+
+/*in the child: the reactor and the threads of the master did not survive
+ * the fork, the listeners go to a reactor of its own*/
+static int
+_server_worker_init(struct server *s, int index)
+{
+    struct prefork *p = s->prefork;
+
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    rstats_arena_attach(p->shm[index].slots);
+    reactor_instance_drop();
+    thread_pool_instance_drop();
+    /*the shared memory stays mapped, the threads count into it*/
+    s->prefork = NULL;
+    s->worker = index;
+    s->throttle_armed = 0;
+    _server_drop_fd(&s->stats_file, &s->stats_path);
+    _server_drop_fd(&s->handover, &s->handover_path);
+    if (s->handover_peer.fd >= 0) {
+        close(s->handover_peer.fd);
+        s->handover_peer.fd = -1;
+    }
+
+    for (int i = 0; i < s->listener_num; ++i) {
+        struct listener *listener = s->listeners[i];
+        if (listener->stopped)
+            continue;
+        if (listener->f.fd < 0) {
+            listener->f.fd = _server_bind(p->addrs + i, p->lens[i], 0, SERVER_REUSEPORT);
+            if (listener->f.fd < 0)
+                return -1;
+        }
+        if (reactor_asyn_accept(REACTOR_INST, &listener->f, -1, _on_accept, listener) != REACTER_OK)
+            return -1;
+    }
+
+    if (s->timer_id) {
+        struct rtimer timer;
+        timer.timer_id = s->timer_id;
+        timer.mtime = SESSION_WHEEL_TICK;
+        timer.repeat = 1;
+        if (reactor_add_timer(REACTOR_INST, &timer, _on_tick, s) != REACTER_OK)
+            return -1;
+    }
+    return 0;
+}
+
+/*0 in the child*/
+static pid_t
+_server_fork(struct server *s, int index)
+{
+    struct prefork_worker *w = s->prefork->shm + index;
+    /*a new worker goes on with the counts of the dead one*/
+    rstats_arena_init(w->slots, SERVER_PREFORK_SLOTS);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (_server_worker_init(s, index) < 0)
+            _exit(1);
+        return 0;
+    }
+    if (pid > 0) {
+        w->started = get_absolute_time(0);
+        __atomic_store_n(&w->pid, pid, __ATOMIC_RELEASE);
+    }
+    return pid;
+}
+
+/*the number of workers still running*/
+static int
+_server_reap(struct server *s)
+{
+    struct prefork *p = s->prefork;
+    int alive = 0;
+
+    for (int i = 0; i < p->workers; ++i) {
+        struct prefork_worker *w = p->shm + i;
+        int status;
+        if (!w->pid)
+            continue;
+        if (waitpid(w->pid, &status, WNOHANG) == w->pid) {
+            /*one that fails its init or crashes at once must not be
+             * forked again every tick*/
+            int64_t now = get_absolute_time(0);
+            if (now - w->started >= SERVER_PREFORK_BACKOFF_MAX)
+                w->backoff = 0;
+            else if (!w->backoff)
+                w->backoff = SERVER_PREFORK_TICK;
+            else if ((w->backoff *= 2) > SERVER_PREFORK_BACKOFF_MAX)
+                w->backoff = SERVER_PREFORK_BACKOFF_MAX;
+            w->restart_at = now + w->backoff;
+            __atomic_store_n(&w->pid, 0, __ATOMIC_RELEASE);
+            if (!__atomic_load_n(&p->stopping, __ATOMIC_RELAXED))
+                __atomic_add_fetch(&w->restarts, 1, __ATOMIC_RELEASE);
+        } else {
+            alive++;
+        }
+    }
+    return alive;
+}
+
+/*a tick of the master, serving the stats endpoint meanwhile*/
+static void
+_server_master_wait(struct server *s)
+{
+    struct pollfd pfd = {s->stats_file.fd, POLLIN, 0};
+    if (poll(&pfd, s->stats_file.fd >= 0, SERVER_PREFORK_TICK) == 1) {
+        int fd = accept(s->stats_file.fd, NULL, NULL);
+        if (fd >= 0)
+            _server_dump_stats(s, fd);
+    }
+}
+
+static void
+_server_stop_workers(struct server *s)
+{
+    struct prefork *p = s->prefork;
+    for (int i = 0; i < p->workers; ++i) {
+        if (p->shm[i].pid)
+            kill(p->shm[i].pid, SIGTERM);
+    }
+
+    int64_t deadline = get_absolute_time(SERVER_PREFORK_STOP_TIMEOUT);
+    while (_server_reap(s) > 0) {
+        if (get_absolute_time(0) >= deadline) {
+            for (int i = 0; i < p->workers; ++i) {
+                if (p->shm[i].pid)
+                    kill(p->shm[i].pid, SIGKILL);
+            }
+        }
+        poll(NULL, 0, SERVER_PREFORK_TICK / 10);
+    }
+}
+
+int
+server_prefork(server_t s, int workers)
+{
+    if (workers <= 0 || s->prefork || s->worker >= 0)
+        return -1;
+
+    struct prefork *p = (struct prefork*)calloc(1, sizeof(struct prefork));
+    if (!p)
+        return -1;
+    p->workers = workers;
+    p->stopping = 0;
+    p->shm = (struct prefork_worker*)mmap(NULL, sizeof(struct prefork_worker) * workers,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    p->addrs = (struct sockaddr_storage*)calloc(s->listener_num + 1, sizeof(struct sockaddr_storage));
+    p->lens = (socklen_t*)calloc(s->listener_num + 1, sizeof(socklen_t));
+    p->reuseport = (int*)calloc(s->listener_num + 1, sizeof(int));
+    if (p->shm == MAP_FAILED || !p->addrs || !p->lens || !p->reuseport) {
+        if (p->shm != MAP_FAILED)
+            munmap(p->shm, sizeof(struct prefork_worker) * workers);
+        free(p->addrs);
+        free(p->lens);
+        free(p->reuseport);
+        free(p);
+        return -1;
+    }
+    s->prefork = p;
+
+    for (int i = 0; i < s->listener_num; ++i) {
+        struct listener *listener = s->listeners[i];
+        if (listener->stopped)
+            continue;
+        int on = 0;
+        socklen_t len = sizeof(on);
+        p->lens[i] = sizeof(struct sockaddr_storage);
+        getsockname(listener->f.fd, (struct sockaddr*)(p->addrs + i), p->lens + i);
+        p->reuseport[i] = getsockopt(listener->f.fd, SOL_SOCKET, SO_REUSEPORT, &on, &len) == 0 && on;
+        /*the master never accepts*/
+        reactor_del_file(REACTOR_INST, listener->f.fd);
+    }
+
+    int started = 0;
+    for (int i = 0; i < workers; ++i) {
+        pid_t pid = _server_fork(s, i);
+        if (pid == 0)
+            return i;
+        if (pid < 0 || started++)
+            continue;
+        /*the first worker keeps the SO_REUSEPORT sockets bound so far, the
+         * others bind their own: no connection lands on a socket nobody
+         * accepts on*/
+        for (int j = 0; j < s->listener_num; ++j) {
+            if (p->reuseport[j] && s->listeners[j]->f.fd >= 0) {
+                close(s->listeners[j]->f.fd);
+                s->listeners[j]->f.fd = -1;
+            }
+        }
+    }
+    if (!started)
+        return -1;
+
+    while (!__atomic_load_n(&p->stopping, __ATOMIC_ACQUIRE)) {
+        _server_reap(s);
+        int64_t now = get_absolute_time(0);
+        for (int i = 0; i < workers; ++i) {
+            if (!p->shm[i].pid && now >= p->shm[i].restart_at && _server_fork(s, i) == 0)
+                return i;
+        }
+        _server_master_wait(s);
+    }
+    _server_stop_workers(s);
+    return SERVER_PREFORK_MASTER;
+}
+
+void
+server_prefork_stop(server_t s)
+{
+    if (s->prefork)
+        __atomic_store_n(&s->prefork->stopping, 1, __ATOMIC_RELEASE);
+}
+
+void
+server_prefork_stats(server_t s, uint64_t counters[RSTAT_NUM])
+{
+    for (int i = 0; i < RSTAT_NUM; ++i)
+        counters[i] = 0;
+    if (!s->prefork)
+        return;
+    for (int i = 0; i < s->prefork->workers; ++i)
+        rstats_arena_sum(s->prefork->shm[i].slots, SERVER_PREFORK_SLOTS, counters);
+}
+
+int
+server_connect(server_t s, const char *addr)
+{
+    struct sockaddr_storage peer_addr;
+    socklen_t len;
+    if (parse_addr(addr, &peer_addr, &len) < 0)
+        return -1;
+
+    int fd = socket(peer_addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    struct rfile file;
+    file.fd = fd;
+    if (reactor_asyn_connect(REACTOR_INST, &file, (struct sockaddr*)&peer_addr, len,
+                -1, _on_connect, s) != REACTER_OK) {
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+/*called with out_lock held*/
+static void
+_session_drop_output(struct server *s, session_t session)
+{
+    struct out_node *node = session->out_head;
+    while (node) {
+        struct out_node *next = node->next;
+        rbuf_unref(node->buf);
+        objcache_free(node);
+        node = next;
+    }
+    session->out_head = session->out_tail = NULL;
+    session->out_offset = 0;
+    session->out_bytes = 0;
+}
+
+static void
+_server_out_close(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    reactor_del_file(REACTOR_INST, fd);
+    close(fd);
+}
+
+static void _server_flush(void *arg);
+
+/*the ids could not be listed: unmark them, so that the next send lists
+ * them again instead of leaving their output behind for good*/
+static void
+_server_unmark_dirty(struct server *s, const session_id_t *ids, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        session_t session = session_get(s->session_mgr, ids[i]);
+        if (!session)
+            continue;
+        pthread_mutex_lock(&session->out_lock);
+        if (session->session_id == ids[i])
+            session->out_dirty = 0;
+        pthread_mutex_unlock(&session->out_lock);
+    }
+}
+
+/*list sessions for the next flush, and post it unless it is posted*/
+static void
+_server_mark_dirty(struct server *s, const session_id_t *ids, size_t n)
+{
+    LOCK(&s->flush_lock);
+    if (s->dirty_len + n > s->dirty_capa) {
+        size_t capa = s->dirty_capa ? s->dirty_capa : 64;
+        while (capa < s->dirty_len + n)
+            capa *= 2;
+        session_id_t *dirty = (session_id_t*)realloc(s->dirty, capa * sizeof(session_id_t));
+        if (!dirty) {
+            UNLOCK(&s->flush_lock);
+            _server_unmark_dirty(s, ids, n);
+            return;
+        }
+        s->dirty = dirty;
+        s->dirty_capa = capa;
+    }
+    memcpy(s->dirty + s->dirty_len, ids, n * sizeof(session_id_t));
+    s->dirty_len += n;
+    int post = !s->flush_posted;
+    s->flush_posted = 1;
+    UNLOCK(&s->flush_lock);
+
+    if (post)
+        reactor_post(REACTOR_INST, _server_flush, s);
+}
+
+/*return whether the session has to be listed for a flush*/
+static int
+_session_enqueue(struct server *s, session_t session, session_id_t id, struct rbuf *buf, int *dirty)
+{
+    *dirty = 0;
+    pthread_mutex_lock(&session->out_lock);
+    if (session->session_id != id || session->out_closed ||
+            session->out_bytes + buf->len > SERVER_OUT_MAX) {
+        pthread_mutex_unlock(&session->out_lock);
+        return -1;
+    }
+    struct out_node *node = (struct out_node*)objcache_alloc(s->out_cache);
+    if (!node) {
+        pthread_mutex_unlock(&session->out_lock);
+        return -1;
+    }
+    node->buf = rbuf_ref(buf);
+    node->next = NULL;
+    if (session->out_tail)
+        session->out_tail->next = node;
+    else
+        session->out_head = node;
+    session->out_tail = node;
+    session->out_bytes += buf->len;
+
+    /*an armed session is flushed once it is writable*/
+    if (!session->out_dirty && !session->out_armed) {
+        session->out_dirty = 1;
+        *dirty = 1;
+    }
+    pthread_mutex_unlock(&session->out_lock);
+    return 0;
+}
+
+int
+server_send(server_t s, session_t session, struct rbuf *buf)
+{
+    int dirty;
+    session_id_t id = __atomic_load_n(&session->session_id, __ATOMIC_ACQUIRE);
+    if (buf->len == 0)
+        return 0;
+    if (_session_enqueue(s, session, id, buf, &dirty) < 0)
+        return -1;
+    if (dirty)
+        _server_mark_dirty(s, &id, 1);
+    return 0;
+}
+
+size_t
+server_broadcast(server_t s, const session_id_t *ids, size_t n, struct rbuf *buf)
+{
+    session_id_t batch[256];
+    size_t batch_len = 0, queued = 0;
+    int dirty;
+
+    if (buf->len == 0)
+        return 0;
+    for (size_t i = 0; i < n; ++i) {
+        session_t session = session_get(s->session_mgr, ids[i]);
+        if (!session || _session_enqueue(s, session, ids[i], buf, &dirty) < 0)
+            continue;
+        queued++;
+        if (dirty)
+            batch[batch_len++] = ids[i];
+        if (batch_len == sizeof(batch) / sizeof(batch[0])) {
+            _server_mark_dirty(s, batch, batch_len);
+            batch_len = 0;
+        }
+    }
+    if (batch_len > 0)
+        _server_mark_dirty(s, batch, batch_len);
+    return queued;
+}
+
+static int
+_on_writable(struct rfile *file, void *buffer, ssize_t len, void *arg)
+{
+    session_t session = (session_t)arg;
+    struct server *s = session->server;
+
+    if (len == REACTER_BUSY)
+        return 0;
+    pthread_mutex_lock(&session->out_lock);
+    if (!session->out_armed || file->fd != session->out_fd) {
+        pthread_mutex_unlock(&session->out_lock);
+        return 0;
+    }
+    session->out_armed = 0;
+    int dirty = !session->out_dirty;
+    session->out_dirty = 1;
+    session_id_t id = session->session_id;
+    pthread_mutex_unlock(&session->out_lock);
+
+    if (dirty)
+        _server_mark_dirty(s, &id, 1);
+    return 0;
+}
+
+/*in the loop with out_lock held: wait for the socket to drain. the read of
+ * the session is armed on its fd, so readiness is watched on a dup*/
+static int
+_session_arm_write(struct server *s, session_t session)
+{
+    if (session->out_fd < 0 && (session->out_fd = dup(session->f.fd)) < 0)
+        return -1;
+    struct rfile file;
+    file.fd = session->out_fd;
+    if (reactor_asyn_write(REACTOR_INST, &file, NULL, 0, -1, _on_writable, session) != REACTER_OK)
+        return -1;
+    session->out_armed = 1;
+    if (!session->write_since)
+        session_write_pending(s->session_mgr, session, true);
+    return 0;
+}
+
+static void
+_session_flush(struct server *s, session_t session, session_id_t id)
+{
+    struct iovec iov[SERVER_IOV_MAX];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+
+    pthread_mutex_lock(&session->out_lock);
+    if (session->session_id != id || session->out_armed) {
+        pthread_mutex_unlock(&session->out_lock);
+        return;
+    }
+    session->out_dirty = 0;
+
+    while (session->out_head) {
+        int cnt = 0;
+        size_t offset = session->out_offset;
+        for (struct out_node *node = session->out_head; node && cnt < SERVER_IOV_MAX; node = node->next) {
+            iov[cnt].iov_base = node->buf->data + offset;
+            iov[cnt].iov_len = node->buf->len - offset;
+            offset = 0;
+            cnt++;
+        }
+        msg.msg_iovlen = cnt;
+
+        ssize_t n = sendmsg(session->f.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        rstats_add(RSTAT_SYS_WRITE, 1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            /*a broken session is closed through its read*/
+            if (errno != EAGAIN || _session_arm_write(s, session) < 0)
+                _session_drop_output(s, session);
+            break;
+        }
+        session_touch_write(s->session_mgr, session);
+        rstats_add(RSTAT_BYTES_OUT, n);
+        session->out_bytes -= n;
+        n += session->out_offset;
+        while (session->out_head && n >= session->out_head->buf->len) {
+            struct out_node *node = session->out_head;
+            n -= node->buf->len;
+            session->out_head = node->next;
+            rbuf_unref(node->buf);
+            objcache_free(node);
+        }
+        session->out_offset = n;
+        if (!session->out_head)
+            session->out_tail = NULL;
+    }
+    if (!session->out_head && session->write_since)
+        session_write_pending(s->session_mgr, session, false);
+    pthread_mutex_unlock(&session->out_lock);
+}
+
+/*in the loop: write everything queued since the last flush*/
+static void
+_server_flush(void *arg)
+{
+    struct server *s = (struct server*)arg;
+
+    LOCK(&s->flush_lock);
+    session_id_t *ids = s->dirty;
+    size_t n = s->dirty_len;
+    size_t capa = s->dirty_capa;
+    s->dirty = s->flushing;
+    s->dirty_capa = s->flushing_capa;
+    s->dirty_len = 0;
+    s->flushing = ids;
+    s->flushing_capa = capa;
+    s->flush_posted = 0;
+    UNLOCK(&s->flush_lock);
+
+    for (size_t i = 0; i < n; ++i) {
+        session_t session = session_get(s->session_mgr, ids[i]);
+        if (session)
+            _session_flush(s, session, ids[i]);
+    }
+}
@@ -9,31 +9,221 @@
 #include "reactor.h"
 #include "reactor_event.h"
 #include "session.h"
+#include "frame.h"
+#include "buffer.h"
+#include "objcache.h"
 #include <stdint.h>
 
 #define INIT_LISTERNER_LEN 4
+#define SERVER_BACKLOG 1024
+#define SERVER_REUSEPORT 0x1      //listener flag: SO_REUSEPORT, for several processes on one port
+#define SERVER_HANDOVER_MAX 64        //listener fds passed in one hot restart
+#define SERVER_HANDOVER_TIMEOUT 5000  //ms the two processes wait for each other
+#define SERVER_OUT_MAX (4 << 20)      //bytes queued on a session before sends to it fail
+#define SERVER_IOV_MAX 64             //buffers written by one writev
+#define SERVER_TIMER_ID_BASE 0x40000000   //the timers of servers take ids from here
+#define SERVER_THROTTLE_TICK 10           //ms, granularity of the input rate limit
+#define SERVER_STATS_SIZE 2048            //bytes of a stats dump
+#define SERVER_PREFORK_SLOTS 16           //rstats slots in shared memory per worker, i.e. threads
+#define SERVER_PREFORK_TICK 100           //ms between two checks of the master on its workers
+#define SERVER_PREFORK_STOP_TIMEOUT 5000  //ms from SIGTERM to SIGKILL of the workers
+#define SERVER_PREFORK_BACKOFF_MAX 10000  //ms, the longest restart delay, and the run after which it resets
+#define SERVER_PREFORK_MASTER -2          //server_prefork returned in the master
 
+/*
+ * The callbacks run in the thread pool. A non-zero return from
+ * on_newconnect, on_receive or on_connected closes the session.
+ * With framing set, on_receive gets whole frames instead of raw chunks.
+ */
 typedef int (*newconnect_cb)(session_t);
 typedef int (*receive_cb)(session_t, void*, size_t);
 typedef int (*connected_cb)(session_t);
+typedef void (*close_cb)(session_t);
+/*return non-zero to keep the session, otherwise it is closed*/
+typedef int (*timeout_cb)(session_t, enum session_timeout);
+typedef void (*handover_cb)(struct server*);
+
+struct server;
+
+/*one per worker, in memory shared by the master and the workers*/
+struct prefork_worker {
+    struct rstats_slot slots[SERVER_PREFORK_SLOTS];
+    pid_t pid;                  //0 while down
+    int restarts;
+    int64_t started;            //ms
+    int32_t backoff;            //ms the last restart waited, 0 if the worker had run long
+    int64_t restart_at;         //ms, not forked again before
+};
+
+struct prefork {
+    int workers;
+    int stopping;
+    struct prefork_worker *shm;
+    struct sockaddr_storage *addrs;     //of the listeners, SO_REUSEPORT ones are bound again
+    socklen_t *lens;
+    int *reuseport;
+};
+
+struct listener {
+    struct rfile f;
+    struct server *server;
+    char *addr;
+    int stopped;                //handed over, no longer accepted on
+};
 
 struct server {
     char *addr;
-    struct rfile listener;
-    
+    struct listener **listeners;
+    int listener_num;
+    int listener_capa;
+
     /*callback functions*/
     newconnect_cb on_newconnect;
     receive_cb on_receive;
     connected_cb on_connected;
+    close_cb on_close;
+    timeout_cb on_timeout;
+
+    int framing;
+    struct frame_format frame_format;
 
     session_manager_t session_mgr;
+    int timer_id;               //sweeps the timeouts, 0 if not running
+
+    struct rfile handover;      //control socket of hot restart, -1 if none
+    char *handover_path;
+    handover_cb on_handover;
+    struct rfile handover_peer; //the new process waiting for its ack, -1 if none
+    int handover_sent[SERVER_HANDOVER_MAX];    //indexes of the listeners passed to it
+    int handover_sent_num;
+
+    /*sessions with output to write, flushed by the loop in one go*/
+    struct objcache *out_cache;     //struct out_node
+    lock_t flush_lock;
+    session_id_t *dirty;
+    size_t dirty_len;
+    size_t dirty_capa;
+    session_id_t *flushing;         //the batch being written, swapped with dirty
+    size_t flushing_capa;
+    int flush_posted;
+
+    /*sessions over their input rate, their reads are armed again by a timer*/
+    int64_t rate;                   //default limit of new sessions, 0 for none
+    int64_t burst;
+    int throttle_timer_id;
+    int throttle_armed;
+    lock_t throttle_lock;
+    session_t *throttled;
+    size_t throttled_len;
+    size_t throttled_capa;
+    session_t *resuming;            //taken off throttled by a tick
+    size_t resuming_capa;
+
+    struct rfile stats_file;        //unix socket dumping the stats, -1 if none
+    char *stats_path;
+
+    struct prefork *prefork;        //in the master of a prefork server
+    int worker;                     //index in a prefork worker, -1 otherwise
+};
+
+struct server_stats {
+    struct reactor_stats reactor;
+    size_t sessions;
+    size_t listeners;               //accepting, not handed over
+    size_t throttled;               //sessions over their input rate
+    size_t workers;                 //running, in the master of a prefork server
 };
 
 typedef struct server *server_t;
 
 server_t server_create(const char *addr, newconnect_cb, receive_cb, connected_cb);
 void server_destroy(server_t *s);
+/*called before the session is freed, whoever closed it*/
+void server_set_close_cb(server_t s, close_cb on_close);
+/*timeouts in ms, 0 disables one. the sweep reads the current values, so a
+ * change applies to every tracked session; sessions started while all of
+ * them were 0 are not tracked*/
+int server_set_timeouts(server_t s, int32_t idle, int32_t read, int32_t write);
+void server_set_timeout_cb(server_t s, timeout_cb on_timeout);
+/*the sessions the server can hold at once, SESSION_POOL_CAPA by default;
+ * a connection beyond is closed on accept. set before the server listens
+ * or connects*/
+int server_set_max_sessions(server_t s, size_t max_sessions);
+/*deliver length-prefixed frames to on_receive, set before the server
+ * listens or connects. a frame is valid during the call only; an
+ * oversized or malformed frame closes the session*/
+void server_set_framing(server_t s, const struct frame_format *format);
+/*limit the input of each session started afterwards to rate bytes per
+ * second, with bursts of burst bytes; rate 0 for no limit. a session over
+ * its rate is not read from, the kernel pushes back on the peer.
+ * session_set_rate changes the limit of one session*/
+void server_set_rate_limit(server_t s, int64_t rate, int64_t burst);
 
+/*
+ * Addresses are "ip:port", "[ipv6]:port" or "unix:/path". server_listen
+ * listens on the address given to server_create, if any, with the default
+ * backlog; server_add_listener adds another endpoint. A stale unix socket
+ * file is replaced, and removed again when the server is destroyed.
+ */
 int server_listen(server_t s);
+int server_add_listener(server_t s, const char *addr, int backlog, int flags);
+/*
+ * Hot restart. The running process calls server_enable_handover; the new
+ * one calls server_takeover on the same path before listening. The old
+ * process passes its listening sockets over the unix socket, the new one
+ * starts accepting on them, and only then does the old one stop: the
+ * accept queues are never closed, so no connection is refused. The old
+ * process keeps serving its sessions, on_handover tells it to drain.
+ * Listeners beyond SERVER_HANDOVER_MAX are not passed and keep accepting
+ * in the old process. The old process gives up the path once acked, and
+ * server_takeover returns after that, so the new one may enable a handover
+ * of its own at the path. Without an ack in SERVER_HANDOVER_TIMEOUT the
+ * old process keeps everything and waits for the next try.
+ */
+int server_enable_handover(server_t s, const char *path, handover_cb on_handover);
+/*the number of listeners taken over, 0 if no process hands over at path*/
+int server_takeover(server_t s, const char *path);
+
+/*a live view of the server and its reactor, taken without stopping either*/
+void server_stats_snapshot(server_t s, struct server_stats *stats);
+int server_stats_format(const struct server_stats *stats, char *buf, size_t len);
+/*every connection to the unix socket at path gets the text of
+ * server_stats_format and is closed, e.g. `nc -U path`*/
+int server_enable_stats(server_t s, const char *path);
+
+/*
+ * Prefork mode: call after listening, before the reactor runs. Forks
+ * that many worker processes, each with a reactor and a thread pool of
+ * its own, and returns in each its index; the worker then runs
+ * REACTOR_INST as usual. A listener added with SERVER_REUSEPORT gets a socket per worker,
+ * the others are shared by all. The master does not return: it restarts
+ * the workers that die, doubling the delay for one that keeps dying
+ * soon, and serves the stats endpoint with the counters of all workers,
+ * which count into shared memory, until server_prefork_stop.
+ * It then sends SIGTERM to the workers, waits for them and returns
+ * SERVER_PREFORK_MASTER; -1 if it could fork none. Workers get SIGTERM
+ * too if the thread calling server_prefork ends.
+ */
+int server_prefork(server_t s, int workers);
+/*async-signal-safe, from a handler or another thread of the master*/
+void server_prefork_stop(server_t s);
+/*the sums of all workers, dead ones included*/
+void server_prefork_stats(server_t s, uint64_t counters[RSTAT_NUM]);
+
+/*connect to an address of the forms above, on_connected gets the new session*/
+int server_connect(server_t s, const char *addr);
+/*-1 if the id is stale*/
+int server_close_session(server_t s, session_id_t id);
+
+/*
+ * Queue buf on the output of sessions without copying it, each session
+ * holds a reference until its write completes. The queues are written by
+ * the reactor loop, once per iteration for everything queued meanwhile,
+ * so bytes sent this way must not be mixed with direct writes to the fd.
+ * A session with SERVER_OUT_MAX bytes pending takes no more.
+ */
+int server_send(server_t s, session_t session, struct rbuf *buf);
+/*the number of sessions buf was queued on, stale ids are skipped*/
+size_t server_broadcast(server_t s, const session_id_t *ids, size_t n, struct rbuf *buf);
 
 #endif //_SERVER_H_
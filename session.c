@@ -4,5 +4,247 @@
  */
 
 #include "session.h"
+#include <stdlib.h>
 
+session_manager_t session_manager_create()
+{
+    return session_manager_create_for_all(SESSION_POOL_CAPA);
+}
 
+session_manager_t session_manager_create_for_all(size_t capacity)
+{
+    if (capacity == 0 || capacity > UINT32_MAX)
+        return NULL;
+
+    session_manager_t mgr = (struct session_manager*)calloc(1, sizeof(struct session_manager));
+    if (!mgr)
+        return NULL;
+    mgr->sessions = (struct session*)calloc(capacity, sizeof(struct session));
+    if (!mgr->sessions) {
+        free(mgr);
+        return NULL;
+    }
+    mgr->capacity = capacity;
+    mgr->len = 0;
+
+    for (size_t i = 0; i < capacity; ++i) {
+        mgr->sessions[i].f.fd = -1;
+        mgr->sessions[i].generation = 1;
+        mgr->sessions[i].next_free = i + 1;
+        mgr->sessions[i].wheel_slot = -1;
+        mgr->sessions[i].out_fd = -1;
+        pthread_mutex_init(&mgr->sessions[i].out_lock, NULL);
+    }
+    mgr->free_head = 0;
+    LOCK_INIT(&mgr->free_lock);
+
+    mgr->now = get_absolute_time(0);
+    mgr->wheel_tick = mgr->now / SESSION_WHEEL_TICK;
+    LOCK_INIT(&mgr->wheel_lock);
+    for (size_t i = 0; i < SESSION_WHEEL_SLOTS; ++i)
+        LIST_INIT(mgr->wheel + i);
+    return mgr;
+}
+
+void session_manager_destroy(session_manager_t *mgr)
+{
+    if (!mgr || !*mgr)
+        return;
+
+    for (size_t i = 0; i < (*mgr)->capacity; ++i)
+        pthread_mutex_destroy(&(*mgr)->sessions[i].out_lock);
+    LOCK_DESTROY(&(*mgr)->free_lock);
+    LOCK_DESTROY(&(*mgr)->wheel_lock);
+    free((*mgr)->sessions);
+    free(*mgr);
+    *mgr = NULL;
+}
+
+session_t session_alloc(session_manager_t mgr, int fd)
+{
+    LOCK(&mgr->free_lock);
+    if (mgr->free_head == mgr->capacity) {
+        UNLOCK(&mgr->free_lock);
+        return NULL;
+    }
+    session_t session = mgr->sessions + mgr->free_head;
+    mgr->free_head = session->next_free;
+    __atomic_add_fetch(&mgr->len, 1, __ATOMIC_RELAXED);
+    UNLOCK(&mgr->free_lock);
+
+    session->f.fd = fd;
+    session->data = NULL;
+    session->out_head = session->out_tail = NULL;
+    session->out_offset = 0;
+    session->out_bytes = 0;
+    session->out_dirty = 0;
+    session->out_armed = 0;
+    session->out_closed = 0;
+    session->rate = 0;
+    /*publish the id last, a lookup that matches it sees the fields above*/
+    __atomic_store_n(&session->session_id,
+            SESSION_ID(session->generation, session - mgr->sessions), __ATOMIC_RELEASE);
+    return session;
+}
+
+void session_free(session_manager_t mgr, session_t session)
+{
+    session_timeout_stop(mgr, session);
+    __atomic_store_n(&session->session_id, 0, __ATOMIC_RELEASE);
+    session->f.fd = -1;
+    /*0 is skipped, so no id is ever 0*/
+    if (++session->generation == 0)
+        session->generation = 1;
+
+    LOCK(&mgr->free_lock);
+    session->next_free = mgr->free_head;
+    mgr->free_head = session - mgr->sessions;
+    __atomic_sub_fetch(&mgr->len, 1, __ATOMIC_RELAXED);
+    UNLOCK(&mgr->free_lock);
+}
+
+session_t session_get(session_manager_t mgr, session_id_t id)
+{
+    uint32_t index = SESSION_INDEX(id);
+    if (id == 0 || index >= mgr->capacity)
+        return NULL;
+
+    session_t session = mgr->sessions + index;
+    if (__atomic_load_n(&session->session_id, __ATOMIC_ACQUIRE) != id)
+        return NULL;
+    return session;
+}
+
+size_t session_manager_len(session_manager_t mgr)
+{
+    return __atomic_load_n(&mgr->len, __ATOMIC_RELAXED);
+}
+
+void session_manager_set_timeouts(session_manager_t mgr, int32_t idle, int32_t read, int32_t write)
+{
+    LOCK(&mgr->wheel_lock);
+    mgr->idle_timeout = idle > 0 ? idle : 0;
+    mgr->read_timeout = read > 0 ? read : 0;
+    mgr->write_timeout = write > 0 ? write : 0;
+    UNLOCK(&mgr->wheel_lock);
+}
+
+/*the earliest deadline of the session and what runs out then, or
+ * INT64_MAX if none applies (only a write timeout and nothing pending)*/
+static int64_t _session_deadline(session_manager_t mgr, session_t session, enum session_timeout *reason)
+{
+    int64_t last_read = __atomic_load_n(&session->last_read, __ATOMIC_RELAXED);
+    int64_t last_write = __atomic_load_n(&session->last_write, __ATOMIC_RELAXED);
+    int64_t write_since = __atomic_load_n(&session->write_since, __ATOMIC_RELAXED);
+    int64_t deadline = INT64_MAX;
+
+    if (mgr->idle_timeout) {
+        deadline = (last_read > last_write ? last_read : last_write) + mgr->idle_timeout;
+        *reason = SESSION_TIMEOUT_IDLE;
+    }
+    if (mgr->read_timeout && last_read + mgr->read_timeout < deadline) {
+        deadline = last_read + mgr->read_timeout;
+        *reason = SESSION_TIMEOUT_READ;
+    }
+    if (mgr->write_timeout && write_since && write_since + mgr->write_timeout < deadline) {
+        deadline = write_since + mgr->write_timeout;
+        *reason = SESSION_TIMEOUT_WRITE;
+    }
+    return deadline;
+}
+
+static int32_t _session_min_timeout(session_manager_t mgr)
+{
+    int32_t min = 0;
+    if (mgr->idle_timeout)
+        min = mgr->idle_timeout;
+    if (mgr->read_timeout && (!min || mgr->read_timeout < min))
+        min = mgr->read_timeout;
+    if (mgr->write_timeout && (!min || mgr->write_timeout < min))
+        min = mgr->write_timeout;
+    return min;
+}
+
+/*link into the slot of the deadline, no earlier than the next tick. a
+ * deadline beyond the wheel comes around early and is linked again*/
+static void _session_link(session_manager_t mgr, session_t session, int64_t deadline)
+{
+    int64_t tick = (deadline + SESSION_WHEEL_TICK - 1) / SESSION_WHEEL_TICK;
+    if (tick <= mgr->wheel_tick)
+        tick = mgr->wheel_tick + 1;
+    session->wheel_slot = tick & (SESSION_WHEEL_SLOTS - 1);
+    LIST_INSERT_AT_TAIL(mgr->wheel + session->wheel_slot, session);
+}
+
+void session_timeout_start(session_manager_t mgr, session_t session)
+{
+    LOCK(&mgr->wheel_lock);
+    int32_t min = _session_min_timeout(mgr);
+    if (min && session->wheel_slot < 0) {
+        int64_t now = mgr->now;
+        session->last_read = now;
+        session->last_write = now;
+        session->write_since = 0;
+        _session_link(mgr, session, now + min);
+    }
+    UNLOCK(&mgr->wheel_lock);
+}
+
+void session_timeout_stop(session_manager_t mgr, session_t session)
+{
+    LOCK(&mgr->wheel_lock);
+    if (session->wheel_slot >= 0) {
+        LIST_ERASE(mgr->wheel + session->wheel_slot, session);
+        session->wheel_slot = -1;
+    }
+    UNLOCK(&mgr->wheel_lock);
+}
+
+size_t session_manager_expire(session_manager_t mgr, int64_t now, session_expire_cb cb, void *arg)
+{
+    size_t expired = 0;
+
+    LOCK(&mgr->wheel_lock);
+    __atomic_store_n(&mgr->now, now, __ATOMIC_RELAXED);
+    int64_t tick = now / SESSION_WHEEL_TICK;
+    int64_t t = mgr->wheel_tick + 1;
+    if (tick - t >= SESSION_WHEEL_SLOTS)
+        t = tick - SESSION_WHEEL_SLOTS + 1;
+    int32_t min = _session_min_timeout(mgr);
+
+    for (; t <= tick; ++t) {
+        session_list_t *slot = mgr->wheel + (t & (SESSION_WHEEL_SLOTS - 1));
+        session_t session = LIST_BEGIN(slot);
+        LIST_INIT(slot);
+        /*relinked sessions go to later ticks, never to the due list*/
+        mgr->wheel_tick = t;
+
+        while (session) {
+            session_t next = LIST_NEXT(session);
+            enum session_timeout reason = SESSION_TIMEOUT_IDLE;
+            int64_t deadline = _session_deadline(mgr, session, &reason);
+            session->wheel_slot = -1;
+
+            if (deadline == INT64_MAX) {
+                if (min)
+                    _session_link(mgr, session, now + min);
+            } else if (deadline > now) {
+                _session_link(mgr, session, deadline);
+            } else {
+                expired++;
+                if (cb && cb(session, reason, arg) != 0 && min) {
+                    session->last_read = now;
+                    session->last_write = now;
+                    if (session->write_since)
+                        session->write_since = now;
+                    _session_link(mgr, session, now + min);
+                }
+            }
+            session = next;
+        }
+    }
+    if (mgr->wheel_tick < tick)
+        mgr->wheel_tick = tick;
+    UNLOCK(&mgr->wheel_lock);
+    return expired;
+}
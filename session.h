@@ -6,24 +6,176 @@
 #ifndef _SESSION_H_
 #define _SESSION_H_
 
-#include "hashmap.h"
 #include "reactor_event.h"
+#include "comm.h"
+#include "macro_list.h"
+#include "frame.h"
+#include "buffer.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SESSION_POOL_CAPA 4096      //sessions preallocated by session_manager_create
+/*the timeout wheel: SESSION_WHEEL_SLOTS slots of SESSION_WHEEL_TICK ms*/
+#define SESSION_WHEEL_SLOTS 1024
+#define SESSION_WHEEL_TICK 100
+
+/*
+ * A session id is the index of the session in the pool (low 32 bits) and
+ * the generation of that slot (high 32 bits). The generation goes up
+ * every time the slot is freed, so an id held after its session closed
+ * no longer matches. 0 is never a valid id.
+ */
+typedef uint64_t session_id_t;
+
+#define SESSION_ID(gen, index) (((uint64_t)(gen) << 32) | (uint32_t)(index))
+#define SESSION_INDEX(id) ((uint32_t)(id))
+#define SESSION_GEN(id) ((uint32_t)((id) >> 32))
+
+struct server;
+
+/*a buffer queued on a session*/
+struct out_node {
+    struct rbuf *buf;
+    struct out_node *next;
+};
+
+enum session_timeout {
+    SESSION_TIMEOUT_IDLE = 0,   //neither read nor written
+    SESSION_TIMEOUT_READ,       //nothing read
+    SESSION_TIMEOUT_WRITE       //a pending write made no progress
+};
 
 struct session {
     struct rfile f;
-    int session_id;
+    session_id_t session_id;    //0 while the slot is free
+    uint32_t generation;
+    uint32_t next_free;
+    struct server *server;
+    void *data;                 //for the user
+    struct frame_decoder frames;    //if the server frames its input
+
+    /*output queue, filled by any thread and written by the loop. a mutex,
+     * not a lock_t: the flush holds it across sendmsg, which keeps the fd
+     * from being closed under it*/
+    pthread_mutex_t out_lock;
+    struct out_node *out_head;
+    struct out_node *out_tail;
+    size_t out_offset;          //bytes of out_head already written
+    size_t out_bytes;           //queued and not yet written
+    int out_dirty;              //listed for the next flush
+    int out_armed;              //waiting for out_fd to become writable
+    int out_closed;             //the session is closing, nothing more is queued
+    int out_fd;                 //dup of fd for write readiness, -1 if none
+
+    /*activity stamps in ms of the manager's coarse clock. touching them is
+     * a plain store, the wheel looks at them only when a slot comes due*/
+    int64_t last_read;
+    int64_t last_write;
+    int64_t write_since;        //0 if no write is pending
+    int wheel_slot;             //-1 if not in the wheel
+    struct session *__next__;
+    struct session *__prev__;
+
+    /*input rate limit, a token bucket in bytes. only the read callback of
+     * the session touches it*/
+    int64_t rate;               //bytes per second, 0 for no limit
+    int64_t burst;
+    int64_t tokens;             //in 1/1000 bytes, a ms refills rate. below 0 in debt
+    int64_t refilled;           //ms
+    int64_t throttled_until;    //ms, its next read is armed then
 };
 typedef struct session *session_t;
 
+typedef LIST(struct session) session_list_t;
+
+/*called with the wheel locked: it may write to the session, but must not
+ * start or stop its timeout. return non-zero to keep the session alive*/
+typedef int (*session_expire_cb)(session_t, enum session_timeout, void*);
+
 struct session_manager {
-    hashmap_t session_dict;     //session_id <-> session
-    int next_session_id;
+    struct session *sessions;   //never moves, so a lookup needs no lock
+    size_t capacity;
+    size_t len;
 
+    lock_t free_lock;
+    uint32_t free_head;         //index of the first free slot, capacity if none
 
+    int32_t idle_timeout;       //ms, 0 if disabled
+    int32_t read_timeout;
+    int32_t write_timeout;
+    int64_t now;                //coarse clock, advanced by session_manager_expire
+    int64_t wheel_tick;         //the last tick swept
+    lock_t wheel_lock;
+    session_list_t wheel[SESSION_WHEEL_SLOTS];
 };
 typedef struct session_manager *session_manager_t;
 
 session_manager_t session_manager_create();
-session_manager_destroy(session_manager_t *s);
+session_manager_t session_manager_create_for_all(size_t capacity);
+void session_manager_destroy(session_manager_t *mgr);
+
+/*NULL if the pool is exhausted*/
+session_t session_alloc(session_manager_t mgr, int fd);
+void session_free(session_manager_t mgr, session_t session);
+/*NULL if the id is stale or was never handed out*/
+session_t session_get(session_manager_t mgr, session_id_t id);
+size_t session_manager_len(session_manager_t mgr);
+
+/*0 disables one. the sweep reads the current values for every linked session;
+ * only session_timeout_start links one, and not while all of them are 0*/
+void session_manager_set_timeouts(session_manager_t mgr, int32_t idle, int32_t read, int32_t write);
+void session_timeout_start(session_manager_t mgr, session_t session);
+void session_timeout_stop(session_manager_t mgr, session_t session);
+/*sweep the slots due by `now` (ms). expired sessions are left out of the
+ * wheel unless cb keeps them. return the number of expired sessions*/
+size_t session_manager_expire(session_manager_t mgr, int64_t now, session_expire_cb cb, void *arg);
+
+static inline void session_touch_read(session_manager_t mgr, session_t session)
+{
+    __atomic_store_n(&session->last_read, __atomic_load_n(&mgr->now, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+/*some bytes went out*/
+static inline void session_touch_write(session_manager_t mgr, session_t session)
+{
+    int64_t now = __atomic_load_n(&mgr->now, __ATOMIC_RELAXED);
+    __atomic_store_n(&session->last_write, now, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&session->write_since, __ATOMIC_RELAXED))
+        __atomic_store_n(&session->write_since, now, __ATOMIC_RELAXED);
+}
+
+/*the write timeout only runs while a write is pending*/
+static inline void session_write_pending(session_manager_t mgr, session_t session, bool pending)
+{
+    __atomic_store_n(&session->write_since,
+            pending ? __atomic_load_n(&mgr->now, __ATOMIC_RELAXED) : 0, __ATOMIC_RELAXED);
+}
+
+/*rate bytes per second with bursts of burst bytes, rate 0 for no limit.
+ * the server sets its default when the session starts*/
+static inline void session_set_rate(session_t session, int64_t rate, int64_t burst)
+{
+    session->rate = rate;
+    session->burst = burst > 0 ? burst : rate;
+    session->tokens = session->burst * 1000;
+    session->refilled = get_absolute_time(0);
+}
+
+/*len bytes were read at now, the ms to wait until the bucket is out of
+ * debt, 0 if it is not*/
+static inline int32_t session_take_tokens(session_t session, size_t len, int64_t now)
+{
+    if (now > session->refilled) {
+        session->tokens += (now - session->refilled) * session->rate;
+        session->refilled = now;
+        if (session->tokens > session->burst * 1000)
+            session->tokens = session->burst * 1000;
+    }
+    session->tokens -= (int64_t)len * 1000;
+    if (session->tokens >= 0)
+        return 0;
+    return (int32_t)((-session->tokens + session->rate - 1) / session->rate);
+}
 
 #endif //_SESSION_H_
@@ -0,0 +1,304 @@
+/**
+ * @author: luyuhuang
+ * @brief: Data structure: an open addressing hash map (swiss table)
+ */
+
+#include "swissmap.h"
+#include "hash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CTRL_EMPTY      ((int8_t)-128)
+#define CTRL_DELETED    ((int8_t)-2)
+#define CTRL_IS_FULL(c) ((c) >= 0)
+
+/*the hash functions of the callers may be weak (e.g. identity for
+ * integers), spread them before taking bits for the position and tag*/
+static inline uint64_t _swissmap_hash(swissmap_t map, basic_value_t key)
+{
+    return hash_mix64(map->hs(key));
+}
+
+#define H1(h) ((h) >> 7)
+#define H2(h) ((int8_t)((h) & 0x7f))
+
+#ifdef __SSE2__
+
+static inline uint32_t _group_match(const int8_t *group, int8_t tag)
+{
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(tag), ctrl));
+}
+
+static inline uint32_t _group_match_empty(const int8_t *group)
+{
+    return _group_match(group, CTRL_EMPTY);
+}
+
+/*empty or deleted, i.e. the high bit is set*/
+static inline uint32_t _group_match_free(const int8_t *group)
+{
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return _mm_movemask_epi8(ctrl);
+}
+
+#else //__SSE2__
+
+static inline uint32_t _group_match(const int8_t *group, int8_t tag)
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISSMAP_GROUP; ++i) {
+        if (group[i] == tag)
+            mask |= 1u << i;
+    }
+    return mask;
+}
+
+static inline uint32_t _group_match_empty(const int8_t *group)
+{
+    return _group_match(group, CTRL_EMPTY);
+}
+
+static inline uint32_t _group_match_free(const int8_t *group)
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISSMAP_GROUP; ++i) {
+        if (group[i] < 0)
+            mask |= 1u << i;
+    }
+    return mask;
+}
+
+#endif //__SSE2__
+
+static inline void _set_ctrl(swissmap_t map, size_t i, int8_t c)
+{
+    map->ctrl[i] = c;
+    if (i < SWISSMAP_GROUP)
+        map->ctrl[map->capacity + i] = c;
+}
+
+static size_t _round_capacity(size_t capacity)
+{
+    size_t c = SWISSMAP_GROUP;
+    while (c < capacity)
+        c <<= 1;
+    return c;
+}
+
+static int _swissmap_alloc(swissmap_t map, size_t capacity)
+{
+    map->capacity = capacity;
+    map->ctrl = (int8_t*)malloc(capacity + SWISSMAP_GROUP);
+    map->slots = (struct swissmap_slot*)malloc(capacity * sizeof(struct swissmap_slot));
+    if (!map->ctrl || !map->slots) {
+        free(map->ctrl);
+        free(map->slots);
+        return -1;
+    }
+    memset(map->ctrl, CTRL_EMPTY, capacity + SWISSMAP_GROUP);
+    /*keep the load factor under 7/8*/
+    map->growth_left = capacity - capacity / 8 - map->len;
+    return 0;
+}
+
+swissmap_t swissmap_create(hashmap_hs hs, hashmap_eq eq)
+{
+    return swissmap_create_for_all(hs, eq, SWISSMAP_INIT_CAPA);
+}
+
+swissmap_t swissmap_create_for_all(hashmap_hs hs, hashmap_eq eq, size_t init_capacity)
+{
+    if (!hs || !eq)
+        return NULL;
+
+    swissmap_t map = (struct swissmap*)calloc(1, sizeof(struct swissmap));
+    assert(map != NULL);
+    map->hs = hs;
+    map->eq = eq;
+    map->len = 0;
+
+    /*room for init_capacity items without a rehash*/
+    if (_swissmap_alloc(map, _round_capacity(init_capacity + init_capacity / 7)) != 0) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+void swissmap_destroy(swissmap_t *pmap)
+{
+    assert(pmap != NULL);
+    assert((*pmap) != NULL);
+
+    swissmap_t map = *pmap;
+    free(map->ctrl);
+    free(map->slots);
+    free(map);
+    *pmap = NULL;
+}
+
+/*return the slot holding key, or -1*/
+static ssize_t _swissmap_find(swissmap_t map, basic_value_t key, uint64_t hash)
+{
+    size_t mask = map->capacity - 1;
+    size_t pos = H1(hash) & mask;
+    int8_t tag = H2(hash);
+
+    for (size_t step = SWISSMAP_GROUP; ; step += SWISSMAP_GROUP) {
+        const int8_t *group = map->ctrl + pos;
+        uint32_t match = _group_match(group, tag);
+        while (match) {
+            size_t i = (pos + __builtin_ctz(match)) & mask;
+            if (map->eq(map->slots[i].key, key))
+                return i;
+            match &= match - 1;
+        }
+        if (_group_match_empty(group))
+            return -1;
+        pos = (pos + step) & mask;
+    }
+}
+
+/*the first empty or deleted slot on the probe sequence of hash*/
+static size_t _swissmap_find_free(swissmap_t map, uint64_t hash)
+{
+    size_t mask = map->capacity - 1;
+    size_t pos = H1(hash) & mask;
+
+    for (size_t step = SWISSMAP_GROUP; ; step += SWISSMAP_GROUP) {
+        uint32_t match = _group_match_free(map->ctrl + pos);
+        if (match)
+            return (pos + __builtin_ctz(match)) & mask;
+        pos = (pos + step) & mask;
+    }
+}
+
+static int _swissmap_rehash(swissmap_t map)
+{
+    int8_t *old_ctrl = map->ctrl;
+    struct swissmap_slot *old_slots = map->slots;
+    size_t old_capacity = map->capacity;
+
+    /*mostly tombstones: rebuild at the same size*/
+    size_t new_capacity = map->len * 16 <= old_capacity * 7 ? old_capacity : old_capacity * 2;
+    if (_swissmap_alloc(map, new_capacity) != 0) {
+        map->ctrl = old_ctrl;
+        map->slots = old_slots;
+        map->capacity = old_capacity;
+        return -1;
+    }
+
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (!CTRL_IS_FULL(old_ctrl[i]))
+            continue;
+        uint64_t hash = _swissmap_hash(map, old_slots[i].key);
+        size_t slot = _swissmap_find_free(map, hash);
+        _set_ctrl(map, slot, H2(hash));
+        map->slots[slot] = old_slots[i];
+    }
+
+    free(old_ctrl);
+    free(old_slots);
+    return 0;
+}
+
+int swissmap_add(swissmap_t map, basic_value_t key, basic_value_t value)
+{
+    if (!map)
+        return -1;
+
+    uint64_t hash = _swissmap_hash(map, key);
+    ssize_t found = _swissmap_find(map, key, hash);
+    if (found >= 0) {
+        map->slots[found].value = value;
+        return 0;
+    }
+
+    size_t slot = _swissmap_find_free(map, hash);
+    if (map->growth_left == 0 && map->ctrl[slot] == CTRL_EMPTY) {
+        if (_swissmap_rehash(map) != 0)
+            return -1;
+        slot = _swissmap_find_free(map, hash);
+    }
+    if (map->ctrl[slot] == CTRL_EMPTY)
+        map->growth_left--;
+    _set_ctrl(map, slot, H2(hash));
+    map->slots[slot].key = key;
+    map->slots[slot].value = value;
+    map->len++;
+    return 0;
+}
+
+basic_value_t swissmap_get_value(swissmap_t map, basic_value_t key)
+{
+    if (!map)
+        return BASIC_NULL;
+
+    ssize_t found = _swissmap_find(map, key, _swissmap_hash(map, key));
+    if (found < 0)
+        return BASIC_NULL;
+    return map->slots[found].value;
+}
+
+int swissmap_is_in(swissmap_t map, basic_value_t key)
+{
+    if (!map)
+        return -1;
+    return _swissmap_find(map, key, _swissmap_hash(map, key)) >= 0;
+}
+
+basic_value_t swissmap_del(swissmap_t map, basic_value_t key)
+{
+    if (!map)
+        return BASIC_NULL;
+
+    ssize_t found = _swissmap_find(map, key, _swissmap_hash(map, key));
+    if (found < 0)
+        return BASIC_NULL;
+
+    basic_value_t value = map->slots[found].value;
+    size_t mask = map->capacity - 1;
+    size_t before = (found - SWISSMAP_GROUP) & mask;
+    uint32_t empty_before = _group_match_empty(map->ctrl + before);
+    uint32_t empty_after = _group_match_empty(map->ctrl + found);
+
+    /*if no group window around the slot was ever full, no probe sequence
+     * went past it and the slot may become empty again*/
+    int full_before = empty_before ? __builtin_clz(empty_before << 16) : SWISSMAP_GROUP;
+    int full_after = empty_after ? __builtin_ctz(empty_after) : SWISSMAP_GROUP;
+    if (full_before + full_after < SWISSMAP_GROUP) {
+        _set_ctrl(map, found, CTRL_EMPTY);
+        map->growth_left++;
+    } else {
+        _set_ctrl(map, found, CTRL_DELETED);
+    }
+    map->len--;
+    return value;
+}
+
+ssize_t swissmap_len(swissmap_t map)
+{
+    if (!map)
+        return -1;
+    return map->len;
+}
+
+bool swissmap_next(swissmap_t map, size_t *cursor, basic_value_t *key, basic_value_t *value)
+{
+    for (; *cursor < map->capacity; ++*cursor) {
+        if (CTRL_IS_FULL(map->ctrl[*cursor])) {
+            if (key)
+                *key = map->slots[*cursor].key;
+            if (value)
+                *value = map->slots[*cursor].value;
+            ++*cursor;
+            return true;
+        }
+    }
+    return false;
+}
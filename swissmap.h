@@ -0,0 +1,56 @@
+/**
+ * @author: luyuhuang
+ * @brief: Data structure: an open addressing hash map (swiss table)
+ */
+
+#ifndef _SWISSMAP_H_
+#define _SWISSMAP_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "basic.h"
+#include "hashmap.h"
+
+#define SWISSMAP_INIT_CAPA      16
+#define SWISSMAP_GROUP          16      //slots scanned by one SIMD compare
+
+struct swissmap_slot {
+    basic_value_t key;
+    basic_value_t value;
+};
+
+/*
+ * Keys and values live in one flat array of slots. One control byte per slot holds
+ * 7 bits of the hash of a full slot, or marks the slot empty or deleted.
+ * A lookup compares a whole group of control bytes at once and only calls
+ * `eq` on the slots whose 7 bits match.
+ */
+struct swissmap {
+    size_t len;
+    size_t capacity;        //power of 2, not less than SWISSMAP_GROUP
+    size_t growth_left;     //insertions into empty slots before a rehash
+
+    hashmap_hs hs;
+    hashmap_eq eq;
+
+    int8_t *ctrl;           //capacity + SWISSMAP_GROUP, the tail mirrors the head
+    struct swissmap_slot *slots;
+};
+
+typedef struct swissmap *swissmap_t;
+
+swissmap_t swissmap_create(hashmap_hs hs, hashmap_eq eq);
+swissmap_t swissmap_create_for_all(hashmap_hs hs, hashmap_eq eq, size_t init_capacity);
+void swissmap_destroy(swissmap_t *pmap);
+
+int swissmap_is_in(swissmap_t map, basic_value_t key);
+int swissmap_add(swissmap_t map, basic_value_t key, basic_value_t value);
+basic_value_t swissmap_get_value(swissmap_t map, basic_value_t key);
+basic_value_t swissmap_del(swissmap_t map, basic_value_t key);
+ssize_t swissmap_len(swissmap_t map);
+
+/*iterate by a cursor starting from 0. return false at the end*/
+bool swissmap_next(swissmap_t map, size_t *cursor, basic_value_t *key, basic_value_t *value);
+
+#endif //_SWISSMAP_H_
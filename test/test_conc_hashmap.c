@@ -0,0 +1,161 @@
+#include "../conc_hashmap.h"
+#include "../hashmap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <assert.h>
+
+#define TEST_THREADS    8
+#define TEST_KEYS       10000
+#define BENCH_KEYS      100000
+#define BENCH_OPS       2000000     //split among the threads
+
+static int64_t _hs(basic_value_t key)
+{
+    return BASIC2L(key);
+}
+
+static bool _eq(basic_value_t key1, basic_value_t key2)
+{
+    return BASIC2L(key1) == BASIC2L(key2);
+}
+
+static conc_hashmap_t g_map;
+
+/*every thread owns the keys k with k % TEST_THREADS == id*/
+static void *_test_worker(void *arg)
+{
+    long id = (long)arg;
+    for (long k = id; k < TEST_KEYS; k += TEST_THREADS)
+        assert(conc_hashmap_add(g_map, L2BASIC(k), L2BASIC(k * 3)) == 0);
+    for (long k = id; k < TEST_KEYS; k += TEST_THREADS) {
+        assert(BASIC2L(conc_hashmap_get_value(g_map, L2BASIC(k))) == k * 3);
+        if (k % 2 == 0)
+            assert(BASIC2L(conc_hashmap_del(g_map, L2BASIC(k))) == k * 3);
+    }
+    return NULL;
+}
+
+static void _sum_keys(basic_value_t key, basic_value_t value, void *arg)
+{
+    assert(BASIC2L(value) == BASIC2L(key) * 3);
+    *(long*)arg += BASIC2L(key);
+}
+
+static int _test_conc_hashmap()
+{
+    g_map = conc_hashmap_create(_hs, _eq);
+    pthread_t threads[TEST_THREADS];
+    for (long i = 0; i < TEST_THREADS; ++i)
+        pthread_create(threads + i, NULL, _test_worker, (void*)i);
+    for (int i = 0; i < TEST_THREADS; ++i)
+        pthread_join(threads[i], NULL);
+
+    assert(conc_hashmap_len(g_map) == TEST_KEYS / 2);
+    for (long k = 0; k < TEST_KEYS; ++k)
+        assert(conc_hashmap_is_in(g_map, L2BASIC(k)) == (k % 2 == 1));
+
+    long sum = 0;
+    conc_hashmap_foreach(g_map, _sum_keys, &sum);
+    assert(sum == (long)TEST_KEYS * TEST_KEYS / 4);
+
+    conc_hashmap_destroy(&g_map);
+    return 0;
+}
+
+/*the baseline: one hashmap_t behind one reader/writer lock*/
+static hashmap_t g_single;
+static pthread_rwlock_t g_single_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+struct bench_arg {
+    bool sharded;
+    long ops;
+    uint64_t seed;
+};
+
+static uint64_t _rand(uint64_t *seed)
+{
+    *seed ^= *seed >> 12;
+    *seed ^= *seed << 25;
+    *seed ^= *seed >> 27;
+    return *seed * 0x2545F4914F6CDD1DULL;
+}
+
+/*95% lookups, 5% writes split between add and del of the same key range*/
+static void *_bench_worker(void *arg)
+{
+    struct bench_arg *a = (struct bench_arg*)arg;
+    for (long i = 0; i < a->ops; ++i) {
+        uint64_t r = _rand(&a->seed);
+        basic_value_t key = L2BASIC((r >> 8) % BENCH_KEYS);
+        int op = r % 100;
+        if (a->sharded) {
+            if (op < 95)
+                conc_hashmap_get_value(g_map, key);
+            else if (op < 98)
+                conc_hashmap_add(g_map, key, key);
+            else
+                conc_hashmap_del(g_map, key);
+        } else if (op < 95) {
+            pthread_rwlock_rdlock(&g_single_lock);
+            hashmap_get_value(g_single, key);
+            pthread_rwlock_unlock(&g_single_lock);
+        } else {
+            pthread_rwlock_wrlock(&g_single_lock);
+            if (op < 98)
+                hashmap_add(g_single, key, key);
+            else
+                hashmap_del(g_single, key);
+            pthread_rwlock_unlock(&g_single_lock);
+        }
+    }
+    return NULL;
+}
+
+static double _now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double _bench(bool sharded, int thread_num)
+{
+    pthread_t threads[thread_num];
+    struct bench_arg args[thread_num];
+
+    double t = _now();
+    for (int i = 0; i < thread_num; ++i) {
+        args[i].sharded = sharded;
+        args[i].ops = BENCH_OPS / thread_num;
+        args[i].seed = 88172645463325252ULL + i;
+        pthread_create(threads + i, NULL, _bench_worker, args + i);
+    }
+    for (int i = 0; i < thread_num; ++i)
+        pthread_join(threads[i], NULL);
+    return BENCH_OPS / (_now() - t) / 1e6;
+}
+
+int main()
+{
+    _test_conc_hashmap();
+    printf("test conc hashmap: OK\n");
+
+    g_map = conc_hashmap_create(_hs, _eq);
+    g_single = hashmap_create(_hs, _eq);
+    for (long k = 0; k < BENCH_KEYS; k += 2) {
+        conc_hashmap_add(g_map, L2BASIC(k), L2BASIC(k));
+        hashmap_add(g_single, L2BASIC(k), L2BASIC(k));
+    }
+
+    int threads[] = {1, 2, 4, 8, 16};
+    for (int i = 0; i < sizeof(threads) / sizeof(int); ++i) {
+        printf("%2d threads, 95/5 read/write: single lock %.2lf Mops/s, %d shards %.2lf Mops/s\n",
+                threads[i], _bench(false, threads[i]), CONC_HASHMAP_SHARDS, _bench(true, threads[i]));
+    }
+
+    conc_hashmap_destroy(&g_map);
+    hashmap_destroy(&g_single);
+    return 0;
+}
@@ -0,0 +1,311 @@
+#include "../connpool.h"
+#include "../server.h"
+#include "../reactor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <poll.h>
+#include <assert.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define TEST_MAX_PER_HOST   2
+#define BENCH_REQUESTS      2000
+#define DESTROY_ROUNDS      100
+#define TICK_POOLS          32
+
+static int64_t _now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int _backend_closes;
+
+/*echo, and hang up on "quit"*/
+static int on_receive(session_t session, void *buffer, size_t len)
+{
+    if (len == 4 && memcmp(buffer, "quit", 4) == 0) {
+        shutdown(session->f.fd, SHUT_RDWR);
+        return 0;
+    }
+    assert(write(session->f.fd, buffer, len) == len);
+    return 0;
+}
+
+static void on_close(session_t session)
+{
+    __atomic_add_fetch(&_backend_closes, 1, __ATOMIC_RELEASE);
+}
+
+static void *_reactor_thread(void *arg)
+{
+    reactor_run((reactor_t)arg);
+    return NULL;
+}
+
+static void _wait_for(int *counter, int n)
+{
+    while (__atomic_load_n(counter, __ATOMIC_ACQUIRE) < n)
+        sched_yield();
+}
+
+/*callbacks append here*/
+static struct connpool_conn *_got[64];
+static int _callbacks;
+
+static void _on_conn(struct connpool_conn *conn, void *arg)
+{
+    int i = __atomic_load_n(&_callbacks, __ATOMIC_ACQUIRE);
+    _got[i] = conn;
+    __atomic_store_n(&_callbacks, i + 1, __ATOMIC_RELEASE);
+}
+
+static int _failed;
+
+static void _on_failed(struct connpool_conn *conn, void *arg)
+{
+    assert(conn == NULL);
+    __atomic_add_fetch(&_failed, 1, __ATOMIC_RELEASE);
+}
+
+/*get one, waiting for the callback if need be*/
+static struct connpool_conn *_get(connpool_t pool, const char *addr, int32_t mtime)
+{
+    struct connpool_conn *conn = NULL;
+    int n = __atomic_load_n(&_callbacks, __ATOMIC_ACQUIRE);
+    int ret = connpool_get(pool, addr, mtime, _on_conn, NULL, &conn);
+    if (ret == CONNPOOL_READY)
+        return conn;
+    assert(ret == CONNPOOL_PENDING);
+    _wait_for(&_callbacks, n + 1);
+    return _got[n];
+}
+
+/*the pooled fds are nonblocking*/
+static void _echo(int fd, int i)
+{
+    char out[32], in[32];
+    int len = snprintf(out, sizeof(out), "hello %d", i);
+    assert(write(fd, out, len) == len);
+    struct pollfd pfd = {fd, POLLIN, 0};
+    assert(poll(&pfd, 1, 1000) == 1);
+    assert(read(fd, in, sizeof(in)) == len);
+    assert(memcmp(in, out, len) == 0);
+}
+
+static void _test_reuse(const char *addr)
+{
+    connpool_t pool = connpool_create_for_all(TEST_MAX_PER_HOST, 60000, 1000);
+
+    struct connpool_conn *conn = _get(pool, addr, -1);
+    assert(conn);
+    _echo(conn->f.fd, 0);
+    connpool_put(pool, conn);
+
+    struct connpool_conn *again = NULL;
+    assert(connpool_get(pool, addr, -1, _on_conn, NULL, &again) == CONNPOOL_READY);
+    assert(again == conn);
+    _echo(again->f.fd, 1);
+    assert(pool->connects == 1 && pool->reused == 1);
+    printf("reuse: OK\n");
+
+    /*at the cap, a get waits for a put or a discard*/
+    struct connpool_conn *second = _get(pool, addr, -1);
+    assert(second && second != again && pool->connects == 2);
+    struct connpool_conn *unused;
+    int n = __atomic_load_n(&_callbacks, __ATOMIC_ACQUIRE);
+    assert(connpool_get(pool, addr, -1, _on_conn, NULL, &unused) == CONNPOOL_PENDING);
+    usleep(100000);
+    assert(__atomic_load_n(&_callbacks, __ATOMIC_ACQUIRE) == n);
+    connpool_put(pool, second);
+    _wait_for(&_callbacks, n + 1);
+    assert(_got[n] == second && pool->connects == 2);
+
+    assert(connpool_get(pool, addr, -1, _on_conn, NULL, &unused) == CONNPOOL_PENDING);
+    connpool_discard(pool, second);
+    _wait_for(&_callbacks, n + 2);
+    assert(_got[n + 1] && pool->connects == 3);
+    _echo(_got[n + 1]->f.fd, 2);
+    printf("max per host with waiters: OK\n");
+
+    /*nothing comes back in time*/
+    int64_t t1 = _now_ns();
+    assert(connpool_get(pool, addr, 200, _on_conn, NULL, &unused) == CONNPOOL_PENDING);
+    _wait_for(&_callbacks, n + 3);
+    int64_t waited = (_now_ns() - t1) / 1000000;
+    assert(_got[n + 2] == NULL && waited >= 199 && waited < 1000);
+    printf("waiter timeout after %ld ms: OK\n", waited);
+
+    connpool_put(pool, again);
+    connpool_put(pool, _got[n + 1]);
+    connpool_destroy(&pool);
+    assert(pool == NULL);
+    /*the discarded one and the two idle ones*/
+    _wait_for(&_backend_closes, 3);
+}
+
+static void _test_eviction(const char *addr)
+{
+    connpool_t pool = connpool_create_for_all(TEST_MAX_PER_HOST, 300, 1000);
+
+    /*past the idle timeout*/
+    int closes = __atomic_load_n(&_backend_closes, __ATOMIC_ACQUIRE);
+    connpool_put(pool, _get(pool, addr, -1));
+    _wait_for(&_backend_closes, closes + 1);
+    assert(pool->evicted == 1 && pool->connects == 1);
+    connpool_put(pool, _get(pool, addr, -1));
+    assert(pool->connects == 2 && pool->reused == 0);
+    printf("idle eviction: OK\n");
+
+    /*the backend hung up while the connection sat idle*/
+    struct connpool_conn *conn = _get(pool, addr, -1);
+    assert(pool->reused == 1);
+    assert(write(conn->f.fd, "quit", 4) == 4);
+    connpool_put(pool, conn);
+    _wait_for(&_backend_closes, closes + 2);
+    conn = _get(pool, addr, -1);
+    assert(conn && pool->connects == 3 && pool->evicted == 2);
+    _echo(conn->f.fd, 0);
+    connpool_put(pool, conn);
+    printf("broken idle connection: OK\n");
+
+    /*a bad address fails at once, a refused one through the callback*/
+    struct connpool_conn *unused;
+    assert(connpool_get(pool, "nonsense", -1, _on_conn, NULL, &unused) == -1);
+    assert(_get(pool, "127.0.0.1:1", -1) == NULL);
+    assert(_get(pool, "unix:/nonexistent/connpool.sock", -1) == NULL);
+    assert(pool->host_list->total == 0);
+
+    /*more waiters than connects, every one of them hears back*/
+    for (int i = 0; i < TEST_MAX_PER_HOST * 2; ++i)
+        assert(connpool_get(pool, "127.0.0.1:1", -1, _on_failed, NULL, &unused) == CONNPOOL_PENDING);
+    _wait_for(&_failed, TEST_MAX_PER_HOST * 2);
+    assert(pool->host_list->total == 0 && pool->host_list->waiter_len == 0);
+    printf("connect failures: OK\n");
+
+    connpool_destroy(&pool);
+}
+
+/*destroyed with connects in flight: the waiters get NULL, the connects
+ * coming back later find the pool still there*/
+static void _test_destroy_pending()
+{
+    int failed = __atomic_load_n(&_failed, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < DESTROY_ROUNDS; ++i) {
+        connpool_t pool = connpool_create_for_all(TEST_MAX_PER_HOST, 60000, 1000);
+        struct connpool_conn *unused;
+        for (int j = 0; j < TEST_MAX_PER_HOST * 2; ++j)
+            assert(connpool_get(pool, "127.0.0.1:1", -1, _on_failed, NULL, &unused) == CONNPOOL_PENDING);
+        connpool_destroy(&pool);
+        failed += TEST_MAX_PER_HOST * 2;
+        _wait_for(&_failed, failed);
+    }
+    printf("destroy with %d rounds of connects in flight: OK\n", DESTROY_ROUNDS);
+}
+
+static size_t _armed_timers()
+{
+    struct reactor_stats stats;
+    reactor_stats_snapshot(REACTOR_INST, &stats);
+    return stats.timers;
+}
+
+/*destroyed at any point of the tick: the tick in flight keeps the pool,
+ * the next one lets go of it and is not armed again*/
+static void _test_destroy_tick()
+{
+    usleep(CONNPOOL_TICK * 3 * 1000);
+    size_t timers = _armed_timers();
+
+    connpool_t pools[TICK_POOLS];
+    for (int i = 0; i < TICK_POOLS; ++i)
+        assert((pools[i] = connpool_create()) != NULL);
+    for (int i = 0; i < TICK_POOLS; ++i) {
+        usleep(CONNPOOL_TICK * 1000 / 8);
+        connpool_destroy(&pools[i]);
+    }
+
+    int64_t deadline = _now_ns() + CONNPOOL_TICK * 10 * 1000000LL;
+    while (_armed_timers() > timers) {
+        assert(_now_ns() < deadline);
+        usleep(1000);
+    }
+    printf("destroy across %d pool ticks: OK\n", TICK_POOLS);
+}
+
+static int _connected;
+
+static int _on_connect(struct rfile *file, int fd, void *arg)
+{
+    assert(fd >= 0);
+    __atomic_add_fetch(&_connected, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*a request/response per call, on a fresh connection or a pooled one*/
+static void _bench(const char *addr)
+{
+    struct sockaddr_storage ss;
+    socklen_t len;
+    assert(parse_addr(addr, &ss, &len) == 0);
+
+    int64_t t1 = _now_ns();
+    for (int i = 0; i < BENCH_REQUESTS; ++i) {
+        struct rfile file;
+        file.fd = socket(ss.ss_family, SOCK_STREAM, 0);
+        assert(reactor_asyn_connect(REACTOR_INST, &file, (struct sockaddr*)&ss, len,
+                    1000, _on_connect, NULL) == REACTER_OK);
+        _wait_for(&_connected, i + 1);
+        _echo(file.fd, i);
+        close(file.fd);
+    }
+    int64_t t2 = _now_ns();
+
+    connpool_t pool = connpool_create();
+    for (int i = 0; i < BENCH_REQUESTS; ++i) {
+        struct connpool_conn *conn = _get(pool, addr, -1);
+        _echo(conn->f.fd, i);
+        connpool_put(pool, conn);
+    }
+    int64_t t3 = _now_ns();
+    assert(pool->connects == 1 && pool->reused == BENCH_REQUESTS - 1);
+    connpool_destroy(&pool);
+
+    printf("%d requests: %ld ns/req connecting each time, %ld ns/req pooled\n",
+            BENCH_REQUESTS, (t2 - t1) / BENCH_REQUESTS, (t3 - t2) / BENCH_REQUESTS);
+}
+
+int main()
+{
+    reactor_t r = REACTOR_INST;
+    server_t s = server_create("127.0.0.1:0", NULL, on_receive, NULL);
+    server_set_close_cb(s, on_close);
+    assert(server_listen(s) == 0);
+
+    struct sockaddr_in sin;
+    socklen_t sinlen = sizeof(sin);
+    assert(getsockname(s->listeners[0]->f.fd, (struct sockaddr*)&sin, &sinlen) == 0);
+    char addr[32];
+    snprintf(addr, sizeof(addr), "127.0.0.1:%d", ntohs(sin.sin_port));
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, _reactor_thread, r);
+
+    _test_reuse(addr);
+    _test_eviction(addr);
+    _test_destroy_pending();
+    _test_destroy_tick();
+    _bench(addr);
+
+    reactor_stop(r);
+    pthread_join(tid, NULL);
+    server_destroy(&s);
+    return 0;
+}
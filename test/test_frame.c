@@ -0,0 +1,165 @@
+#include "../frame.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+
+#define TEST_FRAMES     1000
+#define TEST_MAX_FRAME  300
+#define BENCH_BYTES     (64 << 20)
+#define BENCH_CHUNK     4096    //DFL_MAX_BUFFER_SIZE, what one read hands over
+
+static int64_t _now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint8_t _stream[TEST_FRAMES * (TEST_MAX_FRAME + FRAME_HEADER_MAX)];
+static size_t _lens[TEST_FRAMES];
+static int _got;
+
+/*frame i is _lens[i] bytes of i*/
+static size_t _build(const struct frame_format *format)
+{
+    size_t n = 0;
+    srand(1);
+    for (int i = 0; i < TEST_FRAMES; ++i) {
+        _lens[i] = i % 10 == 0 ? 0 : rand() % (TEST_MAX_FRAME + 1);
+        n += frame_header_encode(format, _lens[i], _stream + n);
+        memset(_stream + n, i & 0xff, _lens[i]);
+        n += _lens[i];
+    }
+    return n;
+}
+
+static int _check(void *frame, size_t len, void *arg)
+{
+    assert(len == _lens[_got]);
+    for (size_t i = 0; i < len; ++i)
+        assert(((uint8_t*)frame)[i] == (_got & 0xff));
+    _got++;
+    return 0;
+}
+
+static void _test_formats()
+{
+    const char *names[] = {"fixed2", "fixed4", "fixed8", "varint"};
+    size_t chunks[] = {1, 3, 7, 64, BENCH_CHUNK, sizeof(_stream)};
+
+    for (int prefix = FRAME_FIXED2; prefix <= FRAME_VARINT; ++prefix) {
+        for (int big = 0; big < 2; ++big) {
+            struct frame_format format = {prefix, big, TEST_MAX_FRAME};
+            size_t n = _build(&format);
+
+            for (int c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+                struct frame_decoder d;
+                frame_decoder_init(&d, &format);
+                _got = 0;
+                for (size_t off = 0; off < n; off += chunks[c]) {
+                    size_t len = n - off < chunks[c] ? n - off : chunks[c];
+                    assert(frame_decode(&d, _stream + off, len, _check, NULL) == 0);
+                }
+                assert(_got == TEST_FRAMES);
+                assert(d.header_len == 0 && d.frame_len == 0);
+                /*in one piece, nothing is copied*/
+                if (chunks[c] >= n)
+                    assert(d.copied == 0);
+                frame_decoder_clear(&d);
+            }
+        }
+        printf("%s: OK\n", names[prefix]);
+    }
+}
+
+static int _stop(void *frame, size_t len, void *arg)
+{
+    return 7;
+}
+
+static void _test_layout()
+{
+    uint8_t out[FRAME_HEADER_MAX];
+    struct frame_format be4 = {FRAME_FIXED4, 1, 0}, le2 = {FRAME_FIXED2, 0, 0};
+    struct frame_format varint = {FRAME_VARINT, 0, 0};
+
+    assert(frame_header_encode(&be4, 0x01020304, out) == 4);
+    assert(memcmp(out, "\x01\x02\x03\x04", 4) == 0);
+    assert(frame_header_encode(&le2, 0x0102, out) == 2);
+    assert(memcmp(out, "\x02\x01", 2) == 0);
+    assert(frame_header_encode(&le2, 70000, out) == 0);
+    assert(frame_header_encode(&varint, 300, out) == 2);
+    assert(memcmp(out, "\xac\x02", 2) == 0);
+    assert(frame_header_encode(&varint, UINT64_MAX, out) == FRAME_HEADER_MAX);
+    assert(frame_header_size(&varint, 127) == 1 && frame_header_size(&varint, 128) == 2);
+
+    /*limits and malformed prefixes end the stream*/
+    struct frame_decoder d;
+    struct frame_format limited = {FRAME_FIXED2, 1, 100};
+    frame_decoder_init(&d, &limited);
+    assert(frame_decode(&d, "\x00\x65", 2, _check, NULL) == FRAME_ERR_SIZE);
+    frame_decoder_clear(&d);
+
+    uint8_t bad[FRAME_HEADER_MAX + 1];
+    memset(bad, 0xff, sizeof(bad));
+    frame_decoder_init(&d, &varint);
+    assert(frame_decode(&d, bad, 5, _check, NULL) == 0);
+    assert(frame_decode(&d, bad + 5, 6, _check, NULL) == FRAME_ERR_PREFIX);
+    frame_decoder_clear(&d);
+
+    /*a callback stops the decoding*/
+    frame_decoder_init(&d, &le2);
+    assert(frame_decode(&d, "\x01\x00x\x01\x00y", 6, _stop, NULL) == 7);
+    frame_decoder_clear(&d);
+    printf("layout and errors: OK\n");
+}
+
+static size_t _sum;
+
+static int _touch(void *frame, size_t len, void *arg)
+{
+    _sum += len + ((uint8_t*)frame)[len ? len - 1 : 0];
+    return 0;
+}
+
+/*the stream arrives in reads of BENCH_CHUNK bytes*/
+static void _bench(size_t size)
+{
+    struct frame_format format = {FRAME_FIXED4, 1, 0};
+    size_t frame = frame_header_size(&format, size) + size;
+    size_t frames = BENCH_BYTES / frame;
+    uint8_t *stream = (uint8_t*)malloc(frames * frame);
+    for (size_t i = 0; i < frames; ++i) {
+        frame_header_encode(&format, size, stream + i * frame);
+        memset(stream + i * frame + 4, (int)i, size);
+    }
+
+    struct frame_decoder d;
+    frame_decoder_init(&d, &format);
+    int64_t t1 = _now_ns();
+    for (size_t off = 0; off < frames * frame; off += BENCH_CHUNK) {
+        size_t len = frames * frame - off < BENCH_CHUNK ? frames * frame - off : BENCH_CHUNK;
+        frame_decode(&d, stream + off, len, _touch, NULL);
+    }
+    int64_t t2 = _now_ns();
+    printf("%6zu byte frames: %9.0f frames/s, %6.0f MB/s, %5.1f%% copied\n", size,
+            frames * 1e9 / (t2 - t1), frames * frame * 1e3 / (t2 - t1),
+            100.0 * d.copied / frames);
+    frame_decoder_clear(&d);
+    free(stream);
+}
+
+int main()
+{
+    _test_formats();
+    _test_layout();
+
+    _bench(16);
+    _bench(256);
+    _bench(4096);
+    _bench(65536);
+    return _sum == 0;
+}
@@ -1,7 +1,11 @@
 #include "../hashmap.h"
+#include "../swissmap.h"
+#include "../hash.h"
+#include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <assert.h>
 
 #define TEST_TIMES 100000
 
@@ -65,6 +69,287 @@ static int _test_traversals_hashmap()
     return 0;
 }
 
+static uint64_t _bench_seed;
+
+static uint64_t _bench_rand()
+{
+    /*xorshift64*, rand() only gives 31 bits*/
+    _bench_seed ^= _bench_seed >> 12;
+    _bench_seed ^= _bench_seed << 25;
+    _bench_seed ^= _bench_seed >> 27;
+    return _bench_seed * 0x2545F4914F6CDD1DULL;
+}
+
+static double _seconds(clock_t t1, clock_t t2)
+{
+    return (t2 - t1) / (CLOCKS_PER_SEC + 0.0);
+}
+
+/*keys in insertion order and the same keys shuffled for lookups. looking
+ * up in insertion order would let the chained map walk its pairs in
+ * allocation order*/
+static uint64_t *_bench_keys;
+static uint64_t *_bench_order;
+
+static void _bench_prepare(size_t n)
+{
+    _bench_keys = (uint64_t*)malloc(n * sizeof(uint64_t));
+    _bench_order = (uint64_t*)malloc(n * sizeof(uint64_t));
+    _bench_seed = 88172645463325252ULL;
+    for (size_t i = 0; i < n; ++i)
+        _bench_keys[i] = _bench_order[i] = _bench_rand();
+    for (size_t i = n - 1; i > 0; --i) {
+        size_t j = _bench_rand() % (i + 1);
+        uint64_t t = _bench_order[i];
+        _bench_order[i] = _bench_order[j];
+        _bench_order[j] = t;
+    }
+}
+
+static void _bench_release()
+{
+    free(_bench_keys);
+    free(_bench_order);
+}
+
+static void _bench_hashmap(size_t n)
+{
+    hashmap_t map = hashmap_create(_hs, _eq);
+    clock_t t1, t2, t3, t4;
+
+    t1 = clock();
+    for (size_t i = 0; i < n; ++i)
+        hashmap_add(map, U2BASIC(_bench_keys[i]), L2BASIC(i));
+    t2 = clock();
+    for (size_t i = 0; i < n; ++i)
+        assert(hashmap_is_in(map, U2BASIC(_bench_order[i])));
+    t3 = clock();
+    for (size_t i = 0; i < n; ++i)
+        hashmap_del(map, U2BASIC(_bench_order[i]));
+    t4 = clock();
+    assert(hashmap_len(map) == 0);
+
+    printf("hashmap  %9zu keys: insert %.3lf(s), find %.3lf(s), del %.3lf(s)\n",
+            n, _seconds(t1, t2), _seconds(t2, t3), _seconds(t3, t4));
+    hashmap_destroy(&map);
+}
+
+static void _bench_swissmap(size_t n)
+{
+    swissmap_t map = swissmap_create(_hs, _eq);
+    clock_t t1, t2, t3, t4;
+
+    t1 = clock();
+    for (size_t i = 0; i < n; ++i)
+        swissmap_add(map, U2BASIC(_bench_keys[i]), L2BASIC(i));
+    t2 = clock();
+    for (size_t i = 0; i < n; ++i)
+        assert(swissmap_is_in(map, U2BASIC(_bench_order[i])));
+    t3 = clock();
+    for (size_t i = 0; i < n; ++i)
+        swissmap_del(map, U2BASIC(_bench_order[i]));
+    t4 = clock();
+    assert(swissmap_len(map) == 0);
+
+    printf("swissmap %9zu keys: insert %.3lf(s), find %.3lf(s), del %.3lf(s)\n",
+            n, _seconds(t1, t2), _seconds(t2, t3), _seconds(t3, t4));
+    swissmap_destroy(&map);
+}
+
+static void _check_iter(hashmap_t map)
+{
+    long count = 0;
+    hashmap_iter_t it = hashmap_iter_create(map);
+    struct hashmap_pair *p;
+    while ((p = hashmap_iter_next(it)) != NULL) {
+        assert(BASIC2L(p->key) % 3 != 0);
+        assert(BASIC2L(p->value) == BASIC2L(p->key) * 2);
+        ++count;
+    }
+    hashmap_iter_destroy(&it);
+    assert(count == hashmap_len(map));
+}
+
+static int _test_incremental()
+{
+    hashmap_t map = hashmap_create_for_all(_hs, _eq, 4, HASHMAP_INIT_FACTOR);
+    hashmap_set_incremental(map, true);
+    int resizes = 0;
+    for (long i = 0; i < 10000; ++i) {
+        hashmap_add(map, L2BASIC(i), L2BASIC(i * 2));
+        /*lookups must see keys on both sides of a running resize*/
+        if (i / 2 % 3 != 0 || i / 2 == i)
+            assert(BASIC2L(hashmap_get_value(map, L2BASIC(i / 2))) == i / 2 * 2);
+        if (i % 3 == 0)
+            assert(BASIC2L(hashmap_del(map, L2BASIC(i))) == i * 2);
+        /*iteration must span both tables*/
+        if (map->old_lists != NULL && map->rehash_index > 0) {
+            _check_iter(map);
+            ++resizes;
+        }
+    }
+    assert(resizes > 0);
+    _check_iter(map);
+
+    hashmap_set_incremental(map, false);
+    assert(map->old_lists == NULL);
+    for (long i = 0; i < 10000; ++i)
+        assert(hashmap_is_in(map, L2BASIC(i)) == (i % 3 != 0));
+    hashmap_destroy(&map);
+    return 0;
+}
+
+static int64_t _now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*the slowest single insert is the one that triggers a resize*/
+static void _bench_insert_latency(size_t n, bool incremental)
+{
+    hashmap_t map = hashmap_create(_hs, _eq);
+    hashmap_set_incremental(map, incremental);
+    int64_t worst = 0, total = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        int64_t t = _now_ns();
+        hashmap_add(map, U2BASIC(_bench_keys[i]), L2BASIC(i));
+        t = _now_ns() - t;
+        total += t;
+        if (t > worst)
+            worst = t;
+    }
+
+    printf("hashmap %-11s %9zu inserts: total %.3lf(s), worst %.3lf(ms)\n",
+            incremental ? "incremental" : "stop-world", n, total / 1e9, worst / 1e6);
+    hashmap_destroy(&map);
+}
+
+static size_t _longest_chain(hashmap_t map)
+{
+    size_t longest = 0;
+    for (size_t i = 0; i < map->capacity; ++i) {
+        size_t n = 0;
+        struct hashmap_pair *p;
+        SLIST_FOREACH(p, map->lists + i)
+            ++n;
+        if (n > longest)
+            longest = n;
+    }
+    return longest;
+}
+
+/*integer patterns that defeat identity hashes: strides of powers of two
+ *(aligned pointers, ids packed in high bits) leave the low bits constant*/
+static void _bench_int_patterns(size_t n)
+{
+    struct {
+        const char *name;
+        uint64_t stride;
+    } patterns[] = {
+        {"sequential", 1}, {"stride 1K", 1024}, {"stride 64K", 65536}, {"stride 2^32", 1ULL << 32},
+    };
+    struct {
+        const char *name;
+        hashmap_hs hs;
+    } hashes[] = {{"identity", _hs}, {"hash_int_key", hash_int_key}};
+
+    for (int i = 0; i < sizeof(patterns) / sizeof(patterns[0]); ++i) {
+        for (int j = 0; j < sizeof(hashes) / sizeof(hashes[0]); ++j) {
+            hashmap_t map = hashmap_create(hashes[j].hs, _eq);
+            clock_t t1 = clock();
+            for (uint64_t k = 0; k < n; ++k)
+                hashmap_add(map, U2BASIC(k * patterns[i].stride), L2BASIC(k));
+            clock_t t2 = clock();
+            for (uint64_t k = 0; k < n; ++k)
+                assert(hashmap_is_in(map, U2BASIC(k * patterns[i].stride)));
+            clock_t t3 = clock();
+            printf("%-12s %-13s insert %.3lf(s), find %.3lf(s), longest chain %zu\n",
+                    patterns[i].name, hashes[j].name, _seconds(t1, t2), _seconds(t2, t3),
+                    _longest_chain(map));
+            hashmap_destroy(&map);
+        }
+    }
+}
+
+/*keys sharing a long prefix, as in "session:000123"*/
+static void _bench_string_keys(size_t n)
+{
+    char (*keys)[32] = malloc(n * sizeof(*keys));
+    for (size_t i = 0; i < n; ++i)
+        snprintf(keys[i], sizeof(keys[i]), "session:%012zu", i);
+
+    hashmap_t map = hashmap_create(hash_str_key, hash_str_equal);
+    clock_t t1 = clock();
+    for (size_t i = 0; i < n; ++i)
+        hashmap_add(map, S2BASIC(keys[i]), L2BASIC(i));
+    clock_t t2 = clock();
+    for (size_t i = 0; i < n; ++i)
+        assert(BASIC2L(hashmap_get_value(map, S2BASIC(keys[i]))) == i);
+    clock_t t3 = clock();
+    printf("%-12s %-13s insert %.3lf(s), find %.3lf(s), longest chain %zu\n",
+            "string keys", "hash_str_key", _seconds(t1, t2), _seconds(t2, t3), _longest_chain(map));
+    hashmap_destroy(&map);
+
+    /*raw throughput of the bytes hash*/
+    size_t len = 1 << 20;
+    char *buf = malloc(len);
+    memset(buf, 'x', len);
+    uint64_t h = 0;
+    t1 = clock();
+    for (int i = 0; i < 256; ++i)
+        h ^= hash_bytes(buf, len, i);
+    t2 = clock();
+    printf("hash_bytes: %.2lf GB/s (%lx)\n", 256.0 / 1024 / _seconds(t1, t2), h & 0xf);
+    free(buf);
+    free(keys);
+}
+
+static int _test_hash()
+{
+    /*every length takes a different read path, check each one sees all bytes*/
+    char buf[128];
+    for (size_t len = 1; len < sizeof(buf); ++len) {
+        memset(buf, 'a', len);
+        uint64_t h = hash_bytes(buf, len, 0);
+        for (size_t i = 0; i < len; ++i) {
+            buf[i] = 'b';
+            assert(hash_bytes(buf, len, 0) != h);
+            buf[i] = 'a';
+        }
+        assert(hash_bytes(buf, len, 1) != h);
+        assert(hash_bytes(buf, len - 1, 0) != h);
+    }
+
+    char s1[] = "hello", s2[] = "hello";
+    assert(hash_str_key(S2BASIC(s1)) == hash_str_key(S2BASIC(s2)));
+    assert(hash_str_equal(S2BASIC(s1), S2BASIC(s2)));
+    assert(hash_mix64(1) != hash_mix64(2));
+    return 0;
+}
+
+static int _test_swissmap()
+{
+    swissmap_t map = swissmap_create(_hs, _eq);
+    for (long i = 0; i < 1000; ++i)
+        swissmap_add(map, L2BASIC(i * 7), L2BASIC(i));
+    for (long i = 0; i < 1000; i += 2)
+        assert(BASIC2L(swissmap_del(map, L2BASIC(i * 7))) == i);
+    for (long i = 0; i < 1000; ++i)
+        assert(swissmap_is_in(map, L2BASIC(i * 7)) == (i & 1));
+    swissmap_add(map, L2BASIC(7), L2BASIC(-1));
+    assert(BASIC2L(swissmap_get_value(map, L2BASIC(7))) == -1);
+
+    size_t cursor = 0, count = 0;
+    while (swissmap_next(map, &cursor, NULL, NULL))
+        ++count;
+    assert(count == 500 && swissmap_len(map) == 500);
+    swissmap_destroy(&map);
+    return 0;
+}
+
 static void _init_env()
 {
     g_map = hashmap_create_for_all(_hs, _eq, 100000, 0.5f);
@@ -86,5 +371,28 @@ int main()
     _test_traversals_hashmap();
 
     _free_env();
+
+    _test_incremental();
+    printf("test incremental resize: OK\n");
+    _test_swissmap();
+    printf("test swissmap: OK\n");
+    _test_hash();
+    printf("test hash: OK\n");
+
+    _bench_int_patterns(1000000);
+    _bench_string_keys(1000000);
+
+    _bench_prepare(1000000);
+    _bench_insert_latency(1000000, false);
+    _bench_insert_latency(1000000, true);
+    _bench_release();
+
+    size_t sizes[] = {1000, 100000, 10000000};
+    for (int i = 0; i < sizeof(sizes) / sizeof(size_t); ++i) {
+        _bench_prepare(sizes[i]);
+        _bench_hashmap(sizes[i]);
+        _bench_swissmap(sizes[i]);
+        _bench_release();
+    }
     return 0;
 }
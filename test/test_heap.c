@@ -0,0 +1,209 @@
+#include "../minheap.h"
+#include "../dheap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <assert.h>
+
+#define TEST_TIMES 10000
+
+struct item {
+    int64_t key;
+    size_t index;
+};
+
+static bool _item_lt(basic_value_t a, basic_value_t b)
+{
+    return BASIC2P(a, struct item*)->key < BASIC2P(b, struct item*)->key;
+}
+
+static void _item_setidx(basic_value_t a, size_t index)
+{
+    BASIC2P(a, struct item*)->index = index;
+}
+
+static void _check_heap(minheap_t heap)
+{
+    for (size_t i = 0; i < heap->len; ++i) {
+        struct item *it = BASIC2P(heap->heap_array[i], struct item*);
+        assert(it->index == i);
+        if (i > 0)
+            assert(!_item_lt(heap->heap_array[i], heap->heap_array[(i - 1) / 2]));
+    }
+}
+
+static int _test_indexed_heap()
+{
+    minheap_t heap = minheap_create_indexed(_item_lt, _item_setidx);
+    struct item *items = (struct item*)calloc(TEST_TIMES, sizeof(struct item));
+
+    /*many equal keys: removal must pick the exact element, not an equal one*/
+    for (int i = 0; i < TEST_TIMES; ++i) {
+        items[i].key = rand() % 100;
+        minheap_add(heap, P2BASIC(items + i));
+    }
+    _check_heap(heap);
+
+    for (int i = 0; i < TEST_TIMES; i += 3) {
+        struct item *it = BASIC2P(minheap_remove(heap, items[i].index), struct item*);
+        assert(it == items + i);
+        assert(it->index == MINHEAP_NO_INDEX);
+    }
+    _check_heap(heap);
+
+    /*decrease and increase keys in place*/
+    for (int i = 1; i < TEST_TIMES; i += 3) {
+        items[i].key += (i % 2) ? -1000 : 1000;
+        assert(minheap_update(heap, items[i].index) == 0);
+    }
+    _check_heap(heap);
+
+    int64_t last = INT64_MIN;
+    size_t n = 0;
+    struct item *it;
+    while ((it = BASIC2P(minheap_pop(heap), struct item*)) != NULL) {
+        assert(it->key >= last);
+        last = it->key;
+        ++n;
+    }
+    assert(n == TEST_TIMES - (TEST_TIMES + 2) / 3);
+
+    free(items);
+    minheap_destroy(&heap);
+    return 0;
+}
+
+/*a timeout rescheduled on every packet: update by handle against the old
+ *remove-by-scan plus add*/
+static void _bench_reschedule(size_t n, size_t rounds)
+{
+    minheap_t heap = minheap_create_indexed(_item_lt, _item_setidx);
+    struct item *items = (struct item*)calloc(n, sizeof(struct item));
+    for (size_t i = 0; i < n; ++i) {
+        items[i].key = i;
+        minheap_add(heap, P2BASIC(items + i));
+    }
+
+    clock_t t1 = clock();
+    for (size_t r = 0; r < rounds; ++r) {
+        struct item *it = items + rand() % n;
+        it->key += n;
+        minheap_update(heap, it->index);
+    }
+    clock_t t2 = clock();
+    for (size_t r = 0; r < rounds / 100; ++r) {
+        struct item *it = items + rand() % n;
+        minheap_del(heap, P2BASIC(it));
+        it->key += n;
+        minheap_add(heap, P2BASIC(it));
+    }
+    clock_t t3 = clock();
+    _check_heap(heap);
+
+    printf("reschedule in %zu timers: update %.1lf(ns/op), del+add %.1lf(ns/op)\n", n,
+            (t2 - t1) * 1e9 / CLOCKS_PER_SEC / rounds, (t3 - t2) * 1e9 / CLOCKS_PER_SEC / (rounds / 100));
+    free(items);
+    minheap_destroy(&heap);
+}
+
+static void _check_dheap(dheap_t heap)
+{
+    for (size_t i = 0; i < heap->len; ++i) {
+        struct dheap_entry *e = heap->entries + i + DHEAP_ARITY - 1;
+        struct item *it = BASIC2P(e->value, struct item*);
+        assert(it->index == i && it->key == e->key);
+        if (i > 0)
+            assert(heap->entries[(i - 1) / DHEAP_ARITY + DHEAP_ARITY - 1].key <= e->key);
+    }
+}
+
+static int _test_dheap()
+{
+    dheap_t heap = dheap_create(_item_setidx);
+    struct item *items = (struct item*)calloc(TEST_TIMES, sizeof(struct item));
+    /*the children of every node start on a cache line*/
+    assert(((uintptr_t)(heap->entries + DHEAP_ARITY) & 63) == 0);
+
+    for (int i = 0; i < TEST_TIMES; ++i) {
+        items[i].key = rand() % 100;
+        dheap_push(heap, items[i].key, P2BASIC(&items[i]));
+    }
+    _check_dheap(heap);
+
+    for (int i = 0; i < TEST_TIMES; i += 3)
+        assert(BASIC2P(dheap_remove(heap, items[i].index), struct item*) == &items[i]);
+    for (int i = 1; i < TEST_TIMES; i += 3) {
+        items[i].key += (i % 2) ? -1000 : 1000;
+        assert(dheap_update(heap, items[i].index, items[i].key) == 0);
+    }
+    _check_dheap(heap);
+
+    int64_t key, last = INT64_MIN;
+    size_t n = 0;
+    while (dheap_len(heap) > 0) {
+        struct item *it = BASIC2P(dheap_pop(heap, &key), struct item*);
+        assert(key == it->key && key >= last);
+        assert(it->index == DHEAP_NO_INDEX);
+        last = key;
+        ++n;
+    }
+    assert(n == TEST_TIMES - (TEST_TIMES + 2) / 3);
+    assert(BASIC_IS_NULL(dheap_pop(heap, NULL)));
+
+    free(items);
+    dheap_destroy(&heap);
+    return 0;
+}
+
+/*timers as the reactor keeps them: separately allocated, random deadlines*/
+static void _bench_push_pop(size_t n)
+{
+    struct item **items = (struct item**)malloc(n * sizeof(struct item*));
+    for (size_t i = 0; i < n; ++i) {
+        items[i] = (struct item*)malloc(sizeof(struct item));
+        items[i]->key = rand();
+    }
+
+    minheap_t mheap = minheap_create_indexed(_item_lt, _item_setidx);
+    clock_t t1 = clock();
+    for (size_t i = 0; i < n; ++i)
+        minheap_add(mheap, P2BASIC(items[i]));
+    clock_t t2 = clock();
+    while (minheap_len(mheap) > 0)
+        minheap_pop(mheap);
+    clock_t t3 = clock();
+    printf("%-13s %zu: push %.3lf(s), pop %.3lf(s)\n", "minheap", n,
+            (t2 - t1) / (CLOCKS_PER_SEC + 0.0), (t3 - t2) / (CLOCKS_PER_SEC + 0.0));
+    minheap_destroy(&mheap);
+
+    /*with setidx every move still writes through the value pointer*/
+    for (int indexed = 1; indexed >= 0; --indexed) {
+        dheap_t dheap = dheap_create(indexed ? _item_setidx : NULL);
+        t1 = clock();
+        for (size_t i = 0; i < n; ++i)
+            dheap_push(dheap, items[i]->key, P2BASIC(items[i]));
+        t2 = clock();
+        while (dheap_len(dheap) > 0)
+            dheap_pop(dheap, NULL);
+        t3 = clock();
+        printf("%-13s %zu: push %.3lf(s), pop %.3lf(s)\n", indexed ? "dheap indexed" : "dheap", n,
+                (t2 - t1) / (CLOCKS_PER_SEC + 0.0), (t3 - t2) / (CLOCKS_PER_SEC + 0.0));
+        dheap_destroy(&dheap);
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        free(items[i]);
+    free(items);
+}
+
+int main()
+{
+    _test_indexed_heap();
+    printf("test indexed heap: OK\n");
+    _test_dheap();
+    printf("test dheap: OK\n");
+
+    _bench_reschedule(100000, 1000000);
+    _bench_push_pop(1000000);
+    return 0;
+}
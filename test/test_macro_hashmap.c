@@ -0,0 +1,168 @@
+#include "../macro_hashmap.h"
+#include "../hashmap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <assert.h>
+
+struct node {
+    int64_t __key__;
+    int64_t value;
+    struct node *__next__;
+};
+
+#define NODE_HASH(k) (k)
+#define NODE_EQ(k1, k2) ((k1) == (k2))
+
+typedef HASHMAP(struct node) node_map_t;
+HASHMAP_GENERATE(node_map, node_map_t, struct node, NODE_HASH, NODE_EQ)
+
+static struct node *_new_node(int64_t key, int64_t value)
+{
+    struct node *n = (struct node*)malloc(sizeof(struct node));
+    n->__key__ = key;
+    n->value = value;
+    n->__next__ = NULL;
+    return n;
+}
+
+static int _test_macro_hashmap()
+{
+    node_map_t map = HASHMAP_INITIALIZER;
+    assert(node_map_find(&map, 1) == NULL);
+    assert(node_map_erase(&map, 1) == NULL);
+
+    for (int64_t i = 0; i < 10000; ++i)
+        assert(node_map_insert(&map, _new_node(i * 1024, i)) == NULL);
+    assert(HASHMAP_LEN(&map) == 10000);
+
+    /*replacing hands the old node back*/
+    struct node *old = node_map_insert(&map, _new_node(0, -1));
+    assert(old && old->value == 0);
+    free(old);
+    assert(node_map_find(&map, 0)->value == -1);
+
+    for (int64_t i = 1; i < 10000; ++i) {
+        struct node *n = node_map_find(&map, i * 1024);
+        assert(n && n->value == i);
+        assert(node_map_find(&map, i * 1024 + 1) == NULL);
+    }
+
+    for (int64_t i = 0; i < 10000; i += 2)
+        free(node_map_erase(&map, i * 1024));
+    assert(HASHMAP_LEN(&map) == 5000);
+    assert(node_map_erase(&map, 0) == NULL);
+
+    struct node *n;
+    size_t count = 0;
+    HASHMAP_FOREACH(n, &map) {
+        assert(n->__key__ / 1024 % 2 == 1);
+        ++count;
+    }
+    assert(count == 5000);
+
+    /*break must leave both loops*/
+    count = 0;
+    HASHMAP_FOREACH(n, &map) {
+        if (++count == 10)
+            break;
+    }
+    assert(count == 10 && n != NULL);
+
+    HASHMAP_DEL(&map, free);
+    assert(HASHMAP_EMPTY(&map));
+
+    /*a doubling leaves the buckets in the old table, moved a few at a time*/
+    int64_t i = 0;
+    while (!map.old_lists)
+        assert(node_map_insert(&map, _new_node(i, i)) == NULL), ++i;
+    size_t len = HASHMAP_LEN(&map);
+    assert(map.rehash_index < map.old_capacity);
+    for (int64_t j = 0; j < i; ++j)
+        assert(node_map_find(&map, j)->value == j);
+    count = 0;
+    HASHMAP_FOREACH(n, &map)
+        ++count;
+    assert(count == len);
+    free(node_map_erase(&map, 0));
+    while (map.old_lists)
+        assert(node_map_insert(&map, _new_node(i, i)) == NULL), ++i;
+    for (int64_t j = 1; j < i; ++j)
+        assert(node_map_find(&map, j)->value == j);
+    assert(HASHMAP_LEN(&map) == i - 1);
+    HASHMAP_DEL(&map, free);
+    return 0;
+}
+
+static int64_t _hs(basic_value_t key)
+{
+    return BASIC2L(key);
+}
+
+static bool _eq(basic_value_t key1, basic_value_t key2)
+{
+    return BASIC2L(key1) == BASIC2L(key2);
+}
+
+static double _seconds(clock_t t1, clock_t t2)
+{
+    return (t2 - t1) / (CLOCKS_PER_SEC + 0.0);
+}
+
+/*the nodes of the bench are freed in one go*/
+static void _keep(struct node *n)
+{
+}
+
+static void _bench(size_t n)
+{
+    clock_t t1, t2, t3, t4;
+    int64_t sum = 0;
+
+    hashmap_t hmap = hashmap_create(_hs, _eq);
+    t1 = clock();
+    for (size_t i = 0; i < n; ++i)
+        hashmap_add(hmap, L2BASIC(i), L2BASIC(i));
+    t2 = clock();
+    for (size_t i = 0; i < n; ++i)
+        sum += BASIC2L(hashmap_get_value(hmap, L2BASIC(i)));
+    t3 = clock();
+    for (size_t i = 0; i < n; ++i)
+        hashmap_del(hmap, L2BASIC(i));
+    t4 = clock();
+    printf("hashmap_t     %8zu keys: insert %.3lf(s), find %.3lf(s), erase %.3lf(s)\n",
+            n, _seconds(t1, t2), _seconds(t2, t3), _seconds(t3, t4));
+    hashmap_destroy(&hmap);
+
+    /*nodes are allocated up front: the map itself never allocates them*/
+    struct node *nodes = (struct node*)malloc(n * sizeof(struct node));
+    node_map_t map = HASHMAP_INITIALIZER;
+    t1 = clock();
+    for (size_t i = 0; i < n; ++i) {
+        nodes[i].__key__ = nodes[i].value = i;
+        node_map_insert(&map, nodes + i);
+    }
+    t2 = clock();
+    for (size_t i = 0; i < n; ++i)
+        sum -= node_map_find(&map, i)->value;
+    t3 = clock();
+    for (size_t i = 0; i < n; ++i)
+        node_map_erase(&map, i);
+    t4 = clock();
+    printf("HASHMAP macro %8zu keys: insert %.3lf(s), find %.3lf(s), erase %.3lf(s)\n",
+            n, _seconds(t1, t2), _seconds(t2, t3), _seconds(t3, t4));
+    assert(sum == 0 && HASHMAP_EMPTY(&map));
+    HASHMAP_DEL(&map, _keep);
+    free(nodes);
+}
+
+int main()
+{
+    _test_macro_hashmap();
+    printf("test macro hashmap: OK\n");
+
+    _bench(100000);
+    _bench(1000000);
+    return 0;
+}
@@ -1,6 +1,11 @@
 #include "../macro_list.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <assert.h>
 
 
 struct node {
@@ -112,6 +117,174 @@ static int _test_slist_erase()
 }
 
 
+#define QUEUE_PRODUCERS 4
+#define QUEUE_NODES     200000      //per producer
+#define RING_SIZE       1024
+
+struct qnode {
+    int producer;
+    int seq;
+    struct qnode *__next__;
+};
+
+static int64_t _now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static MPSC_QUEUE(struct qnode) g_mpsc;
+static struct qnode *g_nodes;
+
+static void *_mpsc_producer(void *arg)
+{
+    long id = (long)arg;
+    for (int i = 0; i < QUEUE_NODES; ++i) {
+        struct qnode *n = g_nodes + id * QUEUE_NODES + i;
+        n->producer = id;
+        n->seq = i;
+        MPSC_QUEUE_PUSH(&g_mpsc, n);
+    }
+    return NULL;
+}
+
+static int64_t _test_mpsc()
+{
+    pthread_t tids[QUEUE_PRODUCERS];
+    int next_seq[QUEUE_PRODUCERS] = {0};
+    long total = 0;
+
+    g_nodes = (struct qnode*)malloc(sizeof(struct qnode) * QUEUE_PRODUCERS * QUEUE_NODES);
+    MPSC_QUEUE_INIT(&g_mpsc);
+    assert(MPSC_QUEUE_POP(&g_mpsc) == NULL);
+    assert(MPSC_QUEUE_EMPTY(&g_mpsc));
+
+    int64_t t1 = _now_ns();
+    for (long i = 0; i < QUEUE_PRODUCERS; ++i)
+        pthread_create(tids + i, NULL, _mpsc_producer, (void*)i);
+    while (total < QUEUE_PRODUCERS * QUEUE_NODES) {
+        struct qnode *n = MPSC_QUEUE_POP(&g_mpsc);
+        if (n == NULL) {
+            sched_yield();
+            continue;
+        }
+        /*FIFO per producer*/
+        assert(n->seq == next_seq[n->producer]);
+        next_seq[n->producer]++;
+        total++;
+    }
+    int64_t t2 = _now_ns();
+    for (int i = 0; i < QUEUE_PRODUCERS; ++i)
+        pthread_join(tids[i], NULL);
+
+    assert(MPSC_QUEUE_POP(&g_mpsc) == NULL);
+    assert(MPSC_QUEUE_EMPTY(&g_mpsc));
+    /*the queue still works after running dry*/
+    MPSC_QUEUE_PUSH(&g_mpsc, g_nodes);
+    assert(MPSC_QUEUE_POP(&g_mpsc) == g_nodes);
+    assert(MPSC_QUEUE_POP(&g_mpsc) == NULL);
+
+    free(g_nodes);
+    return t2 - t1;
+}
+
+/*the same traffic through a mutex protected SLIST*/
+static SLIST(struct qnode) g_locked = SLIST_INITIALIZER;
+static pthread_mutex_t g_locked_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *_locked_producer(void *arg)
+{
+    long id = (long)arg;
+    for (int i = 0; i < QUEUE_NODES; ++i) {
+        struct qnode *n = g_nodes + id * QUEUE_NODES + i;
+        pthread_mutex_lock(&g_locked_mutex);
+        SLIST_INSERT_AT_TAIL(&g_locked, n);
+        pthread_mutex_unlock(&g_locked_mutex);
+    }
+    return NULL;
+}
+
+static int64_t _bench_locked_queue()
+{
+    pthread_t tids[QUEUE_PRODUCERS];
+    long total = 0;
+
+    g_nodes = (struct qnode*)malloc(sizeof(struct qnode) * QUEUE_PRODUCERS * QUEUE_NODES);
+    int64_t t1 = _now_ns();
+    for (long i = 0; i < QUEUE_PRODUCERS; ++i)
+        pthread_create(tids + i, NULL, _locked_producer, (void*)i);
+    while (total < QUEUE_PRODUCERS * QUEUE_NODES) {
+        pthread_mutex_lock(&g_locked_mutex);
+        struct qnode *n = SLIST_BEGIN(&g_locked);
+        if (n)
+            SLIST_ERASE_HEAD(&g_locked);
+        pthread_mutex_unlock(&g_locked_mutex);
+        if (n == NULL) {
+            sched_yield();
+            continue;
+        }
+        total++;
+    }
+    int64_t t2 = _now_ns();
+    for (int i = 0; i < QUEUE_PRODUCERS; ++i)
+        pthread_join(tids[i], NULL);
+
+    free(g_nodes);
+    return t2 - t1;
+}
+
+static SPSC_RING(struct qnode, RING_SIZE) g_ring;
+
+static void *_spsc_producer(void *arg)
+{
+    for (int i = 0; i < QUEUE_NODES; ++i) {
+        struct qnode *n = g_nodes + i;
+        n->seq = i;
+        while (SPSC_RING_PUSH(&g_ring, n) != 0)
+            sched_yield();
+    }
+    return NULL;
+}
+
+static int64_t _test_spsc()
+{
+    pthread_t tid;
+
+    SPSC_RING_INIT(&g_ring);
+    assert(SPSC_RING_CAPA(&g_ring) == RING_SIZE);
+    assert(SPSC_RING_POP(&g_ring) == NULL);
+
+    /*fill up, then drain, in one thread*/
+    struct qnode one;
+    for (int i = 0; i < RING_SIZE; ++i)
+        assert(SPSC_RING_PUSH(&g_ring, &one) == 0);
+    assert(SPSC_RING_PUSH(&g_ring, &one) == -1);
+    assert(SPSC_RING_LEN(&g_ring) == RING_SIZE);
+    for (int i = 0; i < RING_SIZE; ++i)
+        assert(SPSC_RING_POP(&g_ring) == &one);
+    assert(SPSC_RING_EMPTY(&g_ring));
+
+    g_nodes = (struct qnode*)malloc(sizeof(struct qnode) * QUEUE_NODES);
+    int64_t t1 = _now_ns();
+    pthread_create(&tid, NULL, _spsc_producer, NULL);
+    for (int i = 0; i < QUEUE_NODES; ) {
+        struct qnode *n = SPSC_RING_POP(&g_ring);
+        if (n == NULL) {
+            sched_yield();
+            continue;
+        }
+        assert(n == g_nodes + i && n->seq == i);
+        i++;
+    }
+    int64_t t2 = _now_ns();
+    pthread_join(tid, NULL);
+    assert(SPSC_RING_EMPTY(&g_ring));
+
+    free(g_nodes);
+    return t2 - t1;
+}
+
 int main()
 {
     _test_list_insert();
@@ -123,5 +296,14 @@ int main()
     _test_slist_erase();
     printf("test slist erase succeed\n");
 
+    int64_t ns = _test_mpsc();
+    printf("test mpsc queue succeed, %d producers: %.1f M nodes/s\n", QUEUE_PRODUCERS,
+            QUEUE_PRODUCERS * QUEUE_NODES * 1e3 / ns);
+    ns = _bench_locked_queue();
+    printf("mutex slist, %d producers: %.1f M nodes/s\n", QUEUE_PRODUCERS,
+            QUEUE_PRODUCERS * QUEUE_NODES * 1e3 / ns);
+    ns = _test_spsc();
+    printf("test spsc ring succeed: %.1f M nodes/s\n", QUEUE_NODES * 1e3 / ns);
+
     return 0;
 }
@@ -0,0 +1,194 @@
+#include "../objcache.h"
+#include "../thread_pool.h"
+#include "../reactor_event.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <assert.h>
+
+#define TEST_OBJS       10000
+#define BENCH_OBJS      1000000
+#define BENCH_BATCH     4096    //the reactor hands off at most this many at once
+
+static int64_t _now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int _local_count(struct objcache *cache)
+{
+    int n = 0;
+    for (struct objcache_local *l = cache->locals; l; l = l->next)
+        n++;
+    return n;
+}
+
+static int _slab_count(struct objcache_local *local)
+{
+    int n = 0;
+    for (void *slab = local->slabs; slab; slab = *(void**)slab)
+        n++;
+    return n;
+}
+
+static int _ptr_cmp(const void *a, const void *b)
+{
+    uintptr_t x = *(uintptr_t*)a, y = *(uintptr_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void *_objs[TEST_OBJS];
+
+static void _test_local()
+{
+    struct objcache *cache = objcache_create(100);
+    for (int i = 0; i < TEST_OBJS; ++i) {
+        _objs[i] = objcache_alloc(cache);
+        assert(((uintptr_t)_objs[i] & (OBJCACHE_ALIGN - 1)) == 0);
+        memset(_objs[i], i & 0xff, 100);
+    }
+    qsort(_objs, TEST_OBJS, sizeof(void*), _ptr_cmp);
+    for (int i = 1; i < TEST_OBJS; ++i)
+        assert((uint8_t*)_objs[i] - (uint8_t*)_objs[i - 1] >= 100);
+
+    struct objcache_local *local = cache->locals;
+    int slabs = _slab_count(local);
+    for (int i = 0; i < TEST_OBJS; ++i)
+        objcache_free(_objs[i]);
+    for (int i = 0; i < TEST_OBJS; ++i)
+        _objs[i] = objcache_alloc(cache);
+    assert(_slab_count(local) == slabs);
+    assert(_local_count(cache) == 1);
+
+    objcache_destroy(&cache);
+    assert(cache == NULL);
+    printf("local alloc/free: OK\n");
+}
+
+static int _freed;
+
+static void _free_task(void *arg)
+{
+    void *obj;
+    memcpy(&obj, arg, sizeof(obj));
+    objcache_free(obj);
+    __atomic_add_fetch(&_freed, 1, __ATOMIC_RELEASE);
+}
+
+static void _wait_freed(int n)
+{
+    while (__atomic_load_n(&_freed, __ATOMIC_ACQUIRE) < n)
+        sched_yield();
+}
+
+static void _test_remote()
+{
+    struct objcache *cache = objcache_create(sizeof(struct revent));
+    struct thread_pool *pool = thread_pool_create(1);
+
+    /*every round the worker frees what we allocated, the next round must
+     * reuse it instead of growing*/
+    _freed = 0;
+    int slabs = 0;
+    for (int round = 0; round < 10; ++round) {
+        for (int i = 0; i < TEST_OBJS; ++i)
+            _objs[i] = objcache_alloc(cache);
+        for (int i = 0; i < TEST_OBJS; ++i)
+            thread_pool_push_payload(pool, TASK_PRIO_NORMAL, _free_task, _objs + i, sizeof(void*));
+        _wait_freed((round + 1) * TEST_OBJS);
+        if (round == 0)
+            slabs = _slab_count(cache->locals);
+        assert(_slab_count(cache->locals) == slabs);
+    }
+    /*the worker allocated nothing, its local is still empty*/
+    assert(_local_count(cache) == 1);
+
+    thread_pool_destroy(&pool);
+    objcache_destroy(&cache);
+    printf("remote free: OK\n");
+}
+
+static void *_alloc_and_exit(void *arg)
+{
+    struct objcache *cache = (struct objcache*)arg;
+    for (int i = 0; i < 100; ++i)
+        objcache_alloc(cache);
+    return NULL;
+}
+
+static void _test_orphan()
+{
+    struct objcache *cache = objcache_create(64);
+    pthread_t tid;
+    for (int i = 0; i < 4; ++i) {
+        pthread_create(&tid, NULL, _alloc_and_exit, cache);
+        pthread_join(tid, NULL);
+    }
+    /*each thread adopted the local its predecessor left*/
+    assert(_local_count(cache) == 1);
+    assert(cache->locals->orphan);
+    objcache_destroy(&cache);
+    printf("orphan adoption: OK\n");
+}
+
+static void _malloc_free_task(void *arg)
+{
+    void *obj;
+    memcpy(&obj, arg, sizeof(obj));
+    free(obj);
+    __atomic_add_fetch(&_freed, 1, __ATOMIC_RELEASE);
+}
+
+/*the reactor allocates, a worker frees: malloc against objcache*/
+static void _bench_handoff(const char *name, size_t size)
+{
+    struct thread_pool *pool = thread_pool_create(1);
+    struct objcache *cache = objcache_create(size);
+    int64_t t1, t2;
+
+    _freed = 0;
+    t1 = _now_ns();
+    for (int i = 0; i < BENCH_OBJS; ++i) {
+        void *obj = malloc(size);
+        *(volatile uint8_t*)obj = (uint8_t)i;
+        thread_pool_push_payload(pool, TASK_PRIO_NORMAL, _malloc_free_task, &obj, sizeof(obj));
+        if ((i + 1) % BENCH_BATCH == 0)
+            _wait_freed(i + 1);
+    }
+    _wait_freed(BENCH_OBJS);
+    t2 = _now_ns();
+    printf("%-8s %5zu bytes: malloc   %4ld ns/obj\n", name, size, (t2 - t1) / BENCH_OBJS);
+
+    _freed = 0;
+    t1 = _now_ns();
+    for (int i = 0; i < BENCH_OBJS; ++i) {
+        void *obj = objcache_alloc(cache);
+        *(volatile uint8_t*)obj = (uint8_t)i;
+        thread_pool_push_payload(pool, TASK_PRIO_NORMAL, _free_task, &obj, sizeof(obj));
+        if ((i + 1) % BENCH_BATCH == 0)
+            _wait_freed(i + 1);
+    }
+    _wait_freed(BENCH_OBJS);
+    t2 = _now_ns();
+    printf("%-8s %5zu bytes: objcache %4ld ns/obj\n", name, size, (t2 - t1) / BENCH_OBJS);
+
+    thread_pool_destroy(&pool);
+    objcache_destroy(&cache);
+}
+
+int main()
+{
+    _test_local();
+    _test_remote();
+    _test_orphan();
+
+    _bench_handoff("revent", sizeof(struct revent));
+    _bench_handoff("buffer", 4097);
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include "../server.h"
+#include "../reactor.h"
+#include "../rstats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <assert.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+
+#define TEST_WORKERS    3
+#define TEST_CONNS      60
+#define BENCH_CONNS     2000
+
+static int64_t _now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*in the workers: "pid" is answered with the pid, "crash" kills the worker*/
+static int on_receive(session_t session, void *buffer, size_t len)
+{
+    if (len == 5 && memcmp(buffer, "crash", 5) == 0)
+        kill(getpid(), SIGKILL);
+    if (len == 3 && memcmp(buffer, "pid", 3) == 0) {
+        int pid = getpid();
+        assert(write(session->f.fd, &pid, sizeof(pid)) == sizeof(pid));
+        return 0;
+    }
+    assert(write(session->f.fd, buffer, len) == len);
+    return 0;
+}
+
+static int _master_ret;
+
+static void *_master(void *arg)
+{
+    server_t s = (server_t)arg;
+    int index = server_prefork(s, TEST_WORKERS);
+    if (index >= 0) {
+        assert(index < TEST_WORKERS && s->worker == index && s->prefork == NULL);
+        reactor_run(REACTOR_INST);
+        _exit(0);
+    }
+    __atomic_store_n(&_master_ret, index, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int _client(struct sockaddr_in *addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    assert(connect(fd, (struct sockaddr*)addr, sizeof(*addr)) == 0);
+    return fd;
+}
+
+static void _echo(int fd, int i)
+{
+    char out[32], in[32];
+    int len = snprintf(out, sizeof(out), "hello %d", i);
+    assert(write(fd, out, len) == len);
+    assert(read(fd, in, sizeof(in)) == len);
+    assert(memcmp(in, out, len) == 0);
+}
+
+static int _pid_of(int fd)
+{
+    int pid;
+    assert(write(fd, "pid", 3) == 3);
+    assert(read(fd, &pid, sizeof(pid)) == sizeof(pid));
+    return pid;
+}
+
+static int _worker_of(server_t s, int pid)
+{
+    for (int i = 0; i < TEST_WORKERS; ++i) {
+        if (__atomic_load_n(&s->prefork->shm[i].pid, __ATOMIC_ACQUIRE) == pid)
+            return i;
+    }
+    return -1;
+}
+
+static void _wait_workers(server_t s)
+{
+    for (int i = 0; i < TEST_WORKERS; ++i) {
+        while (!__atomic_load_n(&s->prefork->shm[i].pid, __ATOMIC_ACQUIRE))
+            sched_yield();
+    }
+}
+
+/*the workers hit over a listener, each of them a known one*/
+static int _spread(server_t s, struct sockaddr_in *addr)
+{
+    int seen[TEST_WORKERS] = {0}, n = 0;
+    for (int i = 0; i < TEST_CONNS; ++i) {
+        int fd = _client(addr);
+        _echo(fd, i);
+        int w = _worker_of(s, _pid_of(fd));
+        assert(w >= 0);
+        if (!seen[w]++)
+            n++;
+        close(fd);
+    }
+    return n;
+}
+
+static void _addr_of(struct listener *listener, struct sockaddr_in *addr)
+{
+    socklen_t len = sizeof(*addr);
+    assert(getsockname(listener->f.fd, (struct sockaddr*)addr, &len) == 0);
+}
+
+static void _read_stats(const char *path, char *text, size_t size)
+{
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(connect(fd, (struct sockaddr*)&sun, sizeof(sun)) == 0);
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(fd, text + len, size - 1 - len)) > 0)
+        len += n;
+    text[len] = '\0';
+    close(fd);
+}
+
+int main()
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_prefork_stats_%d.sock", (int)getpid());
+
+    server_t s = server_create("127.0.0.1:0", NULL, on_receive, NULL);
+    assert(server_listen(s) == 0);
+    assert(server_add_listener(s, "127.0.0.1:0", 0, SERVER_REUSEPORT) == 0);
+    assert(server_enable_stats(s, path) == 0);
+    assert(server_set_timeouts(s, 60000, 0, 0) == 0);
+    struct sockaddr_in shared, reuseport;
+    _addr_of(s->listeners[0], &shared);
+    _addr_of(s->listeners[1], &reuseport);
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, _master, s);
+    while (!__atomic_load_n(&s->prefork, __ATOMIC_ACQUIRE))
+        sched_yield();
+    _wait_workers(s);
+    /*the master only kept the shared socket*/
+    assert(s->listeners[0]->f.fd >= 0 && s->listeners[1]->f.fd < 0);
+
+    uint64_t before[RSTAT_NUM], after[RSTAT_NUM];
+    server_prefork_stats(s, before);
+    int spread = _spread(s, &shared);
+    assert(spread >= 2);
+    /*the workers that lost a race for a client still accept*/
+    int again = _spread(s, &shared);
+    assert(again >= 2);
+    int reused = _spread(s, &reuseport);
+    assert(reused >= 2);
+    server_prefork_stats(s, after);
+    assert(after[RSTAT_ACCEPTS] - before[RSTAT_ACCEPTS] == TEST_CONNS * 3);
+    printf("shared listener, %d and %d of %d workers hit: OK\n", spread, again, TEST_WORKERS);
+    printf("SO_REUSEPORT listener, %d of %d workers hit: OK\n", reused, TEST_WORKERS);
+
+    char text[SERVER_STATS_SIZE];
+    _read_stats(path, text, sizeof(text));
+    char line[64];
+    snprintf(line, sizeof(line), "workers %d\n", TEST_WORKERS);
+    assert(strstr(text, line) && strstr(text, "\naccepts "));
+    printf("stats of all workers from the master: OK\n");
+
+    /*a crash takes one worker down, the master starts another*/
+    int fd = _client(&reuseport);
+    int pid = _pid_of(fd);
+    int w = _worker_of(s, pid);
+    assert(write(fd, "crash", 5) == 5);
+    char c;
+    assert(read(fd, &c, 1) <= 0);
+    close(fd);
+    while (__atomic_load_n(&s->prefork->shm[w].restarts, __ATOMIC_ACQUIRE) != 1)
+        sched_yield();
+    _wait_workers(s);
+    assert(s->prefork->shm[w].pid != pid);
+    _spread(s, &shared);
+    _spread(s, &reuseport);
+    server_prefork_stats(s, before);
+    assert(before[RSTAT_ACCEPTS] - after[RSTAT_ACCEPTS] == TEST_CONNS * 2 + 1);
+    printf("worker %d restarted, counts kept: OK\n", w);
+
+    /*dying again soon after, it waits twice as long*/
+    assert(s->prefork->shm[w].backoff == SERVER_PREFORK_TICK);
+    do {
+        fd = _client(&reuseport);
+        pid = _pid_of(fd);
+        if (_worker_of(s, pid) != w)
+            close(fd);
+    } while (_worker_of(s, pid) != w);
+    int64_t t0 = _now_ns();
+    assert(write(fd, "crash", 5) == 5);
+    assert(read(fd, &c, 1) <= 0);
+    close(fd);
+    while (__atomic_load_n(&s->prefork->shm[w].restarts, __ATOMIC_ACQUIRE) != 2)
+        sched_yield();
+    _wait_workers(s);
+    int64_t waited = (_now_ns() - t0) / 1000000;
+    assert(s->prefork->shm[w].backoff == SERVER_PREFORK_TICK * 2);
+    assert(waited >= SERVER_PREFORK_TICK * 2);
+    printf("worker %d restarted after %ld ms backoff: OK\n", w, waited);
+
+    int64_t t1 = _now_ns();
+    for (int i = 0; i < BENCH_CONNS; ++i) {
+        fd = _client(&reuseport);
+        _echo(fd, i);
+        close(fd);
+    }
+    int64_t t2 = _now_ns();
+    printf("connect/echo/close %d over %d workers: %ld ns/conn\n",
+            BENCH_CONNS, TEST_WORKERS, (t2 - t1) / BENCH_CONNS);
+
+    int pids[TEST_WORKERS];
+    for (int i = 0; i < TEST_WORKERS; ++i)
+        pids[i] = s->prefork->shm[i].pid;
+    server_prefork_stop(s);
+    pthread_join(tid, NULL);
+    assert(_master_ret == SERVER_PREFORK_MASTER);
+    for (int i = 0; i < TEST_WORKERS; ++i)
+        assert(s->prefork->shm[i].pid == 0 && kill(pids[i], 0) < 0);
+    printf("stop: OK\n");
+
+    server_destroy(&s);
+    assert(access(path, F_OK) != 0);
+    return 0;
+}
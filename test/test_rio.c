@@ -6,7 +6,18 @@
 #include <assert.h>
 #include <pthread.h>
 
+#define RIO_TEST_REACTORS 16
+
 int pipefd[2];
+reactor_t g_reactor;
+pthread_t loop_tid;
+int posted = 0;
+
+static void on_post(void *data)
+{
+    assert(pthread_equal(pthread_self(), loop_tid));
+    posted++;
+}
 
 static int on_timer(struct rtimer *timer, void *data)
 {
@@ -18,6 +29,7 @@ static int on_timer(struct rtimer *timer, void *data)
     if (a >= 10)
         assert(write(pipefd[1], "exit", 5) == 5);
     printf("%s\n", (char*)data);
+    reactor_post(g_reactor, on_post, NULL);
     a++;
     return 0;
 }
@@ -48,6 +60,8 @@ int main()
     printf("PID:%d, TID:%lx\n", getpid(), pthread_self());
     reactor_t r = reactor_create();  
     assert(r);
+    g_reactor = r;
+    loop_tid = pthread_self();
     struct rtimer timer;
     timer.mtime = 10;
     timer.timer_id = 314;
@@ -66,6 +80,17 @@ int main()
     assert(reactor_add_signal(r, &signal, on_signal, NULL) == REACTER_OK);
 
     reactor_run(r);
+    assert(posted > 0);
     reactor_destroy(&r);
+
+    /*each reactor watches the pool, there is no limit on them*/
+    reactor_t rs[RIO_TEST_REACTORS];
+    for (int i = 0; i < RIO_TEST_REACTORS; ++i)
+        assert((rs[i] = reactor_create()) != NULL);
+    reactor_destroy(&rs[0]);
+    assert((rs[0] = reactor_create()) != NULL);
+    for (int i = 0; i < RIO_TEST_REACTORS; ++i)
+        reactor_destroy(&rs[i]);
+    printf("many reactors watching the pool: OK\n");
     return 0;
 }
@@ -0,0 +1,101 @@
+#include "../rstats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <assert.h>
+
+#define TEST_THREADS    4
+#define TEST_ADDS       1000000
+#define BENCH_ADDS      10000000
+#define BENCH_SNAPSHOTS 100000
+
+static int64_t _now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *_adder(void *arg)
+{
+    for (int i = 0; i < TEST_ADDS; ++i) {
+        rstats_add(RSTAT_EVENTS, 1);
+        rstats_add(RSTAT_BYTES_IN, 3);
+    }
+    return NULL;
+}
+
+static int _adding;
+
+/*sums only go up, even read while the slots are written*/
+static void *_reader(void *arg)
+{
+    uint64_t last[RSTAT_NUM] = {0}, now[RSTAT_NUM];
+    int *snapshots = (int*)arg;
+    while (__atomic_load_n(&_adding, __ATOMIC_ACQUIRE)) {
+        rstats_collect(now);
+        for (int i = 0; i < RSTAT_NUM; ++i) {
+            assert(now[i] >= last[i]);
+            last[i] = now[i];
+        }
+        ++*snapshots;
+    }
+    return NULL;
+}
+
+static void _test_sums()
+{
+    uint64_t before[RSTAT_NUM], after[RSTAT_NUM];
+    rstats_collect(before);
+
+    pthread_t adders[TEST_THREADS], reader;
+    int snapshots = 0;
+    __atomic_store_n(&_adding, 1, __ATOMIC_RELEASE);
+    pthread_create(&reader, NULL, _reader, &snapshots);
+    for (int i = 0; i < TEST_THREADS; ++i)
+        pthread_create(adders + i, NULL, _adder, NULL);
+    for (int i = 0; i < TEST_THREADS; ++i)
+        pthread_join(adders[i], NULL);
+    __atomic_store_n(&_adding, 0, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+
+    rstats_collect(after);
+    assert(after[RSTAT_EVENTS] - before[RSTAT_EVENTS] == (uint64_t)TEST_THREADS * TEST_ADDS);
+    assert(after[RSTAT_BYTES_IN] - before[RSTAT_BYTES_IN] == (uint64_t)TEST_THREADS * TEST_ADDS * 3);
+    assert(after[RSTAT_ACCEPTS] == before[RSTAT_ACCEPTS]);
+    printf("exact sums with %d snapshots taken meanwhile: OK\n", snapshots);
+
+    /*the slots of the exited threads are reused, the counts stay*/
+    pthread_create(adders, NULL, _adder, NULL);
+    pthread_join(adders[0], NULL);
+    rstats_collect(before);
+    assert(before[RSTAT_EVENTS] - after[RSTAT_EVENTS] == TEST_ADDS);
+    printf("slot reuse: OK\n");
+
+    assert(rstats_name(RSTAT_WAKEUPS) && rstats_name(RSTAT_SYS_ACCEPT) && !rstats_name(RSTAT_NUM));
+}
+
+static void _bench()
+{
+    int64_t t1 = _now_ns();
+    for (int i = 0; i < BENCH_ADDS; ++i)
+        rstats_add(RSTAT_POSTS, 1);
+    int64_t t2 = _now_ns();
+
+    uint64_t counters[RSTAT_NUM];
+    for (int i = 0; i < BENCH_SNAPSHOTS; ++i)
+        rstats_collect(counters);
+    int64_t t3 = _now_ns();
+    assert(counters[RSTAT_POSTS] >= BENCH_ADDS);
+
+    printf("rstats_add: %.2f ns/op, rstats_collect: %ld ns/op\n",
+            (double)(t2 - t1) / BENCH_ADDS, (t3 - t2) / BENCH_SNAPSHOTS);
+}
+
+int main()
+{
+    _test_sums();
+    _bench();
+    return 0;
+}
@@ -0,0 +1,1060 @@
+#include "../server.h"
+#include "../session.h"
+#include "../reactor.h"
+#include "../rstats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <assert.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#define TEST_CLIENTS    50
+#define BENCH_CONNS     2000
+#define BENCH_FAMILY_CONNS  1000
+#define BENCH_ROUNDTRIPS    20000
+#define BENCH_SUBSCRIBERS    4000
+#define BENCH_SESSIONS  1000000
+#define BENCH_IDLE      30000   //ms
+#define BENCH_SECONDS   60      //simulated
+#define TEST_STREAM     (1 << 20)
+#define TEST_RATE       (1 << 20)   //bytes per second
+#define TEST_BURST      (64 << 10)
+#define TEST_LIMITED    (512 << 10)
+#define BENCH_PINGS     2000
+
+/*count the allocations of the whole process while _counting is set*/
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void*, size_t);
+static int _counting;
+static long _allocs;
+
+void *malloc(size_t size)
+{
+    if (__atomic_load_n(&_counting, __ATOMIC_RELAXED))
+        __atomic_add_fetch(&_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    if (__atomic_load_n(&_counting, __ATOMIC_RELAXED))
+        __atomic_add_fetch(&_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+    if (__atomic_load_n(&_counting, __ATOMIC_RELAXED))
+        __atomic_add_fetch(&_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(p, size);
+}
+
+static int64_t _now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int _newconnects;
+static int _connecteds;
+static int _closes;
+static int _pongs;
+static session_id_t _last_id;
+
+static int on_newconnect(session_t session)
+{
+    __atomic_store_n(&_last_id, session->session_id, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&_newconnects, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*inbound sessions echo, the outbound one only counts what comes back*/
+static int on_receive(session_t session, void *buffer, size_t len)
+{
+    if (session->data) {
+        assert(len == 4 && memcmp(buffer, "ping", 4) == 0);
+        __atomic_add_fetch(&_pongs, 1, __ATOMIC_RELEASE);
+        return 0;
+    }
+    assert(write(session->f.fd, buffer, len) == len);
+    return 0;
+}
+
+static int on_connected(session_t session)
+{
+    session->data = (void*)1;
+    __atomic_add_fetch(&_connecteds, 1, __ATOMIC_RELEASE);
+    assert(write(session->f.fd, "ping", 4) == 4);
+    return 0;
+}
+
+static void on_close(session_t session)
+{
+    __atomic_add_fetch(&_closes, 1, __ATOMIC_RELEASE);
+}
+
+static int _timeouts[3];
+
+static int on_timeout(session_t session, enum session_timeout reason)
+{
+    __atomic_add_fetch(_timeouts + reason, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void _wait_for(int *counter, int n)
+{
+    while (__atomic_load_n(counter, __ATOMIC_ACQUIRE) < n)
+        sched_yield();
+}
+
+static void *_reactor_thread(void *arg)
+{
+    reactor_run((reactor_t)arg);
+    return NULL;
+}
+
+static int _client(struct sockaddr_in *addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    assert(connect(fd, (struct sockaddr*)addr, sizeof(*addr)) == 0);
+    return fd;
+}
+
+static int _client_of(struct listener *listener)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    assert(getsockname(listener->f.fd, (struct sockaddr*)&addr, &len) == 0);
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    assert(connect(fd, (struct sockaddr*)&addr, len) == 0);
+    return fd;
+}
+
+static void _echo(int fd, int i)
+{
+    char out[32], in[32];
+    int len = snprintf(out, sizeof(out), "hello %d", i);
+    assert(write(fd, out, len) == len);
+    assert(read(fd, in, sizeof(in)) == len);
+    assert(memcmp(in, out, len) == 0);
+}
+
+static int _expires;
+static enum session_timeout _last_reason;
+
+static int _count_expire(session_t session, enum session_timeout reason, void *arg)
+{
+    _expires++;
+    _last_reason = reason;
+    return arg != NULL;     //keep if asked to
+}
+
+static void _test_timeouts()
+{
+    session_manager_t mgr = session_manager_create_for_all(8);
+    int64_t now = mgr->now;
+
+    /*idle: activity pushes the deadline without touching the wheel*/
+    session_manager_set_timeouts(mgr, 1000, 0, 0);
+    session_t session = session_alloc(mgr, -1);
+    session_timeout_start(mgr, session);
+    assert(session_manager_expire(mgr, now + 500, _count_expire, NULL) == 0);
+    session_touch_read(mgr, session);
+    assert(session_manager_expire(mgr, now + 1200, _count_expire, NULL) == 0);
+    session_touch_write(mgr, session);
+    assert(session_manager_expire(mgr, now + 1600, _count_expire, NULL) == 0);
+    assert(session_manager_expire(mgr, now + 2700, _count_expire, NULL) == 1);
+    assert(_last_reason == SESSION_TIMEOUT_IDLE && session->wheel_slot == -1);
+
+    /*kept by the callback, it runs out again a timeout later*/
+    session_timeout_start(mgr, session);
+    assert(session_manager_expire(mgr, now + 3800, _count_expire, (void*)1) == 1);
+    assert(session->wheel_slot >= 0);
+    assert(session_manager_expire(mgr, now + 4500, _count_expire, NULL) == 0);
+    assert(session_manager_expire(mgr, now + 5000, _count_expire, NULL) == 1);
+
+    /*read runs out although writes go on*/
+    session_manager_set_timeouts(mgr, 0, 1000, 0);
+    session_timeout_start(mgr, session);
+    for (int i = 1; i <= 5; ++i) {
+        session_manager_expire(mgr, now + 5000 + i * 300, _count_expire, NULL);
+        session_touch_write(mgr, session);
+    }
+    assert(_expires == 4 && _last_reason == SESSION_TIMEOUT_READ);
+
+    /*write counts only while something is pending*/
+    session_manager_set_timeouts(mgr, 0, 0, 1000);
+    session_timeout_start(mgr, session);
+    assert(session_manager_expire(mgr, now + 10000, _count_expire, NULL) == 0);
+    session_write_pending(mgr, session, true);
+    assert(session_manager_expire(mgr, now + 10800, _count_expire, NULL) == 0);
+    session_touch_write(mgr, session);
+    assert(session_manager_expire(mgr, now + 11600, _count_expire, NULL) == 0);
+    assert(session_manager_expire(mgr, now + 12000, _count_expire, NULL) == 1);
+    assert(_last_reason == SESSION_TIMEOUT_WRITE);
+
+    /*a freed session leaves the wheel*/
+    session_timeout_start(mgr, session);
+    session_free(mgr, session);
+    assert(session_manager_expire(mgr, now + 20000, _count_expire, NULL) == 0);
+
+    session_manager_destroy(&mgr);
+    printf("session timeouts: OK\n");
+}
+
+/*BENCH_SESSIONS idle sessions, 1% of them active in every tick*/
+static void _bench_timeouts()
+{
+    session_manager_t mgr = session_manager_create_for_all(BENCH_SESSIONS);
+    session_manager_set_timeouts(mgr, BENCH_IDLE, 0, 0);
+    int64_t now = mgr->now;
+    for (int i = 0; i < BENCH_SESSIONS; ++i)
+        session_timeout_start(mgr, session_alloc(mgr, -1));
+
+    int ticks = BENCH_SECONDS * 1000 / SESSION_WHEEL_TICK;
+    int per_tick = BENCH_SESSIONS / 100;
+    int64_t expire_ns = 0, touch_ns = 0;
+    size_t expired = 0;
+    unsigned seed = 1;
+    _expires = 0;
+    for (int i = 1; i <= ticks; ++i) {
+        int64_t t1 = _now_ns();
+        expired += session_manager_expire(mgr, now + i * SESSION_WHEEL_TICK, _count_expire, (void*)1);
+        int64_t t2 = _now_ns();
+        for (int j = 0; j < per_tick; ++j)
+            session_touch_read(mgr, mgr->sessions + rand_r(&seed) % BENCH_SESSIONS);
+        int64_t t3 = _now_ns();
+        expire_ns += t2 - t1;
+        touch_ns += t3 - t2;
+    }
+    assert(session_manager_len(mgr) == BENCH_SESSIONS);
+    printf("%d sessions, %ds idle, %d s simulated: sweep %.3f ms cpu/s (%zu expired), touch %ld ns\n",
+            BENCH_SESSIONS, BENCH_IDLE / 1000, BENCH_SECONDS, expire_ns / 1e6 / BENCH_SECONDS,
+            expired, touch_ns / ((int64_t)ticks * per_tick));
+    session_manager_destroy(&mgr);
+}
+
+/*echo through a listener of every family, then compare them on loopback*/
+static void _test_families(server_t s)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "unix:/tmp/test_server_%d.sock", (int)getpid());
+    const char *names[] = {"tcp4", "tcp6", "unix"};
+    struct listener *listeners[3] = {s->listeners[0], NULL, NULL};
+
+    if (server_add_listener(s, "[::1]:0", 64, SERVER_REUSEPORT) == 0)
+        listeners[1] = s->listeners[s->listener_num - 1];
+    else
+        printf("no IPv6 loopback, tcp6 skipped\n");
+    assert(server_add_listener(s, path, 0, 0) == 0);
+    listeners[2] = s->listeners[s->listener_num - 1];
+    assert(server_add_listener(s, "unix:", 0, 0) != 0);
+    assert(server_add_listener(s, "[::1:0", 0, 0) != 0);
+    /*a live socket file is never taken over, a dead one is*/
+    assert(server_add_listener(s, path, 0, 0) != 0);
+    int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_storage ss;
+    socklen_t sslen;
+    char stale_path[80];
+    snprintf(stale_path, sizeof(stale_path), "%s.stale", path);
+    assert(parse_addr(stale_path, &ss, &sslen) == 0);
+    assert(bind(stale, (struct sockaddr*)&ss, sslen) == 0 && listen(stale, 1) == 0);
+    close(stale);
+    assert(server_add_listener(s, stale_path, 0, 0) == 0);
+
+    int closes = __atomic_load_n(&_closes, __ATOMIC_ACQUIRE);
+    for (int f = 0; f < 3; ++f) {
+        if (!listeners[f])
+            continue;
+        int fd = _client_of(listeners[f]);
+        _echo(fd, f);
+        close(fd);
+        _wait_for(&_closes, ++closes);
+    }
+    printf("tcp4/tcp6/unix listeners: OK\n");
+
+    for (int f = 0; f < 3; ++f) {
+        if (!listeners[f])
+            continue;
+        int64_t t1 = _now_ns();
+        for (int i = 0; i < BENCH_FAMILY_CONNS; ++i) {
+            int fd = _client_of(listeners[f]);
+            _echo(fd, i);
+            close(fd);
+        }
+        closes += BENCH_FAMILY_CONNS;
+        _wait_for(&_closes, closes);
+        int64_t t2 = _now_ns();
+
+        int fd = _client_of(listeners[f]);
+        for (int i = 0; i < BENCH_ROUNDTRIPS; ++i)
+            _echo(fd, i);
+        int64_t t3 = _now_ns();
+        close(fd);
+        _wait_for(&_closes, ++closes);
+        printf("%s: connect/echo/close %ld ns/conn, echo %ld ns/round trip\n", names[f],
+                (t2 - t1) / BENCH_FAMILY_CONNS, (t3 - t2) / BENCH_ROUNDTRIPS);
+    }
+}
+
+static int _handed_over;
+static int _hammer_stop;
+static int _hammer_conns;
+
+static void on_handover(server_t s)
+{
+    __atomic_store_n(&_handed_over, 1, __ATOMIC_RELEASE);
+}
+
+/*connects without pause through the handover, every one must be served*/
+static void *_hammer(void *arg)
+{
+    struct listener *listener = (struct listener*)arg;
+    while (!__atomic_load_n(&_hammer_stop, __ATOMIC_ACQUIRE)) {
+        int fd = _client_of(listener);
+        _echo(fd, _hammer_conns);
+        close(fd);
+        __atomic_add_fetch(&_hammer_conns, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void _wait_len(server_t s, size_t len)
+{
+    while (session_manager_len(s->session_mgr) != len)
+        sched_yield();
+}
+
+/*both processes of a hot restart in one: old hands over to new*/
+static void _test_handover()
+{
+    char ctl[64], path[64];
+    snprintf(ctl, sizeof(ctl), "/tmp/test_server_ctl_%d.sock", (int)getpid());
+    snprintf(path, sizeof(path), "unix:/tmp/test_server_ho_%d.sock", (int)getpid());
+    server_t nobody = server_create(NULL, NULL, NULL, NULL);
+    assert(server_takeover(nobody, ctl) == 0 && nobody->listener_num == 0);
+    server_destroy(&nobody);
+
+    server_t old = server_create(NULL, on_newconnect, on_receive, on_connected);
+    server_set_close_cb(old, on_close);
+    assert(server_add_listener(old, "127.0.0.1:0", 0, 0) == 0);
+    assert(server_add_listener(old, path, 0, 0) == 0);
+    assert(server_enable_handover(old, ctl, on_handover) == 0);
+
+    int kept = _client_of(old->listeners[1]);
+    _echo(kept, 0);
+    _wait_len(old, 1);
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, _hammer, old->listeners[0]);
+    while (__atomic_load_n(&_hammer_conns, __ATOMIC_ACQUIRE) < 100)
+        sched_yield();
+
+    server_t new = server_create(NULL, on_newconnect, on_receive, on_connected);
+    server_set_close_cb(new, on_close);
+    assert(server_takeover(new, ctl) == 2);
+    assert(strcmp(new->listeners[1]->addr, path) == 0);
+    while (!__atomic_load_n(&_handed_over, __ATOMIC_ACQUIRE))
+        sched_yield();
+    assert(server_enable_handover(new, ctl, NULL) == 0);
+
+    int conns = __atomic_load_n(&_hammer_conns, __ATOMIC_ACQUIRE);
+    while (__atomic_load_n(&_hammer_conns, __ATOMIC_ACQUIRE) < conns + 100)
+        sched_yield();
+    __atomic_store_n(&_hammer_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(tid, NULL);
+
+    /*new connections land in the new server, the old one drains*/
+    _wait_len(old, 1);
+    _wait_len(new, 0);
+    int fd = _client_of(new->listeners[1]);
+    _echo(fd, 1);
+    _wait_len(new, 1);
+    assert(session_manager_len(old->session_mgr) == 1);
+    _echo(kept, 2);
+    close(kept);
+    close(fd);
+    _wait_len(old, 0);
+    _wait_len(new, 0);
+    printf("hot restart, %d connections through it: OK\n", _hammer_conns);
+
+    /*the socket files stay with the new server*/
+    server_destroy(&old);
+    assert(access(path + 5, F_OK) == 0 && access(ctl, F_OK) == 0);
+    server_destroy(&new);
+    assert(access(path + 5, F_OK) != 0 && access(ctl, F_OK) != 0);
+}
+
+/*a new process that dies before its ack takes nothing: the old one keeps
+ * its listeners and its path, and the next try goes through*/
+static void _test_handover_nack()
+{
+    char ctl[64];
+    snprintf(ctl, sizeof(ctl), "/tmp/test_server_ctl_%d.sock", (int)getpid());
+    __atomic_store_n(&_handed_over, 0, __ATOMIC_RELEASE);
+
+    server_t old = server_create(NULL, on_newconnect, on_receive, on_connected);
+    server_set_close_cb(old, on_close);
+    assert(server_add_listener(old, "127.0.0.1:0", 0, 0) == 0);
+    assert(server_enable_handover(old, ctl, on_handover) == 0);
+
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, ctl);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(connect(fd, (struct sockaddr*)&sun, sizeof(sun)) == 0);
+    char buf[128];
+    assert(read(fd, buf, sizeof(buf)) > 0);
+    assert(!old->listeners[0]->stopped && access(ctl, F_OK) == 0);
+    close(fd);
+
+    server_t new = server_create(NULL, on_newconnect, on_receive, on_connected);
+    server_set_close_cb(new, on_close);
+    assert(server_takeover(new, ctl) == 1);
+    /*the path is free once server_takeover returns*/
+    assert(old->listeners[0]->stopped && access(ctl, F_OK) != 0);
+    while (!__atomic_load_n(&_handed_over, __ATOMIC_ACQUIRE))
+        sched_yield();
+    assert(server_enable_handover(new, ctl, NULL) == 0);
+    printf("hot restart after a new process died unacked: OK\n");
+
+    server_destroy(&old);
+    server_destroy(&new);
+}
+
+/*listeners beyond SERVER_HANDOVER_MAX stay with the old process*/
+static void _test_handover_max()
+{
+    char ctl[64];
+    snprintf(ctl, sizeof(ctl), "/tmp/test_server_ctl_%d.sock", (int)getpid());
+    __atomic_store_n(&_handed_over, 0, __ATOMIC_RELEASE);
+
+    server_t old = server_create(NULL, on_newconnect, on_receive, on_connected);
+    server_set_close_cb(old, on_close);
+    for (int i = 0; i <= SERVER_HANDOVER_MAX; ++i)
+        assert(server_add_listener(old, "127.0.0.1:0", 0, 0) == 0);
+    assert(server_enable_handover(old, ctl, on_handover) == 0);
+
+    server_t new = server_create(NULL, on_newconnect, on_receive, on_connected);
+    server_set_close_cb(new, on_close);
+    assert(server_takeover(new, ctl) == SERVER_HANDOVER_MAX);
+    while (!__atomic_load_n(&_handed_over, __ATOMIC_ACQUIRE))
+        sched_yield();
+
+    struct listener *left = old->listeners[SERVER_HANDOVER_MAX];
+    assert(old->listeners[SERVER_HANDOVER_MAX - 1]->stopped && !left->stopped);
+    int fd = _client_of(left);
+    _echo(fd, 0);
+    _wait_len(old, 1);
+    close(fd);
+    _wait_len(old, 0);
+    assert(session_manager_len(new->session_mgr) == 0);
+    printf("hot restart of %d listeners, the last one kept: OK\n", SERVER_HANDOVER_MAX + 1);
+
+    server_destroy(&old);
+    server_destroy(&new);
+}
+
+static int _frames;
+
+/*echo the frame back with its prefix*/
+static int on_frame(session_t session, void *frame, size_t len)
+{
+    uint8_t out[2 + 256];
+    assert(len <= 256);
+    out[0] = len >> 8;
+    out[1] = len & 0xff;
+    memcpy(out + 2, frame, len);
+    assert(write(session->f.fd, out, len + 2) == len + 2);
+    __atomic_add_fetch(&_frames, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void _read_full(int fd, void *buffer, size_t len)
+{
+    for (size_t n = 0; n < len; ) {
+        ssize_t ret = read(fd, (uint8_t*)buffer + n, len - n);
+        assert(ret > 0);
+        n += ret;
+    }
+}
+
+static void _test_framing()
+{
+    struct frame_format format = {FRAME_FIXED2, 1, 256};
+    server_t fs = server_create("127.0.0.1:0", NULL, on_frame, NULL);
+    server_set_framing(fs, &format);
+    assert(server_listen(fs) == 0);
+
+    /*100 frames in one write, then one split over three*/
+    uint8_t stream[100 * 12], in[sizeof(stream)];
+    for (int i = 0; i < 100; ++i)
+        snprintf((char*)stream + i * 12, 13, "%c%cframe %04d", 0, 10, i);
+    int fd = _client_of(fs->listeners[0]);
+    assert(write(fd, stream, sizeof(stream)) == sizeof(stream));
+    _read_full(fd, in, sizeof(stream));
+    assert(memcmp(in, stream, sizeof(stream)) == 0);
+    int pieces[] = {0, 1, 7, 12};
+    for (int i = 0; i < 3; ++i) {
+        int len = pieces[i + 1] - pieces[i];
+        assert(write(fd, stream + pieces[i], len) == len);
+        usleep(20000);
+    }
+    _read_full(fd, in, 12);
+    assert(memcmp(in, stream, 12) == 0);
+    _wait_for(&_frames, 101);
+
+    /*an oversized frame closes the session*/
+    assert(write(fd, "\x01\x01", 2) == 2);
+    assert(read(fd, in, 1) == 0);
+    close(fd);
+    _wait_len(fs, 0);
+    server_destroy(&fs);
+    printf("framed sessions: OK\n");
+}
+
+static size_t _streamed;
+static int _stream_closes;
+
+/*a stream is the bytes of its offsets, & 0xff*/
+static int on_stream(session_t session, void *buffer, size_t len)
+{
+    size_t off = __atomic_load_n(&_streamed, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < len; ++i)
+        assert(((uint8_t*)buffer)[i] == ((off + i) & 0xff));
+    __atomic_store_n(&_streamed, off + len, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void on_stream_close(session_t session)
+{
+    __atomic_add_fetch(&_stream_closes, 1, __ATOMIC_RELEASE);
+}
+
+struct streamer {
+    int fd;
+    size_t len;                 //0 to write until stop
+    int stop;
+};
+
+static void *_streamer(void *arg)
+{
+    struct streamer *st = (struct streamer*)arg;
+    static uint8_t pattern[65536 + 256];
+    for (size_t i = 0; i < sizeof(pattern); ++i)
+        pattern[i] = i & 0xff;
+
+    size_t off = 0;
+    while (st->len ? off < st->len : !__atomic_load_n(&st->stop, __ATOMIC_ACQUIRE)) {
+        size_t len = st->len && st->len - off < 65536 ? st->len - off : 65536;
+        ssize_t ret = write(st->fd, pattern + (off & 0xff), len);
+        assert(ret > 0);
+        off += ret;
+    }
+    close(st->fd);
+    return NULL;
+}
+
+static void _test_streams(server_t ss)
+{
+    /*more than one read buffer in one go, with the end right behind it*/
+    uint64_t counters[RSTAT_NUM];
+    rstats_collect(counters);
+    uint64_t requeued = counters[RSTAT_READY_EVENTS];
+    struct streamer st = {_client_of(ss->listeners[0]), TEST_STREAM, 0};
+    _streamer(&st);
+    _wait_for(&_stream_closes, 1);
+    assert(_streamed == TEST_STREAM);
+    rstats_collect(counters);
+    requeued = counters[RSTAT_READY_EVENTS] - requeued;
+    assert(requeued > 0);
+    printf("%d byte stream to its end: OK, %lu reads served from the ready list\n",
+            TEST_STREAM, requeued);
+
+    /*the burst goes at once, the rest at the rate*/
+    server_set_rate_limit(ss, TEST_RATE, TEST_BURST);
+    _streamed = 0;
+    st.fd = _client_of(ss->listeners[0]);
+    st.len = TEST_LIMITED;
+    pthread_t tid;
+    int64_t t1 = _now_ns();
+    pthread_create(&tid, NULL, _streamer, &st);
+    _wait_for(&_stream_closes, 2);
+    int64_t ms = (_now_ns() - t1) / 1000000;
+    pthread_join(tid, NULL);
+    int64_t expected = (int64_t)(TEST_LIMITED - TEST_BURST) * 1000 / TEST_RATE;
+    assert(_streamed == TEST_LIMITED);
+    assert(ms >= expected * 9 / 10 && ms < expected * 2);
+    printf("rate limit: %d bytes in %ld ms, %ld expected: OK\n", TEST_LIMITED, ms, expected);
+    server_set_rate_limit(ss, 0, 0);
+}
+
+static int _cmp_ns(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/*round trips of a small client, alone and next to a client streaming
+ * as fast as it can*/
+static void _bench_fairness(server_t ss, struct sockaddr_in *addr)
+{
+    static int64_t lat[BENCH_PINGS];
+    int fd = _client(addr);
+    for (int round = 0; round < 2; ++round) {
+        pthread_t tid;
+        struct streamer st = {_client_of(ss->listeners[0]), 0, 0};
+        _streamed = 0;
+        if (round)
+            pthread_create(&tid, NULL, _streamer, &st);
+        else
+            close(st.fd);
+        for (int i = 0; i < BENCH_PINGS; ++i) {
+            int64_t t = _now_ns();
+            _echo(fd, i);
+            lat[i] = _now_ns() - t;
+        }
+        size_t streamed = __atomic_load_n(&_streamed, __ATOMIC_ACQUIRE);
+        if (round) {
+            __atomic_store_n(&st.stop, 1, __ATOMIC_RELEASE);
+            pthread_join(tid, NULL);
+        }
+        qsort(lat, BENCH_PINGS, sizeof(int64_t), _cmp_ns);
+        printf("round trips %s: p50 %ld ns, p99 %ld ns, max %ld ns; %zu MB streamed\n",
+                round ? "next to a bulk stream" : "alone", lat[BENCH_PINGS / 2],
+                lat[BENCH_PINGS * 99 / 100], lat[BENCH_PINGS - 1], streamed >> 20);
+    }
+    close(fd);
+}
+
+static void _wait_refs(struct rbuf *buf, int refs)
+{
+    while (__atomic_load_n(&buf->refs, __ATOMIC_ACQUIRE) != refs)
+        sched_yield();
+}
+
+static size_t _session_ids(server_t s, session_id_t *ids)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < s->session_mgr->capacity; ++i) {
+        session_id_t id = s->session_mgr->sessions[i].session_id;
+        if (id)
+            ids[n++] = id;
+    }
+    return n;
+}
+
+static void _test_broadcast(server_t s, struct sockaddr_in *addr)
+{
+    int fds[TEST_CLIENTS];
+    session_id_t ids[TEST_CLIENTS + 1];
+    for (int i = 0; i < TEST_CLIENTS; ++i) {
+        fds[i] = _client(addr);
+        _echo(fds[i], i);
+    }
+    _wait_len(s, TEST_CLIENTS);
+    assert(_session_ids(s, ids) == TEST_CLIENTS);
+
+    /*one buffer, every client gets it, and it goes with the last write*/
+    const char *msg = "one for all";
+    struct rbuf *buf = rbuf_from(msg, strlen(msg));
+    ids[TEST_CLIENTS] = SESSION_ID(12345, 0);   //stale
+    assert(server_broadcast(s, ids, TEST_CLIENTS + 1, buf) == TEST_CLIENTS);
+    char in[64];
+    for (int i = 0; i < TEST_CLIENTS; ++i) {
+        _read_full(fds[i], in, strlen(msg));
+        assert(memcmp(in, msg, strlen(msg)) == 0);
+    }
+    _wait_refs(buf, 1);
+    rbuf_unref(buf);
+    printf("broadcast to %d: OK\n", TEST_CLIENTS);
+
+    /*more than the sockets take: the rest waits for write readiness.
+     * a queue over SERVER_OUT_MAX turns sends down*/
+    int slow = socket(AF_INET, SOCK_STREAM, 0);
+    int rcvbuf = 4096;
+    setsockopt(slow, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    assert(connect(slow, (struct sockaddr*)addr, sizeof(*addr)) == 0);
+    _wait_len(s, TEST_CLIENTS + 1);
+    session_t session = NULL;
+    for (size_t i = 0; i < s->session_mgr->capacity && !session; ++i) {
+        session_t candidate = s->session_mgr->sessions + i;
+        int found = candidate->session_id != 0;
+        for (int j = 0; j < TEST_CLIENTS && found; ++j)
+            found = candidate->session_id != ids[j];
+        if (found)
+            session = candidate;
+    }
+    assert(session);
+
+    buf = rbuf_create(256 << 10);
+    for (size_t i = 0; i < buf->len; ++i)
+        buf->data[i] = i % 251;
+    struct rbuf *huge = rbuf_create(SERVER_OUT_MAX + 1);
+    assert(server_send(s, session, huge) == -1);
+    rbuf_unref(huge);
+    int sndbuf = 16384;
+    setsockopt(session->f.fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    for (int i = 0; i < 12; ++i)
+        assert(server_send(s, session, buf) == 0);
+    usleep(50000);
+    assert(session->out_armed && session->write_since);
+    assert(__atomic_load_n(&buf->refs, __ATOMIC_ACQUIRE) > 1);
+    /*read as it comes, the sender is held back meanwhile*/
+    uint8_t *big = (uint8_t*)malloc(buf->len);
+    for (int i = 0; i < 12; ++i) {
+        _read_full(slow, big, buf->len);
+        assert(memcmp(big, buf->data, buf->len) == 0);
+    }
+    free(big);
+    _wait_refs(buf, 1);
+    rbuf_unref(buf);
+    assert(session->write_since == 0 && !session->out_armed);
+
+    /*what is queued on a closing session is dropped*/
+    buf = rbuf_create(256 << 10);
+    for (int i = 0; i < 8; ++i)
+        server_send(s, session, buf);
+    for (int i = 0; i < TEST_CLIENTS; ++i)
+        close(fds[i]);
+    close(slow);
+    _wait_len(s, 0);
+    _wait_refs(buf, 1);
+    rbuf_unref(buf);
+    printf("send with back pressure: OK\n");
+}
+
+static int _written;
+
+static int _on_written(struct rfile *file, void *buffer, ssize_t len, void *arg)
+{
+    free(buffer);
+    __atomic_add_fetch(&_written, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void _drain(int fd)
+{
+    char buffer[65536];
+    while (read(fd, buffer, sizeof(buffer)) > 0)
+        ;
+}
+
+/*one message to BENCH_SUBSCRIBERS: a copy and an asyn write each, or
+ * one shared buffer*/
+static void _bench_broadcast(server_t s, size_t len)
+{
+    static int peers[BENCH_SUBSCRIBERS];
+    static session_id_t ids[BENCH_SUBSCRIBERS];
+    for (int i = 0; i < BENCH_SUBSCRIBERS; ++i) {
+        int sv[2];
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        fcntl(sv[0], F_SETFL, O_NONBLOCK);
+        fcntl(sv[1], F_SETFL, O_NONBLOCK);
+        session_t session = session_alloc(s->session_mgr, sv[0]);
+        session->server = s;
+        ids[i] = session->session_id;
+        peers[i] = sv[1];
+    }
+    struct rbuf *buf = rbuf_create(len);
+    memset(buf->data, 'x', len);
+
+    int64_t copy_ns = 0, shared_ns = 0;
+    long copy_allocs = 0, shared_allocs = 0;
+    for (int round = 0; round < 3; ++round) {
+        _allocs = 0;
+        __atomic_store_n(&_counting, 1, __ATOMIC_RELEASE);
+        int64_t t1 = _now_ns();
+        _written = 0;
+        for (int i = 0; i < BENCH_SUBSCRIBERS; ++i) {
+            void *copy = malloc(len);
+            memcpy(copy, buf->data, len);
+            struct rfile file;
+            file.fd = session_get(s->session_mgr, ids[i])->f.fd;
+            reactor_asyn_write(REACTOR_INST, &file, copy, len, -1, _on_written, NULL);
+        }
+        _wait_for(&_written, BENCH_SUBSCRIBERS);
+        int64_t t2 = _now_ns();
+        copy_allocs = _allocs;
+        for (int i = 0; i < BENCH_SUBSCRIBERS; ++i)
+            _drain(peers[i]);
+
+        _allocs = 0;
+        int64_t t3 = _now_ns();
+        assert(server_broadcast(s, ids, BENCH_SUBSCRIBERS, buf) == BENCH_SUBSCRIBERS);
+        _wait_refs(buf, 1);
+        int64_t t4 = _now_ns();
+        __atomic_store_n(&_counting, 0, __ATOMIC_RELEASE);
+        shared_allocs = _allocs;
+        for (int i = 0; i < BENCH_SUBSCRIBERS; ++i)
+            _drain(peers[i]);
+
+        if (round > 0) {
+            copy_ns += t2 - t1;
+            shared_ns += t4 - t3;
+        }
+    }
+    printf("%d subscribers x %5zu bytes: copy+asyn_write %5ld ns/sub, %ld allocations, %zu bytes; "
+            "broadcast %4ld ns/sub, %ld allocations, %zu bytes\n", BENCH_SUBSCRIBERS, len,
+            copy_ns / 2 / BENCH_SUBSCRIBERS, copy_allocs, (size_t)BENCH_SUBSCRIBERS * len,
+            shared_ns / 2 / BENCH_SUBSCRIBERS, shared_allocs,
+            len + BENCH_SUBSCRIBERS * (sizeof(struct out_node) + OBJCACHE_ALIGN));
+    rbuf_unref(buf);
+
+    for (int i = 0; i < BENCH_SUBSCRIBERS; ++i) {
+        session_t session = session_get(s->session_mgr, ids[i]);
+        close(session->f.fd);
+        session_free(s->session_mgr, session);
+        close(peers[i]);
+    }
+}
+
+/*a connection past the pool is closed on accept*/
+static void _test_max_sessions()
+{
+    server_t small = server_create("127.0.0.1:0", NULL, NULL, NULL);
+    assert(server_set_max_sessions(small, 0) == -1);
+    assert(server_set_max_sessions(small, 2) == 0);
+    assert(server_listen(small) == 0);
+    assert(server_set_max_sessions(small, 4) == -1);
+
+    int fds[3];
+    for (int i = 0; i < 3; ++i)
+        fds[i] = _client_of(small->listeners[0]);
+    char c;
+    assert(read(fds[2], &c, 1) == 0);
+    _wait_len(small, 2);
+    struct pollfd pfd[2] = {{fds[0], POLLIN, 0}, {fds[1], POLLIN, 0}};
+    assert(poll(pfd, 2, 100) == 0);
+    for (int i = 0; i < 3; ++i)
+        close(fds[i]);
+    _wait_len(small, 0);
+    server_destroy(&small);
+    printf("max sessions: OK\n");
+}
+
+static void _set_flag(void *arg)
+{
+    __atomic_store_n((int*)arg, 1, __ATOMIC_RELEASE);
+}
+
+static int _refused_len;
+
+/*only the duplicate ever gets here*/
+static int _on_refused(struct rfile *file, void *buffer, ssize_t len, void *arg)
+{
+    assert(buffer == NULL);
+    __atomic_store_n(&_refused_len, (int)len, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*counters move with the traffic, and the endpoint dumps them as text*/
+static void _test_stats(server_t s, struct sockaddr_in *addr)
+{
+    uint64_t before[RSTAT_NUM], after[RSTAT_NUM];
+    rstats_collect(before);
+    int fd = _client(addr);
+    for (int i = 0; i < 4; ++i)
+        _echo(fd, i);
+    rstats_collect(after);
+    assert(after[RSTAT_ACCEPTS] - before[RSTAT_ACCEPTS] == 1);
+    assert(after[RSTAT_BYTES_IN] - before[RSTAT_BYTES_IN] == 4 * strlen("hello 0"));
+    assert(after[RSTAT_WAKEUPS] > before[RSTAT_WAKEUPS]);
+    assert(after[RSTAT_SYS_READ] > before[RSTAT_SYS_READ]);
+
+    /*posted from off the loop, a duplicate read fails in the loop and
+     * is called back with REACTER_BUSY*/
+    int pfd[2];
+    assert(pipe(pfd) == 0);
+    struct rfile pf = {pfd[0]};
+    assert(reactor_asyn_read(REACTOR_INST, &pf, -1, _on_refused, NULL) == REACTER_OK);
+    assert(reactor_asyn_read(REACTOR_INST, &pf, -1, _on_refused, NULL) == REACTER_OK);
+    while (!__atomic_load_n(&_refused_len, __ATOMIC_ACQUIRE))
+        sched_yield();
+    assert(_refused_len == REACTER_BUSY);
+    rstats_collect(after);
+    assert(after[RSTAT_FAILED_REGISTRATIONS] - before[RSTAT_FAILED_REGISTRATIONS] == 1);
+    /*the fd is closed once the posted delete has run*/
+    int deleted = 0;
+    reactor_del_file(REACTOR_INST, pfd[0]);
+    reactor_post(REACTOR_INST, _set_flag, &deleted);
+    while (!__atomic_load_n(&deleted, __ATOMIC_ACQUIRE))
+        sched_yield();
+    close(pfd[0]);
+    close(pfd[1]);
+
+    struct server_stats stats;
+    server_stats_snapshot(s, &stats);
+    assert(stats.sessions >= 1 && stats.listeners == s->listener_num);
+    assert(stats.reactor.files >= 1 && stats.reactor.process_counters[RSTAT_ACCEPTS] >= 1);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_server_stats_%d.sock", (int)getpid());
+    assert(server_enable_stats(s, path) == 0);
+    assert(server_enable_stats(s, path) == -1);
+    for (int i = 0; i < 2; ++i) {
+        struct sockaddr_un sun;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, path);
+        int cfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        assert(connect(cfd, (struct sockaddr*)&sun, sizeof(sun)) == 0);
+        char text[SERVER_STATS_SIZE + 1];
+        size_t len = 0;
+        ssize_t n;
+        while ((n = read(cfd, text + len, SERVER_STATS_SIZE - len)) > 0)
+            len += n;
+        text[len] = '\0';
+        close(cfd);
+        assert(strstr(text, "sessions ") && strstr(text, "\naccepts ") && strstr(text, "\npool_queued "));
+    }
+    close(fd);
+    printf("stats: OK\n");
+}
+
+int main()
+{
+    _test_timeouts();
+    _bench_timeouts();
+
+    reactor_t r = REACTOR_INST;
+    server_t s = server_create("127.0.0.1:0", on_newconnect, on_receive, on_connected);
+    server_set_close_cb(s, on_close);
+    assert(server_listen(s) == 0);
+
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    assert(getsockname(s->listeners[0]->f.fd, (struct sockaddr*)&addr, &addrlen) == 0);
+    char straddr[32];
+    snprintf(straddr, sizeof(straddr), "127.0.0.1:%d", ntohs(addr.sin_port));
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, _reactor_thread, r);
+
+    /*accept, read loop and close*/
+    int fds[TEST_CLIENTS];
+    for (int i = 0; i < TEST_CLIENTS; ++i) {
+        fds[i] = _client(&addr);
+        _echo(fds[i], i);
+    }
+    _wait_for(&_newconnects, TEST_CLIENTS);
+    assert(session_manager_len(s->session_mgr) == TEST_CLIENTS);
+
+    session_id_t id = __atomic_load_n(&_last_id, __ATOMIC_ACQUIRE);
+    session_t session = session_get(s->session_mgr, id);
+    assert(session && session->session_id == id);
+    for (int i = 0; i < TEST_CLIENTS; ++i)
+        close(fds[i]);
+    _wait_for(&_closes, TEST_CLIENTS);
+    assert(session_manager_len(s->session_mgr) == 0);
+    printf("accept/receive/close %d clients: OK\n", TEST_CLIENTS);
+
+    /*the slot comes back with another generation*/
+    assert(session_get(s->session_mgr, id) == NULL);
+    int fd = _client(&addr);
+    _echo(fd, 0);
+    _wait_for(&_newconnects, TEST_CLIENTS + 1);
+    session_id_t new_id = __atomic_load_n(&_last_id, __ATOMIC_ACQUIRE);
+    assert(new_id != id && session_get(s->session_mgr, id) == NULL);
+    assert(session_get(s->session_mgr, new_id) != NULL);
+    close(fd);
+    _wait_for(&_closes, TEST_CLIENTS + 1);
+    assert(server_close_session(s, new_id) == -1);
+    printf("stale session ids: OK\n");
+
+    /*outbound: connect to ourselves and ping through the echo*/
+    assert(server_connect(s, straddr) == 0);
+    _wait_for(&_connecteds, 1);
+    _wait_for(&_pongs, 1);
+    assert(session_manager_len(s->session_mgr) == 2);
+    for (size_t i = 0; i < s->session_mgr->capacity; ++i) {
+        session = s->session_mgr->sessions + i;
+        if (session->session_id && session->data)
+            assert(server_close_session(s, session->session_id) == 0);
+    }
+    _wait_for(&_closes, TEST_CLIENTS + 3);
+    assert(session_manager_len(s->session_mgr) == 0);
+    printf("connect/close_session: OK\n");
+
+    /*a silent client is closed, a chatty one stays*/
+    server_set_timeout_cb(s, on_timeout);
+    assert(server_set_timeouts(s, 300, 0, 0) == 0);
+    int quiet = _client(&addr), chatty = _client(&addr);
+    _wait_for(&_newconnects, TEST_CLIENTS + 4);
+    for (int i = 0; i < 8; ++i) {
+        _echo(chatty, i);
+        usleep(100000);
+    }
+    char c;
+    assert(read(quiet, &c, 1) == 0);
+    assert(_timeouts[SESSION_TIMEOUT_IDLE] == 1);
+    _wait_for(&_closes, TEST_CLIENTS + 4);
+    assert(session_manager_len(s->session_mgr) == 1);
+    assert(read(chatty, &c, 1) == 0);
+    _wait_for(&_closes, TEST_CLIENTS + 5);
+    assert(_timeouts[SESSION_TIMEOUT_IDLE] == 2);
+    close(quiet);
+    close(chatty);
+    assert(server_set_timeouts(s, 0, 0, 0) == 0);
+    printf("idle timeout: OK\n");
+
+    /*connection setup, warm then counted*/
+    int64_t t1 = 0;
+    for (int i = 0; i < BENCH_CONNS * 2; ++i) {
+        if (i == BENCH_CONNS) {
+            _wait_for(&_closes, TEST_CLIENTS + 5 + BENCH_CONNS);
+            t1 = _now_ns();
+            __atomic_store_n(&_counting, 1, __ATOMIC_RELEASE);
+        }
+        fd = _client(&addr);
+        _echo(fd, i);
+        close(fd);
+    }
+    _wait_for(&_closes, TEST_CLIENTS + 5 + BENCH_CONNS * 2);
+    __atomic_store_n(&_counting, 0, __ATOMIC_RELEASE);
+    int64_t t2 = _now_ns();
+    printf("connect/echo/close %d: %ld ns/conn, %ld allocations once warm\n",
+            BENCH_CONNS, (t2 - t1) / BENCH_CONNS, _allocs);
+
+    _test_families(s);
+    _test_max_sessions();
+    _test_handover();
+    _test_handover_nack();
+    _test_handover_max();
+    _test_framing();
+    _test_broadcast(s, &addr);
+    _bench_broadcast(s, 64);
+    _bench_broadcast(s, 1024);
+    _bench_broadcast(s, 16384);
+    _test_stats(s, &addr);
+
+    server_t ss = server_create("127.0.0.1:0", NULL, on_stream, NULL);
+    server_set_close_cb(ss, on_stream_close);
+    assert(server_listen(ss) == 0);
+    _test_streams(ss);
+    _bench_fairness(ss, &addr);
+    _wait_len(ss, 0);
+    server_destroy(&ss);
+
+    reactor_stop(r);
+    pthread_join(tid, NULL);
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_server_%d.sock", (int)getpid());
+    assert(access(path, F_OK) == 0);
+    server_destroy(&s);
+    assert(s == NULL && access(path, F_OK) != 0);
+    return 0;
+}
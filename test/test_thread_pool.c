@@ -1,12 +1,409 @@
 #include "../thread_pool.h"
+#include "../macro_tuple.h"
 #include <stdio.h>
 #include <unistd.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <time.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+
+#define BENCH_TASKS 5000
+#define BENCH_INTERVAL 20   //us between two pushes, the worker idles in between
 
 void func(void *data)
 {
     printf("thread %lx: %ld\n", pthread_self(), (long)data);
 }
 
+static int64_t _now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int _cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void _nop(void *data)
+{
+}
+
+static void _bench_pool_handoff(const char *name, int spin, int yield)
+{
+    struct thread_pool *pool = thread_pool_create(1);
+    thread_pool_set_idle(pool, spin, yield);
+
+    for (long i = 0; i < BENCH_TASKS; ++i) {
+        thread_pool_push(pool, _nop, NULL);
+        usleep(BENCH_INTERVAL);
+    }
+    usleep(10000);
+
+    printf("%-24s p50 %8ld ns, p99 %8ld ns\n", name,
+            thread_pool_handoff_percentile(pool, 0.5),
+            thread_pool_handoff_percentile(pool, 0.99));
+    thread_pool_destroy(&pool);
+}
+
+/*the idle strategy before eventcount: every handoff is a sem_post/sem_wait*/
+static sem_t _sem;
+static volatile int64_t _sem_push_ns;
+static int64_t _sem_samples[BENCH_TASKS];
+
+static void *_sem_consumer(void *arg)
+{
+    for (int i = 0; i < BENCH_TASKS; ++i) {
+        sem_wait(&_sem);
+        _sem_samples[i] = _now_ns() - _sem_push_ns;
+    }
+    return NULL;
+}
+
+static void _bench_sem_handoff()
+{
+    pthread_t tid;
+    sem_init(&_sem, 0, 0);
+    pthread_create(&tid, NULL, _sem_consumer, NULL);
+
+    for (int i = 0; i < BENCH_TASKS; ++i) {
+        _sem_push_ns = _now_ns();
+        sem_post(&_sem);
+        usleep(BENCH_INTERVAL);
+    }
+    pthread_join(tid, NULL);
+    sem_destroy(&_sem);
+
+    qsort(_sem_samples, BENCH_TASKS, sizeof(int64_t), _cmp_int64);
+    printf("%-24s p50 %8ld ns, p99 %8ld ns\n", "semaphore",
+            _sem_samples[BENCH_TASKS / 2], _sem_samples[BENCH_TASKS * 99 / 100]);
+}
+
+#define MIX_ROUNDS 100
+#define MIX_BULK_US 50      //cpu time of one bulk task
+
+static int64_t _mix_samples[MIX_ROUNDS];
+static int _mix_count;
+
+static void _bulk_task(void *data)
+{
+    int64_t end = _now_ns() + MIX_BULK_US * 1000;
+    while (_now_ns() < end);
+}
+
+static void _high_task(void *data)
+{
+    int64_t push_ns = (int64_t)(intptr_t)data;
+    _mix_samples[_mix_count++] = _now_ns() - push_ns;
+}
+
+/*one heartbeat per round behind a growing burst of bulk tasks*/
+static void _bench_mixed_load(const char *name, int lanes, enum thread_pool_sched sched, int bulk)
+{
+    struct thread_pool *pool = thread_pool_create(1);
+    thread_pool_set_sched(pool, sched, NULL);
+    enum task_priority high = lanes ? TASK_PRIO_HIGH : TASK_PRIO_NORMAL;
+    enum task_priority low = lanes ? TASK_PRIO_LOW : TASK_PRIO_NORMAL;
+
+    _mix_count = 0;
+    for (int i = 0; i < MIX_ROUNDS; ++i) {
+        for (int j = 0; j < bulk; ++j) {
+            thread_pool_push_prio(pool, low, _bulk_task, NULL);
+        }
+        thread_pool_push_prio(pool, high, _high_task, (void*)(intptr_t)_now_ns());
+        usleep(2000);
+    }
+    thread_pool_destroy(&pool);
+
+    qsort(_mix_samples, MIX_ROUNDS, sizeof(int64_t), _cmp_int64);
+    printf("%-10s bulk %3d/round: heartbeat p50 %10ld ns, p99 %10ld ns\n", name, bulk,
+            _mix_samples[MIX_ROUNDS / 2], _mix_samples[MIX_ROUNDS * 99 / 100]);
+}
+
+#define OVERLOAD_CAPACITY 256
+#define OVERLOAD_TASKS (OVERLOAD_CAPACITY * 10)
+
+static pthread_t _main_tid;
+static int _inline_count;
+static int _reject_count;
+
+static void _slow_task(void *data)
+{
+    if (pthread_equal(pthread_self(), _main_tid))
+        _inline_count++;
+    int64_t end = _now_ns() + 20000;
+    while (_now_ns() < end);
+}
+
+static void _on_reject(task_func func, void *data, void *arg)
+{
+    _reject_count++;
+}
+
+static void _test_overload(const char *name, enum thread_pool_overload overload)
+{
+    struct thread_pool *pool = thread_pool_create(1);
+    thread_pool_set_overload(pool, OVERLOAD_CAPACITY, overload, _on_reject, NULL);
+
+    size_t max_len = 0;
+    _inline_count = _reject_count = 0;
+    for (int i = 0; i < OVERLOAD_TASKS; ++i) {
+        thread_pool_push_prio(pool, TASK_PRIO_LOW, _slow_task, NULL);
+        if (thread_pool_len(pool) > max_len)
+            max_len = thread_pool_len(pool);
+    }
+    size_t lane_len = pool->lanes[TASK_PRIO_LOW].tq_len;
+    thread_pool_destroy(&pool);
+
+    printf("%-10s pushed %d: max queued %zu, lane slots %zu, inline %d, rejected %d\n",
+            name, OVERLOAD_TASKS, max_len, lane_len, _inline_count, _reject_count);
+    assert(max_len <= OVERLOAD_CAPACITY);
+    assert(lane_len <= OVERLOAD_CAPACITY * 2);
+}
+
+static void _slow_payload_task(void *arg)
+{
+    __atomic_add_fetch(*(int**)arg, 1, __ATOMIC_RELAXED);
+    _slow_task(NULL);
+}
+
+static void _test_dispatch_reject()
+{
+    /*a dispatch is run inline by a full rejecting pool, never rejected*/
+    struct thread_pool *pool = thread_pool_create(1);
+    thread_pool_set_overload(pool, OVERLOAD_CAPACITY, THREAD_POOL_REJECT, _on_reject, NULL);
+
+    int ran = 0;
+    int *p = &ran;
+    _inline_count = _reject_count = 0;
+    for (int i = 0; i < OVERLOAD_TASKS; ++i)
+        assert(thread_pool_dispatch(pool, TASK_PRIO_LOW, _slow_payload_task, &p, sizeof(p)) == 0);
+    thread_pool_destroy(&pool);
+
+    assert(_reject_count == 0);
+    assert(_inline_count > 0);
+    assert(ran == OVERLOAD_TASKS);
+    printf("dispatch to a rejecting pool, inline %d: OK\n", _inline_count);
+}
+
+#define WATCHER_NUM 64
+
+static void _count_watermark(bool saturated, void *arg)
+{
+    if (saturated)
+        __atomic_add_fetch((int*)arg, 1, __ATOMIC_RELAXED);
+}
+
+static void _test_watchers()
+{
+    struct thread_pool *pool = thread_pool_create(1);
+    thread_pool_set_overload(pool, OVERLOAD_CAPACITY, THREAD_POOL_BLOCK, NULL, NULL);
+
+    int counts[WATCHER_NUM] = {0};
+    for (int i = 0; i < WATCHER_NUM; ++i)
+        assert(thread_pool_add_watcher(pool, _count_watermark, counts + i) == 0);
+    assert(thread_pool_del_watcher(pool, _count_watermark, counts) == 0);
+    assert(thread_pool_del_watcher(pool, _count_watermark, counts) == -1);
+
+    for (int i = 0; i < OVERLOAD_CAPACITY; ++i)
+        thread_pool_push_prio(pool, TASK_PRIO_LOW, _slow_task, NULL);
+    thread_pool_destroy(&pool);
+
+    assert(counts[0] == 0);
+    for (int i = 1; i < WATCHER_NUM; ++i)
+        assert(counts[i] > 0);
+    printf("%d pool watchers: OK\n", WATCHER_NUM - 1);
+}
+
+#define PFOR_N 1000000
+
+static void _sum_squares(size_t begin, size_t end, void *arg)
+{
+    uint64_t sum = 0;
+    for (size_t i = begin; i < end; ++i)
+        sum += (uint64_t)i * i;
+    __atomic_add_fetch((uint64_t*)arg, sum, __ATOMIC_RELAXED);
+}
+
+static void _nested_group(void *arg)
+{
+    /*a worker waiting for its own group must help, not block*/
+    uint64_t sum = 0;
+    thread_pool_parallel_for(THREAD_POOL_INST, 0, 1000, 0, _sum_squares, &sum);
+    assert(sum == 332833500ULL);
+    __atomic_add_fetch((int*)arg, 1, __ATOMIC_RELAXED);
+}
+
+static void _test_parallel_for()
+{
+    uint64_t expect = 0;
+    for (uint64_t i = 0; i < PFOR_N; ++i)
+        expect += i * i;
+
+    uint64_t sum = 0;
+    int64_t t1 = _now_ns();
+    thread_pool_parallel_for(THREAD_POOL_INST, 0, PFOR_N, 0, _sum_squares, &sum);
+    int64_t t2 = _now_ns();
+    assert(sum == expect);
+    printf("parallel_for %d: %ld ns\n", PFOR_N, t2 - t1);
+
+    int done = 0;
+    struct task_group group;
+    task_group_init(&group, THREAD_POOL_INST);
+    for (int i = 0; i < 8; ++i)
+        task_group_push(&group, _nested_group, &done);
+    task_group_wait(&group);
+    assert(done == 8);
+    printf("nested task groups: OK\n");
+}
+
+#define PAYLOAD_TASKS 1000000
+#define PAYLOAD_BATCH 4096
+
+static int _payload_done;
+static uint64_t _payload_sum;
+
+static void _payload_task(void *arg)
+{
+    long id;
+    int64_t key;
+    void *ptr;
+    GET_TUPLE_3(arg, id, key, ptr);
+    assert(ptr == (void*)&_payload_done);
+    _payload_sum += id + key;
+    __atomic_add_fetch(&_payload_done, 1, __ATOMIC_RELEASE);
+}
+
+static void _malloc_tuple_task(void *arg)
+{
+    _payload_task(arg);
+    DELETE_TUPLE(arg);
+}
+
+/*the payload starts with its length*/
+static void _spill_task(void *arg)
+{
+    uint16_t len;
+    memcpy(&len, arg, sizeof(len));
+    uint8_t *bytes = (uint8_t*)arg;
+    uint64_t sum = 0;
+    for (int i = sizeof(len); i < len; ++i) {
+        assert(bytes[i] == (uint8_t)(len + i));
+        sum += bytes[i];
+    }
+    _payload_sum += sum;
+    __atomic_add_fetch(&_payload_done, 1, __ATOMIC_RELEASE);
+}
+
+static void _payload_wait(int n)
+{
+    while (__atomic_load_n(&_payload_done, __ATOMIC_ACQUIRE) < n)
+        sched_yield();
+}
+
+static void _test_payload()
+{
+    struct thread_pool *pool = thread_pool_create(1);
+    uint64_t expect = 0;
+    _payload_done = 0;
+    _payload_sum = 0;
+
+    for (long i = 0; i < 1000; ++i) {
+        LOCAL_TUPLE_3(tuple, i, (int64_t)(i * 7), (void*)&_payload_done);
+        assert(thread_pool_push_payload(pool, TASK_PRIO_NORMAL, _payload_task, &tuple, sizeof(tuple)) == 0);
+        /*the pool has its own copy*/
+        memset(&tuple, 0, sizeof(tuple));
+        expect += i * 8;
+    }
+    /*payloads over TASK_PAYLOAD_SIZE spill, some over TASK_SPILL_SIZE too*/
+    uint8_t bytes[TASK_SPILL_SIZE * 2];
+    for (int i = 0; i < 1000; ++i) {
+        uint16_t len = TASK_PAYLOAD_SIZE + 1 + i % (sizeof(bytes) - TASK_PAYLOAD_SIZE);
+        memcpy(bytes, &len, sizeof(len));
+        for (int j = sizeof(len); j < len; ++j) {
+            bytes[j] = (uint8_t)(len + j);
+            expect += bytes[j];
+        }
+        assert(thread_pool_push_payload(pool, TASK_PRIO_LOW, _spill_task, bytes, len) == 0);
+    }
+    _payload_wait(2000);
+    assert(_payload_sum == expect);
+    assert(pool->spill_count <= TASK_SPILL_CACHE);
+    thread_pool_destroy(&pool);
+    printf("inline payloads: OK\n");
+}
+
+/*push in batches the pool can hold, so the numbers show the cost of a task
+ * rather than the context switches of a blocked pusher*/
+static void _bench_payload()
+{
+    struct thread_pool *pool = thread_pool_create(1);
+    int64_t t1, t2;
+
+    _payload_done = 0;
+    t1 = _now_ns();
+    for (long i = 0; i < PAYLOAD_TASKS; ++i) {
+        void *tuple = NEW_TUPLE_3(i, (int64_t)i, (void*)&_payload_done);
+        thread_pool_push_prio(pool, TASK_PRIO_NORMAL, _malloc_tuple_task, tuple);
+        if ((i + 1) % PAYLOAD_BATCH == 0)
+            _payload_wait(i + 1);
+    }
+    _payload_wait(PAYLOAD_TASKS);
+    t2 = _now_ns();
+    printf("%-24s %d tasks: %ld ns/task\n", "malloc'd tuple", PAYLOAD_TASKS, (t2 - t1) / PAYLOAD_TASKS);
+
+    _payload_done = 0;
+    t1 = _now_ns();
+    for (long i = 0; i < PAYLOAD_TASKS; ++i) {
+        LOCAL_TUPLE_3(tuple, i, (int64_t)i, (void*)&_payload_done);
+        thread_pool_push_payload(pool, TASK_PRIO_NORMAL, _payload_task, &tuple, sizeof(tuple));
+        if ((i + 1) % PAYLOAD_BATCH == 0)
+            _payload_wait(i + 1);
+    }
+    _payload_wait(PAYLOAD_TASKS);
+    t2 = _now_ns();
+    printf("%-24s %d tasks: %ld ns/task\n", "inline payload", PAYLOAD_TASKS, (t2 - t1) / PAYLOAD_TASKS);
+
+    thread_pool_destroy(&pool);
+}
+
+#define PARK_ROUNDS 200000
+
+static int _parked_done;
+
+static void _count_done(void *arg)
+{
+    __atomic_add_fetch(&_parked_done, 1, __ATOMIC_RELEASE);
+}
+
+/*every push races workers on their way to park: each task must run
+ * without a later push to wake its worker*/
+static void _test_park_race()
+{
+    struct thread_pool *pool = thread_pool_create(4);
+    thread_pool_set_idle(pool, 8, 0);
+
+    for (int i = 0; i < PARK_ROUNDS; ++i) {
+        assert(thread_pool_push(pool, _count_done, NULL) == 0);
+        int64_t deadline = _now_ns() + 1000000000LL;
+        while (__atomic_load_n(&_parked_done, __ATOMIC_ACQUIRE) != i + 1) {
+            assert(_now_ns() < deadline);
+            if (i & 1)
+                sched_yield();
+        }
+        /*vary the gap, so the push lands anywhere in the parking path*/
+        for (volatile int j = 0; j < (i & 63); ++j)
+            ;
+    }
+    thread_pool_destroy(&pool);
+    printf("push against parking workers, %d rounds: OK\n", PARK_ROUNDS);
+}
+
 int main()
 {
     THREAD_POOL_INST;
@@ -15,5 +412,30 @@ int main()
     }
 
     sleep(1);
+
+    _test_parallel_for();
+    _test_park_race();
+
+    _main_tid = pthread_self();
+    _test_overload("block", THREAD_POOL_BLOCK);
+    _test_overload("reject", THREAD_POOL_REJECT);
+    _test_overload("inline", THREAD_POOL_RUN_INLINE);
+    _test_dispatch_reject();
+    _test_watchers();
+
+    _test_payload();
+    _bench_payload();
+
+    _bench_sem_handoff();
+    _bench_pool_handoff("eventcount park", 0, 0);
+    _bench_pool_handoff("eventcount yield", 0, THREAD_POOL_YIELD);
+    _bench_pool_handoff("eventcount spin+yield", THREAD_POOL_SPIN, THREAD_POOL_YIELD);
+
+    int loads[] = {0, 20, 60};
+    for (int i = 0; i < sizeof(loads) / sizeof(int); ++i) {
+        _bench_mixed_load("fifo", 0, THREAD_POOL_STRICT, loads[i]);
+        _bench_mixed_load("strict", 1, THREAD_POOL_STRICT, loads[i]);
+        _bench_mixed_load("weighted", 1, THREAD_POOL_WEIGHTED, loads[i]);
+    }
     return 0;
 }
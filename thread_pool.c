@@ -5,136 +5,764 @@
 
 #include "thread_pool.h"
 #include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
 
-#define QUEUE_EMPTY(pool) ((pool)->tq_head == (pool)->tq_tail)
-#define QUEUE_FULL(pool) (((pool)->tq_tail + 1) % (pool)->tq_len == (pool)->tq_head)
+#define QUEUE_EMPTY(lane) ((lane)->tq_head == (lane)->tq_tail)
+#define QUEUE_FULL(lane) (((lane)->tq_tail + 1) % (lane)->tq_len == (lane)->tq_head)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
+static int64_t _now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
 #ifndef TASK_QUEUE_DONOT_RESIZE
-static int _queue_resize(struct thread_pool *pool)
+static int _queue_resize(struct task_lane *lane)
 {
-    size_t new_len = pool->tq_len * 2;
+    size_t new_len = lane->tq_len * 2;
     struct task *new_queue = (struct task*)malloc(sizeof(struct task) * new_len);
-    if (pool->tq_head > pool->tq_tail) {
-        int tlen = pool->tq_tail + 1;
-        memcpy(new_queue, pool->task_queue, sizeof(struct task) * tlen);
-        int hlen = pool->tq_len = pool->tq_head;
+    if (lane->tq_head > lane->tq_tail) {
+        int tlen = lane->tq_tail + 1;
+        memcpy(new_queue, lane->task_queue, sizeof(struct task) * tlen);
+        int hlen = lane->tq_len - lane->tq_head;
         int pos = new_len - hlen;
-        memcpy(new_queue + pos, pool->task_queue + pool->tq_head, sizeof(struct task) * hlen);
-        pool->tq_head = pos;
+        memcpy(new_queue + pos, lane->task_queue + lane->tq_head, sizeof(struct task) * hlen);
+        lane->tq_head = pos;
     } else {
-        memcpy(new_queue, pool->task_queue, sizeof(struct task) * pool->tq_len);
+        memcpy(new_queue, lane->task_queue, sizeof(struct task) * lane->tq_len);
     }
-    free(pool->task_queue);
-    pool->tq_len = new_len;
-    pool->task_queue = new_queue;
+    free(lane->task_queue);
+    lane->tq_len = new_len;
+    lane->task_queue = new_queue;
 
     return 0;
 }
 #endif //TASK_QUEUE_DONOT_RESIZE
 
-static int _queue_push(struct thread_pool *pool, task_func task, void *data)
+/*return -1 if the pool is full. *crossed is set if this push saturates the pool*/
+static int _queue_push(struct thread_pool *pool, enum task_priority prio, struct task *t, bool *crossed)
 {
+    t->push_ns = _now_ns();
+    struct task_lane *lane = pool->lanes + prio;
     LOCK(&pool->queue_lock);
 
-    if (QUEUE_FULL(pool)) {
+    if (pool->tq_count >= pool->capacity) {
+        UNLOCK(&pool->queue_lock);
+        return -1;
+    }
+    if (QUEUE_FULL(lane)) {
 #ifdef TASK_QUEUE_DONOT_RESIZE
         UNLOCK(&pool->queue_lock);
         return -1;
 #else
-        _queue_resize(pool);
+        _queue_resize(lane);
 #endif
     }
-    pool->task_queue[pool->tq_tail].func = task;
-    pool->task_queue[pool->tq_tail].data = data;
-    pool->tq_tail = (pool->tq_tail + 1) % pool->tq_len;
+    struct task *slot = lane->task_queue + lane->tq_tail;
+    slot->func = t->func;
+    slot->data = t->data;
+    slot->push_ns = t->push_ns;
+    slot->group = t->group;
+    slot->payload_len = t->payload_len;
+    if (t->payload_len > 0 && t->payload_len <= TASK_PAYLOAD_SIZE)
+        memcpy(slot->payload, t->payload, t->payload_len);
+    lane->tq_tail = (lane->tq_tail + 1) % lane->tq_len;
+    __atomic_store_n(&pool->tq_count, pool->tq_count + 1, __ATOMIC_RELEASE);
+
+    if (!pool->saturated && pool->tq_count >= pool->high_watermark) {
+        __atomic_store_n(&pool->saturated, 1, __ATOMIC_RELEASE);
+        *crossed = true;
+    }
 
     UNLOCK(&pool->queue_lock);
     return 0;
 }
 
+/*called with queue_lock held and at least one task queued*/
+static struct task_lane *_queue_select_lane(struct thread_pool *pool)
+{
+    struct task_lane *lane;
+    int i;
+
+    if (pool->sched == THREAD_POOL_STRICT) {
+        for (i = 0; i < TASK_PRIO_NUM; ++i) {
+            lane = pool->lanes + i;
+            if (!QUEUE_EMPTY(lane))
+                return lane;
+        }
+        return NULL;
+    }
+
+    /*weighted round: every non-empty lane gets `weight` tasks per round,
+     * higher lanes first. the round restarts once they have all used up
+     * their credit.*/
+    for (int round = 0; round < 2; ++round) {
+        for (i = 0; i < TASK_PRIO_NUM; ++i) {
+            lane = pool->lanes + i;
+            if (!QUEUE_EMPTY(lane) && lane->credit > 0) {
+                lane->credit--;
+                return lane;
+            }
+        }
+        for (i = 0; i < TASK_PRIO_NUM; ++i) {
+            pool->lanes[i].credit = pool->lanes[i].weight;
+        }
+    }
+    return NULL;
+}
+
 //static task_func _queue_pop(struct thread_pool *pool)
-static int _queue_pop(struct thread_pool *pool, struct task *ret)
+static int _queue_pop(struct thread_pool *pool, struct task *ret, enum task_priority *prio, bool *crossed)
 {
+    /*peek without the lock, so spinning workers do not fight with pushers*/
+    if (__atomic_load_n(&pool->tq_count, __ATOMIC_ACQUIRE) == 0)
+        return -1;
+
     LOCK(&pool->queue_lock);
 
-    if (QUEUE_EMPTY(pool)) {
+    struct task_lane *lane = _queue_select_lane(pool);
+    if (lane == NULL) {
         UNLOCK(&pool->queue_lock);
         return -1;
     }
 
-    ret->func = pool->task_queue[pool->tq_head].func;
-    ret->data = pool->task_queue[pool->tq_head].data;
-    pool->tq_head = (pool->tq_head + 1) % pool->tq_len;
+    struct task *slot = lane->task_queue + lane->tq_head;
+    ret->func = slot->func;
+    ret->data = slot->data;
+    ret->push_ns = slot->push_ns;
+    ret->group = slot->group;
+    ret->payload_len = slot->payload_len;
+    if (slot->payload_len > 0 && slot->payload_len <= TASK_PAYLOAD_SIZE)
+        memcpy(ret->payload, slot->payload, slot->payload_len);
+    *prio = lane - pool->lanes;
+    lane->tq_head = (lane->tq_head + 1) % lane->tq_len;
+    __atomic_store_n(&pool->tq_count, pool->tq_count - 1, __ATOMIC_RELEASE);
+
+    if (pool->saturated && pool->tq_count <= pool->low_watermark) {
+        __atomic_store_n(&pool->saturated, 0, __ATOMIC_RELEASE);
+        *crossed = true;
+    }
 
     UNLOCK(&pool->queue_lock);
     return 0;
 }
 
+static void *_spill_alloc(struct thread_pool *pool, size_t len)
+{
+    if (len > TASK_SPILL_SIZE)
+        return malloc(len);
+
+    void *block = NULL;
+    LOCK(&pool->spill_lock);
+    if (pool->spill_free) {
+        block = pool->spill_free;
+        pool->spill_free = *(void**)block;
+        pool->spill_count--;
+    }
+    UNLOCK(&pool->spill_lock);
+    return block ? block : malloc(TASK_SPILL_SIZE);
+}
+
+static void _spill_free(struct thread_pool *pool, void *block, size_t len)
+{
+    if (len <= TASK_SPILL_SIZE) {
+        LOCK(&pool->spill_lock);
+        if (pool->spill_count < TASK_SPILL_CACHE) {
+            *(void**)block = pool->spill_free;
+            pool->spill_free = block;
+            pool->spill_count++;
+            block = NULL;
+        }
+        UNLOCK(&pool->spill_lock);
+    }
+    free(block);
+}
+
+/*the argument the task function gets*/
+static inline void *_task_arg(struct task *t)
+{
+    if (t->payload_len > 0 && t->payload_len <= TASK_PAYLOAD_SIZE)
+        return t->payload;
+    return t->data;
+}
+
+static inline void _task_release(struct thread_pool *pool, struct task *t)
+{
+    if (t->payload_len > TASK_PAYLOAD_SIZE)
+        _spill_free(pool, t->data, t->payload_len);
+}
+
+static void _notify_watchers(struct thread_pool *pool, bool saturated)
+{
+    /*call a copy out of the lock, a watcher may push*/
+    while (1) {
+        size_t n = __atomic_load_n(&pool->watcher_num, __ATOMIC_ACQUIRE);
+        struct pool_watcher watchers[n > 0 ? n : 1];
+
+        LOCK(&pool->queue_lock);
+        if (pool->watcher_num != n) {
+            UNLOCK(&pool->queue_lock);
+            continue;
+        }
+        size_t i = 0;
+        for (struct pool_watcher *w = pool->watchers; w; w = w->next)
+            watchers[i++] = *w;
+        UNLOCK(&pool->queue_lock);
+
+        for (i = 0; i < n; ++i)
+            watchers[i].func(saturated, watchers[i].arg);
+        return;
+    }
+}
+
+static int _handoff_bucket(int64_t ns)
+{
+    uint64_t v = ns > 0 ? (uint64_t)ns : 0;
+    if (v < (1 << HANDOFF_SUB_BITS))
+        return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    int sub = (v >> (msb - HANDOFF_SUB_BITS)) & ((1 << HANDOFF_SUB_BITS) - 1);
+    return ((msb - HANDOFF_SUB_BITS + 1) << HANDOFF_SUB_BITS) + sub;
+}
+
+static int64_t _handoff_bucket_upper(int bucket)
+{
+    if (bucket < (1 << HANDOFF_SUB_BITS))
+        return bucket;
+    int msb = (bucket >> HANDOFF_SUB_BITS) - 1 + HANDOFF_SUB_BITS;
+    int sub = bucket & ((1 << HANDOFF_SUB_BITS) - 1);
+    int64_t lower = (1LL << msb) | ((int64_t)sub << (msb - HANDOFF_SUB_BITS));
+    return lower + (1LL << (msb - HANDOFF_SUB_BITS)) - 1;
+}
 
+
+static __thread struct thread_pool *_t_worker_pool = NULL;
 static struct thread_pool *_g_thread_pool_instance = NULL;
 static lock_t _g_instance_lock = LOCK_INITIALIZER;
 static void *_thread_dealer(void *arg);
 
-static struct thread_pool *
-_thread_pool_create()
+struct thread_pool *thread_pool_create(size_t thread_num)
 {
-    struct thread_pool *pool = (struct thread_pool*)malloc(sizeof(struct thread_pool));
+    struct thread_pool *pool = (struct thread_pool*)calloc(1, sizeof(struct thread_pool));
 
-    pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * THREAD_COUNT);
-    pool->thread_num = THREAD_COUNT;
+    pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * thread_num);
+    pool->thread_num = thread_num;
 
-    pool->task_queue = (struct task*)malloc(sizeof(struct task) * TASK_QUEUE_INIT_LEN);
-    pool->tq_len = TASK_QUEUE_INIT_LEN;
-    pool->tq_head = pool->tq_tail = 0;
+    int weights[TASK_PRIO_NUM] = TASK_LANE_WEIGHTS;
+    for (int i = 0; i < TASK_PRIO_NUM; ++i) {
+        struct task_lane *lane = pool->lanes + i;
+        lane->task_queue = (struct task*)malloc(sizeof(struct task) * TASK_QUEUE_INIT_LEN);
+        lane->tq_len = TASK_QUEUE_INIT_LEN;
+        lane->tq_head = lane->tq_tail = 0;
+    }
+    pool->tq_count = 0;
 
     LOCK_INIT(&pool->queue_lock);
-    sem_init(&pool->queue_sem, 0, 0);
+    LOCK_INIT(&pool->spill_lock);
+    pool->spill_free = NULL;
+    pool->spill_count = 0;
+    thread_pool_set_sched(pool, THREAD_POOL_WEIGHTED, weights);
+    thread_pool_set_overload(pool, THREAD_POOL_CAPACITY, THREAD_POOL_BLOCK, NULL, NULL);
+    ec_init(&pool->idle_ec);
+    ec_init(&pool->space_ec);
+    pool->spinners = 0;
+    pool->stop = 0;
+
+    /*spinning only pays when the pusher runs on another cpu*/
+    if (sysconf(_SC_NPROCESSORS_ONLN) > 1)
+        thread_pool_set_idle(pool, THREAD_POOL_SPIN, THREAD_POOL_YIELD);
+    else
+        thread_pool_set_idle(pool, 0, THREAD_POOL_YIELD);
 
     for (int i = 0; i < pool->thread_num; ++i) {
         pthread_create(pool->threads + i, NULL, _thread_dealer, (void*)pool);
-        pthread_detach(pool->threads[i]);
     }
 
     return pool;
 }
 
+void thread_pool_destroy(struct thread_pool **pool)
+{
+    if (!pool || !*pool)
+        return;
+
+    struct thread_pool *p = *pool;
+    __atomic_store_n(&p->stop, 1, __ATOMIC_SEQ_CST);
+    ec_notify_all(&p->idle_ec);
+    ec_notify_all(&p->space_ec);
+    for (int i = 0; i < p->thread_num; ++i) {
+        pthread_join(p->threads[i], NULL);
+    }
+
+    LOCK_DESTROY(&p->queue_lock);
+    for (int i = 0; i < TASK_PRIO_NUM; ++i) {
+        struct task_lane *lane = p->lanes + i;
+        for (int j = lane->tq_head; j != lane->tq_tail; j = (j + 1) % lane->tq_len) {
+            _task_release(p, lane->task_queue + j);
+        }
+        free(lane->task_queue);
+    }
+    while (p->spill_free) {
+        void *block = p->spill_free;
+        p->spill_free = *(void**)block;
+        free(block);
+    }
+    LOCK_DESTROY(&p->spill_lock);
+    while (p->watchers) {
+        struct pool_watcher *w = p->watchers;
+        p->watchers = w->next;
+        free(w);
+    }
+    free(p->threads);
+    free(p);
+    *pool = NULL;
+}
+
+void thread_pool_set_idle(struct thread_pool *pool, int spin, int yield)
+{
+    pool->spin = spin > 0 ? spin : 0;
+    pool->yield = yield > 0 ? yield : 0;
+}
+
+void thread_pool_set_sched(struct thread_pool *pool, enum thread_pool_sched sched, const int *weights)
+{
+    LOCK(&pool->queue_lock);
+    pool->sched = sched;
+    for (int i = 0; i < TASK_PRIO_NUM; ++i) {
+        if (weights)
+            pool->lanes[i].weight = weights[i] > 0 ? weights[i] : 1;
+        pool->lanes[i].credit = pool->lanes[i].weight;
+    }
+    UNLOCK(&pool->queue_lock);
+}
+
+void thread_pool_set_overload(struct thread_pool *pool,
+        size_t capacity, enum thread_pool_overload overload, reject_cb on_reject, void *arg)
+{
+    LOCK(&pool->queue_lock);
+    pool->capacity = capacity > 0 ? capacity : 1;
+    pool->overload = overload;
+    pool->on_reject = on_reject;
+    pool->reject_arg = arg;
+    UNLOCK(&pool->queue_lock);
+
+    thread_pool_set_watermark(pool, pool->capacity * 3 / 4, pool->capacity / 4);
+}
+
+void thread_pool_set_watermark(struct thread_pool *pool, size_t high, size_t low)
+{
+    LOCK(&pool->queue_lock);
+    pool->high_watermark = high > 0 ? high : 1;
+    pool->low_watermark = low < pool->high_watermark ? low : pool->high_watermark - 1;
+    UNLOCK(&pool->queue_lock);
+}
+
+int thread_pool_add_watcher(struct thread_pool *pool, watermark_cb func, void *arg)
+{
+    struct pool_watcher *w = (struct pool_watcher*)malloc(sizeof(struct pool_watcher));
+    if (!w)
+        return -1;
+    w->func = func;
+    w->arg = arg;
+
+    LOCK(&pool->queue_lock);
+    w->next = pool->watchers;
+    pool->watchers = w;
+    __atomic_store_n(&pool->watcher_num, pool->watcher_num + 1, __ATOMIC_RELEASE);
+    UNLOCK(&pool->queue_lock);
+    return 0;
+}
+
+int thread_pool_del_watcher(struct thread_pool *pool, watermark_cb func, void *arg)
+{
+    struct pool_watcher *w = NULL;
+    LOCK(&pool->queue_lock);
+    for (struct pool_watcher **pw = &pool->watchers; *pw; pw = &(*pw)->next) {
+        if ((*pw)->func == func && (*pw)->arg == arg) {
+            w = *pw;
+            *pw = w->next;
+            __atomic_store_n(&pool->watcher_num, pool->watcher_num - 1, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+    UNLOCK(&pool->queue_lock);
+
+    if (!w)
+        return -1;
+    free(w);
+    return 0;
+}
+
+bool thread_pool_saturated(struct thread_pool *pool)
+{
+    return __atomic_load_n(&pool->saturated, __ATOMIC_ACQUIRE);
+}
+
+size_t thread_pool_len(struct thread_pool *pool)
+{
+    return __atomic_load_n(&pool->tq_count, __ATOMIC_ACQUIRE);
+}
+
 struct thread_pool *thread_pool_instance()
 {
-    if (_g_thread_pool_instance == NULL) {
+    struct thread_pool *pool = __atomic_load_n(&_g_thread_pool_instance, __ATOMIC_ACQUIRE);
+    if (pool == NULL) {
         LOCK(&_g_instance_lock);
-        _g_thread_pool_instance = _thread_pool_create();
+        pool = __atomic_load_n(&_g_thread_pool_instance, __ATOMIC_RELAXED);
+        if (pool == NULL) {
+            pool = thread_pool_create(THREAD_COUNT);
+            __atomic_store_n(&_g_thread_pool_instance, pool, __ATOMIC_RELEASE);
+        }
         UNLOCK(&_g_instance_lock);
     }
 
-    return _g_thread_pool_instance;
+    return pool;
+}
+
+void thread_pool_instance_drop()
+{
+    _t_worker_pool = NULL;
+    _g_thread_pool_instance = NULL;
+    LOCK_INIT(&_g_instance_lock);
 }
 
 int thread_pool_push(struct thread_pool *pool, task_func task, void *data)
 {
-    if (_queue_push(pool, task, data) != 0)
-        return -1;
+    return thread_pool_push_prio(pool, TASK_PRIO_NORMAL, task, data);
+}
+
+static void _task_group_done(struct task_group *group)
+{
+    __atomic_add_fetch(&group->notifying, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_SEQ_CST) == 0)
+        ec_notify_all(&group->done_ec);
+    __atomic_sub_fetch(&group->notifying, 1, __ATOMIC_SEQ_CST);
+}
+
+static int _thread_pool_push(struct thread_pool *pool, enum task_priority prio, struct task *t, bool no_reject)
+{
+    struct task_group *group = t->group;
+    bool crossed = false;
+    while (_queue_push(pool, prio, t, &crossed) != 0) {
+        enum thread_pool_overload overload = pool->overload;
+        /*a worker waiting for room may wait for itself*/
+        if (overload == THREAD_POOL_BLOCK && _t_worker_pool == pool)
+            overload = THREAD_POOL_RUN_INLINE;
+        /*nobody would finish a rejected task of a group, nor deliver a
+         * rejected dispatch again*/
+        if (overload == THREAD_POOL_REJECT && (group || no_reject))
+            overload = THREAD_POOL_RUN_INLINE;
 
-    sem_post(&pool->queue_sem);
+        if (overload == THREAD_POOL_BLOCK) {
+            uint32_t key = ec_prepare_wait(&pool->space_ec);
+            if (thread_pool_len(pool) < pool->capacity ||
+                    __atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE)) {
+                ec_cancel_wait(&pool->space_ec);
+                if (__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE)) {
+                    _task_release(pool, t);
+                    return -1;
+                }
+                continue;
+            }
+            ec_wait(&pool->space_ec, key);
+        } else if (overload == THREAD_POOL_RUN_INLINE) {
+            t->func(_task_arg(t));
+            _task_release(pool, t);
+            if (group)
+                _task_group_done(group);
+            return 0;
+        } else {
+            if (pool->on_reject)
+                pool->on_reject(t->func, _task_arg(t), pool->reject_arg);
+            _task_release(pool, t);
+            return -1;
+        }
+    }
+    if (crossed)
+        _notify_watchers(pool, true);
+
+    /*a spinning worker will find the task by itself, the futex wake is only
+     * paid when every idle worker has parked. the fence orders the tq_count
+     * store before the load, pairing with the one of a parking worker*/
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->spinners, __ATOMIC_SEQ_CST) == 0)
+        ec_notify(&pool->idle_ec, 1);
     return 0;
 }
 
-static int _thread_pool_pop(struct thread_pool *pool, struct task *ret)
+int thread_pool_push_prio(struct thread_pool *pool, enum task_priority prio, task_func task, void *data)
 {
-    sem_wait(&pool->queue_sem);
+    if (prio < 0 || prio >= TASK_PRIO_NUM)
+        return -1;
 
-    if (_queue_pop(pool, ret) != 0)
+    struct task t;
+    t.func = task;
+    t.data = data;
+    t.group = NULL;
+    t.payload_len = 0;
+    return _thread_pool_push(pool, prio, &t, false);
+}
+
+static int _thread_pool_push_payload(struct thread_pool *pool, enum task_priority prio,
+        task_func task, const void *payload, size_t len, bool no_reject)
+{
+    if (prio < 0 || prio >= TASK_PRIO_NUM || len == 0)
         return -1;
-    return 0;
+
+    struct task t;
+    t.func = task;
+    t.group = NULL;
+    t.payload_len = len;
+    if (len <= TASK_PAYLOAD_SIZE) {
+        t.data = NULL;
+        memcpy(t.payload, payload, len);
+    } else {
+        t.data = _spill_alloc(pool, len);
+        if (!t.data)
+            return -1;
+        memcpy(t.data, payload, len);
+    }
+    return _thread_pool_push(pool, prio, &t, no_reject);
+}
+
+int thread_pool_push_payload(struct thread_pool *pool, enum task_priority prio,
+        task_func task, const void *payload, size_t len)
+{
+    return _thread_pool_push_payload(pool, prio, task, payload, len, false);
+}
+
+int thread_pool_dispatch(struct thread_pool *pool, enum task_priority prio,
+        task_func task, const void *payload, size_t len)
+{
+    return _thread_pool_push_payload(pool, prio, task, payload, len, true);
+}
+
+static int _thread_pool_pop(struct thread_pool *pool, struct task *ret, enum task_priority *prio, bool *crossed)
+{
+    while (1) {
+        if (_queue_pop(pool, ret, prio, crossed) == 0)
+            return 0;
+        if (__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE))
+            return -1;
+
+        __atomic_add_fetch(&pool->spinners, 1, __ATOMIC_SEQ_CST);
+        for (int i = 0; i < pool->spin; ++i) {
+            if (_queue_pop(pool, ret, prio, crossed) == 0) {
+                __atomic_sub_fetch(&pool->spinners, 1, __ATOMIC_SEQ_CST);
+                return 0;
+            }
+            CPU_RELAX();
+        }
+        for (int i = 0; i < pool->yield; ++i) {
+            sched_yield();
+            if (_queue_pop(pool, ret, prio, crossed) == 0) {
+                __atomic_sub_fetch(&pool->spinners, 1, __ATOMIC_SEQ_CST);
+                return 0;
+            }
+        }
+
+        /*register as a waiter before leaving the spinners, so a push in
+         * between either sees us spinning or sees us waiting*/
+        uint32_t key = ec_prepare_wait(&pool->idle_ec);
+        __atomic_sub_fetch(&pool->spinners, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (_queue_pop(pool, ret, prio, crossed) == 0) {
+            ec_cancel_wait(&pool->idle_ec);
+            return 0;
+        }
+        if (__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE)) {
+            ec_cancel_wait(&pool->idle_ec);
+            return -1;
+        }
+        ec_wait(&pool->idle_ec, key);
+    }
+}
+
+static void _thread_pool_run(struct thread_pool *pool, struct task *t, enum task_priority prio, bool crossed)
+{
+    ec_notify(&pool->space_ec, 1);
+    if (crossed)
+        _notify_watchers(pool, false);
+
+    int bucket = _handoff_bucket(_now_ns() - t->push_ns);
+    __atomic_add_fetch(pool->handoff_hist[prio] + bucket, 1, __ATOMIC_RELAXED);
+    t->func(_task_arg(t));
+    _task_release(pool, t);
+    if (t->group)
+        _task_group_done(t->group);
 }
 
 static void *_thread_dealer(void *arg)
 {
     struct thread_pool *pool = (struct thread_pool*)arg;
     struct task t = {0};
-    while (1) {
-        _thread_pool_pop(pool, &t);
-        t.func(t.data);
+    enum task_priority prio;
+    bool crossed = false;
+
+    _t_worker_pool = pool;
+    while (_thread_pool_pop(pool, &t, &prio, &crossed) == 0) {
+        _thread_pool_run(pool, &t, prio, crossed);
+        crossed = false;
     }
     return NULL;
 }
 
+void task_group_init(struct task_group *group, struct thread_pool *pool)
+{
+    group->pool = pool;
+    group->pending = 0;
+    group->notifying = 0;
+    ec_init(&group->done_ec);
+}
+
+int task_group_push(struct task_group *group, task_func task, void *data)
+{
+    struct task t;
+    t.func = task;
+    t.data = data;
+    t.group = group;
+    t.payload_len = 0;
+
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_SEQ_CST);
+    if (_thread_pool_push(group->pool, TASK_PRIO_NORMAL, &t, false) != 0) {
+        __atomic_sub_fetch(&group->pending, 1, __ATOMIC_SEQ_CST);
+        return -1;
+    }
+    return 0;
+}
+
+void task_group_wait(struct task_group *group)
+{
+    struct thread_pool *pool = group->pool;
+    struct task t;
+    enum task_priority prio;
+    bool crossed = false;
+
+    while (__atomic_load_n(&group->pending, __ATOMIC_SEQ_CST) > 0) {
+        /*help instead of blocking. the task may belong to anyone*/
+        if (_queue_pop(pool, &t, &prio, &crossed) == 0) {
+            _thread_pool_run(pool, &t, prio, crossed);
+            crossed = false;
+            continue;
+        }
+
+        uint32_t key = ec_prepare_wait(&group->done_ec);
+        if (__atomic_load_n(&group->pending, __ATOMIC_SEQ_CST) == 0) {
+            ec_cancel_wait(&group->done_ec);
+            break;
+        }
+        /*new tasks do not wake us, so look at the queue now and then*/
+        ec_timedwait(&group->done_ec, key, 1);
+    }
+
+    /*the last finisher may still be notifying, do not let the caller
+     * free the group under it*/
+    while (__atomic_load_n(&group->notifying, __ATOMIC_SEQ_CST) > 0)
+        CPU_RELAX();
+}
+
+struct _range_chunk {
+    range_func func;
+    void *arg;
+    size_t begin;
+    size_t end;
+};
+
+static void _range_chunk_run(void *data)
+{
+    struct _range_chunk *chunk = (struct _range_chunk*)data;
+    chunk->func(chunk->begin, chunk->end, chunk->arg);
+}
+
+int thread_pool_parallel_for(struct thread_pool *pool,
+        size_t begin, size_t end, size_t grain, range_func func, void *arg)
+{
+    if (end <= begin)
+        return 0;
+
+    size_t n = end - begin;
+    if (grain == 0) {
+        /*a few chunks per thread (the caller included) balance the load*/
+        grain = n / ((pool->thread_num + 1) * 4);
+        if (grain == 0)
+            grain = 1;
+    }
+    size_t nchunk = (n + grain - 1) / grain;
+
+    struct _range_chunk *chunks = (struct _range_chunk*)malloc(sizeof(struct _range_chunk) * nchunk);
+    if (!chunks)
+        return -1;
+
+    struct task_group group;
+    task_group_init(&group, pool);
+    for (size_t i = 0; i < nchunk; ++i) {
+        chunks[i].func = func;
+        chunks[i].arg = arg;
+        chunks[i].begin = begin + i * grain;
+        chunks[i].end = end - chunks[i].begin > grain ? chunks[i].begin + grain : end;
+        /*the caller takes the first chunk itself*/
+        if (i > 0)
+            task_group_push(&group, _range_chunk_run, chunks + i);
+    }
+    _range_chunk_run(chunks);
+    task_group_wait(&group);
+
+    free(chunks);
+    return 0;
+}
+
+static int64_t _handoff_percentile(struct thread_pool *pool, int lane_begin, int lane_end, double percent)
+{
+    uint64_t hist[HANDOFF_BUCKETS] = {0};
+    uint64_t total = 0;
+    for (int l = lane_begin; l < lane_end; ++l) {
+        for (int i = 0; i < HANDOFF_BUCKETS; ++i) {
+            uint64_t n = __atomic_load_n(pool->handoff_hist[l] + i, __ATOMIC_RELAXED);
+            hist[i] += n;
+            total += n;
+        }
+    }
+    if (total == 0)
+        return -1;
+
+    uint64_t rank = (uint64_t)(total * percent);
+    if (rank >= total)
+        rank = total - 1;
+    uint64_t count = 0;
+    for (int i = 0; i < HANDOFF_BUCKETS; ++i) {
+        count += hist[i];
+        if (count > rank)
+            return _handoff_bucket_upper(i);
+    }
+    return -1;
+}
+
+int64_t thread_pool_handoff_percentile(struct thread_pool *pool, double percent)
+{
+    return _handoff_percentile(pool, 0, TASK_PRIO_NUM, percent);
+}
+
+int64_t thread_pool_lane_handoff_percentile(struct thread_pool *pool, enum task_priority prio, double percent)
+{
+    if (prio < 0 || prio >= TASK_PRIO_NUM)
+        return -1;
+    return _handoff_percentile(pool, prio, prio + 1, percent);
+}
+
+void thread_pool_handoff_reset(struct thread_pool *pool)
+{
+    for (int l = 0; l < TASK_PRIO_NUM; ++l) {
+        for (int i = 0; i < HANDOFF_BUCKETS; ++i) {
+            __atomic_store_n(pool->handoff_hist[l] + i, 0, __ATOMIC_RELAXED);
+        }
+    }
+}
@@ -8,38 +8,177 @@
 
 #include <pthread.h>
 #include <stdlib.h>
-#include <semaphore.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include "comm.h"
+#include "eventcount.h"
 
 #define THREAD_COUNT 1
 #define TASK_QUEUE_INIT_LEN 32
+#define THREAD_POOL_CAPACITY 65536      //max tasks queued in all lanes
 
+/*an idle worker polls the queue THREAD_POOL_SPIN times, then yields
+ * THREAD_POOL_YIELD times, and parks on the eventcount at last*/
+#define THREAD_POOL_SPIN 2048
+#define THREAD_POOL_YIELD 16
+
+/*handoff latency histogram: 4 sub buckets per power of 2 nanoseconds*/
+#define HANDOFF_SUB_BITS 2
+#define HANDOFF_BUCKETS (64 << HANDOFF_SUB_BITS)
+
+/*a task carries up to TASK_PAYLOAD_SIZE bytes of argument in its slot.
+ * larger payloads borrow TASK_SPILL_SIZE blocks from the pool, or malloc*/
+#define TASK_PAYLOAD_SIZE 64     //room for an accepted IPv6 peer
+#define TASK_SPILL_SIZE 256
+#define TASK_SPILL_CACHE 256    //spare spill blocks kept by the pool
 
 typedef void (*task_func)(void*);
 
+struct task_group;
+
 struct task {
     task_func func;
-    void *data;
+    void *data;             //the spilled payload if payload_len > TASK_PAYLOAD_SIZE
+    int64_t push_ns;
+    struct task_group *group;
+    size_t payload_len;     //0 if data is passed as is
+    uint8_t payload[TASK_PAYLOAD_SIZE] __attribute__((aligned(8)));
 };
 
-struct thread_pool {
-    pthread_t *threads;
-    size_t thread_num;
+enum task_priority {
+    TASK_PRIO_HIGH = 0,     //timers, signals, new connections
+    TASK_PRIO_NORMAL,
+    TASK_PRIO_LOW,          //bulk data processing
+    TASK_PRIO_NUM
+};
+
+enum thread_pool_sched {
+    THREAD_POOL_STRICT = 0,     //always serve the highest non-empty lane
+    THREAD_POOL_WEIGHTED        //serve lanes in proportion to their weights
+};
 
+#define TASK_LANE_WEIGHTS {16, 4, 1}
+
+/*what a push does when the pool holds `capacity` tasks*/
+enum thread_pool_overload {
+    THREAD_POOL_BLOCK = 0,      //wait for room. run inline in a worker thread to avoid deadlock
+    THREAD_POOL_REJECT,         //call reject_cb and return -1, the caller keeps the data
+    THREAD_POOL_RUN_INLINE      //run the task in the calling thread
+};
+
+typedef void (*reject_cb)(task_func, void*, void*);
+/*called when the pool crosses the high (saturated) or low (!saturated) watermark*/
+typedef void (*watermark_cb)(bool saturated, void*);
+
+struct pool_watcher {
+    watermark_cb func;
+    void *arg;
+    struct pool_watcher *next;
+};
+
+struct task_lane {
     //task_func *task_queue;
     struct task *task_queue;
     size_t tq_len;
     int tq_head;
     int tq_tail;
 
+    int weight;
+    int credit;     //tasks left to this lane in the current weighted round
+};
+
+struct thread_pool {
+    pthread_t *threads;
+    size_t thread_num;
+
+    struct task_lane lanes[TASK_PRIO_NUM];
+    enum thread_pool_sched sched;
+    size_t tq_count;    //tasks in all lanes
+
+    size_t capacity;
+    enum thread_pool_overload overload;
+    reject_cb on_reject;
+    void *reject_arg;
+
+    size_t high_watermark;
+    size_t low_watermark;
+    int saturated;
+    struct pool_watcher *watchers;  //under queue_lock
+    size_t watcher_num;
+
     lock_t queue_lock;
-    sem_t queue_sem;    //sem value always equal the number of task in queue.
+    lock_t spill_lock;
+    void *spill_free;           //spare spill blocks, linked through their first word
+    size_t spill_count;
+    struct eventcount idle_ec;  //parked workers wait here
+    struct eventcount space_ec; //blocked pushers wait here
+    int spinners;               //number of workers in spin or yield phase
+    int spin;
+    int yield;
+    int stop;
+
+    uint64_t handoff_hist[TASK_PRIO_NUM][HANDOFF_BUCKETS];
 };
 
 struct thread_pool *thread_pool_instance();
+/*in a child after fork: the threads of the inherited instance are gone,
+ * forget it, the next THREAD_POOL_INST creates a new one*/
+void thread_pool_instance_drop();
 
 #define THREAD_POOL_INST (thread_pool_instance())
 
+struct thread_pool *thread_pool_create(size_t thread_num);
+void thread_pool_destroy(struct thread_pool **pool);
+void thread_pool_set_idle(struct thread_pool *pool, int spin, int yield);
+/*weights may be NULL to keep the current ones*/
+void thread_pool_set_sched(struct thread_pool *pool, enum thread_pool_sched sched, const int *weights);
+
+void thread_pool_set_overload(struct thread_pool *pool,
+        size_t capacity, enum thread_pool_overload overload, reject_cb on_reject, void *arg);
+void thread_pool_set_watermark(struct thread_pool *pool, size_t high, size_t low);
+int thread_pool_add_watcher(struct thread_pool *pool, watermark_cb func, void *arg);
+int thread_pool_del_watcher(struct thread_pool *pool, watermark_cb func, void *arg);
+bool thread_pool_saturated(struct thread_pool *pool);
+size_t thread_pool_len(struct thread_pool *pool);
+
+/*push at TASK_PRIO_NORMAL*/
 int thread_pool_push(struct thread_pool *pool, task_func task, void *data);
+int thread_pool_push_prio(struct thread_pool *pool, enum task_priority prio, task_func task, void *data);
+/*copy `len` bytes at `payload` into the task. task (and on_reject) gets a
+ * pointer to the copy, which is valid only during the call*/
+int thread_pool_push_payload(struct thread_pool *pool, enum task_priority prio,
+        task_func task, const void *payload, size_t len);
+/*like thread_pool_push_payload, but never rejects: a full THREAD_POOL_REJECT
+ * pool runs the task inline. for events nobody would deliver again.
+ * -1 only if the task could not be pushed nor run, on_reject is not called*/
+int thread_pool_dispatch(struct thread_pool *pool, enum task_priority prio,
+        task_func task, const void *payload, size_t len);
+
+/*
+ * A task group tracks the completion of the tasks pushed through it.
+ * task_group_wait() runs queued tasks of the pool while it waits, so it
+ * can be called from a worker without blocking the worker.
+ */
+struct task_group {
+    struct thread_pool *pool;
+    int pending;
+    int notifying;      //finishers still touching the group
+    struct eventcount done_ec;
+};
+
+void task_group_init(struct task_group *group, struct thread_pool *pool);
+int task_group_push(struct task_group *group, task_func task, void *data);
+void task_group_wait(struct task_group *group);
+
+typedef void (*range_func)(size_t begin, size_t end, void *arg);
+/*call func over [begin, end) in chunks of `grain` indices (0 to let the
+ * pool choose) and return once every chunk is done*/
+int thread_pool_parallel_for(struct thread_pool *pool,
+        size_t begin, size_t end, size_t grain, range_func func, void *arg);
+
+/*latency in nanoseconds between push and a worker starting the task*/
+int64_t thread_pool_handoff_percentile(struct thread_pool *pool, double percent);
+int64_t thread_pool_lane_handoff_percentile(struct thread_pool *pool, enum task_priority prio, double percent);
+void thread_pool_handoff_reset(struct thread_pool *pool);
 
 #endif //_THREAD_POOL_H_